@@ -0,0 +1,386 @@
+#include "pch.h"
+#include "AnswerCache.h"
+#include "DnsTypes.h"
+
+#include <cctype>
+
+/**
+ * @brief Sets up an empty cache.
+ * @param maxBytes Approximate upper bound on memory used by cached answers
+*/
+AnswerCache::AnswerCache(size_t maxBytes)
+{
+    this->maxShardBytes = max(maxBytes / kShards, (size_t) 1);
+    this->shards.reset(new Shard[kShards]);
+}
+
+/**
+ * @brief Looks up the answers to the given question.
+ * @return The cached answers, or null if there are none (or they've expired)
+*/
+std::shared_ptr<const AnswerCache::Entry> AnswerCache::find(const std::string& name, uint16_t type, uint16_t recordClass)
+{
+    std::shared_ptr<const Entry> entry;
+
+    Key key;
+    key.name = name;
+    AnswerCache::normalize(key.name);
+    key.type = type;
+    key.recordClass = recordClass;
+
+    auto& shard = this->shardFor(key);
+
+    AcquireSRWLockShared(&shard.lock);
+    {
+        auto it = shard.index.find(key);
+
+        if (it != shard.index.end()) {
+            auto& slot = shard.slots[it->second];
+
+            // expired entries are left for the clock to clean up
+            if (std::chrono::steady_clock::now() < slot.entry->expires) {
+                entry = slot.entry;
+
+                if (!slot.referenced.load(std::memory_order_relaxed)) {
+                    slot.referenced.store(true, std::memory_order_relaxed);
+                }
+            } else {
+                shard.expired.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+    ReleaseSRWLockShared(&shard.lock);
+
+    if (entry) {
+        shard.hits.fetch_add(1, std::memory_order_relaxed);
+
+        if (entry->rcode != kRcodeSuccess || entry->answers.empty()) {
+            shard.negativeHits.fetch_add(1, std::memory_order_relaxed);
+        }
+    } else {
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return entry;
+}
+
+/**
+ * @brief Looks up the answers to the given question, and if they're cached, fills in a response
+ * as if they'd just been received. Their TTLs are reduced by the time spent in the cache.
+ *
+ * There's no packet behind a cached response, so its `packetLen` is 0 and `cached` is set. If
+ * the query went unanswered last time, the response's `rcode` is -1.
+ * @return Whether anything was cached for the question
+*/
+bool AnswerCache::lookup(const std::string& name, uint16_t type, uint16_t recordClass, DnsResolver::Response& outResponse)
+{
+    auto entry = this->find(name, type, recordClass);
+    if (!entry) {
+        return false;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    const auto age = (unsigned int) std::chrono::duration_cast<std::chrono::seconds>(now - entry->stored).count();
+
+    DnsResolver::Question question;
+    question.name = name;
+    question.type = type;
+    question.recordClass = recordClass;
+
+    outResponse.questions.clear();
+    outResponse.questions.push_back(question);
+    outResponse.additional.clear();
+
+    outResponse.answers = entry->answers;
+    for (auto& answer : outResponse.answers) {
+        answer.ttl = (answer.ttl > age) ? (answer.ttl - age) : 0;
+    }
+    outResponse.authority = entry->authority;
+    for (auto& record : outResponse.authority) {
+        record.ttl = (record.ttl > age) ? (record.ttl - age) : 0;
+    }
+
+    outResponse.rcode = entry->rcode;
+    outResponse.success = (entry->rcode == kRcodeSuccess);
+    outResponse.cached = true;
+    outResponse.packetLen = 0;
+    outResponse.packetData.clear();
+
+    return true;
+}
+
+/**
+ * @brief Caches the response to the given question, replacing anything already cached for it.
+ *
+ * - Answers are kept until the smallest TTL among them runs out; if that's 0, they're not cached.
+ * - NXDOMAIN, and success without any answers, are negative answers: they're kept for the smaller
+ *   of the SOA's TTL and its MINIMUM field (RFC 2308, section 5), but only if the authority section
+ *   has an SOA.
+ * - SERVFAIL is kept for `kFailureTtl`.
+ *
+ * Any other response isn't cached.
+*/
+void AnswerCache::insert(const std::string& name, uint16_t type, uint16_t recordClass, const DnsResolver::Response& response)
+{
+    auto entry = std::make_shared<Entry>();
+    entry->rcode = response.rcode;
+
+    unsigned int ttl;
+
+    if (response.rcode == kRcodeSuccess && !response.answers.empty()) {
+        ttl = kMaxTtl;
+        entry->answers = response.answers;
+    } else if (response.rcode == kRcodeSuccess || response.rcode == kRcodeNameError) {
+        ttl = AnswerCache::negativeTtl(response.authority);
+
+        // any CNAMEs leading up to the missing name expire with the rest
+        entry->answers = response.answers;
+        for (auto const& record : response.authority) {
+            if (record.type == kRecordTypeSOA) {
+                entry->authority.push_back(record);
+            }
+        }
+    } else if (response.rcode == kRcodeServerError) {
+        ttl = kFailureTtl;
+    } else {
+        return;
+    }
+
+    // the whole set expires with its shortest lived record
+    for (auto const& answer : entry->answers) {
+        // TTLs with the top bit set are treated as 0 (RFC 2181, section 8)
+        ttl = min(ttl, (answer.ttl & 0x80000000) ? 0 : answer.ttl);
+    }
+
+    this->store(name, type, recordClass, std::move(entry), ttl);
+}
+
+/**
+ * @brief Remembers that the given question went unanswered, for `kFailureTtl`.
+*/
+void AnswerCache::insertFailure(const std::string& name, uint16_t type, uint16_t recordClass)
+{
+    auto entry = std::make_shared<Entry>();
+    entry->rcode = -1;
+
+    this->store(name, type, recordClass, std::move(entry), kFailureTtl);
+}
+
+/**
+ * @brief Puts an entry in the cache for the given number of seconds; if that's 0, or the entry is
+ * too big for its shard, it's dropped. TTLs in the entry are capped to `kMaxTtl`.
+*/
+void AnswerCache::store(const std::string& name, uint16_t type, uint16_t recordClass, std::shared_ptr<Entry> entry, unsigned int ttl)
+{
+    const size_t bytes = sizeof(Entry) + sizeof(Slot) + name.size() +
+        AnswerCache::recordBytes(entry->answers) + AnswerCache::recordBytes(entry->authority);
+
+    if (!ttl || bytes > this->maxShardBytes) {
+        return;
+    }
+
+    entry->stored = std::chrono::steady_clock::now();
+    entry->expires = entry->stored + std::chrono::seconds(ttl);
+    entry->bytes = bytes;
+
+    for (auto& answer : entry->answers) {
+        answer.ttl = min(answer.ttl, kMaxTtl);
+    }
+    for (auto& record : entry->authority) {
+        record.ttl = min(record.ttl, kMaxTtl);
+    }
+
+    Key key;
+    key.name = name;
+    AnswerCache::normalize(key.name);
+    key.type = type;
+    key.recordClass = recordClass;
+
+    auto& shard = this->shardFor(key);
+
+    AcquireSRWLockExclusive(&shard.lock);
+    {
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            this->evict(shard, it->second);
+        }
+
+        this->makeRoom(shard, bytes);
+
+        // take a free slot, or grow the clock
+        size_t i;
+
+        if (!shard.freeSlots.empty()) {
+            i = shard.freeSlots.back();
+            shard.freeSlots.pop_back();
+        } else {
+            i = shard.slots.size();
+            shard.slots.emplace_back();
+        }
+
+        auto& slot = shard.slots[i];
+        slot.key = key;
+        slot.entry = std::move(entry);
+        slot.referenced.store(false, std::memory_order_relaxed);
+
+        shard.index.emplace(std::move(key), i);
+        shard.bytes += bytes;
+    }
+    ReleaseSRWLockExclusive(&shard.lock);
+
+    shard.inserts.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Removes all entries from the cache.
+*/
+void AnswerCache::clear()
+{
+    for (size_t i = 0; i < kShards; i++) {
+        auto& shard = this->shards[i];
+
+        AcquireSRWLockExclusive(&shard.lock);
+
+        shard.index.clear();
+        shard.slots.clear();
+        shard.freeSlots.clear();
+        shard.hand = 0;
+        shard.bytes = 0;
+
+        ReleaseSRWLockExclusive(&shard.lock);
+    }
+}
+
+/**
+ * @brief Sums up the counters of all shards.
+*/
+AnswerCache::Stats AnswerCache::getStats()
+{
+    Stats stats;
+
+    for (size_t i = 0; i < kShards; i++) {
+        auto& shard = this->shards[i];
+
+        stats.hits += shard.hits.load(std::memory_order_relaxed);
+        stats.negativeHits += shard.negativeHits.load(std::memory_order_relaxed);
+        stats.misses += shard.misses.load(std::memory_order_relaxed);
+        stats.expired += shard.expired.load(std::memory_order_relaxed);
+        stats.inserts += shard.inserts.load(std::memory_order_relaxed);
+        stats.evictions += shard.evictions.load(std::memory_order_relaxed);
+
+        AcquireSRWLockShared(&shard.lock);
+        stats.entries += shard.index.size();
+        stats.bytes += shard.bytes;
+        ReleaseSRWLockShared(&shard.lock);
+    }
+
+    return stats;
+}
+
+/**
+ * @brief Lowercases a name and strips any trailing dot in place, so names can be compared the way
+ * DNS does.
+*/
+void AnswerCache::normalize(std::string& name)
+{
+    if (!name.empty() && name.back() == '.') {
+        name.pop_back();
+    }
+
+    for (auto& c : name) {
+        c = (char) std::tolower((unsigned char) c);
+    }
+}
+
+
+
+/**
+ * @brief Picks the shard a key lives in. The top bits of its hash are used, since the shard's map
+ * picks buckets with the bottom ones.
+*/
+AnswerCache::Shard& AnswerCache::shardFor(const Key& key)
+{
+    const size_t hash = KeyHash()(key) * (size_t) 0x9E3779B97F4A7C15ULL;
+    return this->shards[hash >> (sizeof(size_t) * 8 - kShardBits)];
+}
+
+/**
+ * @brief Removes the entry in the given slot; the shard must be locked exclusively.
+*/
+void AnswerCache::evict(Shard& shard, size_t i)
+{
+    auto& slot = shard.slots[i];
+
+    shard.bytes -= slot.entry->bytes;
+    shard.index.erase(slot.key);
+
+    slot.entry.reset();
+    slot.key.name.clear();
+    shard.freeSlots.push_back(i);
+}
+
+/**
+ * @brief Evicts entries until there's room for the given number of bytes in the shard; the shard
+ * must be locked exclusively.
+ *
+ * The clock hand sweeps over the slots: expired entries are always evicted, and others only if
+ * they haven't been looked up since the hand last passed them. This takes at most two laps.
+*/
+void AnswerCache::makeRoom(Shard& shard, size_t bytes)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    while (shard.bytes + bytes > this->maxShardBytes && !shard.index.empty()) {
+        const size_t i = shard.hand;
+        shard.hand = (shard.hand + 1) % shard.slots.size();
+
+        auto& slot = shard.slots[i];
+        if (!slot.entry) {
+            continue;
+        }
+
+        if (now < slot.entry->expires && slot.referenced.exchange(false, std::memory_order_relaxed)) {
+            continue;
+        }
+
+        this->evict(shard, i);
+        shard.evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Works out how long a negative answer may be cached, from the SOA record in its authority
+ * section: the smaller of the record's TTL and its MINIMUM field, the last 32 bits of its data.
+ * @return TTL in seconds, or 0 if there's no SOA
+*/
+unsigned int AnswerCache::negativeTtl(const std::vector<DnsResolver::Answer>& authority)
+{
+    for (auto const& record : authority) {
+        if (record.type != kRecordTypeSOA || record.payload.size() < 22) {
+            continue;
+        }
+
+        uint32_t minimum;
+        memcpy(&minimum, record.payload.data() + record.payload.size() - sizeof(uint32_t), sizeof(uint32_t));
+        minimum = ntohl(minimum);
+
+        const unsigned int ttl = (record.ttl & 0x80000000) ? 0 : record.ttl;
+        return min(min(ttl, (unsigned int) minimum), kMaxNegativeTtl);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Approximates the memory used by a set of records.
+*/
+size_t AnswerCache::recordBytes(const std::vector<DnsResolver::Answer>& records)
+{
+    size_t bytes = 0;
+
+    for (auto const& record : records) {
+        bytes += sizeof(DnsResolver::Answer) + record.name.capacity() + record.payload.capacity();
+    }
+
+    return bytes;
+}
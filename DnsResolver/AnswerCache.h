@@ -0,0 +1,183 @@
+#ifndef ANSWERCACHE_H
+#define ANSWERCACHE_H
+
+#include "DnsResolver.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+
+/**
+ * @brief Caches the answers to queries until their TTL runs out, so repeated lookups of the same
+ * name don't have to go to the network.
+ *
+ * Negative answers (NXDOMAIN, or no records of the type asked for) are cached too, for as long as
+ * the SOA record in their authority section allows (RFC 2308.) Server failures and queries that
+ * got no response at all are remembered only briefly, so a dead name doesn't get waited on over
+ * and over; they're not negative answers, just a hint that asking again right away is pointless.
+ *
+ * Entries are keyed by (name, type, class), with names compared case insensitively. The cache is
+ * split into shards, each with its own reader/writer lock, so many threads can look things up at
+ * once; lookups only take the lock shared. The memory used by each shard is bounded, and when it's
+ * full, entries are evicted in CLOCK order (expired ones first, as they come up.)
+*/
+class AnswerCache {
+public:
+    /// Default upper bound on memory used by cached answers
+    constexpr static const size_t kDefaultMaxBytes = (1024 * 1024 * 64);
+    /// Number of shards (as a power of 2)
+    constexpr static const size_t kShardBits = 6;
+    constexpr static const size_t kShards = (1 << kShardBits);
+    /// Longest time anything is cached for (seconds), no matter its TTL
+    constexpr static const unsigned int kMaxTtl = (60 * 60 * 24);
+    /// Longest time a negative answer is cached for (seconds)
+    constexpr static const unsigned int kMaxNegativeTtl = (60 * 60 * 3);
+    /// Time a server failure or unanswered query is cached for (seconds)
+    constexpr static const unsigned int kFailureTtl = 30;
+
+    /**
+     * @brief A cached answer set. Entries are immutable once cached, and can be held on to after
+     * they've been evicted.
+     */
+    struct Entry {
+        /// response code, or -1 if the query went unanswered
+        int rcode = 0;
+
+        /// answer records, with TTLs as received
+        std::vector<DnsResolver::Answer> answers;
+        /// for negative answers, the SOA record they were cached by
+        std::vector<DnsResolver::Answer> authority;
+        /// when the entry was cached, and when it expires (the earliest any of its records does)
+        std::chrono::steady_clock::time_point stored;
+        std::chrono::steady_clock::time_point expires;
+        /// approximate memory used by the entry
+        size_t bytes = 0;
+
+        /// seconds until the entry expires
+        unsigned int ttlLeft(std::chrono::steady_clock::time_point now) const
+        {
+            if (now >= this->expires) {
+                return 0;
+            }
+            return (unsigned int) std::chrono::duration_cast<std::chrono::seconds>(this->expires - now).count();
+        }
+    };
+
+    /**
+     * @brief Cache counters, summed across all shards
+     */
+    struct Stats {
+        size_t hits = 0;
+        /// hits on negative answers or failures (also counted as hits)
+        size_t negativeHits = 0;
+        size_t misses = 0;
+        /// lookups that found an entry, but it had expired (also counted as misses)
+        size_t expired = 0;
+        size_t inserts = 0;
+        /// entries removed to make room for new ones
+        size_t evictions = 0;
+
+        /// entries and memory currently in use
+        size_t entries = 0;
+        size_t bytes = 0;
+    };
+
+public:
+    AnswerCache(size_t maxBytes = kDefaultMaxBytes);
+    virtual ~AnswerCache() {};
+
+    AnswerCache(const AnswerCache&) = delete;
+    AnswerCache& operator=(const AnswerCache&) = delete;
+
+    std::shared_ptr<const Entry> find(const std::string& name, uint16_t type, uint16_t recordClass = 1);
+    bool lookup(const std::string& name, uint16_t type, uint16_t recordClass, DnsResolver::Response& outResponse);
+
+    void insert(const std::string& name, uint16_t type, uint16_t recordClass, const DnsResolver::Response& response);
+    void insertFailure(const std::string& name, uint16_t type, uint16_t recordClass);
+    void clear();
+
+    Stats getStats();
+
+    static void normalize(std::string& name);
+
+private:
+    struct Key {
+        std::string name;
+        uint16_t type;
+        uint16_t recordClass;
+
+        bool operator==(const Key& other) const
+        {
+            return this->type == other.type && this->recordClass == other.recordClass && this->name == other.name;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const
+        {
+            return std::hash<std::string>()(key.name) ^ (((size_t) key.type << 16) | key.recordClass);
+        }
+    };
+
+    /**
+     * @brief Position on a shard's clock
+     */
+    struct Slot {
+        Key key;
+        /// the entry, or null if the slot is free
+        std::shared_ptr<const Entry> entry;
+        /// set when the entry is looked up; cleared as the clock hand passes over it
+        std::atomic_bool referenced = false;
+    };
+
+    /**
+     * @brief A piece of the cache with its own lock. Each sits on its own cache line, so threads
+     * working on different shards don't fight over them.
+     */
+    struct alignas(64) Shard {
+        /// protects everything below, except the counters
+        SRWLOCK lock = SRWLOCK_INIT;
+
+        /// slot of each cached key
+        std::unordered_map<Key, size_t, KeyHash> index;
+        /// the clock; a deque so slots stay put as it grows
+        std::deque<Slot> slots;
+        /// free slots
+        std::vector<size_t> freeSlots;
+        /// current position of the clock hand
+        size_t hand = 0;
+
+        /// memory used by the entries in this shard
+        size_t bytes = 0;
+
+        std::atomic<size_t> hits = 0;
+        std::atomic<size_t> negativeHits = 0;
+        std::atomic<size_t> misses = 0;
+        std::atomic<size_t> expired = 0;
+        std::atomic<size_t> inserts = 0;
+        std::atomic<size_t> evictions = 0;
+    };
+
+private:
+    void store(const std::string& name, uint16_t type, uint16_t recordClass, std::shared_ptr<Entry> entry, unsigned int ttl);
+
+    Shard& shardFor(const Key& key);
+    void evict(Shard& shard, size_t slot);
+    void makeRoom(Shard& shard, size_t bytes);
+
+    static unsigned int negativeTtl(const std::vector<DnsResolver::Answer>& authority);
+    static size_t recordBytes(const std::vector<DnsResolver::Answer>& records);
+
+private:
+    /// upper bound on the memory used by each shard
+    size_t maxShardBytes = 0;
+
+    std::unique_ptr<Shard[]> shards;
+};
+
+#endif
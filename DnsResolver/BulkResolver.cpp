@@ -0,0 +1,505 @@
+#include "pch.h"
+#include "BulkResolver.h"
+#include "PacketView.h"
+#include "QueryRandom.h"
+#include "DnsTypes.h"
+
+#include <iostream>
+#include <cstring>
+#include <stdexcept>
+
+/**
+ * @brief Sets up the sockets to send queries from.
+ * @param addr Server to query (port 53, unless it specifies another)
+ * @param maxInFlight Most queries in flight at once; over TCP, it's limited to `kMaxPipelined` per
+ * connection
+ * @param sockets Number of sockets (or TCP connections) to spread queries over
+ * @param transport Whether to send queries over UDP or TCP
+*/
+BulkResolver::BulkResolver(const struct sockaddr_storage& addr, size_t maxInFlight, size_t sockets, Transport transport) :
+    transport(transport), parser(addr)
+{
+    if (addr.ss_family != AF_INET) {
+        throw std::invalid_argument("only IPv4 servers are supported");
+    } else if (!maxInFlight) {
+        throw std::invalid_argument("must allow at least one query in flight");
+    } else if (!sockets || sockets > kMaxSockets) {
+        throw std::invalid_argument("invalid number of sockets");
+    }
+
+    memcpy(&this->server, &addr, sizeof(struct sockaddr_in));
+    if (!this->server.sin_port) {
+        this->server.sin_port = htons(53);
+    }
+
+    if (transport == kTransportTcp) {
+        maxInFlight = min(maxInFlight, sockets * kMaxPipelined);
+    }
+
+    // set up the query slots
+    this->slots.resize(maxInFlight);
+    this->freeSlots.reserve(maxInFlight);
+
+    for (size_t i = maxInFlight; i > 0; i--) {
+        this->freeSlots.push_back(i - 1);
+    }
+    this->inFlight.reserve(maxInFlight);
+    this->rxBuffer.resize(this->parser.getUdpBufferSize());
+
+    // and the sockets; connections are only opened once there's something to send on them
+    if (transport == kTransportTcp) {
+        for (size_t i = 0; i < sockets; i++) {
+            this->connections.push_back(std::make_unique<TcpConnection>(this->server));
+            this->events.push_back(this->connections[i]->getEvent());
+        }
+    } else {
+        this->sockets.resize(sockets, INVALID_SOCKET);
+        this->events.resize(sockets, nullptr);
+
+        for (size_t i = 0; i < sockets; i++) {
+            this->setUpSocket(i);
+        }
+    }
+}
+
+/**
+ * @brief Closes all sockets. Connections close themselves (and their events.)
+*/
+BulkResolver::~BulkResolver()
+{
+    for (auto sock : this->sockets) {
+        if (sock != INVALID_SOCKET) {
+            closesocket(sock);
+        }
+    }
+    if (this->transport == kTransportUdp) {
+        for (auto event : this->events) {
+            if (event) {
+                CloseHandle(event);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Opens a socket bound to a random port; it's non-blocking, and signals its event when a
+ * response can be read.
+*/
+void BulkResolver::setUpSocket(size_t i)
+{
+    int err;
+
+    this->events[i] = CreateEvent(nullptr, false, false, nullptr);
+    if (!this->events[i]) {
+        throw std::runtime_error("CreateEvent() failed: " + std::to_string(GetLastError()));
+    }
+
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock == INVALID_SOCKET) {
+        throw std::runtime_error("socket() failed: " + std::to_string(WSAGetLastError()));
+    }
+    this->sockets[i] = sock;
+
+    DnsResolver::bindRandomPort(sock);
+
+    // thousands of responses may arrive while we're busy sending
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char*)&kSocketBufferSize, sizeof(int)) == -1) {
+        std::cerr << "SO_RCVBUF set failed: " << WSAGetLastError() << std::endl;
+    }
+
+    err = WSAEventSelect(sock, this->events[i], FD_READ);
+    if (err == -1) {
+        throw std::runtime_error("WSAEventSelect() failed: " + std::to_string(WSAGetLastError()));
+    }
+}
+
+/**
+ * @brief Resolves all of the given names; this blocks until every one of them has either been
+ * answered or given up on.
+ * @param names Names to resolve
+ * @param type Record type to ask for
+ * @param callback Invoked with the result of each name
+*/
+void BulkResolver::resolve(const std::vector<std::string>& names, uint16_t type, Callback callback)
+{
+    size_t next = 0;
+    this->names = &names;
+
+    TcpConnection::MessageCallback onMessage = [&](const char* message, size_t length) {
+        this->handleResponse(message, length, callback);
+    };
+
+    while (next < names.size() || !this->inFlight.empty()) {
+        // fill up the free slots
+        while (next < names.size() && !this->freeSlots.empty()) {
+            // no need to ask if the answer is cached
+            if (this->cache && this->cache->lookup(names[next], type, 0x0001, this->result.response)) {
+                this->result.name = names[next];
+                this->result.type = type;
+                this->result.received = (this->result.response.rcode != -1);
+                this->result.error = this->result.received ? "" : "no response (cached)";
+                this->result.attempts = 0;
+                this->result.latency = std::chrono::microseconds(0);
+
+                this->stats.cached++;
+                callback(this->result);
+
+                next++;
+                continue;
+            }
+
+            const size_t slot = this->freeSlots.back();
+            this->freeSlots.pop_back();
+
+            try {
+                this->start(slot, next, names[next], type);
+            } catch (const std::exception& e) {
+                // name can't be put in a query
+                this->freeSlots.push_back(slot);
+
+                this->result.name = names[next];
+                this->result.type = type;
+                this->result.received = false;
+                this->result.error = e.what();
+                this->result.attempts = 0;
+                this->result.latency = std::chrono::microseconds(0);
+
+                this->stats.failed++;
+                callback(this->result);
+            }
+            next++;
+        }
+
+        if (this->inFlight.empty()) {
+            continue;
+        }
+
+        // wait for a response, or until the next timer is up
+        DWORD timeout = 0;
+        auto now = std::chrono::steady_clock::now();
+
+        if (!this->timers.empty() && this->timers.top().deadline > now) {
+            timeout = (DWORD) std::chrono::duration_cast<std::chrono::milliseconds>(this->timers.top().deadline - now).count() + 1;
+        }
+
+        DWORD err = WaitForMultipleObjects((DWORD) this->events.size(), this->events.data(), false, timeout);
+
+        if (err == WAIT_FAILED) {
+            throw std::runtime_error("WaitForMultipleObjects() failed: " + std::to_string(GetLastError()));
+        } else if (err != WAIT_TIMEOUT) {
+            // the event only says one socket is readable; check them all while we're here
+            for (size_t i = 0; i < this->sockets.size(); i++) {
+                this->readResponses(i, callback);
+            }
+            for (size_t i = 0; i < this->connections.size(); i++) {
+                if (this->connections[i]->isOpen() && !this->connections[i]->service(onMessage)) {
+                    this->connectionLost(i);
+                }
+            }
+        }
+
+        this->expireTimers(callback);
+    }
+}
+
+/**
+ * @brief Sets up a query in the given slot, and sends it.
+ *
+ * The txid is random; if a query for the same question with the same txid is already in flight,
+ * another one is picked.
+*/
+void BulkResolver::start(size_t slot, size_t index, const std::string& name, uint16_t type)
+{
+    auto& query = this->slots[slot];
+
+    query.key.name = name;
+    AnswerCache::normalize(query.key.name);
+    query.key.type = type;
+
+    do {
+        query.key.txid = QueryRandom::txid();
+    } while (this->inFlight.count(query.key));
+
+    query.edns = true;
+    query.packetLen = this->parser.buildQuery(query.packet, DnsResolver::kMaxQueryLen, name, type, query.key.txid, query.edns);
+
+    query.active = true;
+    query.generation++;
+    query.index = index;
+    query.attempts = 0;
+
+    if (this->transport == kTransportUdp) {
+        query.socket = this->nextSocket;
+        this->nextSocket = (this->nextSocket + 1) % this->sockets.size();
+    }
+
+    this->inFlight.emplace(query.key, slot);
+
+    query.firstSent = std::chrono::steady_clock::now();
+    this->transmit(slot);
+    this->stats.sent++;
+}
+
+/**
+ * @brief (Re)transmits the query in the given slot, and arms its timer.
+ *
+ * If the socket's send buffer is full, the query is dropped on the floor; its timer will send it
+ * again, like any other lost packet. Over TCP, the query goes out on the connection with the
+ * fewest queries outstanding, which is (re)opened if need be.
+*/
+void BulkResolver::transmit(size_t slot)
+{
+    auto& query = this->slots[slot];
+    bool lost = false;
+    unsigned int timeout = kInitialTimeout;
+
+    if (this->transport == kTransportTcp) {
+        const auto now = std::chrono::steady_clock::now();
+        timeout = kInitialTcpTimeout;
+
+        for (size_t i = 0; i < this->connections.size(); i++) {
+            if (this->connections[i]->getOutstanding() < this->connections[query.socket]->getOutstanding()) {
+                query.socket = i;
+            }
+        }
+
+        // the server has likely closed a connection that's been idle for a while
+        auto& connection = *this->connections[query.socket];
+        if (connection.isOpen() && connection.isIdle(now, std::chrono::milliseconds(TcpConnection::kIdleTimeout))) {
+            connection.close();
+        }
+        if (!connection.isOpen()) {
+            connection.open();
+        }
+
+        lost = !connection.send(query.packet, query.packetLen);
+    } else {
+        int err = sendto(this->sockets[query.socket], query.packet, (int) query.packetLen, 0,
+            (struct sockaddr*)&this->server, sizeof(struct sockaddr_in));
+
+        if (err == -1 && WSAGetLastError() != WSAEWOULDBLOCK) {
+            throw std::runtime_error("sendto() failed: " + std::to_string(WSAGetLastError()));
+        }
+    }
+
+    timeout <<= query.attempts;
+    query.attempts++;
+
+    Timer timer;
+    timer.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    timer.slot = slot;
+    timer.generation = query.generation;
+
+    this->timers.push(timer);
+
+    if (lost) {
+        this->connectionLost(query.socket);
+    }
+}
+
+/**
+ * @brief Reads all responses waiting on the given socket, and completes the queries they answer.
+*/
+void BulkResolver::readResponses(size_t socket, Callback& callback)
+{
+    char* packet = this->rxBuffer.data();
+    struct sockaddr_in from;
+
+    while (true) {
+        socklen_t fromLen = sizeof(from);
+
+        int err = recvfrom(this->sockets[socket], packet, (int) this->rxBuffer.size(), 0, (struct sockaddr*)&from, &fromLen);
+        if (err == -1) {
+            const int error = WSAGetLastError();
+
+            if (error == WSAEWOULDBLOCK) {
+                return;
+            } else if (error == WSAECONNRESET || error == WSAEMSGSIZE) {
+                // ICMP error from an earlier query, or an oversized packet
+                this->stats.unmatched += (error == WSAEMSGSIZE);
+                continue;
+            } else {
+                throw std::runtime_error("recvfrom() failed: " + std::to_string(error));
+            }
+        }
+
+        // only the server gets to answer
+        if (from.sin_addr.s_addr != this->server.sin_addr.s_addr || from.sin_port != this->server.sin_port) {
+            this->stats.unmatched++;
+            continue;
+        }
+
+        this->handleResponse(packet, err, callback);
+    }
+}
+
+/**
+ * @brief Completes the query that the given response (received over either UDP or TCP) answers, if
+ * there is one.
+*/
+void BulkResolver::handleResponse(const char* packet, size_t length, Callback& callback)
+{
+    // find the query it answers; the packet is only copied out once it's matched
+    auto& key = this->matchKey;
+    decltype(this->inFlight)::iterator it;
+
+    try {
+        PacketView view(packet, length);
+        PacketView::Question question;
+
+        if (!(view.getFlags() & kPacketTypeResponse) || view.getQuestionCount() != 1) {
+            this->stats.unmatched++;
+            return;
+        }
+
+        size_t offset = view.getQuestions();
+        view.readQuestion(offset, question);
+
+        char name[PacketView::kMaxNameLen + 1];
+        const size_t nameLen = view.readName(question.name, name, sizeof(name));
+
+        key.txid = view.getTxid();
+        key.type = question.type;
+        key.name.assign(name, nameLen);
+        AnswerCache::normalize(key.name);
+
+        it = this->inFlight.find(key);
+        if (it == this->inFlight.end()) {
+            this->stats.unmatched++;
+            return;
+        }
+
+        const size_t slot = it->second;
+        auto& query = this->slots[slot];
+        const int rcode = (view.getFlags() & kRcodeMask);
+
+        // server doesn't understand EDNS0: send the query again without it
+        if (query.edns && (rcode == kRcodeInvalidFormat || rcode == kRcodeNotImplemented)) {
+            query.edns = false;
+            query.packetLen = this->parser.buildQuery(query.packet, DnsResolver::kMaxQueryLen, query.key.name, query.key.type, query.key.txid, query.edns);
+
+            // the timer of the previous attempt no longer applies
+            query.generation++;
+            this->stats.retransmitted++;
+            this->transmit(slot);
+            return;
+        }
+
+        // answer didn't fit; get the whole thing over TCP (unless that's where it came from)
+        if ((view.getFlags() & kTruncation) && this->transport == kTransportUdp) {
+            const size_t len = this->parser.tcpTransaction(query.packet, query.packetLen, this->tcpBuffer);
+            this->stats.tcp++;
+
+            this->parser.parseResponse(this->tcpBuffer.data(), len, this->result.response);
+        } else {
+            this->parser.parseResponse(view, this->result.response);
+        }
+    } catch (const std::exception&) {
+        this->stats.unmatched++;
+        return;
+    }
+
+    this->result.received = true;
+    this->result.error.clear();
+    this->stats.received++;
+
+    if (this->cache) {
+        this->cache->insert(key.name, key.type, 0x0001, this->result.response);
+    }
+
+    this->finish(it->second, callback);
+}
+
+/**
+ * @brief Called when a TCP connection was closed; every query that was outstanding on it is lost.
+ * Rather than waiting for their timers, they're due for a retransmission right away.
+ *
+ * Servers may close a connection after answering some number of queries; if this one answered
+ * anything at all, that's what likely happened, and the lost attempt isn't held against the
+ * queries. Otherwise, it counts like a timeout, so a server that won't talk to us at all doesn't
+ * keep us busy forever.
+*/
+void BulkResolver::connectionLost(size_t connection)
+{
+    const auto now = std::chrono::steady_clock::now();
+    const bool progress = (this->connections[connection]->getReceived() != 0);
+    bool any = false;
+
+    for (size_t slot = 0; slot < this->slots.size(); slot++) {
+        auto& query = this->slots[slot];
+        if (!query.active || query.socket != connection) {
+            continue;
+        }
+
+        // the timer that's already armed no longer applies
+        query.generation++;
+
+        if (progress && query.attempts) {
+            query.attempts--;
+        }
+
+        Timer timer;
+        timer.deadline = now;
+        timer.slot = slot;
+        timer.generation = query.generation;
+
+        this->timers.push(timer);
+        any = true;
+    }
+
+    this->stats.reconnects += any;
+}
+
+/**
+ * @brief Retransmits (or gives up on) queries whose timers are up.
+*/
+void BulkResolver::expireTimers(Callback& callback)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    while (!this->timers.empty() && this->timers.top().deadline <= now) {
+        const Timer timer = this->timers.top();
+        this->timers.pop();
+
+        // query was answered (and the slot maybe reused) since the timer was armed
+        auto& query = this->slots[timer.slot];
+        if (!query.active || query.generation != timer.generation) {
+            continue;
+        }
+
+        if (query.attempts < kMaxAttempts) {
+            this->stats.retransmitted++;
+            this->transmit(timer.slot);
+        } else {
+            this->result.received = false;
+            this->result.error = "no response after " + std::to_string(query.attempts) + " attempts";
+            this->stats.failed++;
+
+            if (this->cache) {
+                this->cache->insertFailure(query.key.name, query.key.type, 0x0001);
+            }
+
+            this->finish(timer.slot, callback);
+        }
+    }
+}
+
+/**
+ * @brief Hands the result of the query in the given slot to the callback, and frees the slot. The
+ * response (or error) must already be filled in.
+*/
+void BulkResolver::finish(size_t slot, Callback& callback)
+{
+    auto& query = this->slots[slot];
+
+    this->result.name = (*this->names)[query.index];
+    this->result.type = query.key.type;
+    this->result.attempts = query.attempts;
+    this->result.latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - query.firstSent);
+
+    this->inFlight.erase(query.key);
+    query.active = false;
+    this->freeSlots.push_back(slot);
+
+    callback(this->result);
+}
@@ -0,0 +1,255 @@
+#ifndef BULKRESOLVER_H
+#define BULKRESOLVER_H
+
+#include "DnsResolver.h"
+#include "AnswerCache.h"
+#include "TcpConnection.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <queue>
+#include <functional>
+#include <memory>
+#include <chrono>
+
+/**
+ * @brief Resolves large lists of names against a single server, with many queries in flight.
+ *
+ * Queries go out over a few long-lived sockets as fast as the in-flight limit allows. Responses are
+ * matched back to their query by txid and question (so that the same txid may be in use by several
+ * queries at once), in whatever order they arrive. Each query has its own retransmission timer,
+ * which backs off exponentially; a retransmission reuses the query's txid, so a late response to
+ * an earlier attempt is still accepted.
+ *
+ * Queries carry an EDNS0 OPT record, so larger responses fit over UDP. The rare response that's
+ * still truncated is fetched again over TCP, which holds up everything else while it runs.
+ *
+ * Alternatively, all queries can go over a few persistent TCP connections instead, with many
+ * pipelined on each; that's slower to get going, but nothing is lost or truncated on the way. If a
+ * connection is closed with queries outstanding, they're sent again right away (on whichever
+ * connection is least busy) rather than waiting for their timers.
+*/
+class BulkResolver {
+public:
+    /**
+     * @brief What queries are sent over
+     */
+    enum Transport {
+        /// UDP, falling back to TCP for truncated responses
+        kTransportUdp,
+        /// only persistent TCP connections
+        kTransportTcp,
+    };
+
+    /// Default number of queries in flight at once
+    constexpr static const size_t kDefaultMaxInFlight = 2048;
+    /// Default number of sockets to spread queries over
+    constexpr static const size_t kDefaultSockets = 1;
+    /// Default number of TCP connections to spread queries over
+    constexpr static const size_t kDefaultTcpConnections = 4;
+    /// Most queries outstanding on a single TCP connection
+    constexpr static const size_t kMaxPipelined = 256;
+    /// Most sockets that may be used (they're all waited on at once)
+    constexpr static const size_t kMaxSockets = (MAXIMUM_WAIT_OBJECTS - 1);
+    /// Timeout for the first attempt of a query (in msec); it doubles with every retransmission
+    constexpr static const unsigned int kInitialTimeout = 1000;
+    /// Same, but for queries over TCP; there's a handshake first, and the server may work through
+    /// pipelined queries one at a time
+    constexpr static const unsigned int kInitialTcpTimeout = 4000;
+    /// Maximum number of times a query is sent before giving up on it
+    constexpr static const size_t kMaxAttempts = 3;
+    /// Receive buffer to request for each socket, so bursts of responses aren't dropped
+    constexpr static const int kSocketBufferSize = (1024 * 1024 * 4);
+
+    /**
+     * @brief Outcome of resolving a single name
+     */
+    struct Result {
+        /// name and type that were queried
+        std::string name;
+        uint16_t type = 0;
+
+        /// whether a response was received; if not, `error` says why
+        bool received = false;
+        std::string error;
+
+        /// number of times the query was sent
+        size_t attempts = 0;
+        /// time from the first transmission to the response
+        std::chrono::microseconds latency{ 0 };
+
+        /// the response, if one was received
+        DnsResolver::Response response;
+    };
+
+    /**
+     * @brief Invoked with the result of each name, in the order they complete. The result is only
+     * valid for the duration of the call.
+     */
+    using Callback = std::function<void(const Result&)>;
+
+    /**
+     * @brief Counters across all calls to `resolve()`
+     */
+    struct Stats {
+        /// queries sent (not counting retransmissions)
+        size_t sent = 0;
+        /// retransmissions
+        size_t retransmitted = 0;
+        /// responses matched to a query
+        size_t received = 0;
+        /// packets that didn't match any query in flight, or couldn't be parsed
+        size_t unmatched = 0;
+        /// queries given up on
+        size_t failed = 0;
+        /// names answered from the cache (including negative answers and failures), without a query
+        size_t cached = 0;
+        /// responses that were truncated, and fetched again over TCP
+        size_t tcp = 0;
+        /// TCP connections that were closed with queries outstanding on them
+        size_t reconnects = 0;
+    };
+
+public:
+    BulkResolver(const struct sockaddr_storage& addr, size_t maxInFlight = kDefaultMaxInFlight, size_t sockets = kDefaultSockets,
+        Transport transport = kTransportUdp);
+    virtual ~BulkResolver();
+
+    BulkResolver(const BulkResolver&) = delete;
+    BulkResolver& operator=(const BulkResolver&) = delete;
+
+    void resolve(const std::vector<std::string>& names, uint16_t type, Callback callback);
+
+    const Stats& getStats() const
+    {
+        return this->stats;
+    }
+
+    /**
+     * @brief Sets the cache that names are looked up in before they're queried, and that
+     * successful answers are stored in. It must outlive the resolver.
+     */
+    void setCache(AnswerCache* cache)
+    {
+        this->cache = cache;
+    }
+
+private:
+    /**
+     * @brief Identifies a query in flight: only a response with the same txid, asking the same
+     * question, is accepted for it. Names are compared case insensitively.
+     */
+    struct Key {
+        uint16_t txid;
+        uint16_t type;
+        std::string name;
+
+        bool operator==(const Key& other) const
+        {
+            return this->txid == other.txid && this->type == other.type && this->name == other.name;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const
+        {
+            return std::hash<std::string>()(key.name) ^ (((size_t) key.txid << 16) | key.type);
+        }
+    };
+
+    /**
+     * @brief A query in flight
+     */
+    struct Query {
+        /// whether the slot is in use
+        bool active = false;
+        /// bumped every time the slot is reused, so stale timers can be told apart
+        size_t generation = 0;
+
+        /// index of the name in the list being resolved
+        size_t index = 0;
+        Key key;
+        /// socket (or TCP connection) the query last went out on
+        size_t socket = 0;
+
+        /// number of times sent, and when it was first sent
+        size_t attempts = 0;
+        std::chrono::steady_clock::time_point firstSent;
+
+        /// whether the query has an OPT record; it's dropped if the server chokes on it
+        bool edns = true;
+        /// the query packet, for retransmissions
+        size_t packetLen = 0;
+        char packet[DnsResolver::kMaxQueryLen];
+    };
+
+    /**
+     * @brief Retransmission timer of a query
+     */
+    struct Timer {
+        std::chrono::steady_clock::time_point deadline;
+        size_t slot;
+        size_t generation;
+
+        bool operator>(const Timer& other) const
+        {
+            return this->deadline > other.deadline;
+        }
+    };
+
+private:
+    void setUpSocket(size_t i);
+
+    void start(size_t slot, size_t index, const std::string& name, uint16_t type);
+    void transmit(size_t slot);
+    void readResponses(size_t socket, Callback& callback);
+    void handleResponse(const char* packet, size_t length, Callback& callback);
+    void connectionLost(size_t connection);
+    void expireTimers(Callback& callback);
+    void finish(size_t slot, Callback& callback);
+
+private:
+    /// server queries are sent to
+    struct sockaddr_in server = { 0 };
+
+    /// what queries are sent over
+    Transport transport = kTransportUdp;
+
+    /// sockets queries are sent from, and the events signalled when they're readable
+    std::vector<SOCKET> sockets;
+    std::vector<HANDLE> events;
+    /// TCP connections queries are sent over instead; their events are in `events`, too
+    std::vector<std::unique_ptr<TcpConnection>> connections;
+    /// socket the next query is sent from
+    size_t nextSocket = 0;
+
+    /// used to build queries and parse responses
+    DnsResolver parser;
+    /// answer cache, if any
+    AnswerCache* cache = nullptr;
+
+    /// all query slots; at most this many queries are in flight
+    std::vector<Query> slots;
+    /// slots not in use
+    std::vector<size_t> freeSlots;
+    /// slot of each query in flight
+    std::unordered_map<Key, size_t, KeyHash> inFlight;
+    /// retransmission timers; stale ones (for finished queries) are skipped when they come up
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+
+    /// names being resolved
+    const std::vector<std::string>* names = nullptr;
+    /// result being filled in for the callback
+    Result result;
+    /// key of the response being matched; kept around so its name needn't be allocated each time
+    Key matchKey;
+    /// buffers responses are received into, over UDP and TCP
+    std::vector<char> rxBuffer;
+    std::vector<char> tcpBuffer;
+
+    Stats stats;
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include "pch.h"
+#include "DelegationCache.h"
+#include "AnswerCache.h"
+
+#include <stdexcept>
+
+/**
+ * @brief Root hints: the root servers (a through m.root-servers.net) and their IPv4 addresses.
+*/
+static const struct {
+    const char* name;
+    const char* address;
+} kRootHints[] = {
+    { "a.root-servers.net", "198.41.0.4" },
+    { "b.root-servers.net", "170.247.170.2" },
+    { "c.root-servers.net", "192.33.4.12" },
+    { "d.root-servers.net", "199.7.91.13" },
+    { "e.root-servers.net", "192.203.230.10" },
+    { "f.root-servers.net", "192.5.5.241" },
+    { "g.root-servers.net", "192.112.36.4" },
+    { "h.root-servers.net", "198.97.190.53" },
+    { "i.root-servers.net", "192.36.148.17" },
+    { "j.root-servers.net", "192.58.128.30" },
+    { "k.root-servers.net", "193.0.14.129" },
+    { "l.root-servers.net", "199.7.83.42" },
+    { "m.root-servers.net", "202.12.27.33" },
+};
+
+/**
+ * @brief Sets up the cache with only the root zone in it.
+ * @param rootServers Servers to use for the root zone; if empty, the root hints are used
+*/
+DelegationCache::DelegationCache(const std::vector<struct sockaddr_in>& rootServers)
+{
+    this->root.expires = std::chrono::steady_clock::time_point::max();
+
+    if (!rootServers.empty()) {
+        this->root.addresses = rootServers;
+        this->root.nameservers.resize(rootServers.size());
+    } else {
+        for (const auto& hint : kRootHints) {
+            struct sockaddr_in addr = { 0 };
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(53);
+
+            if (inet_pton(AF_INET, hint.address, &addr.sin_addr) != 1) {
+                throw std::logic_error("invalid root hint");
+            }
+
+            this->root.nameservers.push_back(hint.name);
+            this->root.addresses.push_back(addr);
+        }
+    }
+
+    this->zones.emplace("", this->root);
+}
+
+/**
+ * @brief Finds the closest zone enclosing the given name whose servers are known. Since the root
+ * is always known, there's always one.
+ * @param name Name to look up
+ * @param outDelegation Filled in with the zone's delegation
+*/
+void DelegationCache::find(const std::string& name, Delegation& outDelegation)
+{
+    std::string zone = name;
+    AnswerCache::normalize(zone);
+
+    const auto now = std::chrono::steady_clock::now();
+
+    AcquireSRWLockShared(&this->lock);
+    {
+        // strip off labels until a zone turns up; expired ones are replaced when next inserted
+        while (true) {
+            auto it = this->zones.find(zone);
+
+            if (it != this->zones.end() && now < it->second.expires && !it->second.addresses.empty()) {
+                outDelegation = it->second;
+                break;
+            } else if (zone.empty()) {
+                outDelegation = this->root;
+                break;
+            }
+
+            const size_t dot = zone.find('.');
+            zone = (dot == std::string::npos) ? "" : zone.substr(dot + 1);
+        }
+    }
+    ReleaseSRWLockShared(&this->lock);
+
+    if (zone.empty()) {
+        this->misses.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        this->hits.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Caches the delegation of a zone, replacing whatever was known about it before. The root
+ * zone can't be replaced, and delegations with a TTL of 0 aren't cached at all.
+ * @param delegation Zone and its servers; the expiry time is ignored
+ * @param ttl Seconds to cache it for
+*/
+void DelegationCache::insert(const Delegation& delegation, unsigned int ttl)
+{
+    Delegation entry = delegation;
+    AnswerCache::normalize(entry.zone);
+
+    if (entry.zone.empty() || entry.addresses.empty() || !ttl) {
+        return;
+    }
+
+    entry.expires = std::chrono::steady_clock::now() + std::chrono::seconds(min(ttl, kMaxTtl));
+
+    AcquireSRWLockExclusive(&this->lock);
+    {
+        this->zones[entry.zone] = std::move(entry);
+    }
+    ReleaseSRWLockExclusive(&this->lock);
+
+    this->inserts.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Forgets all delegations, except for the root.
+*/
+void DelegationCache::clear()
+{
+    AcquireSRWLockExclusive(&this->lock);
+    {
+        this->zones.clear();
+        this->zones.emplace("", this->root);
+    }
+    ReleaseSRWLockExclusive(&this->lock);
+}
+
+/**
+ * @brief Returns the cache's counters.
+*/
+DelegationCache::Stats DelegationCache::getStats()
+{
+    Stats stats;
+
+    stats.hits = this->hits.load(std::memory_order_relaxed);
+    stats.misses = this->misses.load(std::memory_order_relaxed);
+    stats.inserts = this->inserts.load(std::memory_order_relaxed);
+
+    AcquireSRWLockShared(&this->lock);
+    stats.entries = this->zones.size();
+    ReleaseSRWLockShared(&this->lock);
+
+    return stats;
+}
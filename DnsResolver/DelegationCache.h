@@ -0,0 +1,85 @@
+#ifndef DELEGATIONCACHE_H
+#define DELEGATIONCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+
+/**
+ * @brief Remembers which servers are authoritative for which zones, for iterative resolution.
+ *
+ * Each zone cut learned from a referral is kept (with the addresses of its servers) until the TTL
+ * of its NS records runs out; a lookup then starts at the closest enclosing zone that's known,
+ * rather than at the root every time. The root zone itself is seeded from the root hints, and
+ * never expires.
+ *
+ * Zones are keyed by name, compared case insensitively, with the root being the empty string. The
+ * cache may be shared between resolvers: lookups take its lock shared, and there are few enough
+ * zone cuts that a single lock is plenty.
+*/
+class DelegationCache {
+public:
+    /// Longest time a delegation is cached for (seconds), no matter its TTL
+    constexpr static const unsigned int kMaxTtl = (60 * 60 * 24 * 2);
+
+    /**
+     * @brief Servers that are authoritative for a zone
+     */
+    struct Delegation {
+        /// name of the zone; empty for the root
+        std::string zone;
+
+        /// names of the zone's servers, and the addresses known for them (on port 53)
+        std::vector<std::string> nameservers;
+        std::vector<struct sockaddr_in> addresses;
+
+        /// when the delegation expires
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    /**
+     * @brief Cache counters
+     */
+    struct Stats {
+        /// lookups that found a zone below the root
+        size_t hits = 0;
+        /// lookups that had to start at the root
+        size_t misses = 0;
+        size_t inserts = 0;
+
+        /// zones currently cached, including the root
+        size_t entries = 0;
+    };
+
+public:
+    DelegationCache(const std::vector<struct sockaddr_in>& rootServers = {});
+    virtual ~DelegationCache() {};
+
+    DelegationCache(const DelegationCache&) = delete;
+    DelegationCache& operator=(const DelegationCache&) = delete;
+
+    void find(const std::string& name, Delegation& outDelegation);
+    void insert(const Delegation& delegation, unsigned int ttl);
+    void clear();
+
+    Stats getStats();
+
+private:
+    /// protects the zones
+    SRWLOCK lock = SRWLOCK_INIT;
+    /// delegation of each zone
+    std::unordered_map<std::string, Delegation> zones;
+
+    /// servers of the root zone
+    Delegation root;
+
+    std::atomic<size_t> hits = 0;
+    std::atomic<size_t> misses = 0;
+    std::atomic<size_t> inserts = 0;
+};
+
+#endif
@@ -1,541 +1,1095 @@
-#include "pch.h"
-#include "DnsResolver.h"
-#include "DnsTypes.h"
-
-#include <iostream>
-#include <cstring>
-#include <sstream>
-#include <algorithm>
-#include <regex>
-#include <random>
-#include <chrono>
-
-/**
- * @brief Sets the given address as the nameserver we're querying.
-*/
-void DnsResolver::setNameserverAddr(const struct sockaddr_storage& ipAddr, const unsigned int port)
-{
-    switch (ipAddr.ss_family) {
-    case AF_INET:
-        memcpy(&this->toQuery, &ipAddr, sizeof(struct sockaddr_in));
-
-        struct sockaddr_in* addr = (struct sockaddr_in*)&this->toQuery;
-        addr->sin_port = htons(port);
-        break;
-    }
-}
-
-/**
- * @brief Resolves all A records for the given record.
- * @param name Record to resolve
- * @param outResponse Output
-*/
-void DnsResolver::resolveDomain(const std::string& name, Response& outResponse, uint16_t type, uint16_t txidHint)
-{
-    int err;
-    char response[kMaxPacketLen] = { 0 };
-    size_t responseLen, offset;
-
-    // prepare a packet with the fixed header
-    char questionPacket[kMaxPacketLen] = { 0 };
-    size_t questionLen = sizeof(dns_header_t);
-
-    dns_header_t* questionHeader = reinterpret_cast<dns_header_t*>(&questionPacket);
-
-    questionHeader->flags = htons(kPacketTypeRequest | kRecursionDesired);
-    questionHeader->numQuestions = htons(1);
-
-    if (txidHint) {
-        questionHeader->txid = htons(txidHint);
-    } else {
-        std::random_device dev;
-        std::mt19937 random(dev());
-        std::uniform_int_distribution<> dist(1, 0xFFFF);
-
-        questionHeader->txid = htons(dist(random));
-    }
-
-    questionLen += this->putQuestion(&questionPacket[sizeof(dns_header_t)],
-        (questionLen - sizeof(dns_header_t)), name, type, 0x0001);
-
-    // open the UDP socket, then send txn
-    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock == -1) {
-        throw std::runtime_error("socket() failed");
-    }
-
-    struct sockaddr_in local = { 0 };
-    local.sin_family = AF_INET;
-    local.sin_addr.s_addr = INADDR_ANY;
-    local.sin_port = htons(0);
-
-    err = bind(sock, (struct sockaddr*)&local, sizeof(local));
-    if (err == -1) {
-        throw std::runtime_error("bind() failed: " + std::to_string(WSAGetLastError()));
-    }
-
-    responseLen = this->singlePacketTxn(sock, questionPacket, questionLen, response, kMaxPacketLen);
-
-    closesocket(sock);
-
-    if (responseLen < sizeof(dns_header_t)) {
-        throw std::runtime_error("++ response too small");
-    }
-
-    // validate the txid
-    auto resHeader = reinterpret_cast<dns_header_t*>(&response);
-
-    if (ntohs(resHeader->txid) != htons(questionHeader->txid)) {
-        throw std::runtime_error("++ txid mismatch");
-    }
-
-    // determine if success or not
-    resHeader->txid = ntohs(resHeader->txid);
-    resHeader->flags = ntohs(resHeader->flags);
-    resHeader->numQuestions = ntohs(resHeader->numQuestions);
-    resHeader->numAnswers = ntohs(resHeader->numAnswers);
-    resHeader->numNameservers = ntohs(resHeader->numNameservers);
-    resHeader->numAdditionalRsrc = ntohs(resHeader->numAdditionalRsrc);
-
-    outResponse.packetLen = responseLen;
-    memcpy(outResponse.packetData, response, kMaxPacketLen);
-
-    uint16_t rcode = (resHeader->flags & kRcodeMask);
-    outResponse.rcode = rcode;
-    outResponse.success = (rcode == kRcodeSuccess);
-
-    // ignore non-success rcodes
-    if (rcode != kRcodeSuccess && rcode != kRcodeNameError && rcode != kRcodeServerError) {
-        throw std::runtime_error("++ invalid rcode");
-    }
-
-    // parse the question/answer/authority/bonus sections
-    offset = this->readQuestions(response, responseLen, outResponse.questions);
-
-    if (offset) {
-        offset = this->readAnswers(response, responseLen, &response[offset], outResponse.answers, resHeader->numAnswers);
-    }
-    if (offset) {
-        offset = this->readAnswers(response, responseLen, & response[offset], outResponse.authority, resHeader->numNameservers);
-    }
-    if (offset) {
-        if (offset >= responseLen && resHeader->numAdditionalRsrc) {
-            throw std::runtime_error("header indicates additional records, but no more packet bytes");
-        }
-
-        offset = this->readAnswers(response, responseLen, &response[offset], outResponse.additional, resHeader->numAdditionalRsrc);
-    }
-}
-
-
-
-/**
- * @brief Writes a question record to the given pointer. This record contains the given label
- * (split into its component parts) and the provided type and result class.
- * @param writePtr Where in memory to write the question
- * @param labels String to parse; split on periods
- * @param type Query type
- * @param resultClass Desired result class
- * @return The number of bytes written for the question record
-*/
-size_t DnsResolver::putQuestion(void* _writePtr, size_t _writePtrLen, const std::string& label, uint16_t type, uint16_t resultClass)
-{
-    uint8_t* writePtr = reinterpret_cast<uint8_t*>(_writePtr);
-
-    // split the string labels and write them into the query
-    std::vector<std::string> pieces;
-    this->splitLabel(label, pieces);
-
-    if (pieces.empty()) { 
-        pieces.push_back(label);
-    }
-
-    // write each of the pieces
-    for (auto const& label : pieces) {
-        // the length (may not be more than 64 bytes)
-        if (label.size() >= 64) {
-            throw std::runtime_error("label too long: '" + label + "'");
-        }
-
-        *writePtr++ = (uint8_t)label.size() & 0x3F;
-
-        // copy all bytes
-        memcpy(writePtr, label.c_str(), label.size());
-        writePtr += label.size();
-    }
-
-    // the apex (terminating) null label
-    *writePtr++ = '\0';
-
-    // footer
-    auto footer = reinterpret_cast<dns_question_footer_t*>(writePtr);
-
-    footer->type = htons(type);
-    footer->reqClass = htons(resultClass);
-
-    writePtr += sizeof(dns_question_footer_t);
-
-    // return the bytes written
-    return writePtr - ((uint8_t *) _writePtr);
-}
-
-
-
-/**
- * @brief Splits a domain name by period into components
- * @param label 
- * @param pieces 
-*/
-void DnsResolver::splitLabel(const std::string& label, std::vector<std::string>& pieces)
-{
-    std::string piece;
-    std::stringstream stream(label);
-
-    while (std::getline(stream, piece, '.')) {
-        pieces.push_back(piece);
-    }
-}
-
-/**
- * @brief Reconstructs a DNS label from the given byte buffer.
- * 
- * This supports compression.
- * 
- * @param packet Address of the base of the packet (the fixed header)
- * @param labelStart First byte of the label
- * @param name Stream into which label components are inserted sequentially
- * @return Number of bytes read, starting at labelStart, for this label
-*/
-size_t DnsResolver::reconstructLabel(void* packet, const size_t packetLen, void* labelStart, std::stringstream& name, bool *done, size_t depth)
-{
-    uint8_t* readPtr = reinterpret_cast<uint8_t*>(labelStart);
-    size_t bytesRead = 0;
-
-    // bail if too deep
-    if (depth >= 16) {
-        throw std::runtime_error("++ jump loop reconstructing label");
-    }
-
-    // read until we get the null terminator
-    while (*readPtr != 0) {
-        size_t stringBytes = *readPtr;
-
-        // handle checking for end of packet
-        if ((readPtr - (uint8_t*)packet) > packetLen) {
-            throw std::runtime_error("unexpected end of packet");
-        }
-
-        // directly encoded
-        if (stringBytes <= 63) {
-            std::string chunk((char*)readPtr + 1, stringBytes);
-            name << chunk << ".";
-
-            readPtr += 1 + stringBytes;
-        }
-        // handle compressed strings
-        else {
-            bool ptrDone = false;
-
-            if ((stringBytes & 0b11000000) != 0xc0) {
-                throw std::runtime_error("++ invalid label length");
-            }
-
-            // make sure there's one more byte
-            if ((readPtr - (uint8_t*)packet) + 1 > packetLen) {
-                throw std::runtime_error("++ unexpected end of packet in compressed value");
-            }
-
-            // recurse on down
-            uint16_t ptr = ((*readPtr++ << 8) | (*readPtr++)) & 0x3FFF;
-            auto nextStart = (reinterpret_cast<uint8_t*>(packet) + ptr);
-
-            if (ptr < sizeof(dns_header_t)) {
-                throw std::runtime_error("++ jump into fixed header");
-            }
-            if (nextStart == labelStart) {
-                throw std::runtime_error("++ label jump loop");
-            }
-            if (ptr > packetLen) {
-                throw std::runtime_error("++ jump past end of packet");
-            }
-
-            this->reconstructLabel(packet, packetLen, nextStart, name, &ptrDone, (depth + 1));
-
-            if (ptrDone) {
-                goto gotFullLabel;
-            }
-        }
-    }
-    
-    // handle trailing zero byte
-    if (*readPtr == 0) {
-        readPtr++;
-    }
-
-gotFullLabel:;
-    if (done) {
-        *done = true;
-    }
-    // return number of bytes read
-    return readPtr - ((uint8_t*)labelStart);
-}
-
-
-
-/**
- * @brief Parses the question section out of the given packet. Assumes questions come directly after
- * the header in the given buffer.
- * @param packet 
- * @param questions 
- * @return Offset into buffer for the answers section
-*/
-size_t DnsResolver::readQuestions(void* packet, const size_t packetLen, std::vector<Question>& questions)
-{
-    auto header = reinterpret_cast<dns_header_t*>(packet);
-    uint8_t* readPtr = reinterpret_cast<uint8_t*>(packet) + sizeof(dns_header_t);
-
-    for (size_t i = 0; i < header->numQuestions; i++) {
-        Question q;
-
-        // re-stringify the name
-        std::stringstream name;
-        readPtr += this->reconstructLabel(packet, packetLen, readPtr, name);
-
-        q.name = name.str();
-        q.name.pop_back(); // remove trailing dot
-
-        if ((readPtr - (uint8_t*) packet) > packetLen) {
-            throw std::runtime_error("++ unexpected end of packet");
-        }
-
-        // read the type/result code
-        auto footer = reinterpret_cast<dns_question_footer_t*>(readPtr);
-        
-        q.type = ntohs(footer->type);
-        q.recordClass = ntohs(footer->reqClass);
-
-        readPtr += sizeof(dns_question_footer_t);
-
-        // prepare for next
-        questions.push_back(q);
-    }
-
-    // return the number of bytes read
-    return readPtr - ((uint8_t*) packet);
-}
-
-/**
- * @brief Parses the answers section of the given packet.
- * 
- * @param packet 
- * @param start 
- * @param answers 
- * @return Number of bytes consumed; add this to start ptr to get address of the authority section
-*/
-size_t DnsResolver::readAnswers(void* packet, const size_t packetLen, void* start, std::vector<Answer> &answers, const size_t count)
-{
-    auto header = reinterpret_cast<dns_header_t*>(packet);
-    uint8_t* readPtr = reinterpret_cast<uint8_t*>(start);
-
-    for (size_t i = 0; i < count; i++) {
-        Answer a;
-
-        // re-stringify the name of the answer
-        std::stringstream name;
-        readPtr += this->reconstructLabel(packet, packetLen, readPtr, name);
-
-        a.name = name.str();
-
-        if (a.name.empty()) {
-            throw std::runtime_error("++ invalid name");
-        }
-
-        a.name.pop_back(); // remove trailing dot
-
-        if ((readPtr - (uint8_t*)packet) > packetLen) {
-            throw std::runtime_error("++ unexpected end of packet");
-        }
-
-        // read the type/result code
-        auto filling = reinterpret_cast<dns_answer_filling_t*>(readPtr);
-
-        a.type = ntohs(filling->type);
-        a.payloadClass = ntohs(filling->dataClass);
-        a.ttl = ntohl(filling->ttl);
-
-        readPtr += sizeof(dns_answer_filling_t);
-
-        if ((readPtr - (uint8_t*)packet) > packetLen) {
-            throw std::runtime_error("++ unexpected end of packet");
-        }
-
-        // lastly, the payload
-        std::vector<std::byte> payload;
-        size_t payloadLen = ntohs(filling->dataLen);
-        payload.resize(payloadLen, std::byte(0));
-
-        if (a.type == kRecordTypePTR || a.type == kRecordTypeCNAME || a.type == kRecordTypeNS) {
-            std::stringstream ptrName;
-            this->reconstructLabel(packet, packetLen, filling->data, ptrName);
-
-            a.labelValue = ptrName.str();
-            a.labelValue.pop_back();
-        } else {
-            if (((uint8_t *)&filling->data - (uint8_t*)packet) + payloadLen > packetLen) {
-                throw std::runtime_error("++ unexpected end of packet");
-            }
-
-            memcpy(payload.data(), filling->data, payloadLen);
-        }
-
-        readPtr += payloadLen;
-        a.payload = payload;
-
-        // prepare for next
-        answers.push_back(a);
-    }
-
-    // return the number of bytes read
-    return readPtr - ((uint8_t*)packet);
-}
-
-
-
-
-/**
- * @brief Runs a single packet UDP transaction against the DNS server.
- * @param sock Socket to use in sending/receiving query
- * @param txBuf Packet data to transmit
- * @param txBufLen Length of packet data to transmit
- * @param rxBuf Buffer to receive response packet
- * @param rxBufLen Size of receive buffer; if packet is larger, it is truncated
- * @return Number of bytes received
-*/
-size_t DnsResolver::singlePacketTxn(SOCKET sock, const void* txBuf, const size_t txBufLen, void* _rxBuf, const size_t _rxBufLen)
-{
-    int err = 0;
-    size_t packetLen = 0;
-    size_t attempt = 0;
-
-    // fixed timeout value
-    struct timeval timeout = {0};
-    timeout.tv_sec = 10;
-
-    // buffer to read into
-    char packet[kMaxPacketLen] = { 0 };
-    struct sockaddr_storage respFrom;
-    socklen_t respFromLen = sizeof(struct sockaddr_storage);
-
-    while (attempt++ < kMaxRetransmissions) {
-        auto startTime = std::chrono::steady_clock::now();
-        auto start = std::chrono::duration_cast<std::chrono::milliseconds>(startTime.time_since_epoch()).count();
-
-        std::cout << "Attempt " << attempt << " with " << txBufLen << " bytes...";
-
-        // transmit the packet
-        err = sendto(sock, (const char*)txBuf, (int)txBufLen, 0, (struct sockaddr*)&this->toQuery,
-            sizeof(struct sockaddr_in));
-        if (err == -1) {
-            std::cout << "socket error: " << WSAGetLastError() << std::endl;
-            throw std::runtime_error("sendto() failed: " + std::to_string(WSAGetLastError()));
-        }
-
-        // wait for activity on the socket
-        fd_set set;
-        FD_ZERO(&set);
-        FD_SET(sock, &set);
-
-        err = select(0, &set, nullptr, nullptr, &timeout);
-        if (err == -1) {
-            throw std::runtime_error("select() failed");
-        }
-        if (err == 0) {
-            auto nowTime = std::chrono::steady_clock::now();
-            auto now = std::chrono::duration_cast<std::chrono::milliseconds>(nowTime.time_since_epoch()).count();
-
-            std::cout << " timeout in " << (now - start) << " ms" << std::endl;
-            continue;
-        }
-
-        // receive the packet
-        err = recvfrom(sock, packet, kMaxPacketLen, 0, (struct sockaddr*)&respFrom, &respFromLen);
-        if (err == -1) {
-            std::cout << "socket error: " << WSAGetLastError() << std::endl;
-            throw std::runtime_error("recvfrom() failed: " + std::to_string(WSAGetLastError()));
-        }
-        packetLen = err;
-
-        // print time taken to receive this packet, then process it
-        auto nowTime = std::chrono::steady_clock::now();
-        auto now = std::chrono::duration_cast<std::chrono::milliseconds>(nowTime.time_since_epoch()).count();
-
-        std::cout << " response in " << (now - start) << " ms with " << packetLen << " bytes" << std::endl;
-        goto gotPacket;
-    }
-
-    // failed to receive packet
-    throw std::runtime_error("failed to receive DNS response");
-
- gotPacket:;
-    // TODO: make sure packet came from the same host that we sent data to
-
-    // copy out
-    memcpy(_rxBuf, packet, min(packetLen, _rxBufLen));
-    return packetLen;
-}
-
-
-
-/**
- * @brief Prints a string representation of a question record.
-*/
-std::ostream& operator<<(std::ostream& output, const DnsResolver::Question& question)
-{
-    output << question.name << " type " << (unsigned int) question.type 
-           << " class " << (unsigned int) question.recordClass;
-    return output;
-}
- 
-/**
- * @brief Prints a string representation of an answer record.
-*/
-std::ostream& operator<<(std::ostream& output, const DnsResolver::Answer& answer) {
-    std::string typeStr = std::to_string(answer.type);
-    std::string valueStr = "(unknown value)";
-
-    switch (answer.type) {
-    case kRecordTypeA: {
-        typeStr = "A";
-
-        std::stringstream addrStream;
-        addrStream << (int)answer.payload[0] << ".";
-        addrStream << (int)answer.payload[1] << ".";
-        addrStream << (int)answer.payload[2] << ".";
-        addrStream << (int)answer.payload[3];
-
-        valueStr = addrStream.str();
-
-        break;
-    }
-    case kRecordTypeNS:
-        typeStr = "NS";
-        valueStr = answer.labelValue;
-        break;
-    case kRecordTypeCNAME:
-        typeStr = "CNAME";
-        valueStr = answer.labelValue;
-        break;
-    case kRecordTypePTR:
-        typeStr = "PTR";
-        valueStr = answer.labelValue;
-        break;
-    case kRecordTypeMX:
-        typeStr = "MX";
-        break;
-    }
-
-    output  << answer.name << " " << typeStr << " " << valueStr
-              << " TTL = " << (unsigned int) answer.ttl;
-
-    return output;
+#include "pch.h"
+#include "DnsResolver.h"
+#include "AnswerCache.h"
+#include "PacketView.h"
+#include "QueryRandom.h"
+#include "TcpConnection.h"
+#include "DelegationCache.h"
+#include "DnsTypes.h"
+
+#include <iostream>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+#include <regex>
+#include <chrono>
+#include <cmath>
+
+/**
+ * @brief Sets up a resolver that queries the given server.
+*/
+DnsResolver::DnsResolver(const struct sockaddr_storage& addr)
+{
+    this->setNameserverAddr(addr);
+}
+
+/**
+ * @brief Closes all of the sockets.
+*/
+DnsResolver::~DnsResolver()
+{
+    for (auto sock : this->sockets) {
+        closesocket(sock);
+    }
+}
+
+/**
+ * @brief Sets the given address as the only nameserver we're querying.
+*/
+void DnsResolver::setNameserverAddr(const struct sockaddr_storage& ipAddr, const unsigned int port)
+{
+    this->recursors.clear();
+    this->addNameserverAddr(ipAddr, port);
+}
+
+/**
+ * @brief Adds another nameserver to query. Until it's answered something, it's preferred over the
+ * servers that have, so that it gets an RTT estimate.
+*/
+void DnsResolver::addNameserverAddr(const struct sockaddr_storage& ipAddr, const unsigned int port)
+{
+    switch (ipAddr.ss_family) {
+    case AF_INET: {
+        struct sockaddr_in addr;
+        memcpy(&addr, &ipAddr, sizeof(struct sockaddr_in));
+        addr.sin_port = htons(port);
+
+        const size_t server = this->findServer(addr);
+        if (std::find(this->recursors.begin(), this->recursors.end(), server) == this->recursors.end()) {
+            this->recursors.push_back(server);
+        }
+        break;
+    }
+
+    default:
+        throw std::invalid_argument("only IPv4 servers are supported");
+    }
+}
+
+/**
+ * @brief Resolves all A records for the given record. If there's a cache and it has the answers
+ * (or remembers that there aren't any), the server isn't asked at all.
+ * @param name Record to resolve
+ * @param outResponse Output
+*/
+void DnsResolver::resolveDomain(const std::string& name, Response& outResponse, uint16_t type, uint16_t txidHint)
+{
+    if (this->cache && this->cache->lookup(name, type, 0x0001, outResponse)) {
+        if (outResponse.rcode == -1) {
+            throw std::runtime_error("failed to receive DNS response (cached)");
+        }
+        return;
+    }
+
+    const uint16_t txid = txidHint ? txidHint : QueryRandom::txid();
+    bool answered;
+
+    if (this->delegations) {
+        answered = this->resolveIteratively(name, type, txid, outResponse, 0);
+    } else {
+        answered = this->exchange(this->recursors, name, type, txid, outResponse);
+    }
+
+    if (!answered) {
+        if (this->cache) {
+            this->cache->insertFailure(name, type, 0x0001);
+        }
+        throw std::runtime_error("failed to receive DNS response");
+    }
+
+    // ignore non-success rcodes
+    if (outResponse.rcode != kRcodeSuccess && outResponse.rcode != kRcodeNameError &&
+        outResponse.rcode != kRcodeServerError) {
+        throw std::runtime_error("++ invalid rcode");
+    }
+
+    if (this->cache) {
+        this->cache->insert(name, type, 0x0001, outResponse);
+    }
+}
+
+/**
+ * @brief Sends a query to (one or two of) the given servers, and parses the response. Servers that
+ * don't understand EDNS0 are asked again without it, and truncated responses fetched over TCP.
+ * @param candidates Servers that may be asked
+ * @return Whether a response was received
+*/
+bool DnsResolver::exchange(const std::vector<size_t>& candidates, const std::string& name, uint16_t type, uint16_t txid, Response& outResponse)
+{
+    size_t responseLen, server;
+    bool edns = (this->ednsBufferSize != 0);
+
+    // prepare the question packet
+    char questionPacket[kMaxQueryLen] = { 0 };
+    size_t questionLen = this->buildQuery(questionPacket, kMaxQueryLen, name, type, txid, edns);
+
+    // send it from any one of our sockets
+    if (this->sockets.empty()) {
+        this->openSockets();
+    }
+    this->rxBuffer.resize(this->getUdpBufferSize());
+
+again:;
+    SOCKET sock = this->sockets[QueryRandom::next() % this->sockets.size()];
+    responseLen = this->singlePacketTxn(sock, candidates, questionPacket, questionLen, this->rxBuffer.data(), this->rxBuffer.size(), server);
+
+    if (!responseLen) {
+        return false;
+    }
+    if (responseLen < sizeof(dns_header_t)) {
+        throw std::runtime_error("++ response too small");
+    }
+
+    auto resHeader = reinterpret_cast<const dns_header_t*>(this->rxBuffer.data());
+    const uint16_t flags = ntohs(resHeader->flags);
+
+    // server doesn't understand EDNS0; ask again without it (RFC 6891, section 7)
+    if (edns && ((flags & kRcodeMask) == kRcodeInvalidFormat || (flags & kRcodeMask) == kRcodeNotImplemented)) {
+        std::cout << "  Server rejected EDNS0, retrying without it" << std::endl;
+
+        edns = false;
+        questionLen = this->buildQuery(questionPacket, kMaxQueryLen, name, type, txid, edns);
+        goto again;
+    }
+
+    // the answer didn't fit; get all of it over TCP, from the same server
+    if (flags & kTruncation) {
+        std::cout << "  Response truncated, retrying over TCP" << std::endl;
+        responseLen = this->tcpTransaction(questionPacket, questionLen, this->rxBuffer, server);
+    }
+
+    this->parseResponse(this->rxBuffer.data(), responseLen, outResponse);
+    return true;
+}
+
+/**
+ * @brief Whether a name is the given zone, or inside of it. Both must be normalized.
+*/
+static bool IsInZone(const std::string& name, const std::string& zone)
+{
+    if (zone.empty() || name == zone) {
+        return true;
+    }
+
+    return name.size() > zone.size() && name[name.size() - zone.size() - 1] == '.' &&
+        !name.compare(name.size() - zone.size(), zone.size(), zone);
+}
+
+/**
+ * @brief Resolves a name iteratively: the servers of the closest zone we know are asked, and if
+ * they refer us to a zone further down, its servers are asked next, and so on until some server
+ * answers. CNAMEs are followed the same way, and end up in front of the final answers.
+ * @param txid Transaction id of the first query; later ones get a random one
+ * @param depth How deeply this lookup is nested in others (for nameserver addresses)
+ * @return Whether a response was received
+*/
+bool DnsResolver::resolveIteratively(const std::string& name, uint16_t type, uint16_t txid, Response& outResponse, size_t depth)
+{
+    DelegationCache::Delegation zone, next;
+    bool referred = false;
+    std::vector<size_t> candidates;
+    std::vector<Answer> aliases;
+
+    std::string target = name;
+    AnswerCache::normalize(target);
+
+    if (depth > kMaxIterationDepth) {
+        throw std::runtime_error("++ nameserver lookups nested too deeply");
+    }
+
+    for (size_t i = 0; i < kMaxReferrals; i++) {
+        // servers we were just referred to are asked directly, even if they weren't cached
+        if (referred) {
+            zone = std::move(next);
+            referred = false;
+        } else {
+            this->delegations->find(target, zone);
+        }
+
+        candidates.clear();
+        for (const auto& addr : zone.addresses) {
+            candidates.push_back(this->findServer(addr));
+        }
+
+        std::cout << "  Asking servers of '" << (zone.zone.empty() ? "." : zone.zone) << "' about " << target << std::endl;
+
+        if (!this->exchange(candidates, target, type, txid ? txid : QueryRandom::txid(), outResponse)) {
+            return false;
+        }
+        txid = 0;
+
+        // no answer, but servers of a zone further down
+        if (outResponse.rcode == kRcodeSuccess && outResponse.answers.empty() &&
+            this->followReferral(zone.zone, target, outResponse, depth, next)) {
+            referred = true;
+            continue;
+        }
+
+        // an alias, without the records it points to: look those up instead
+        std::string alias = target;
+        bool found = false;
+
+        for (auto const& answer : outResponse.answers) {
+            std::string owner = answer.name;
+            AnswerCache::normalize(owner);
+
+            if (owner == alias && answer.type == kRecordTypeCNAME) {
+                alias = answer.labelValue;
+                AnswerCache::normalize(alias);
+            } else if (owner == alias && answer.type == type) {
+                found = true;
+            }
+        }
+
+        if (!found && alias != target && type != kRecordTypeCNAME) {
+            aliases.insert(aliases.end(), outResponse.answers.begin(), outResponse.answers.end());
+            target = alias;
+            continue;
+        }
+
+        // anything else is the answer
+        outResponse.answers.insert(outResponse.answers.begin(), aliases.begin(), aliases.end());
+        return true;
+    }
+
+    throw std::runtime_error("++ too many referrals");
+}
+
+/**
+ * @brief If the response is a referral to a zone below the one that was asked (and above the name),
+ * caches the servers of that zone. Glue is only believed for servers inside the zone that was
+ * asked; servers without it have their addresses looked up.
+ * @param zone Zone whose servers sent the response
+ * @param name Name that was asked about
+ * @param outDelegation Filled in with the zone referred to, and the addresses of its servers
+ * @return Whether the response was a referral
+*/
+bool DnsResolver::followReferral(const std::string& zone, const std::string& name, const Response& response, size_t depth,
+    DelegationCache::Delegation& outDelegation)
+{
+    DelegationCache::Delegation delegation;
+    unsigned int ttl = DelegationCache::kMaxTtl;
+    bool haveZone = false;
+
+    for (auto const& record : response.authority) {
+        if (record.type != kRecordTypeNS) {
+            continue;
+        }
+
+        std::string owner = record.name;
+        AnswerCache::normalize(owner);
+
+        if (!haveZone) {
+            if (owner == zone || !IsInZone(owner, zone) || !IsInZone(name, owner)) {
+                continue;
+            }
+
+            delegation.zone = owner;
+            haveZone = true;
+        } else if (owner != delegation.zone) {
+            continue;
+        }
+
+        std::string server = record.labelValue;
+        AnswerCache::normalize(server);
+
+        delegation.nameservers.push_back(server);
+        ttl = min(ttl, record.ttl);
+    }
+
+    if (!haveZone) {
+        return false;
+    }
+
+    // glue
+    for (auto const& record : response.additional) {
+        if (record.type != kRecordTypeA || record.payload.size() != 4) {
+            continue;
+        }
+
+        std::string owner = record.name;
+        AnswerCache::normalize(owner);
+
+        if (!IsInZone(owner, zone) ||
+            std::find(delegation.nameservers.begin(), delegation.nameservers.end(), owner) == delegation.nameservers.end()) {
+            continue;
+        }
+
+        struct sockaddr_in addr = { 0 };
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(53);
+        memcpy(&addr.sin_addr, record.payload.data(), 4);
+
+        delegation.addresses.push_back(addr);
+    }
+
+    // no glue we can use; look up a few of the servers ourselves
+    for (size_t i = 0, lookups = 0; delegation.addresses.empty() && i < delegation.nameservers.size() && lookups < kMaxGlueLookups; i++) {
+        const auto& server = delegation.nameservers[i];
+        Response addrs;
+
+        // can't find a server inside the zone without its glue
+        if (IsInZone(server, delegation.zone)) {
+            continue;
+        }
+        lookups++;
+
+        try {
+            if (!(this->cache && this->cache->lookup(server, kRecordTypeA, 0x0001, addrs)) &&
+                !this->resolveIteratively(server, kRecordTypeA, 0, addrs, depth + 1)) {
+                continue;
+            }
+        } catch (const std::exception&) {
+            continue;
+        }
+
+        for (auto const& record : addrs.answers) {
+            if (record.type == kRecordTypeA && record.payload.size() == 4) {
+                struct sockaddr_in addr = { 0 };
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons(53);
+                memcpy(&addr.sin_addr, record.payload.data(), 4);
+
+                delegation.addresses.push_back(addr);
+            }
+        }
+    }
+
+    if (delegation.addresses.empty()) {
+        throw std::runtime_error("++ no addresses for the servers of '" + delegation.zone + "'");
+    }
+
+    this->delegations->insert(delegation, ttl);
+
+    outDelegation = std::move(delegation);
+    return true;
+}
+
+/**
+ * @brief Builds a query packet asking for a single record.
+ * @param packet Buffer to write the packet to
+ * @param packetLen Size of the buffer
+ * @param name Record to resolve
+ * @param type Record type
+ * @param txid Transaction id to put in the header
+ * @param edns Whether to add an OPT record advertising our UDP buffer size, if EDNS0 is enabled
+ * @return Length of the packet
+*/
+size_t DnsResolver::buildQuery(void* packet, const size_t packetLen, const std::string& name, uint16_t type, uint16_t txid, bool edns)
+{
+    edns = edns && this->ednsBufferSize;
+    const size_t optLen = edns ? (1 + sizeof(dns_answer_filling_t)) : 0;
+
+    if (packetLen < sizeof(dns_header_t) + name.size() + 2 + sizeof(dns_question_footer_t) + optLen) {
+        throw std::runtime_error("name too long: '" + name + "'");
+    }
+
+    memset(packet, 0, sizeof(dns_header_t));
+
+    dns_header_t* header = reinterpret_cast<dns_header_t*>(packet);
+
+    header->txid = htons(txid);
+    // when resolving iteratively, we're asking the authoritative servers ourselves
+    header->flags = htons(kPacketTypeRequest | (this->delegations ? 0 : kRecursionDesired));
+    header->numQuestions = htons(1);
+
+    size_t len = sizeof(dns_header_t);
+    len += this->putQuestion(reinterpret_cast<char*>(packet) + len, packetLen - len, name, type, 0x0001);
+
+    // OPT pseudo-record: root name, the class holds our buffer size; no extended flags or options
+    if (edns) {
+        auto writePtr = reinterpret_cast<char*>(packet) + len;
+        *writePtr++ = '\0';
+
+        auto opt = reinterpret_cast<dns_answer_filling_t*>(writePtr);
+        opt->type = htons(kRecordTypeOPT);
+        opt->dataClass = htons(this->ednsBufferSize);
+        opt->ttl = 0;
+        opt->dataLen = 0;
+
+        len += optLen;
+        header->numAdditionalRsrc = htons(1);
+    }
+
+    return len;
+}
+
+/**
+ * @brief Parses a response packet.
+ * 
+ * The packet is copied into the response, and its header byteswapped there; anything left in the
+ * response from an earlier packet is cleared out. Any rcode is accepted.
+ * @param packet Start of the response packet
+ * @param packetLen Length of the packet
+ * @param outResponse Output
+*/
+void DnsResolver::parseResponse(const void* packet, const size_t packetLen, Response& outResponse)
+{
+    PacketView view(packet, packetLen);
+    this->parseResponse(view, outResponse);
+}
+
+/**
+ * @brief Parses a response packet that's already been validated by a view. Names and record data
+ * are copied out of the packet into the response.
+ *
+ * If there's an OPT record, its upper 8 bits of the rcode are merged into the response's rcode.
+*/
+void DnsResolver::parseResponse(const PacketView& view, Response& outResponse)
+{
+    const size_t packetLen = view.getLength();
+
+    outResponse.cached = false;
+    outResponse.packetLen = packetLen;
+    outResponse.packetData.assign(view.getPacket(), view.getPacket() + packetLen);
+
+    char* response = outResponse.packetData.data();
+
+    // determine if success or not
+    auto resHeader = reinterpret_cast<dns_header_t*>(response);
+
+    resHeader->txid = ntohs(resHeader->txid);
+    resHeader->flags = ntohs(resHeader->flags);
+    resHeader->numQuestions = ntohs(resHeader->numQuestions);
+    resHeader->numAnswers = ntohs(resHeader->numAnswers);
+    resHeader->numNameservers = ntohs(resHeader->numNameservers);
+    resHeader->numAdditionalRsrc = ntohs(resHeader->numAdditionalRsrc);
+
+    uint16_t rcode = (resHeader->flags & kRcodeMask);
+    outResponse.rcode = rcode;
+    outResponse.success = (rcode == kRcodeSuccess);
+
+    // parse the question/answer/authority/bonus sections
+    this->readQuestions(view, outResponse.questions);
+
+    this->readAnswers(view, view.getAnswers(), view.getAnswerCount(), outResponse.answers);
+    this->readAnswers(view, view.getAuthority(), view.getAuthorityCount(), outResponse.authority);
+    this->readAnswers(view, view.getAdditional(), view.getAdditionalCount(), outResponse.additional);
+
+    for (auto const& record : outResponse.additional) {
+        if (record.type == kRecordTypeOPT) {
+            outResponse.rcode |= ((record.ttl >> 24) & 0xFF) << 4;
+            outResponse.success = (outResponse.rcode == kRcodeSuccess);
+            break;
+        }
+    }
+}
+
+
+
+/**
+ * @brief Writes a question record to the given pointer. This record contains the given label
+ * (split into its component parts) and the provided type and result class.
+ * @param writePtr Where in memory to write the question
+ * @param labels String to parse; split on periods
+ * @param type Query type
+ * @param resultClass Desired result class
+ * @return The number of bytes written for the question record
+*/
+size_t DnsResolver::putQuestion(void* _writePtr, size_t _writePtrLen, const std::string& label, uint16_t type, uint16_t resultClass)
+{
+    uint8_t* writePtr = reinterpret_cast<uint8_t*>(_writePtr);
+
+    // split the string labels and write them into the query
+    std::vector<std::string> pieces;
+    this->splitLabel(label, pieces);
+
+    if (pieces.empty()) { 
+        pieces.push_back(label);
+    }
+
+    // write each of the pieces
+    for (auto const& label : pieces) {
+        // the length (may not be more than 64 bytes)
+        if (label.size() >= 64) {
+            throw std::runtime_error("label too long: '" + label + "'");
+        }
+
+        *writePtr++ = (uint8_t)label.size() & 0x3F;
+
+        // copy all bytes
+        memcpy(writePtr, label.c_str(), label.size());
+        writePtr += label.size();
+    }
+
+    // the apex (terminating) null label
+    *writePtr++ = '\0';
+
+    // footer
+    auto footer = reinterpret_cast<dns_question_footer_t*>(writePtr);
+
+    footer->type = htons(type);
+    footer->reqClass = htons(resultClass);
+
+    writePtr += sizeof(dns_question_footer_t);
+
+    // return the bytes written
+    return writePtr - ((uint8_t *) _writePtr);
+}
+
+
+
+/**
+ * @brief Splits a domain name by period into components
+ * @param label 
+ * @param pieces 
+*/
+void DnsResolver::splitLabel(const std::string& label, std::vector<std::string>& pieces)
+{
+    std::string piece;
+    std::stringstream stream(label);
+
+    while (std::getline(stream, piece, '.')) {
+        pieces.push_back(piece);
+    }
+}
+
+/**
+ * @brief Copies the question section out of the packet.
+ * @param view Packet to read
+ * @param questions Vector to fill with the questions; it's cleared first
+*/
+void DnsResolver::readQuestions(const PacketView& view, std::vector<Question>& questions)
+{
+    PacketView::Question q;
+    size_t offset = view.getQuestions();
+
+    questions.clear();
+    questions.reserve(view.getQuestionCount());
+
+    for (size_t i = 0; i < view.getQuestionCount(); i++) {
+        view.readQuestion(offset, q);
+
+        questions.emplace_back();
+        auto& out = questions.back();
+
+        out.name = view.getName(q.name);
+        out.type = q.type;
+        out.recordClass = q.recordClass;
+    }
+}
+
+/**
+ * @brief Copies a section of resource records out of the packet.
+ * @param view Packet to read
+ * @param offset Start of the first record
+ * @param count Number of records to read
+ * @param answers Vector to fill with the records; it's cleared first
+*/
+void DnsResolver::readAnswers(const PacketView& view, size_t offset, const size_t count, std::vector<Answer>& answers)
+{
+    PacketView::Record r;
+
+    answers.clear();
+    answers.reserve(count);
+
+    for (size_t i = 0; i < count; i++) {
+        view.readRecord(offset, r);
+
+        answers.emplace_back();
+        auto& a = answers.back();
+
+        a.name = view.getName(r.name);
+        a.type = r.type;
+        a.payloadClass = r.recordClass;
+        a.ttl = r.ttl;
+
+        const auto data = reinterpret_cast<const std::byte*>(view.getPacket() + r.data);
+        a.payload.assign(data, data + r.dataLen);
+
+        // these hold a (possibly compressed) name
+        if (r.type == kRecordTypePTR || r.type == kRecordTypeCNAME || r.type == kRecordTypeNS) {
+            a.labelValue = view.getName(r.data);
+        }
+    }
+}
+
+
+
+
+/**
+ * @brief Opens the sockets that queries are sent from. Each is bound to a random port, and a query
+ * goes out on a random one of them, so an attacker has to guess the port as well as the txid to
+ * spoof a response.
+*/
+void DnsResolver::openSockets()
+{
+    for (size_t i = 0; i < kSocketPoolSize; i++) {
+        SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock == INVALID_SOCKET) {
+            throw std::runtime_error("socket() failed: " + std::to_string(WSAGetLastError()));
+        }
+        this->sockets.push_back(sock);
+
+        DnsResolver::bindRandomPort(sock);
+    }
+}
+
+/**
+ * @brief Binds the socket to a random port. If none of a few tries are free, the OS gets to pick
+ * one instead.
+*/
+void DnsResolver::bindRandomPort(SOCKET sock)
+{
+    int err;
+
+    struct sockaddr_in local = { 0 };
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = INADDR_ANY;
+
+    for (size_t i = 0; i < kBindAttempts; i++) {
+        local.sin_port = htons(QueryRandom::port());
+
+        err = bind(sock, (struct sockaddr*)&local, sizeof(local));
+        if (err != -1) {
+            return;
+        } else if (WSAGetLastError() != WSAEADDRINUSE && WSAGetLastError() != WSAEACCES) {
+            throw std::runtime_error("bind() failed: " + std::to_string(WSAGetLastError()));
+        }
+    }
+
+    local.sin_port = htons(0);
+
+    err = bind(sock, (struct sockaddr*)&local, sizeof(local));
+    if (err == -1) {
+        throw std::runtime_error("bind() failed: " + std::to_string(WSAGetLastError()));
+    }
+}
+
+/**
+ * @brief Runs a single packet UDP transaction against the DNS servers.
+ *
+ * Each attempt goes to the best server first; if it hasn't answered by the time it usually would
+ * have, the next best server is asked too, and the first response from either is taken. Responses
+ * to an earlier attempt still count.
+ *
+ * An attempt lasts as long as the retransmission timeout of the servers it went to (worked out from
+ * their RTTs, like TCP does); every timeout doubles it for the next attempt.
+ *
+ * Since sockets are reused, there may be stragglers from earlier queries waiting to be read; so
+ * only a packet from a server we asked, with the same txid as the query, counts as the response.
+ * Anything else is dropped, and we go back to waiting out the rest of the timeout.
+ * @param sock Socket to use in sending/receiving query
+ * @param candidates Servers that may be sent the query
+ * @param txBuf Packet data to transmit
+ * @param txBufLen Length of packet data to transmit
+ * @param rxBuf Buffer to receive response packet
+ * @param rxBufLen Size of receive buffer; it should fit the largest response we advertised
+ * @param outServer Index of the server that answered
+ * @return Number of bytes received, or 0 if there was no response to any of the attempts
+*/
+size_t DnsResolver::singlePacketTxn(SOCKET sock, const std::vector<size_t>& candidates, const void* txBuf, const size_t txBufLen, void* _rxBuf, const size_t _rxBufLen, size_t& outServer)
+{
+    using Clock = std::chrono::steady_clock;
+    using Msec = std::chrono::duration<double, std::milli>;
+
+    int err = 0;
+    size_t packetLen = 0;
+    size_t attempt = 0;
+
+    // buffer to read into
+    char* packet = reinterpret_cast<char*>(_rxBuf);
+    struct sockaddr_in respFrom;
+
+    const uint16_t txid = *reinterpret_cast<const uint16_t*>(txBuf);
+
+    // when each server was last sent the query, and how often; RTTs are only measured off servers
+    // that were sent it once, since it's not clear what a response is to otherwise
+    std::vector<Clock::time_point> sentAt(this->servers.size());
+    std::vector<size_t> sends(this->servers.size(), 0);
+
+    auto transmit = [&](size_t server) {
+        err = sendto(sock, (const char*)txBuf, (int)txBufLen, 0, (struct sockaddr*)&this->servers[server].addr,
+            sizeof(struct sockaddr_in));
+        if (err == -1) {
+            std::cout << "socket error: " << WSAGetLastError() << std::endl;
+            throw std::runtime_error("sendto() failed: " + std::to_string(WSAGetLastError()));
+        }
+
+        sentAt[server] = Clock::now();
+        sends[server]++;
+    };
+
+    while (attempt++ < kMaxRetransmissions) {
+        size_t racing[2];
+        const size_t numRacing = this->pickServers(candidates, racing);
+        size_t numSent = 0;
+
+        auto timeoutOf = [&](size_t server) {
+            return std::chrono::duration_cast<Clock::duration>(Msec(this->getRto(server)));
+        };
+
+        const auto startTime = Clock::now();
+        auto deadline = startTime + timeoutOf(racing[0]);
+        const auto hedgeAt = startTime + std::chrono::duration_cast<Clock::duration>(Msec(this->getHedgeDelay(racing[0])));
+
+        char addrStr[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &this->servers[racing[0]].addr.sin_addr, addrStr, sizeof(addrStr));
+
+        std::cout << "Attempt " << attempt << " with " << txBufLen << " bytes to " << addrStr << " (timeout "
+                  << (long long) Msec(deadline - startTime).count() << " ms)...";
+
+        // transmit the packet
+        transmit(racing[numSent++]);
+
+        while (true) {
+            // best server is taking too long; ask the next best one as well
+            auto nowTime = Clock::now();
+
+            if (numSent < numRacing && nowTime >= hedgeAt) {
+                inet_ntop(AF_INET, &this->servers[racing[numSent]].addr.sin_addr, addrStr, sizeof(addrStr));
+                std::cout << " racing " << addrStr << " after " << (long long) Msec(nowTime - startTime).count() << " ms...";
+
+                // it gets as long as the best server did
+                deadline = max(deadline, nowTime + timeoutOf(racing[numSent]));
+                transmit(racing[numSent++]);
+            }
+
+            // wait for activity on the socket, until the next server is due or the attempt is up
+            const auto waitUntil = (numSent < numRacing) ? min(hedgeAt, deadline) : deadline;
+
+            auto left = std::chrono::duration_cast<std::chrono::microseconds>(waitUntil - nowTime);
+            if (left.count() < 0) {
+                left = std::chrono::microseconds(0);
+            }
+
+            struct timeval tv;
+            tv.tv_sec = (long) (left.count() / 1000000);
+            tv.tv_usec = (long) (left.count() % 1000000);
+
+            fd_set set;
+            FD_ZERO(&set);
+            FD_SET(sock, &set);
+
+            err = select(0, &set, nullptr, nullptr, &tv);
+            if (err == -1) {
+                throw std::runtime_error("select() failed");
+            }
+            if (err == 0) {
+                if (waitUntil != deadline) {
+                    continue;
+                }
+
+                const double waited = Msec(Clock::now() - startTime).count();
+                std::cout << " timeout in " << (long long) waited << " ms" << std::endl;
+
+                for (size_t i = 0; i < numSent; i++) {
+                    this->noteTimeout(racing[i], Msec(Clock::now() - sentAt[racing[i]]).count());
+                }
+                break;
+            }
+
+            // receive the packet
+            socklen_t respFromLen = sizeof(respFrom);
+
+            err = recvfrom(sock, packet, (int) _rxBufLen, 0, (struct sockaddr*)&respFrom, &respFromLen);
+            if (err == -1) {
+                // ICMP unreachable left over from an earlier query on this socket
+                if (WSAGetLastError() == WSAECONNRESET) {
+                    continue;
+                }
+
+                std::cout << "socket error: " << WSAGetLastError() << std::endl;
+                throw std::runtime_error("recvfrom() failed: " + std::to_string(WSAGetLastError()));
+            }
+            packetLen = err;
+
+            // a straggler, or someone else entirely
+            size_t from;
+
+            for (from = 0; from < this->servers.size(); from++) {
+                const auto& addr = this->servers[from].addr;
+                if (sends[from] && respFrom.sin_addr.s_addr == addr.sin_addr.s_addr && respFrom.sin_port == addr.sin_port) {
+                    break;
+                }
+            }
+
+            if (from == this->servers.size() || packetLen < sizeof(uint16_t) ||
+                *reinterpret_cast<const uint16_t*>(packet) != txid) {
+                continue;
+            }
+
+            // servers that were asked but didn't answer took at least this long
+            nowTime = Clock::now();
+
+            this->servers[from].failures = 0;
+
+            for (size_t i = 0; i < this->servers.size(); i++) {
+                if (i == from && sends[i] == 1) {
+                    this->updateRtt(i, Msec(nowTime - sentAt[i]).count());
+                } else if (i != from && sends[i]) {
+                    auto& ns = this->servers[i];
+                    ns.rank = min(max(ns.rank, Msec(nowTime - sentAt[i]).count()), kMaxRank);
+                }
+            }
+
+            // print time taken to receive this packet, then process it
+            inet_ntop(AF_INET, &respFrom.sin_addr, addrStr, sizeof(addrStr));
+
+            std::cout << " response from " << addrStr << " in " << (long long) Msec(nowTime - startTime).count()
+                      << " ms with " << packetLen << " bytes" << std::endl;
+
+            outServer = from;
+            goto gotPacket;
+        }
+    }
+
+    // failed to receive packet
+    return 0;
+
+gotPacket:;
+    return packetLen;
+}
+
+/**
+ * @brief Finds the server with the given address, adding it if we've never queried it before.
+ * @return Index of the server
+*/
+size_t DnsResolver::findServer(const struct sockaddr_in& addr)
+{
+    const uint64_t key = ((uint64_t) addr.sin_addr.s_addr << 16) | addr.sin_port;
+
+    auto it = this->serverIndex.find(key);
+    if (it != this->serverIndex.end()) {
+        return it->second;
+    }
+
+    Nameserver server;
+    server.addr = addr;
+
+    this->servers.push_back(std::move(server));
+    this->serverIndex.emplace(key, this->servers.size() - 1);
+
+    return this->servers.size() - 1;
+}
+
+/**
+ * @brief Picks the servers to send a query to, out of the candidates: the one with the lowest
+ * rank, and the next best one to race it against, if there is one. All other candidates' ranks
+ * decay a little.
+ * @return Number of servers picked (1 or 2)
+*/
+size_t DnsResolver::pickServers(const std::vector<size_t>& candidates, size_t (&outServers)[2])
+{
+    if (candidates.empty()) {
+        throw std::logic_error("no nameservers");
+    }
+
+    const size_t none = this->servers.size();
+    outServers[0] = outServers[1] = none;
+
+    for (auto i : candidates) {
+        if (outServers[0] == none || this->servers[i].rank < this->servers[outServers[0]].rank) {
+            outServers[1] = outServers[0];
+            outServers[0] = i;
+        } else if (outServers[1] == none || this->servers[i].rank < this->servers[outServers[1]].rank) {
+            outServers[1] = i;
+        }
+    }
+
+    for (auto i : candidates) {
+        if (i != outServers[0] && i != outServers[1]) {
+            this->servers[i].rank *= kRankDecay;
+        }
+    }
+
+    return (outServers[1] == none) ? 1 : 2;
+}
+
+/**
+ * @brief How long to give a server before asking the next best one as well (msec): a few of its
+ * smoothed RTTs, or no time at all if it's been timing out.
+*/
+double DnsResolver::getHedgeDelay(size_t server) const
+{
+    const auto& ns = this->servers[server];
+
+    if (ns.failures) {
+        return kMinHedgeDelay;
+    } else if (!ns.srtt) {
+        return kInitialHedgeDelay;
+    }
+    return min(max(ns.srtt * kHedgeFactor, kMinHedgeDelay), kMaxHedgeDelay);
+}
+
+/**
+ * @brief Retransmission timeout of a server (msec): its smoothed RTT plus four times the variance
+ * (RFC 6298), within the configured bounds; it's doubled for every time the server timed out since
+ * it last answered.
+*/
+double DnsResolver::getRto(size_t server) const
+{
+    const auto& ns = this->servers[server];
+    const double rto = ns.srtt ? (ns.srtt + 4 * ns.rttvar) : kInitialRto;
+
+    const double backoff = (double) (1 << min(ns.failures, kMaxBackoff));
+    return min(max(rto, this->minRto) * backoff, this->maxRto);
+}
+
+/**
+ * @brief Adds an RTT sample (msec) to a server's smoothed RTT and RTT variance.
+*/
+void DnsResolver::updateRtt(size_t server, double rtt)
+{
+    auto& ns = this->servers[server];
+
+    if (!ns.srtt) {
+        ns.srtt = rtt;
+        ns.rttvar = rtt / 2;
+    } else {
+        ns.rttvar += kRttvarGain * (fabs(ns.srtt - rtt) - ns.rttvar);
+        ns.srtt += kSrttGain * (rtt - ns.srtt);
+    }
+    ns.srtt = max(ns.srtt, 0.001);
+    ns.rank = min(ns.srtt, kMaxRank);
+}
+
+/**
+ * @brief Records that a server didn't answer within the given time (msec). Its retransmission
+ * timeout stays backed off until it answers again, and its rank is penalized, so that others are
+ * preferred over it for a while.
+*/
+void DnsResolver::noteTimeout(size_t server, double waited)
+{
+    auto& ns = this->servers[server];
+
+    ns.rank = min(max(ns.rank * 2, waited), kMaxRank);
+    ns.failures++;
+}
+
+/**
+ * @brief Sends a query to a server over TCP, and reads the response; this is used when the
+ * response over UDP was truncated.
+ *
+ * The connection is kept open between queries, so a burst of truncated responses only costs one
+ * handshake; if the server closed it in the meantime, a new one is opened and the query is sent
+ * again. Connections that sat idle for longer than servers usually keep them around are closed
+ * rather than reused.
+ * @param query Query packet (without length prefix)
+ * @param queryLen Length of the query
+ * @param outResponse Buffer to receive the response into; it's resized to fit
+ * @param server Index of the server to ask; usually the one whose response was truncated
+ * @return Length of the response
+*/
+size_t DnsResolver::tcpTransaction(const void* query, const size_t queryLen, std::vector<char>& outResponse, size_t server)
+{
+    const auto now = std::chrono::steady_clock::now();
+    const auto deadline = now + std::chrono::milliseconds(kTcpTimeout);
+
+    if (queryLen > kMaxQueryLen) {
+        throw std::invalid_argument("query too long");
+    } else if (server >= this->servers.size()) {
+        throw std::invalid_argument("invalid server");
+    }
+
+    auto& tcp = this->servers[server].tcp;
+
+    if (!tcp) {
+        tcp = std::make_unique<TcpConnection>(this->servers[server].addr);
+    } else if (tcp->isOpen() && tcp->isIdle(now, std::chrono::milliseconds(TcpConnection::kIdleTimeout))) {
+        tcp->close();
+    }
+
+    // take the first response with our txid
+    size_t length = 0;
+    bool done = false;
+
+    auto onMessage = [&](const char* message, size_t messageLen) {
+        if (done || messageLen < sizeof(dns_header_t) || memcmp(message, query, sizeof(uint16_t))) {
+            return;
+        }
+
+        outResponse.assign(message, message + messageLen);
+        length = messageLen;
+        done = true;
+    };
+
+    for (bool retry = true; ; retry = false) {
+        const bool reused = tcp->isOpen();
+        if (!reused) {
+            tcp->open();
+        }
+
+        bool open = tcp->send(query, queryLen);
+
+        while (open && !done) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0) {
+                // the response may still show up later, and confuse the next query
+                tcp->close();
+                throw std::runtime_error("++ TCP timeout");
+            }
+
+            DWORD result = WaitForSingleObject(tcp->getEvent(), (DWORD) left.count());
+            if (result == WAIT_FAILED) {
+                throw std::runtime_error("WaitForSingleObject() failed: " + std::to_string(GetLastError()));
+            }
+
+            open = tcp->service(onMessage);
+        }
+
+        if (done) {
+            return length;
+        }
+        // a connection we reused may have been closed by the server in the meantime
+        else if (!reused || !retry) {
+            throw std::runtime_error("++ TCP connection failed");
+        }
+    }
+}
+
+
+
+/**
+ * @brief Prints a string representation of a question record.
+*/
+std::ostream& operator<<(std::ostream& output, const DnsResolver::Question& question)
+{
+    output << question.name << " type " << (unsigned int) question.type 
+           << " class " << (unsigned int) question.recordClass;
+    return output;
+}
+ 
+/**
+ * @brief Prints a string representation of an answer record.
+*/
+std::ostream& operator<<(std::ostream& output, const DnsResolver::Answer& answer) {
+    std::string typeStr = std::to_string(answer.type);
+    std::string valueStr = "(unknown value)";
+
+    switch (answer.type) {
+    case kRecordTypeA: {
+        typeStr = "A";
+
+        std::stringstream addrStream;
+        addrStream << (int)answer.payload[0] << ".";
+        addrStream << (int)answer.payload[1] << ".";
+        addrStream << (int)answer.payload[2] << ".";
+        addrStream << (int)answer.payload[3];
+
+        valueStr = addrStream.str();
+
+        break;
+    }
+    case kRecordTypeNS:
+        typeStr = "NS";
+        valueStr = answer.labelValue;
+        break;
+    case kRecordTypeCNAME:
+        typeStr = "CNAME";
+        valueStr = answer.labelValue;
+        break;
+    case kRecordTypePTR:
+        typeStr = "PTR";
+        valueStr = answer.labelValue;
+        break;
+    case kRecordTypeMX:
+        typeStr = "MX";
+        break;
+    }
+
+    output  << answer.name << " " << typeStr << " " << valueStr
+              << " TTL = " << (unsigned int) answer.ttl;
+
+    return output;
 }
\ No newline at end of file
@@ -1,115 +1,297 @@
-#ifndef DNSRESOLVER_H
-#define DNSRESOLVER_H
-
-#include <cstddef>
-#include <string>
-#include <vector>
-#include <tuple>
-
-/**
- * @brief Implements the actual DNS resolution.
-*/
-class DnsResolver {
-private:
-    /// Maximum DNS packet size
-    constexpr static const size_t kMaxPacketLen = 512;
-    /// Maximum number of retransmissions before giving up
-    constexpr static const size_t kMaxRetransmissions = 3;
-
-public:
-    /// question record
-    struct Question {
-        /// Name
-        std::string name;
-        /// Type
-        uint16_t type;
-        /// record class (1 = INET)
-        uint16_t recordClass;
-
-        friend std::ostream& operator<<(std::ostream& output, const Question&); 
-    };
-
-    /// answer record
-    struct Answer {
-        friend class DnsResolver;
-
-        /// Name
-        std::string name;
-        /// Type
-        uint16_t type;
-        /// Type of payload
-        uint16_t payloadClass;
-        /// Time-to-live (seconds)
-        unsigned int ttl;
-
-        /// Answer payload (raw)
-        std::vector<std::byte> payload;
-        
-        friend std::ostream& operator<<(std::ostream& output, const Answer&);
-
-    private:
-        /// If a PTR/CNAME record, this is the label in the payload
-        std::string labelValue;
-    };
-
-    /// DNS query response
-    struct Response {
-        friend class DnsResolver;
-
-    public:
-        bool isSuccess() const
-        {
-            return this->success;
-        }
-        
-        /// whether the response was successful or not
-        bool success = false;
-        /// response code
-        int rcode = -1;
-
-        /// Questions asked
-        std::vector<Question> questions;
-        /// Received answer records
-        std::vector<Answer> answers;
-        /// Received authority records
-        std::vector<Answer> authority;
-        /// Bonus records
-        std::vector<Answer> additional;
-
-//    private:
-        /// length of the packet
-        size_t packetLen;
-        /// Full received packet
-        char packetData[DnsResolver::kMaxPacketLen];
-    };
-
-public:
-    DnsResolver() = delete;
-    DnsResolver(const struct sockaddr_storage& addr)
-    {
-        this->setNameserverAddr(addr);
-    }
-    virtual ~DnsResolver() {};
-
-public:
-    void resolveDomain(const std::string& name, Response& outResponse, uint16_t type = 1, uint16_t txidHint = 0);
-
-    void setNameserverAddr(const struct sockaddr_storage& ipAddr, const unsigned int port = 53);
-
-private:
-    size_t putQuestion(void *writePtr, size_t writePtrLeft, const std::string& labels, uint16_t type, uint16_t resultClass);
-
-    void splitLabel(const std::string& label, std::vector<std::string>& pieces);
-    size_t reconstructLabel(void* packet, const size_t packetLen, void* labelStart, std::stringstream& name, bool* done = nullptr, size_t depth = 0);
-
-    size_t readQuestions(void* packet, const size_t packetLen, std::vector<Question>& questions);
-    size_t readAnswers(void* packet, const size_t packetLen, void* start, std::vector<Answer>& answers, const size_t count);
-
-    size_t singlePacketTxn(SOCKET sock, const void* txBuf, const size_t txBufLen, void* rxBuf, const size_t rxBufLen);
-
-private:
-    /// IP address of the server to query
-    struct sockaddr_storage toQuery = {0};
-};
-
+#ifndef DNSRESOLVER_H
+#define DNSRESOLVER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <tuple>
+#include <unordered_map>
+#include <memory>
+#include <stdexcept>
+
+#include "DelegationCache.h"
+
+class AnswerCache;
+class PacketView;
+class TcpConnection;
+
+/**
+ * @brief Implements the actual DNS resolution.
+ *
+ * Queries go out over a small pool of sockets that's kept open for the life of the resolver, as
+ * do the TCP connections used for truncated responses; so a resolver may only be used by one
+ * thread at a time.
+ *
+ * There may be several servers to query. Each query goes to the one that's been quickest to answer
+ * lately (by smoothed RTT); if it doesn't answer within a few of its usual RTTs, the query is sent
+ * to the next best one as well, and whichever answers first wins. Retransmission timeouts follow
+ * each server's RTT too, so a lost packet costs about as long as a response takes.
+ *
+ * Instead of asking those servers to recurse for us, the resolver can also do the iteration
+ * itself: starting at the closest zone it knows the servers of (the root, at first), it follows
+ * referrals down to the servers that are authoritative for the name. The zone cuts it comes across
+ * are cached, so later lookups skip straight to the right servers.
+*/
+class DnsResolver {
+public:
+    /// Maximum DNS message size (over TCP; the length prefix is 16 bits)
+    constexpr static const size_t kMaxPacketLen = 65535;
+    /// Maximum UDP packet size without EDNS0
+    constexpr static const size_t kMaxUdpPacketLen = 512;
+    /// Maximum size of a query we build (one question, plus an OPT record)
+    constexpr static const size_t kMaxQueryLen = 512;
+    /// Default UDP payload size advertised with EDNS0; it avoids IP fragmentation on most paths
+    constexpr static const uint16_t kDefaultEdnsBufferSize = 1232;
+    /// Default bounds for the retransmission timeout (msec)
+    constexpr static const unsigned int kDefaultMinRto = 50;
+    constexpr static const unsigned int kDefaultMaxRto = 5000;
+
+private:
+    /// Maximum number of retransmissions before giving up
+    constexpr static const size_t kMaxRetransmissions = 3;
+    /// Number of sockets (each on its own random port) queries are spread over
+    constexpr static const size_t kSocketPoolSize = 4;
+    /// Random ports tried when binding a socket, before letting the OS pick one
+    constexpr static const size_t kBindAttempts = 8;
+    /// How long to wait on a TCP connection (msec)
+    constexpr static const unsigned int kTcpTimeout = 10000;
+
+    /// Weight of a new RTT sample in a server's smoothed RTT and RTT variance (as with TCP)
+    constexpr static const double kSrttGain = 0.125;
+    constexpr static const double kRttvarGain = 0.25;
+    /// Retransmission timeout of a server that hasn't answered anything yet (msec; RFC 6298)
+    constexpr static const double kInitialRto = 1000;
+
+    /// Most referrals (and CNAMEs) followed while resolving a name iteratively
+    constexpr static const size_t kMaxReferrals = 16;
+    /// Most lookups of nameserver addresses nested in one another, when there's no glue
+    constexpr static const size_t kMaxIterationDepth = 4;
+    /// Nameservers of a zone whose addresses are looked up, when there's no glue
+    constexpr static const size_t kMaxGlueLookups = 2;
+    /// Servers not asked for a query have their rank decay by this factor, so one that was slow (or
+    /// down) for a while gets tried again eventually
+    constexpr static const double kRankDecay = 0.98;
+    /// Upper bound for a server's rank (msec), however badly it's been doing
+    constexpr static const double kMaxRank = 10000;
+    /// Most times a server's retransmission timeout is doubled
+    constexpr static const size_t kMaxBackoff = 16;
+    /// The next best server is asked as well after this many smoothed RTTs of the best one
+    constexpr static const double kHedgeFactor = 2;
+    /// Bounds for how long to wait before asking the next best server (msec)
+    constexpr static const double kMinHedgeDelay = 10;
+    constexpr static const double kMaxHedgeDelay = 1000;
+    /// How long to wait before asking the next best server, if the best hasn't answered yet
+    constexpr static const double kInitialHedgeDelay = 100;
+
+public:
+    /// question record
+    struct Question {
+        /// Name
+        std::string name;
+        /// Type
+        uint16_t type;
+        /// record class (1 = INET)
+        uint16_t recordClass;
+
+        friend std::ostream& operator<<(std::ostream& output, const Question&); 
+    };
+
+    /// answer record
+    struct Answer {
+        friend class DnsResolver;
+
+        /// Name
+        std::string name;
+        /// Type
+        uint16_t type;
+        /// Type of payload
+        uint16_t payloadClass;
+        /// Time-to-live (seconds)
+        unsigned int ttl;
+
+        /// Answer payload (raw)
+        std::vector<std::byte> payload;
+        
+        friend std::ostream& operator<<(std::ostream& output, const Answer&);
+
+    private:
+        /// If a PTR/CNAME record, this is the label in the payload
+        std::string labelValue;
+    };
+
+    /// DNS query response
+    struct Response {
+        friend class DnsResolver;
+
+    public:
+        bool isSuccess() const
+        {
+            return this->success;
+        }
+        
+        /// whether the response was successful or not
+        bool success = false;
+        /// response code
+        int rcode = -1;
+        /// whether the response came out of a cache rather than off the wire
+        bool cached = false;
+
+        /// Questions asked
+        std::vector<Question> questions;
+        /// Received answer records
+        std::vector<Answer> answers;
+        /// Received authority records
+        std::vector<Answer> authority;
+        /// Bonus records
+        std::vector<Answer> additional;
+
+//    private:
+        /// length of the packet
+        size_t packetLen = 0;
+        /// Full received packet
+        std::vector<char> packetData;
+    };
+
+public:
+    DnsResolver() = delete;
+    DnsResolver(const struct sockaddr_storage& addr);
+    virtual ~DnsResolver();
+
+    DnsResolver(const DnsResolver&) = delete;
+    DnsResolver& operator=(const DnsResolver&) = delete;
+
+public:
+    void resolveDomain(const std::string& name, Response& outResponse, uint16_t type = 1, uint16_t txidHint = 0);
+
+    size_t buildQuery(void* packet, const size_t packetLen, const std::string& name, uint16_t type, uint16_t txid, bool edns = true);
+    void parseResponse(const void* packet, const size_t packetLen, Response& outResponse);
+    void parseResponse(const PacketView& view, Response& outResponse);
+
+    void setNameserverAddr(const struct sockaddr_storage& ipAddr, const unsigned int port = 53);
+    void addNameserverAddr(const struct sockaddr_storage& ipAddr, const unsigned int port = 53);
+
+    /// number of servers queries may be sent to (when not resolving iteratively)
+    size_t getNameserverCount() const
+    {
+        return this->recursors.size();
+    }
+
+    static void bindRandomPort(SOCKET sock);
+
+    size_t tcpTransaction(const void* query, const size_t queryLen, std::vector<char>& outResponse, size_t server = 0);
+
+    /**
+     * @brief Sets the UDP payload size advertised in queries with EDNS0; 0 leaves EDNS0 out of
+     * queries entirely, limiting responses over UDP to 512 bytes.
+     */
+    void setEdnsBufferSize(uint16_t size)
+    {
+        this->ednsBufferSize = size;
+    }
+    /// largest UDP response we may get
+    size_t getUdpBufferSize() const
+    {
+        return max((size_t) this->ednsBufferSize, kMaxUdpPacketLen);
+    }
+
+    /**
+     * @brief Sets the bounds for how long to wait for a response before retransmitting (msec.)
+     * In between, the timeout follows each server's RTT; it doubles with every retransmission.
+     */
+    void setRetransmissionTimeouts(unsigned int minRto, unsigned int maxRto)
+    {
+        if (!minRto || minRto > maxRto) {
+            throw std::invalid_argument("invalid retransmission timeouts");
+        }
+
+        this->minRto = minRto;
+        this->maxRto = maxRto;
+    }
+
+    /**
+     * @brief Sets the cache to look answers up in before querying the server, and to store
+     * successful answers in. It may be shared between resolvers, and must outlive this one.
+     */
+    void setCache(AnswerCache* cache)
+    {
+        this->cache = cache;
+    }
+
+    /**
+     * @brief Resolves names iteratively from now on, starting at the delegations in the given
+     * cache (which always knows the root servers) rather than asking the configured servers to
+     * recurse; or stops doing so, if it's null. Like the answer cache, it may be shared, and must
+     * outlive this resolver.
+     */
+    void setIterative(DelegationCache* delegations)
+    {
+        this->delegations = delegations;
+    }
+
+private:
+    /**
+     * @brief A server queries may be sent to, and how it's been doing
+     */
+    struct Nameserver {
+        struct sockaddr_in addr = { 0 };
+
+        /// smoothed RTT and its variance (msec); 0 until the server answered something
+        double srtt = 0;
+        double rttvar = 0;
+        /// timeouts since the server last answered; its retransmission timeout doubles with each
+        size_t failures = 0;
+
+        /// what servers are picked by, lowest first (msec): the smoothed RTT, but penalized for
+        /// timeouts and lost races, and decaying while the server isn't used
+        double rank = 0;
+
+        /// connection for queries over TCP; opened when first needed
+        std::unique_ptr<TcpConnection> tcp;
+    };
+
+private:
+    size_t putQuestion(void *writePtr, size_t writePtrLeft, const std::string& labels, uint16_t type, uint16_t resultClass);
+
+    void splitLabel(const std::string& label, std::vector<std::string>& pieces);
+
+    void readQuestions(const PacketView& view, std::vector<Question>& questions);
+    void readAnswers(const PacketView& view, size_t offset, const size_t count, std::vector<Answer>& answers);
+
+    bool exchange(const std::vector<size_t>& candidates, const std::string& name, uint16_t type, uint16_t txid, Response& outResponse);
+    bool resolveIteratively(const std::string& name, uint16_t type, uint16_t txid, Response& outResponse, size_t depth);
+    bool followReferral(const std::string& zone, const std::string& name, const Response& response, size_t depth,
+        DelegationCache::Delegation& outDelegation);
+
+    void openSockets();
+    size_t singlePacketTxn(SOCKET sock, const std::vector<size_t>& candidates, const void* txBuf, const size_t txBufLen, void* rxBuf, const size_t rxBufLen, size_t& outServer);
+
+    size_t findServer(const struct sockaddr_in& addr);
+    size_t pickServers(const std::vector<size_t>& candidates, size_t (&outServers)[2]);
+    double getHedgeDelay(size_t server) const;
+    double getRto(size_t server) const;
+    void updateRtt(size_t server, double rtt);
+    void noteTimeout(size_t server, double waited);
+
+private:
+    /// every server we've queried (or may query), and the index of each by its address and port
+    std::vector<Nameserver> servers;
+    std::unordered_map<uint64_t, size_t> serverIndex;
+    /// servers to ask to recurse for us
+    std::vector<size_t> recursors;
+
+    /// answer cache, if any
+    AnswerCache* cache = nullptr;
+    /// delegations to start iterative resolution at; null to ask the recursors instead
+    DelegationCache* delegations = nullptr;
+    /// sockets queries are sent from; opened on the first query, and kept until we're destroyed
+    std::vector<SOCKET> sockets;
+    /// bounds for the retransmission timeout (msec)
+    double minRto = kDefaultMinRto;
+    double maxRto = kDefaultMaxRto;
+    /// UDP payload size to advertise with EDNS0, or 0 to not use it
+    uint16_t ednsBufferSize = kDefaultEdnsBufferSize;
+    /// buffer responses are received into
+    std::vector<char> rxBuffer;
+};
+
 #endif
\ No newline at end of file
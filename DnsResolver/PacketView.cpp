@@ -0,0 +1,235 @@
+#include "pch.h"
+#include "PacketView.h"
+#include "DnsTypes.h"
+
+#include <cstring>
+#include <stdexcept>
+
+/**
+ * @brief Validates the packet, and finds where each of its sections start.
+ *
+ * Every name (following compression pointers) and record is checked to lie within the packet. If
+ * the packet is truncated (the TC bit is set), the sections end at the last complete record;
+ * otherwise, a packet that's shorter than its header says is invalid.
+ * @throws std::runtime_error If the packet is malformed
+*/
+PacketView::PacketView(const void* packet, size_t length) : packet(static_cast<const uint8_t*>(packet)), length(length)
+{
+    if (length < sizeof(dns_header_t)) {
+        throw std::runtime_error("++ response too small");
+    }
+
+    auto header = reinterpret_cast<const dns_header_t*>(packet);
+
+    this->txid = ntohs(header->txid);
+    this->flags = ntohs(header->flags);
+
+    const size_t declared[4] = {
+        ntohs(header->numQuestions), ntohs(header->numAnswers),
+        ntohs(header->numNameservers), ntohs(header->numAdditionalRsrc)
+    };
+    const bool truncated = (this->flags & kTruncation);
+
+    size_t offset = sizeof(dns_header_t);
+
+    for (size_t section = 0; section < 4; section++) {
+        this->sections[section] = offset;
+
+        for (size_t i = 0; i < declared[section]; i++) {
+            // find where the record ends, without reading any of it
+            size_t end = offset;
+
+            try {
+                end = this->walkName(end, nullptr, 0, nullptr);
+            } catch (const std::runtime_error&) {
+                if (truncated) {
+                    goto beach;
+                }
+                throw;
+            }
+
+            if (section == 0) {
+                end += sizeof(dns_question_footer_t);
+            } else if (end + sizeof(dns_answer_filling_t) <= this->length) {
+                auto filling = reinterpret_cast<const dns_answer_filling_t*>(this->packet + end);
+                end += sizeof(dns_answer_filling_t) + ntohs(filling->dataLen);
+            } else {
+                end = SIZE_MAX;
+            }
+
+            if (end > this->length) {
+                if (truncated) {
+                    goto beach;
+                }
+                throw std::runtime_error("++ unexpected end of packet");
+            }
+
+            offset = end;
+            this->counts[section]++;
+        }
+    }
+
+    return;
+
+beach:;
+    // truncated: later sections are empty
+    for (size_t section = 0; section < 4; section++) {
+        if (!this->sections[section]) {
+            this->sections[section] = offset;
+        }
+    }
+}
+
+/**
+ * @brief Reads the question at the given offset, and advances the offset past it.
+*/
+void PacketView::readQuestion(size_t& offset, Question& outQuestion) const
+{
+    outQuestion.name = offset;
+    offset = this->walkName(offset, nullptr, 0, nullptr);
+
+    auto footer = reinterpret_cast<const dns_question_footer_t*>(this->packet + offset);
+    outQuestion.type = ntohs(footer->type);
+    outQuestion.recordClass = ntohs(footer->reqClass);
+
+    offset += sizeof(dns_question_footer_t);
+}
+
+/**
+ * @brief Reads the resource record at the given offset, and advances the offset past it.
+*/
+void PacketView::readRecord(size_t& offset, Record& outRecord) const
+{
+    outRecord.name = offset;
+    offset = this->walkName(offset, nullptr, 0, nullptr);
+
+    auto filling = reinterpret_cast<const dns_answer_filling_t*>(this->packet + offset);
+    outRecord.type = ntohs(filling->type);
+    outRecord.recordClass = ntohs(filling->dataClass);
+    outRecord.ttl = ntohl(filling->ttl);
+    outRecord.dataLen = ntohs(filling->dataLen);
+
+    offset += sizeof(dns_answer_filling_t);
+    outRecord.data = offset;
+    offset += outRecord.dataLen;
+}
+
+/**
+ * @brief Decodes the name at the given offset in dotted form, without a trailing dot (the root is
+ * an empty string.) A buffer of `kMaxNameLen + 1` bytes always fits any name.
+ * @param buf Buffer to write the name to; it's always null terminated
+ * @param bufLen Size of the buffer
+ * @return Length of the name
+*/
+size_t PacketView::readName(size_t offset, char* buf, size_t bufLen) const
+{
+    size_t nameLen = 0;
+    this->walkName(offset, buf, bufLen, &nameLen);
+    return nameLen;
+}
+
+/**
+ * @brief Decodes the name at the given offset into a string.
+*/
+std::string PacketView::getName(size_t offset) const
+{
+    char buf[kMaxNameLen + 1];
+    const size_t len = this->readName(offset, buf, sizeof(buf));
+
+    return std::string(buf, len);
+}
+
+/**
+ * @brief Follows the name at the given offset to its end, decoding it along the way if a buffer
+ * is given.
+ *
+ * Compression pointers may only point backwards (to an earlier occurrence of the name, as RFC 1035
+ * intends), so there can't be any loops.
+ * @param buf Buffer to decode the name into, or null
+ * @param bufLen Size of the buffer
+ * @param outNameLen If not null, the length of the decoded name
+ * @return Offset of the first byte after the name, where it appears in the packet
+ * @throws std::runtime_error If the name is malformed, or doesn't fit in the buffer
+*/
+size_t PacketView::walkName(size_t offset, char* buf, size_t bufLen, size_t* outNameLen) const
+{
+    size_t end = 0;
+    size_t wireLen = 0;
+    size_t nameLen = 0;
+    size_t labelStart = offset;
+
+    while (true) {
+        if (offset >= this->length) {
+            throw std::runtime_error("++ unexpected end of packet");
+        }
+
+        const uint8_t len = this->packet[offset];
+
+        // compression pointer
+        if ((len & 0xC0) == 0xC0) {
+            if (offset + 1 >= this->length) {
+                throw std::runtime_error("++ unexpected end of packet in compressed value");
+            }
+
+            const size_t ptr = ((len << 8) | this->packet[offset + 1]) & 0x3FFF;
+
+            if (ptr < sizeof(dns_header_t)) {
+                throw std::runtime_error("++ jump into fixed header");
+            }
+            if (ptr >= labelStart) {
+                throw std::runtime_error("++ label jump loop");
+            }
+
+            if (!end) {
+                end = offset + 2;
+            }
+            offset = labelStart = ptr;
+            continue;
+        } else if (len > 63) {
+            throw std::runtime_error("++ invalid label length");
+        }
+
+        wireLen += 1 + len;
+        if (wireLen > kMaxNameLen) {
+            throw std::runtime_error("++ name too long");
+        }
+
+        // end of the name
+        if (!len) {
+            if (!end) {
+                end = offset + 1;
+            }
+            break;
+        }
+
+        if (offset + 1 + len > this->length) {
+            throw std::runtime_error("++ unexpected end of packet");
+        }
+
+        if (buf) {
+            if (nameLen + (nameLen ? 1 : 0) + len >= bufLen) {
+                throw std::runtime_error("++ name doesn't fit in buffer");
+            }
+
+            if (nameLen) {
+                buf[nameLen++] = '.';
+            }
+            memcpy(buf + nameLen, this->packet + offset + 1, len);
+            nameLen += len;
+        }
+
+        offset += 1 + len;
+    }
+
+    if (buf) {
+        if (!bufLen) {
+            throw std::runtime_error("++ name doesn't fit in buffer");
+        }
+        buf[nameLen] = '\0';
+    }
+    if (outNameLen) {
+        *outNameLen = nameLen;
+    }
+
+    return end;
+}
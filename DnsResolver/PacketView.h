@@ -0,0 +1,136 @@
+#ifndef PACKETVIEW_H
+#define PACKETVIEW_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Read-only view of a DNS packet, that parses it in place without allocating anything.
+ *
+ * The whole packet is validated up front, when the view is created; after that, records are read
+ * out one at a time as offsets into the packet, and names are only decoded (into a buffer the
+ * caller provides) when they're asked for. The packet must outlive the view, and must still have
+ * its header in network byte order.
+*/
+class PacketView {
+public:
+    /// Longest name there can be; RFC 1035 allows 255 bytes in wire format
+    constexpr static const size_t kMaxNameLen = 255;
+
+    /**
+     * @brief A question, as offsets into the packet
+     */
+    struct Question {
+        /// start of the name
+        size_t name;
+
+        uint16_t type;
+        uint16_t recordClass;
+    };
+
+    /**
+     * @brief A resource record, as offsets into the packet
+     */
+    struct Record {
+        /// start of the name
+        size_t name;
+
+        uint16_t type;
+        uint16_t recordClass;
+        uint32_t ttl;
+
+        /// start and length of the record data
+        size_t data;
+        uint16_t dataLen;
+    };
+
+public:
+    PacketView(const void* packet, size_t length);
+
+    /// header fields, in host byte order
+    uint16_t getTxid() const
+    {
+        return this->txid;
+    }
+    uint16_t getFlags() const
+    {
+        return this->flags;
+    }
+
+    /**
+     * @brief Record counts of each section. If the packet was truncated, these only count the
+     * records that are actually in it.
+     */
+    size_t getQuestionCount() const
+    {
+        return this->counts[0];
+    }
+    size_t getAnswerCount() const
+    {
+        return this->counts[1];
+    }
+    size_t getAuthorityCount() const
+    {
+        return this->counts[2];
+    }
+    size_t getAdditionalCount() const
+    {
+        return this->counts[3];
+    }
+
+    /**
+     * @brief Offsets of the first record in each section, to pass to `readQuestion()` or
+     * `readRecord()`.
+     */
+    size_t getQuestions() const
+    {
+        return this->sections[0];
+    }
+    size_t getAnswers() const
+    {
+        return this->sections[1];
+    }
+    size_t getAuthority() const
+    {
+        return this->sections[2];
+    }
+    size_t getAdditional() const
+    {
+        return this->sections[3];
+    }
+
+    void readQuestion(size_t& offset, Question& outQuestion) const;
+    void readRecord(size_t& offset, Record& outRecord) const;
+
+    size_t readName(size_t offset, char* buf, size_t bufLen) const;
+    std::string getName(size_t offset) const;
+
+    /// start of the packet
+    const uint8_t* getPacket() const
+    {
+        return this->packet;
+    }
+    /// length of the packet
+    size_t getLength() const
+    {
+        return this->length;
+    }
+
+private:
+    size_t walkName(size_t offset, char* buf, size_t bufLen, size_t* outNameLen) const;
+
+private:
+    const uint8_t* packet = nullptr;
+    size_t length = 0;
+
+    uint16_t txid = 0;
+    uint16_t flags = 0;
+
+    /// records in each section: questions, answers, authority and additional
+    size_t counts[4] = { 0 };
+    /// offset of the first record of each section
+    size_t sections[4] = { 0 };
+};
+
+#endif
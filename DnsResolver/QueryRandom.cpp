@@ -0,0 +1,53 @@
+#include "pch.h"
+#include "QueryRandom.h"
+
+#include <random>
+
+thread_local QueryRandom::State QueryRandom::state;
+
+/**
+ * @brief Returns the next 32 bits from this thread's generator (xoshiro128**), seeding it first if
+ * it's due.
+*/
+uint32_t QueryRandom::next()
+{
+    auto& st = QueryRandom::state;
+
+    if (!st.left) {
+        QueryRandom::seed(st);
+    }
+    st.left--;
+
+    auto rotl = [](const uint32_t x, int k) {
+        return (x << k) | (x >> (32 - k));
+    };
+
+    const uint32_t result = rotl(st.s[1] * 5, 7) * 9;
+    const uint32_t t = st.s[1] << 9;
+
+    st.s[2] ^= st.s[0];
+    st.s[3] ^= st.s[1];
+    st.s[1] ^= st.s[2];
+    st.s[0] ^= st.s[3];
+    st.s[2] ^= t;
+    st.s[3] = rotl(st.s[3], 11);
+
+    return result;
+}
+
+/**
+ * @brief Fills the generator state from the OS CSPRNG. The state may not be all zeros, so that's
+ * retried (not that it'll ever happen.)
+*/
+void QueryRandom::seed(State& state)
+{
+    std::random_device dev;
+
+    do {
+        for (auto& word : state.s) {
+            word = dev();
+        }
+    } while (!(state.s[0] | state.s[1] | state.s[2] | state.s[3]));
+
+    state.left = kReseedInterval;
+}
@@ -0,0 +1,52 @@
+#ifndef QUERYRANDOM_H
+#define QUERYRANDOM_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Random txids and source ports for queries.
+ *
+ * Each thread has its own xoshiro128** generator, so getting a number is a handful of instructions
+ * and never takes a lock. The generators are seeded (and every so often reseeded) from
+ * `std::random_device`, which is the OS CSPRNG; that way, an attacker that sees some of our txids
+ * can't predict more than a limited run of them.
+*/
+class QueryRandom {
+public:
+    /// Number of outputs after which a thread's generator is reseeded
+    constexpr static const size_t kReseedInterval = (1 << 16);
+    /// Lowest source port handed out; everything below is reserved-ish
+    constexpr static const uint16_t kMinPort = 1024;
+
+    static uint32_t next();
+
+    /// a non-zero transaction id
+    static uint16_t txid()
+    {
+        uint16_t txid;
+        do {
+            txid = (uint16_t) QueryRandom::next();
+        } while (!txid);
+        return txid;
+    }
+
+    /// a source port, at least `kMinPort`
+    static uint16_t port()
+    {
+        return (uint16_t) (kMinPort + (QueryRandom::next() % (0x10000 - kMinPort)));
+    }
+
+private:
+    struct State {
+        uint32_t s[4] = { 0 };
+        /// outputs left until the next reseed
+        size_t left = 0;
+    };
+
+    static void seed(State& state);
+
+    static thread_local State state;
+};
+
+#endif
@@ -0,0 +1,254 @@
+#include "pch.h"
+#include "TcpConnection.h"
+
+#include <cstring>
+#include <stdexcept>
+
+/**
+ * @brief Sets up a connection to the given server; it's not opened until `open()` is called.
+*/
+TcpConnection::TcpConnection(const struct sockaddr_in& server) : server(server)
+{
+    this->event = CreateEvent(nullptr, false, false, nullptr);
+    if (!this->event) {
+        throw std::runtime_error("CreateEvent() failed: " + std::to_string(GetLastError()));
+    }
+}
+
+/**
+ * @brief Closes the connection.
+*/
+TcpConnection::~TcpConnection()
+{
+    this->close();
+    CloseHandle(this->event);
+}
+
+/**
+ * @brief Starts connecting to the server. Queries may be sent right away; they're buffered until
+ * the connection is up.
+*/
+void TcpConnection::open()
+{
+    int err;
+
+    this->close();
+
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == INVALID_SOCKET) {
+        throw std::runtime_error("socket() failed: " + std::to_string(WSAGetLastError()));
+    }
+
+    // this also makes the socket non-blocking
+    err = WSAEventSelect(sock, this->event, FD_CONNECT | FD_READ | FD_WRITE | FD_CLOSE);
+    if (err == -1) {
+        closesocket(sock);
+        throw std::runtime_error("WSAEventSelect() failed: " + std::to_string(WSAGetLastError()));
+    }
+
+    // queries are small, and shouldn't sit around waiting for more to come along
+    BOOL noDelay = true;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
+    err = connect(sock, (struct sockaddr*)&this->server, sizeof(struct sockaddr_in));
+    if (err == -1 && WSAGetLastError() != WSAEWOULDBLOCK) {
+        closesocket(sock);
+        throw std::runtime_error("connect() failed: " + std::to_string(WSAGetLastError()));
+    }
+
+    this->sock = sock;
+    this->received = 0;
+    this->lastActivity = std::chrono::steady_clock::now();
+}
+
+/**
+ * @brief Closes the connection, and forgets about anything that was outstanding on it.
+*/
+void TcpConnection::close()
+{
+    if (this->sock != INVALID_SOCKET) {
+        closesocket(this->sock);
+        this->sock = INVALID_SOCKET;
+    }
+
+    this->connected = false;
+    this->txBuffer.clear();
+    this->txOffset = 0;
+    this->rxLength = 0;
+    this->outstanding = 0;
+
+    ResetEvent(this->event);
+}
+
+/**
+ * @brief Sends a query; it's written out right away if the connection is up, or buffered until
+ * it is otherwise.
+ * @param message The query, without length prefix
+ * @param length Length of the query
+ * @return Whether the connection is still open
+*/
+bool TcpConnection::send(const void* message, size_t length)
+{
+    if (!this->isOpen()) {
+        return false;
+    } else if (length > 0xFFFF) {
+        throw std::invalid_argument("message too long");
+    }
+
+    const size_t offset = this->txBuffer.size();
+    this->txBuffer.resize(offset + 2 + length);
+
+    this->txBuffer[offset] = (char) (length >> 8);
+    this->txBuffer[offset + 1] = (char) (length & 0xFF);
+    memcpy(this->txBuffer.data() + offset + 2, message, length);
+
+    this->outstanding++;
+    this->lastActivity = std::chrono::steady_clock::now();
+
+    if (this->connected) {
+        return this->flush();
+    }
+    return true;
+}
+
+/**
+ * @brief Handles whatever happened on the connection since it was last serviced: finishes
+ * connecting, writes out buffered queries, and reads responses, each of which is handed to the
+ * callback. The callback may send more queries.
+ * @return Whether the connection is still open; if it was closed, all outstanding queries on it
+ * are lost
+*/
+bool TcpConnection::service(const MessageCallback& onMessage)
+{
+    WSANETWORKEVENTS events;
+
+    if (!this->isOpen()) {
+        return false;
+    }
+
+    if (WSAEnumNetworkEvents(this->sock, this->event, &events) == -1) {
+        goto beach;
+    }
+
+    if (events.lNetworkEvents & FD_CONNECT) {
+        if (events.iErrorCode[FD_CONNECT_BIT]) {
+            goto beach;
+        }
+
+        this->connected = true;
+        if (!this->flush()) {
+            return false;
+        }
+    }
+    if ((events.lNetworkEvents & FD_WRITE) && this->connected) {
+        if (!this->flush()) {
+            return false;
+        }
+    }
+
+    // read before handling a close, since the last responses may come with it
+    if (events.lNetworkEvents & (FD_READ | FD_CLOSE)) {
+        if (!this->receive(onMessage)) {
+            return false;
+        }
+    }
+    if (events.lNetworkEvents & FD_CLOSE) {
+        goto beach;
+    }
+
+    return true;
+
+beach:;
+    this->close();
+    return false;
+}
+
+/**
+ * @brief Writes out as much of the buffered queries as the socket will take.
+ * @return Whether the connection is still open
+*/
+bool TcpConnection::flush()
+{
+    while (this->txOffset < this->txBuffer.size()) {
+        int err = ::send(this->sock, this->txBuffer.data() + this->txOffset, (int) (this->txBuffer.size() - this->txOffset), 0);
+
+        if (err == -1) {
+            // FD_WRITE is signalled once there's room again
+            if (WSAGetLastError() == WSAEWOULDBLOCK) {
+                return true;
+            }
+
+            this->close();
+            return false;
+        }
+
+        this->txOffset += err;
+    }
+
+    this->txBuffer.clear();
+    this->txOffset = 0;
+    return true;
+}
+
+/**
+ * @brief Reads everything available on the socket, and hands each complete message to the
+ * callback. Anything left over is kept for the next call.
+ * @return Whether the connection is still open
+*/
+bool TcpConnection::receive(const MessageCallback& onMessage)
+{
+    while (true) {
+        // always have room for at least the largest message
+        if (this->rxBuffer.size() < this->rxLength + 0x10001) {
+            this->rxBuffer.resize(this->rxLength + 0x10001);
+        }
+
+        int err = recv(this->sock, this->rxBuffer.data() + this->rxLength, (int) (this->rxBuffer.size() - this->rxLength), 0);
+
+        if (err == -1) {
+            if (WSAGetLastError() == WSAEWOULDBLOCK) {
+                return true;
+            }
+
+            this->close();
+            return false;
+        } else if (err == 0) {
+            // closed by the server; FD_CLOSE will follow (or came with this)
+            return true;
+        }
+
+        this->rxLength += err;
+        this->lastActivity = std::chrono::steady_clock::now();
+
+        // hand out complete messages
+        size_t offset = 0;
+
+        while (this->rxLength - offset >= 2) {
+            const uint8_t* prefix = reinterpret_cast<const uint8_t*>(this->rxBuffer.data() + offset);
+            const size_t length = (prefix[0] << 8) | prefix[1];
+
+            if (this->rxLength - offset - 2 < length) {
+                break;
+            }
+
+            if (this->outstanding) {
+                this->outstanding--;
+            }
+            this->received++;
+
+            onMessage(this->rxBuffer.data() + offset + 2, length);
+            offset += 2 + length;
+
+            // callback may have run into an error sending
+            if (!this->isOpen()) {
+                return false;
+            }
+        }
+
+        // move the partial message to the front
+        if (offset) {
+            memmove(this->rxBuffer.data(), this->rxBuffer.data() + offset, this->rxLength - offset);
+            this->rxLength -= offset;
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef TCPCONNECTION_H
+#define TCPCONNECTION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <chrono>
+#include <functional>
+
+/**
+ * @brief A TCP connection to a DNS server, with any number of queries pipelined over it (RFC 7766.)
+ *
+ * Each message is preceded by its length, as a 16-bit big endian integer; responses may come back
+ * in any order. Everything is non-blocking: queries are buffered until the socket takes them, and
+ * the connection's event is signalled whenever it needs attention, at which point `service()`
+ * should be called. The connection may be closed and opened again any number of times.
+ *
+ * Errors on the connection close it, rather than throwing; whoever is using it then needs to send
+ * the queries that were outstanding on it again.
+*/
+class TcpConnection {
+public:
+    /// A connection with nothing outstanding is closed after this long (msec), since the server
+    /// will likely have closed its end by then anyways
+    constexpr static const unsigned int kIdleTimeout = 10000;
+
+    using MessageCallback = std::function<void(const char* message, size_t length)>;
+
+public:
+    TcpConnection(const struct sockaddr_in& server);
+    virtual ~TcpConnection();
+
+    TcpConnection(const TcpConnection&) = delete;
+    TcpConnection& operator=(const TcpConnection&) = delete;
+
+    void open();
+    void close();
+
+    bool send(const void* message, size_t length);
+    bool service(const MessageCallback& onMessage);
+
+    bool isOpen() const
+    {
+        return this->sock != INVALID_SOCKET;
+    }
+    /// whether there's nothing outstanding, and hasn't been for at least `timeout`
+    bool isIdle(std::chrono::steady_clock::time_point now, std::chrono::milliseconds timeout) const
+    {
+        return !this->outstanding && (now - this->lastActivity) >= timeout;
+    }
+
+    /// signalled when the connection needs to be serviced
+    HANDLE getEvent() const
+    {
+        return this->event;
+    }
+    /// queries sent that haven't been answered yet
+    size_t getOutstanding() const
+    {
+        return this->outstanding;
+    }
+    /// responses received since the connection was last opened
+    size_t getReceived() const
+    {
+        return this->received;
+    }
+
+private:
+    bool flush();
+    bool receive(const MessageCallback& onMessage);
+
+private:
+    /// server to connect to
+    struct sockaddr_in server = { 0 };
+
+    SOCKET sock = INVALID_SOCKET;
+    /// event the socket signals; it outlives the socket, so it can be waited on all the time
+    HANDLE event = nullptr;
+    /// set once the connection is established; until then, queries are only buffered
+    bool connected = false;
+
+    /// length prefixed queries waiting to be sent, and how much of them has been
+    std::vector<char> txBuffer;
+    size_t txOffset = 0;
+    /// data received that doesn't make up a complete message yet
+    std::vector<char> rxBuffer;
+    size_t rxLength = 0;
+
+    size_t outstanding = 0;
+    size_t received = 0;
+    /// when something was last sent or received
+    std::chrono::steady_clock::time_point lastActivity;
+};
+
+#endif
@@ -1,178 +1,341 @@
-// DnsResolver.cpp : This file contains the 'main' function. Program execution begins and ends there.
-//
-#include "pch.h"
-#include "DnsResolver.h"
-#include "DnsTypes.h"
-
-#include <sstream>
-#include <string>
-#include <stdexcept>
-#include <iostream>
-#include <iomanip>
-#include <random>
-
-#ifdef _WIN32
-// this is fucking stupid
-#pragma comment(lib, "ws2_32.lib")
-
-/**
- * Performs general initialization of stuff like WinSock
- */
-static void WindowsInit()
-{
-    int err;
-    WSAData wsDetails;
-
-    // winsock
-    err = WSAStartup(MAKEWORD(2, 2), &wsDetails);
-
-    if (err != 0) {
-        std::cerr << "WSAStartup() failed: " << err << std::endl;
-        exit(-1);
-    }
-}
-#endif
-
-/**
- * @brief Prints program usage.
-*/
-static void PrintUsage(const char *name)
-{
-    std::cout << "usage: " << name << " [record] [server address]" << std::endl;
-    std::cout << "\twhere record is a domain name or IPv4 in dotted quad form" << std::endl;
-}
-
-/**
- * @brief Prints the DNS response.
-*/
-static void PrintResponse(const DnsResolver::Response& resp)
-{
-    // questions section
-    if (!resp.questions.empty()) {
-        std::cout << "  ------------ [questions] ----------" << std::endl;
-        for (auto const& question : resp.questions) {
-            std::cout << "    " << question << std::endl;
-        }
-    }
-    // answers section
-    if (!resp.answers.empty()) {
-        std::cout << "  ------------ [answers] ------------" << std::endl;
-        for (auto const& answer : resp.answers) {
-            std::cout << "    " << answer << std::endl;
-        }
-    }
-    // authority section
-    if (!resp.authority.empty()) {
-        std::cout << "  ------------ [authority] ----------" << std::endl;
-        for (auto const& answer : resp.authority) {
-            std::cout << "    " << answer << std::endl;
-        }
-    }
-    // additional records section
-    if (!resp.additional.empty()) {
-        std::cout << "  ------------ [additional] ---------" << std::endl;
-        for (auto const& answer : resp.additional) {
-            std::cout << "    " << answer << std::endl;
-        }
-    }
-}
-
-/**
- * @brief Program entry point
- * @return 
-*/
-int main(int argc, const char** argv)
-{
-    int err;
-    struct sockaddr_storage serverAddr = { 0 };
-    struct in_addr reverseAddr = { 0 };
-    bool reverse = false;
-
-    // platform specific init
-#if _WIN32
-    WindowsInit();
-#endif
-
-    // validate number of args
-    if (argc != 3) {
-        PrintUsage(argv[0]);
-        return -1;
-    }
-
-    // parse the server address
-    const std::string serverAddrStr(argv[2]);
-
-    auto server = reinterpret_cast<struct sockaddr_in*>(&serverAddr);
-    server->sin_family = AF_INET;
-    server->sin_port = htons(53);
-
-    err = inet_pton(AF_INET, serverAddrStr.c_str(), &server->sin_addr);
-    if (err != 1) {
-        std::cerr << "Failed to parse server address" << std::endl;
-        return -1;
-    }
-
-    // determine if we need to look up a domain or reverse DNS
-    std::string resolveStr(argv[1]);
-
-    err = inet_pton(AF_INET, resolveStr.c_str(), &reverseAddr);
-
-    if (err == -1) {
-        perror("inet_pton()");
-        return -1;
-    }
-    reverse = (err == 1);
-
-    if (reverse) {
-        std::stringstream reverse;
-
-        for (size_t i = 0; i < 4; i++) {
-            uint8_t value = (reverseAddr.S_un.S_addr & (0xFF << (8 * (3 - i)))) >> (8 * (3 - i));
-            reverse << (unsigned int)value << ".";
-        }
-
-        reverse << "in-addr.arpa";
-
-        resolveStr = reverse.str();
-    }
-
-    // calculate a txid hint (random 16-bit value)
-    std::random_device dev;
-    std::mt19937 random(dev());
-    std::uniform_int_distribution<> dist(1, 0xFFFF);
-
-    uint16_t txidHint = dist(random);
-    uint16_t type = reverse ? kRecordTypePTR : kRecordTypeA;
-
-    // print lookup details
-    std::cout << "Lookup  : " << argv[1] << std::endl;
-    std::cout << "Query   : " << resolveStr << ", type " << type << ", TXID 0x" << std::hex 
-              << std::setw(4) << txidHint << std::dec << std::endl;
-    std::cout << "Server  : " << serverAddrStr << std::endl;
-    std::cout << "********************************" << std::endl;
-
-    // do it
-    DnsResolver resolver(serverAddr);
-    DnsResolver::Response dnsResp;
-
-    try {
-        resolver.resolveDomain(resolveStr, dnsResp, type, txidHint);
-    } catch (const std::exception& e) {
-        std::cerr << "DNS failure: " << e.what() << std::endl;
-        return -1;
-    }
-
-    auto dnsHeader = reinterpret_cast<dns_header_t*>(&dnsResp.packetData);
-    std::cout << "  TXID 0x" << std::hex << std::setw(4) << dnsHeader->txid << std::dec
-              << " flags 0x" << std::hex << dnsHeader->flags << std::dec
-              << " questions " << dnsHeader->numQuestions << " answers " << dnsHeader->numAnswers
-              << " authority " << dnsHeader->numNameservers << " additional "
-              << dnsHeader->numAdditionalRsrc << std::endl;
-
-    if (dnsResp.isSuccess()) {
-        std::cout << "  Succeeded with Rcode = " << dnsResp.rcode << std::endl;
-        PrintResponse(dnsResp);
-    } else {
-        std::cout << "  Failed with Rcode = " << dnsResp.rcode << std::endl;
-    }
+// DnsResolver.cpp : This file contains the 'main' function. Program execution begins and ends there.
+//
+#include "pch.h"
+#include "DnsResolver.h"
+#include "BulkResolver.h"
+#include "AnswerCache.h"
+#include "DelegationCache.h"
+#include "QueryRandom.h"
+#include "DnsTypes.h"
+
+#include <sstream>
+#include <string>
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <random>
+
+#ifdef _WIN32
+// this is fucking stupid
+#pragma comment(lib, "ws2_32.lib")
+
+/**
+ * Performs general initialization of stuff like WinSock
+ */
+static void WindowsInit()
+{
+    int err;
+    WSAData wsDetails;
+
+    // winsock
+    err = WSAStartup(MAKEWORD(2, 2), &wsDetails);
+
+    if (err != 0) {
+        std::cerr << "WSAStartup() failed: " << err << std::endl;
+        exit(-1);
+    }
+}
+#endif
+
+/**
+ * @brief Prints program usage.
+*/
+static void PrintUsage(const char *name)
+{
+    std::cout << "usage: " << name << " [record] [server address[,server address...]]" << std::endl;
+    std::cout << "\twhere record is a domain name or IPv4 in dotted quad form" << std::endl;
+    std::cout << "   or: " << name << " --bulk [name list] [server address] [queries in flight]" << std::endl;
+    std::cout << "\twhere name list is a file with one domain name per line" << std::endl;
+    std::cout << "   or: " << name << " --bulk-tcp [name list] [server address] [queries in flight]" << std::endl;
+    std::cout << "\tto send all queries over a few pipelined TCP connections" << std::endl;
+    std::cout << "   or: " << name << " --iterative [record] [root server address[,root server address...]]" << std::endl;
+    std::cout << "\tto resolve starting at the root servers (from the root hints, if none are given)" << std::endl;
+}
+
+/**
+ * @brief Prints the DNS response.
+*/
+static void PrintResponse(const DnsResolver::Response& resp)
+{
+    // questions section
+    if (!resp.questions.empty()) {
+        std::cout << "  ------------ [questions] ----------" << std::endl;
+        for (auto const& question : resp.questions) {
+            std::cout << "    " << question << std::endl;
+        }
+    }
+    // answers section
+    if (!resp.answers.empty()) {
+        std::cout << "  ------------ [answers] ------------" << std::endl;
+        for (auto const& answer : resp.answers) {
+            std::cout << "    " << answer << std::endl;
+        }
+    }
+    // authority section
+    if (!resp.authority.empty()) {
+        std::cout << "  ------------ [authority] ----------" << std::endl;
+        for (auto const& answer : resp.authority) {
+            std::cout << "    " << answer << std::endl;
+        }
+    }
+    // additional records section
+    if (!resp.additional.empty()) {
+        std::cout << "  ------------ [additional] ---------" << std::endl;
+        for (auto const& answer : resp.additional) {
+            std::cout << "    " << answer << std::endl;
+        }
+    }
+}
+
+/**
+ * @brief Resolves the A records of every name in a file, with many queries in flight at once. One
+ * line is printed per name, followed by some statistics.
+ * @param tcp Whether to send queries over TCP connections rather than UDP
+*/
+static int BulkMain(int argc, const char** argv, bool tcp)
+{
+    struct sockaddr_storage serverAddr = { 0 };
+    size_t inFlight = BulkResolver::kDefaultMaxInFlight;
+
+    if (argc < 4 || argc > 5) {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    auto server = reinterpret_cast<struct sockaddr_in*>(&serverAddr);
+    server->sin_family = AF_INET;
+    server->sin_port = htons(53);
+
+    if (inet_pton(AF_INET, argv[3], &server->sin_addr) != 1) {
+        std::cerr << "Failed to parse server address" << std::endl;
+        return -1;
+    }
+
+    if (argc == 5) {
+        inFlight = std::strtoul(argv[4], nullptr, 10);
+        if (!inFlight) {
+            std::cerr << "invalid number of queries in flight" << std::endl;
+            return -1;
+        }
+    }
+
+    // read the names
+    std::vector<std::string> names;
+    std::ifstream list(argv[2]);
+
+    if (!list) {
+        std::cerr << "Failed to open name list" << std::endl;
+        return -1;
+    }
+
+    for (std::string line; std::getline(list, line); ) {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+
+        if (!line.empty() && line[0] != '#') {
+            names.push_back(line);
+        }
+    }
+
+    std::cout << "Resolving " << names.size() << " names with up to " << inFlight
+              << " queries in flight" << std::endl;
+
+    // do it
+    size_t answered = 0, failed = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    try {
+        AnswerCache cache;
+        BulkResolver resolver(serverAddr, inFlight,
+            tcp ? BulkResolver::kDefaultTcpConnections : BulkResolver::kDefaultSockets,
+            tcp ? BulkResolver::kTransportTcp : BulkResolver::kTransportUdp);
+        resolver.setCache(&cache);
+
+        resolver.resolve(names, kRecordTypeA, [&](const BulkResolver::Result& result) {
+            std::cout << result.name << ": ";
+
+            if (!result.received) {
+                std::cout << "failed (" << result.error << ")" << std::endl;
+                failed++;
+                return;
+            }
+
+            std::cout << "rcode " << result.response.rcode;
+            for (auto const& answer : result.response.answers) {
+                if (answer.type == kRecordTypeA) {
+                    std::cout << ", " << answer;
+                    break;
+                }
+            }
+            if (result.response.cached) {
+                std::cout << " (cached)" << std::endl;
+            } else {
+                std::cout << " (" << (result.latency.count() / 1000.f) << " ms, " << result.attempts
+                          << " attempts)" << std::endl;
+            }
+            answered++;
+        });
+
+        auto end = std::chrono::steady_clock::now();
+        double secs = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() / 1000.f;
+
+        auto& stats = resolver.getStats();
+        std::cout << "********************************" << std::endl;
+        std::cout << answered << " answered, " << failed << " failed in " << secs << " sec ("
+                  << (names.size() / max(secs, 0.001)) << " names/sec)" << std::endl;
+        std::cout << stats.sent << " queries, " << stats.retransmitted << " retransmissions, "
+                  << stats.unmatched << " unmatched responses, " << stats.tcp << " over TCP, "
+                  << stats.reconnects << " TCP connections lost" << std::endl;
+
+        auto cacheStats = cache.getStats();
+        std::cout << stats.cached << " answered from cache (" << cacheStats.negativeHits << " negative); "
+                  << cacheStats.entries << " entries ("
+                  << cacheStats.bytes << " bytes), " << cacheStats.evictions << " evictions" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "DNS failure: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Program entry point
+ * @return 
+*/
+int main(int argc, const char** argv)
+{
+    int err;
+    struct sockaddr_storage serverAddr = { 0 };
+    struct in_addr reverseAddr = { 0 };
+    bool reverse = false;
+    bool iterative = false;
+
+    // platform specific init
+#if _WIN32
+    WindowsInit();
+#endif
+
+    if (argc >= 2 && std::string(argv[1]) == "--bulk") {
+        return BulkMain(argc, argv, false);
+    } else if (argc >= 2 && std::string(argv[1]) == "--bulk-tcp") {
+        return BulkMain(argc, argv, true);
+    } else if (argc >= 2 && std::string(argv[1]) == "--iterative") {
+        iterative = true;
+        argc--;
+        argv++;
+    }
+
+    // validate number of args; the root servers are optional when resolving iteratively
+    if (argc != 3 && !(iterative && argc == 2)) {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    // parse the server addresses; there may be several, separated by commas
+    const std::string serverAddrStr(argc == 3 ? argv[2] : "");
+    std::vector<struct sockaddr_storage> serverAddrs;
+
+    std::stringstream serverList(serverAddrStr);
+    for (std::string addrStr; std::getline(serverList, addrStr, ','); ) {
+        auto server = reinterpret_cast<struct sockaddr_in*>(&serverAddr);
+        server->sin_family = AF_INET;
+        server->sin_port = htons(53);
+
+        err = inet_pton(AF_INET, addrStr.c_str(), &server->sin_addr);
+        if (err != 1) {
+            std::cerr << "Failed to parse server address '" << addrStr << "'" << std::endl;
+            return -1;
+        }
+
+        serverAddrs.push_back(serverAddr);
+    }
+    if (serverAddrs.empty() && !iterative) {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    // determine if we need to look up a domain or reverse DNS
+    std::string resolveStr(argv[1]);
+
+    err = inet_pton(AF_INET, resolveStr.c_str(), &reverseAddr);
+
+    if (err == -1) {
+        perror("inet_pton()");
+        return -1;
+    }
+    reverse = (err == 1);
+
+    if (reverse) {
+        std::stringstream reverse;
+
+        for (size_t i = 0; i < 4; i++) {
+            uint8_t value = (reverseAddr.S_un.S_addr & (0xFF << (8 * (3 - i)))) >> (8 * (3 - i));
+            reverse << (unsigned int)value << ".";
+        }
+
+        reverse << "in-addr.arpa";
+
+        resolveStr = reverse.str();
+    }
+
+    // calculate a txid hint (random 16-bit value)
+    uint16_t txidHint = QueryRandom::txid();
+    uint16_t type = reverse ? kRecordTypePTR : kRecordTypeA;
+
+    // print lookup details
+    std::cout << "Lookup  : " << argv[1] << std::endl;
+    std::cout << "Query   : " << resolveStr << ", type " << type << ", TXID 0x" << std::hex 
+              << std::setw(4) << txidHint << std::dec << std::endl;
+    std::cout << "Server  : " << (serverAddrStr.empty() ? "root hints" : serverAddrStr)
+              << (iterative ? " (iterative)" : "") << std::endl;
+    std::cout << "********************************" << std::endl;
+
+    // when resolving iteratively, the servers given are the root servers
+    std::vector<struct sockaddr_in> rootServers;
+
+    for (const auto& addr : serverAddrs) {
+        rootServers.push_back(*reinterpret_cast<const struct sockaddr_in*>(&addr));
+    }
+
+    DelegationCache delegations(rootServers);
+
+    // there's no server to recurse for us when using the root hints, but the resolver needs one
+    if (serverAddrs.empty()) {
+        serverAddr.ss_family = AF_INET;
+        serverAddrs.push_back(serverAddr);
+    }
+
+    // do it
+    DnsResolver resolver(serverAddrs[0]);
+    DnsResolver::Response dnsResp;
+
+    for (size_t i = 1; i < serverAddrs.size(); i++) {
+        resolver.addNameserverAddr(serverAddrs[i]);
+    }
+    if (iterative) {
+        resolver.setIterative(&delegations);
+    }
+
+    try {
+        resolver.resolveDomain(resolveStr, dnsResp, type, txidHint);
+    } catch (const std::exception& e) {
+        std::cerr << "DNS failure: " << e.what() << std::endl;
+        return -1;
+    }
+
+    auto dnsHeader = reinterpret_cast<dns_header_t*>(dnsResp.packetData.data());
+    std::cout << "  TXID 0x" << std::hex << std::setw(4) << dnsHeader->txid << std::dec
+              << " flags 0x" << std::hex << dnsHeader->flags << std::dec
+              << " questions " << dnsHeader->numQuestions << " answers " << dnsHeader->numAnswers
+              << " authority " << dnsHeader->numNameservers << " additional "
+              << dnsHeader->numAdditionalRsrc << std::endl;
+
+    if (dnsResp.isSuccess()) {
+        std::cout << "  Succeeded with Rcode = " << dnsResp.rcode << std::endl;
+        PrintResponse(dnsResp);
+    } else {
+        std::cout << "  Failed with Rcode = " << dnsResp.rcode << std::endl;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include "pch.h"
+#include "Checkpoint.h"
+
+#include <stdexcept>
+#include <fstream>
+
+namespace {
+/// Identifies checkpoint files
+constexpr static const uint32_t kFileMagic = 0x54504B43; // 'CKPT'
+/// Current checkpoint file version
+constexpr static const uint32_t kFileVersion = 1;
+
+/**
+ * @brief On-disk header of a checkpoint file; followed by one CRC per range
+*/
+#pragma pack(push, 1)
+struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t transferId;
+    uint64_t offset;
+    uint32_t rangeSize;
+    uint32_t numRanges;
+};
+#pragma pack(pop)
+}
+
+/**
+ * @brief Writes the checkpoint to the given file.
+ *
+ * The file is written under a temporary name first, then moved into place, so that a crash while
+ * saving leaves the previous checkpoint intact.
+*/
+void Checkpoint::save(const std::string& path) const
+{
+    const std::string tempPath = path + ".tmp";
+
+    FileHeader hdr = { 0 };
+    hdr.magic = kFileMagic;
+    hdr.version = kFileVersion;
+    hdr.transferId = this->transferId;
+    hdr.offset = this->offset;
+    hdr.rangeSize = this->rangeSize;
+    hdr.numRanges = (uint32_t) this->ranges.size();
+
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("failed to open checkpoint file '" + tempPath + "'");
+        }
+
+        out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        out.write(reinterpret_cast<const char*>(this->ranges.data()), this->ranges.size() * sizeof(uint32_t));
+
+        if (!out) {
+            throw std::runtime_error("failed to write checkpoint file '" + tempPath + "'");
+        }
+    }
+
+    if (!MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        throw std::runtime_error("MoveFileEx(): " + std::to_string(GetLastError()));
+    }
+}
+
+/**
+ * @brief Reads a checkpoint from the given file.
+ *
+ * @return Whether a checkpoint was loaded; false if the file doesn't exist
+*/
+bool Checkpoint::load(const std::string& path, Checkpoint& out)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+
+    FileHeader hdr = { 0 };
+    in.read(reinterpret_cast<char*>(&hdr), sizeof(hdr));
+
+    if (!in || hdr.magic != kFileMagic || hdr.version != kFileVersion) {
+        throw std::runtime_error("'" + path + "' is not a valid checkpoint file");
+    } else if (!hdr.rangeSize || (hdr.offset / hdr.rangeSize) != hdr.numRanges) {
+        throw std::runtime_error("'" + path + "' is corrupted");
+    }
+
+    out.transferId = hdr.transferId;
+    out.offset = hdr.offset;
+    out.rangeSize = hdr.rangeSize;
+    out.ranges.resize(hdr.numRanges);
+
+    in.read(reinterpret_cast<char*>(out.ranges.data()), out.ranges.size() * sizeof(uint32_t));
+    if (!in) {
+        throw std::runtime_error("'" + path + "' is truncated");
+    }
+
+    return true;
+}
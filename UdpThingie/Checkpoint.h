@@ -0,0 +1,43 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Progress of a resumable transfer.
+ *
+ * Progress is tracked in bytes of the application's data stream (i.e. what was passed to `send`,
+ * before compression) rather than packets, since packet boundaries may differ between connections.
+ * The stream is split into fixed size ranges, and the CRC32 of each range that's been acknowledged
+ * is kept; when resuming, these let the sender check that what the receiver claims to have is
+ * actually the same data.
+*/
+class Checkpoint {
+public:
+    /// Default size of a manifest range, in bytes
+    constexpr static const uint32_t kDefaultRangeSize = (1024 * 1024);
+
+public:
+    Checkpoint() = default;
+    Checkpoint(uint64_t transferId, uint32_t rangeSize = kDefaultRangeSize)
+        : transferId(transferId), rangeSize(rangeSize) {};
+
+    void save(const std::string& path) const;
+    static bool load(const std::string& path, Checkpoint& out);
+
+public:
+    /// identifies the transfer across connections
+    uint64_t transferId = 0;
+    /// bytes of the data stream the receiver has acknowledged; always a multiple of the range size
+    uint64_t offset = 0;
+    /// size of each range, in bytes
+    uint32_t rangeSize = kDefaultRangeSize;
+    /// CRC32 of each range below `offset`
+    std::vector<uint32_t> ranges;
+};
+
+#endif
@@ -1,30 +1,39 @@
-#include "pch.h"
-#include "Checksum.h"
-
-/**
- * @brief Computes the CRC computation table
-*/
-Checksum::Checksum()
-{
-    for (uint32_t i = 0; i < 256; i++) {
-        uint32_t c = i;
-
-        for (uint32_t j = 0; j < 8; j++) {
-            c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
-        }
-
-        this->crcTable[i] = c;
-    }
-}
-
-uint32_t Checksum::crc32(void *_buf, size_t len)
-{
-    unsigned char* buf = reinterpret_cast<unsigned char*>(_buf);
-    uint32_t c = 0xFFFFFFFF;
-
-    for (size_t i = 0; i < len; i++) {
-        c = this->crcTable[(c ^ buf[i]) & 0xFF] ^ (c >> 8);
-    }
-
-    return c ^ 0xFFFFFFFF;
+#include "pch.h"
+#include "Checksum.h"
+
+/**
+ * @brief Computes the CRC computation table
+*/
+Checksum::Checksum()
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+
+        for (uint32_t j = 0; j < 8; j++) {
+            c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+        }
+
+        this->crcTable[i] = c;
+    }
+}
+
+uint32_t Checksum::crc32(void *_buf, size_t len)
+{
+    return this->update(0, _buf, len);
+}
+
+/**
+ * @brief Continues a CRC over more data; start with a CRC of 0. The CRC of a buffer is the same no
+ * matter how it's split up between calls.
+*/
+uint32_t Checksum::update(uint32_t crc, const void *_buf, size_t len) const
+{
+    const unsigned char* buf = reinterpret_cast<const unsigned char*>(_buf);
+    uint32_t c = crc ^ 0xFFFFFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        c = this->crcTable[(c ^ buf[i]) & 0xFF] ^ (c >> 8);
+    }
+
+    return c ^ 0xFFFFFFFF;
 }
\ No newline at end of file
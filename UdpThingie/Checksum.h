@@ -1,19 +1,20 @@
-#ifndef CHECKSUM_H
-#define CHECKSUM_H
-
-#include <cstdint>
-
-/**
- * @brief Implements CRC32
-*/
-class Checksum {
-public:
-    Checksum();
-
-    virtual uint32_t crc32(void* buf, size_t len);
-
-private:
-    uint32_t crcTable[256];
-};
-
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstdint>
+
+/**
+ * @brief Implements CRC32
+*/
+class Checksum {
+public:
+    Checksum();
+
+    virtual uint32_t crc32(void* buf, size_t len);
+    uint32_t update(uint32_t crc, const void* buf, size_t len) const;
+
+private:
+    uint32_t crcTable[256];
+};
+
 #endif
\ No newline at end of file
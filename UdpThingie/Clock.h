@@ -0,0 +1,63 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "pch.h"
+
+#include <chrono>
+
+/**
+ * @brief Source of time for a socket, along with the means of waiting for it to pass.
+ *
+ * Sockets never read the time or block on their events directly, but always go through this
+ * interface, so that time can be replaced by a simulated one (see `SimClock`.)
+*/
+class Clock {
+public:
+    using time_point = std::chrono::steady_clock::time_point;
+
+public:
+    virtual ~Clock() = default;
+
+    /// Current time
+    virtual time_point now() = 0;
+
+    /**
+     * @brief Waits for any of the given handles to be signalled, or for the timeout to expire.
+     *
+     * @param timeout Milliseconds to wait, or `INFINITE`
+     * @return Same as `WaitForMultipleObjects()`
+     */
+    virtual DWORD wait(DWORD count, const HANDLE* handles, DWORD timeout) = 0;
+
+    /**
+     * @brief Registers a thread that will be waiting on this clock. Threads are counted rather
+     * than identified, so a thread may be attached by whoever is about to start it; the thread
+     * itself then calls `enter()` before doing anything else.
+     */
+    virtual void attach() {}
+    /// Unregisters the calling thread, once it won't wait on the clock anymore.
+    virtual void detach() {}
+
+    /// Called by an attached thread before it starts running (or after `leave()`.)
+    virtual void enter() {}
+    /// Called by an attached thread before it blocks on something other than the clock.
+    virtual void leave() {}
+};
+
+/**
+ * @brief Plain old wall clock time
+*/
+class RealClock : public Clock {
+public:
+    time_point now() override
+    {
+        return std::chrono::steady_clock::now();
+    }
+
+    DWORD wait(DWORD count, const HANDLE* handles, DWORD timeout) override
+    {
+        return WaitForMultipleObjects(count, handles, false, timeout);
+    }
+};
+
+#endif
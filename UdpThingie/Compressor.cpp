@@ -0,0 +1,310 @@
+#include "pch.h"
+#include "Compressor.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+/// log2 of the number of hash table entries
+constexpr static const size_t kHashLog = 12;
+/// hash table entry that doesn't refer to any position
+constexpr static const uint32_t kEmpty = 0xFFFFFFFF;
+
+/// minimum match length
+constexpr static const size_t kMinMatch = 4;
+/// the last match must start at least this many bytes before the end of the block
+constexpr static const size_t kMatchLimit = 12;
+/// the last this many bytes of a block are always literals
+constexpr static const size_t kLastLiterals = 5;
+/// largest offset that can be encoded
+constexpr static const size_t kMaxOffset = 65535;
+
+uint32_t Read32(const uint8_t* ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+uint32_t Hash(uint32_t sequence)
+{
+    return (sequence * 2654435761U) >> (32 - kHashLog);
+}
+
+/**
+ * @brief Writes a length that doesn't fit in its token nibble: runs of 255, then the remainder.
+*/
+void WriteLength(uint8_t*& op, size_t length)
+{
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t) length;
+}
+
+/**
+ * @brief Emits one sequence: literals, followed by a match (unless `matchLen` is 0, which is only
+ * the case for the last sequence of a block)
+ *
+ * @return Whether the sequence fit in the output buffer
+*/
+bool EmitSequence(uint8_t*& op, const uint8_t* oend, const uint8_t* literals, size_t litLen,
+    size_t offset, size_t matchLen)
+{
+    // worst case: token, literal length, literals, offset, match length
+    const size_t needed = 1 + ((litLen / 255) + 1) + litLen + 2 + ((matchLen / 255) + 1);
+    if ((size_t) (oend - op) < needed) {
+        return false;
+    }
+
+    uint8_t* token = op++;
+
+    if (litLen >= 15) {
+        *token = (15 << 4);
+        WriteLength(op, litLen - 15);
+    } else {
+        *token = (uint8_t) (litLen << 4);
+    }
+
+    memcpy(op, literals, litLen);
+    op += litLen;
+
+    if (!matchLen) {
+        return true;
+    }
+
+    // offset is little endian
+    *op++ = (uint8_t) (offset & 0xFF);
+    *op++ = (uint8_t) (offset >> 8);
+
+    const size_t length = matchLen - kMinMatch;
+    if (length >= 15) {
+        *token |= 15;
+        WriteLength(op, length - 15);
+    } else {
+        *token |= (uint8_t) length;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Reads the extension bytes of a length whose token nibble was saturated
+*/
+size_t ReadLength(const uint8_t*& ip, const uint8_t* iend)
+{
+    size_t length = 0;
+    uint8_t b;
+
+    do {
+        if (ip >= iend) {
+            throw std::runtime_error("truncated compressed block");
+        }
+        b = *ip++;
+        length += b;
+    } while (b == 255);
+
+    return length;
+}
+}
+
+/**
+ * @brief Allocates the match finder's hash table.
+*/
+Compressor::Compressor()
+{
+    this->table.resize(1 << kHashLog);
+}
+
+/**
+ * @brief Compresses a block.
+ *
+ * @param src Data to compress
+ * @param srcLen Length of data to compress; at most `kMaxBlockSize`
+ * @param dst Buffer to receive compressed data
+ * @param dstCap Size of the output buffer
+ * @return Length of the compressed data, or 0 if it wouldn't be smaller than the input (or does
+ * not fit into the output buffer); the data should be sent uncompressed in that case.
+*/
+size_t Compressor::compress(const void* _src, size_t srcLen, void* _dst, size_t dstCap)
+{
+    auto src = reinterpret_cast<const uint8_t*>(_src);
+    auto dst = reinterpret_cast<uint8_t*>(_dst);
+
+    if (srcLen > kMaxBlockSize) {
+        throw std::invalid_argument("block too large to compress");
+    }
+    // too short for even a single match
+    if (srcLen <= kMatchLimit) {
+        return 0;
+    }
+
+    std::fill(this->table.begin(), this->table.end(), kEmpty);
+
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* const end = src + srcLen;
+    const uint8_t* const matchLimit = end - kMatchLimit;
+    const uint8_t* const matchEnd = end - kLastLiterals;
+
+    uint8_t* op = dst;
+    const uint8_t* const oend = dst + dstCap;
+
+    while (ip < matchLimit) {
+        const uint32_t sequence = Read32(ip);
+        const uint32_t h = Hash(sequence);
+        const uint32_t pos = (uint32_t) (ip - src);
+        const uint32_t ref = this->table[h];
+
+        this->table[h] = pos;
+
+        if (ref == kEmpty || (pos - ref) > kMaxOffset || Read32(src + ref) != sequence) {
+            ip++;
+            continue;
+        }
+
+        // extend the match as far as it goes
+        const uint8_t* match = src + ref + kMinMatch;
+        const uint8_t* p = ip + kMinMatch;
+
+        while (p < matchEnd && *p == *match) {
+            p++;
+            match++;
+        }
+
+        if (!EmitSequence(op, oend, anchor, (size_t) (ip - anchor), pos - ref, (size_t) (p - ip))) {
+            return 0;
+        }
+
+        ip = p;
+        anchor = ip;
+    }
+
+    // whatever's left over is literals
+    if (!EmitSequence(op, oend, anchor, (size_t) (end - anchor), 0, 0)) {
+        return 0;
+    }
+
+    const size_t outLen = (size_t) (op - dst);
+    return (outLen < srcLen) ? outLen : 0;
+}
+
+/**
+ * @brief Decompresses a block.
+ *
+ * The input is untrusted; all lengths and offsets are checked against the buffers, and malformed
+ * input results in an exception.
+ *
+ * @param src Compressed data
+ * @param srcLen Length of compressed data
+ * @param dst Buffer to receive the decompressed data
+ * @param dstCap Size of the output buffer
+ * @return Number of bytes decompressed
+*/
+size_t Compressor::decompress(const void* _src, size_t srcLen, void* _dst, size_t dstCap)
+{
+    auto src = reinterpret_cast<const uint8_t*>(_src);
+    auto dst = reinterpret_cast<uint8_t*>(_dst);
+
+    const uint8_t* ip = src;
+    const uint8_t* const iend = src + srcLen;
+    uint8_t* op = dst;
+    const uint8_t* const oend = dst + dstCap;
+
+    while (true) {
+        if (ip >= iend) {
+            throw std::runtime_error("truncated compressed block");
+        }
+        const uint8_t token = *ip++;
+
+        // literals
+        size_t litLen = (token >> 4);
+        if (litLen == 15) {
+            litLen += ReadLength(ip, iend);
+        }
+
+        if ((size_t) (iend - ip) < litLen || (size_t) (oend - op) < litLen) {
+            throw std::runtime_error("literals exceed block bounds");
+        }
+
+        memcpy(op, ip, litLen);
+        op += litLen;
+        ip += litLen;
+
+        // the last sequence has no match
+        if (ip == iend) {
+            break;
+        }
+
+        // match
+        if ((iend - ip) < 2) {
+            throw std::runtime_error("truncated compressed block");
+        }
+        const size_t offset = ip[0] | (((size_t) ip[1]) << 8);
+        ip += 2;
+
+        if (!offset || offset > (size_t) (op - dst)) {
+            throw std::runtime_error("invalid match offset");
+        }
+
+        size_t matchLen = (token & 0x0F);
+        if (matchLen == 15) {
+            matchLen += ReadLength(ip, iend);
+        }
+        matchLen += kMinMatch;
+
+        if ((size_t) (oend - op) < matchLen) {
+            throw std::runtime_error("match exceeds block bounds");
+        }
+
+        // the match may overlap the bytes it produces, so copy bytewise
+        const uint8_t* match = op - offset;
+        for (size_t i = 0; i < matchLen; i++) {
+            op[i] = match[i];
+        }
+        op += matchLen;
+    }
+
+    return (size_t) (op - dst);
+}
+
+/**
+ * @brief Delta filter: replaces each 32-bit (little endian) word with its difference to the
+ * previous one. Trailing bytes that don't make up a full word are copied as-is.
+*/
+void Compressor::deltaEncode32(const void* _src, void* _dst, size_t len)
+{
+    auto src = reinterpret_cast<const uint8_t*>(_src);
+    auto dst = reinterpret_cast<uint8_t*>(_dst);
+
+    uint32_t prev = 0;
+    size_t i = 0;
+
+    for (; (i + 4) <= len; i += 4) {
+        const uint32_t value = Read32(src + i);
+        const uint32_t delta = value - prev;
+
+        memcpy(dst + i, &delta, sizeof(delta));
+        prev = value;
+    }
+
+    memcpy(dst + i, src + i, len - i);
+}
+
+/**
+ * @brief Undoes the delta filter in place.
+*/
+void Compressor::deltaDecode32(void* _buf, size_t len)
+{
+    auto buf = reinterpret_cast<uint8_t*>(_buf);
+    uint32_t prev = 0;
+
+    for (size_t i = 0; (i + 4) <= len; i += 4) {
+        const uint32_t value = Read32(buf + i) + prev;
+
+        memcpy(buf + i, &value, sizeof(value));
+        prev = value;
+    }
+}
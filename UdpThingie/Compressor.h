@@ -0,0 +1,45 @@
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Fast LZ77 block compressor, producing the LZ4 block format.
+ *
+ * This trades ratio for speed: matches are found through a single-entry hash table of 4-byte
+ * sequences, with no chaining or lazy matching. That's plenty for the kind of repetitive data
+ * (logs, counters) we push through the socket, and keeps up with the link.
+ *
+ * Each block is self-contained; there's no dictionary carried over between blocks.
+ *
+ * Arrays of slowly changing integers (counters, timestamps) have no repeated byte sequences for
+ * the match finder to pick up, so a delta filter is provided to turn those into runs first.
+*/
+class Compressor {
+public:
+    /// Largest block that may be compressed
+    constexpr static const size_t kMaxBlockSize = (1024 * 1024 * 4);
+
+public:
+    Compressor();
+
+    size_t compress(const void* src, size_t srcLen, void* dst, size_t dstCap);
+    static size_t decompress(const void* src, size_t srcLen, void* dst, size_t dstCap);
+
+    static void deltaEncode32(const void* src, void* dst, size_t len);
+    static void deltaDecode32(void* buf, size_t len);
+
+    /// Worst case size of the compressed form of `len` bytes
+    static size_t compressBound(size_t len)
+    {
+        return len + (len / 255) + 16;
+    }
+
+private:
+    /// position (in the current block) of the last occurrence of each hashed sequence
+    std::vector<uint32_t> table;
+};
+
+#endif
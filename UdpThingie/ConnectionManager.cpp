@@ -0,0 +1,844 @@
+#include "pch.h"
+#include "ConnectionManager.h"
+#include "PacketTypes.h"
+
+#include <cassert>
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+using namespace __fucker;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Trampoline to jump into the manager's worker main loop
+ * @param ctx Worker the thread services
+*/
+DWORD WINAPI __fucker::ManagerWorkerEntry(LPVOID ctx)
+{
+    auto w = static_cast<ConnectionManager::Worker*>(ctx);
+    w->mgr->workerMain(w);
+    return 0;
+}
+
+/**
+ * @brief Sets up the flow table, the shared sockets and the worker threads.
+ *
+ * @param maxFlows Maximum number of simultaneously open flows
+ * @param numWorkers Number of worker threads
+ * @param lanesPerWorker Number of UDP sockets each worker services; this is also the maximum
+ * number of simultaneous flows to any single receiver.
+*/
+ConnectionManager::ConnectionManager(size_t maxFlows, size_t numWorkers, size_t lanesPerWorker) noexcept(false)
+{
+    int err;
+
+    if (!numWorkers || !lanesPerWorker || lanesPerWorker > kMaxLanesPerWorker) {
+        throw std::invalid_argument("invalid worker/lane count");
+    }
+
+    // flow table
+    this->maxFlows = maxFlows;
+    this->flows = std::make_unique<Flow[]>(maxFlows);
+
+    InitializeCriticalSection(&this->freeLock);
+    this->freeFlows.reserve(maxFlows);
+    for (size_t i = maxFlows; i > 0; i--) {
+        this->freeFlows.push_back((FlowId) (i - 1));
+    }
+
+    this->quitEvent = CreateEvent(nullptr, true, false, nullptr);
+    if (this->quitEvent == (HANDLE)ERROR_INVALID_HANDLE) {
+        std::string msg = "CreateEvent(): " + GetLastError();
+        throw std::runtime_error(msg);
+    }
+
+    // create the lanes: unconnected sockets bound to any local port
+    this->lanes.resize(numWorkers * lanesPerWorker);
+
+    for (auto& lane : this->lanes) {
+        lane.sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (lane.sock == INVALID_SOCKET) {
+            throw SenderSocket::SocketError(SenderSocket::SocketError::kStatusSystemError, WSAGetLastError());
+        }
+
+        struct sockaddr_in local = { 0 };
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = INADDR_ANY;
+        local.sin_port = htons(0);
+
+        err = bind(lane.sock, (struct sockaddr*)&local, sizeof(local));
+        if (err == -1) {
+            throw SenderSocket::SocketError(SenderSocket::SocketError::kStatusSystemError, WSAGetLastError());
+        }
+
+        // these sockets are shared by many flows, so give them big buffers
+        const int kBufSz = (32 * 1000 * 1000);
+
+        if (setsockopt(lane.sock, SOL_SOCKET, SO_RCVBUF, (const char*)&kBufSz, sizeof(int)) == SOCKET_ERROR) {
+            std::cerr << "SO_RCVBUF set failed: " << WSAGetLastError() << std::endl;
+        }
+        if (setsockopt(lane.sock, SOL_SOCKET, SO_SNDBUF, (const char*)&kBufSz, sizeof(int)) == SOCKET_ERROR) {
+            std::cerr << "SO_SNDBUF set failed: " << WSAGetLastError() << std::endl;
+        }
+
+        // readability is signalled through an event (this also makes the socket non-blocking)
+        lane.event = CreateEvent(nullptr, false, false, nullptr);
+        assert(lane.event != INVALID_HANDLE_VALUE);
+
+        err = WSAEventSelect(lane.sock, lane.event, FD_READ);
+        if (err == SOCKET_ERROR) {
+            throw SenderSocket::SocketError(SenderSocket::SocketError::kStatusSystemError, WSAGetLastError());
+        }
+    }
+
+    // create workers; lane i belongs to worker (i % numWorkers)
+    for (size_t i = 0; i < numWorkers; i++) {
+        auto w = std::make_unique<Worker>();
+        w->mgr = this;
+        w->index = i;
+
+        InitializeCriticalSection(&w->pendingLock);
+        w->wakeEvent = CreateEvent(nullptr, false, false, nullptr);
+        assert(w->wakeEvent != INVALID_HANDLE_VALUE);
+
+        for (size_t lane = i; lane < this->lanes.size(); lane += numWorkers) {
+            w->lanes.push_back(lane);
+        }
+
+        this->workers.push_back(std::move(w));
+    }
+
+    for (auto& w : this->workers) {
+        w->thread = CreateThread(nullptr, kWorkerStackSize, ManagerWorkerEntry, w.get(), 0, nullptr);
+        assert(w->thread != INVALID_HANDLE_VALUE);
+    }
+}
+
+/**
+ * @brief Stops the worker threads and releases all sockets. Any flows still open are dropped
+ * without notice to the receiver.
+*/
+ConnectionManager::~ConnectionManager() noexcept(false)
+{
+    if (!SetEvent(this->quitEvent)) {
+        std::string msg = "SetEvent(): " + GetLastError();
+        throw std::runtime_error(msg);
+    }
+
+    for (auto& w : this->workers) {
+        if (WaitForSingleObject(w->thread, 500) != WAIT_OBJECT_0) {
+            std::cerr << "Manager worker failed to exit gracefully; killing it" << std::endl;
+            TerminateThread(w->thread, 0);
+        }
+        CloseHandle(w->thread);
+        CloseHandle(w->wakeEvent);
+        DeleteCriticalSection(&w->pendingLock);
+    }
+
+    for (auto& lane : this->lanes) {
+        if (lane.sock != INVALID_SOCKET) {
+            closesocket(lane.sock);
+        }
+        CloseHandle(lane.event);
+    }
+
+    CloseHandle(this->quitEvent);
+    DeleteCriticalSection(&this->freeLock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Opens a new flow to the given receiver.
+ *
+ * Resolution and flow allocation happen synchronously; the handshake is performed by the flow's
+ * worker, which invokes the open callback when it completes.
+ *
+ * @return Identifier of the new flow
+*/
+ConnectionManager::FlowId ConnectionManager::open(const std::string& host, uint16_t port, size_t window, float rtt, float speed, float loss[2])
+{
+    using SocketError = SenderSocket::SocketError;
+    FlowId id = kInvalidFlow;
+
+    // resolve the address
+    struct sockaddr_storage storage;
+    memset(&storage, 0, sizeof(struct sockaddr_storage));
+
+    SenderSocket::resolve(host, &storage);
+
+    struct sockaddr_in* addr = (struct sockaddr_in*) &storage;
+    addr->sin_port = htons(port);
+
+    const uint64_t key = peerKey(*addr);
+
+    // grab a flow
+    EnterCriticalSection(&this->freeLock);
+    if (!this->freeFlows.empty()) {
+        id = this->freeFlows.back();
+        this->freeFlows.pop_back();
+    }
+    LeaveCriticalSection(&this->freeLock);
+
+    if (id == kInvalidFlow) {
+        throw SocketError(SocketError::kStatusSystemError, "no free flows");
+    }
+
+    // find a lane that doesn't already have a flow to this peer
+    size_t laneIdx = this->lanes.size();
+
+    for (size_t i = 0; i < this->lanes.size(); i++) {
+        size_t candidate = (id + i) % this->lanes.size();
+        auto& lane = this->lanes[candidate];
+
+        AcquireSRWLockExclusive(&lane.peersLock);
+        if (lane.peers.find(key) == lane.peers.end()) {
+            lane.peers[key] = id;
+            laneIdx = candidate;
+        }
+        ReleaseSRWLockExclusive(&lane.peersLock);
+
+        if (laneIdx != this->lanes.size()) {
+            break;
+        }
+    }
+
+    if (laneIdx == this->lanes.size()) {
+        EnterCriticalSection(&this->freeLock);
+        this->freeFlows.push_back(id);
+        LeaveCriticalSection(&this->freeLock);
+
+        throw SocketError(SocketError::kStatusConnected, "all lanes have a flow to " + host);
+    }
+
+    // set up the flow's state
+    auto& flow = this->flows[id];
+
+    flow.peer = *addr;
+    flow.lane = (uint16_t) laneIdx;
+    flow.window = (uint32_t) window;
+    flow.slots = std::make_unique<Slot[]>(window + 1);
+
+    flow.currentSeq = 0;
+    flow.senderBase = 0;
+    flow.nextToSend = 0;
+    flow.effectiveWindow = 0;
+    flow.lastAckSeq = 0;
+    flow.lastAckCount = 0;
+    flow.closing = false;
+    flow.armedDeadline = std::chrono::steady_clock::time_point::max();
+
+    flow.rto = (float) max(SenderSocket::kRetransmissionTimeout, (2.0 * ((double) rtt)));
+    flow.estimatedRtt = -1.f;
+    flow.devRtt = -1.f;
+
+    // build SYN packet
+    auto& control = flow.control();
+    auto syn = reinterpret_cast<SenderSynPacket*>(control.payload);
+    memset(syn, 0, sizeof(SenderSynPacket));
+
+    syn->header.flags.magic = kFlagsMagic;
+    syn->header.flags.syn = 1;
+
+    syn->lp.bufferSize = (DWORD) (window + SenderSocket::kMaxRetransmissions); // W+R
+    syn->lp.RTT = rtt;
+    syn->lp.speed = speed;
+    syn->lp.pLoss[0] = loss[0];
+    syn->lp.pLoss[1] = loss[1];
+
+    control.size = sizeof(SenderSynPacket);
+    control.numTx = 0;
+
+    // the worker sends the SYN once it picks up the flow
+    flow.state = kFlowSynSent;
+    this->stats.activeFlows++;
+
+    this->postFlow(id);
+    return id;
+}
+
+/**
+ * @brief Queues a packet on the given flow, if there is space in its window.
+ *
+ * @return Whether the data was queued; false if the window is full.
+*/
+bool ConnectionManager::send(FlowId id, const void* data, size_t length)
+{
+    using SocketError = SenderSocket::SocketError;
+
+    if (id >= this->maxFlows) {
+        throw std::invalid_argument("invalid flow id");
+    }
+    if (length > (SenderSocket::kMaxPacketSize - sizeof(SenderPacketHeader))) {
+        throw std::invalid_argument("payload too large");
+    }
+
+    auto& flow = this->flows[id];
+    bool queued = false;
+
+    AcquireSRWLockShared(&flow.lock);
+
+    if (flow.state != kFlowEstablished) {
+        ReleaseSRWLockShared(&flow.lock);
+        throw SocketError(SocketError::kStatusNotConnected);
+    } else if (flow.closing) {
+        ReleaseSRWLockShared(&flow.lock);
+        throw SocketError(SocketError::kStatusNotConnected, "flow is closing");
+    }
+
+    // build the packet in place, if there's space in the window
+    const uint32_t seq = flow.currentSeq;
+
+    if ((seq - flow.senderBase) < flow.effectiveWindow) {
+        auto& slot = flow.slots[seq % flow.window];
+        auto packet = reinterpret_cast<SenderDataPacket*>(slot.payload);
+
+        memset(packet, 0, sizeof(SenderPacketHeader));
+        packet->header.flags.magic = kFlagsMagic;
+        packet->header.seq = seq;
+        memcpy(packet->data, data, length);
+
+        slot.size = (uint16_t) (sizeof(SenderPacketHeader) + length);
+        slot.numTx = 0;
+
+        // publish it, then wake the worker
+        flow.currentSeq = seq + 1;
+        this->postFlow(id);
+
+        queued = true;
+    }
+
+    ReleaseSRWLockShared(&flow.lock);
+    return queued;
+}
+
+/**
+ * @brief Requests the flow to be closed. The FIN is sent once all queued data is acknowledged;
+ * the close callback is invoked afterwards, and the flow identifier becomes invalid.
+*/
+void ConnectionManager::close(FlowId id)
+{
+    using SocketError = SenderSocket::SocketError;
+
+    if (id >= this->maxFlows) {
+        throw std::invalid_argument("invalid flow id");
+    }
+
+    auto& flow = this->flows[id];
+
+    AcquireSRWLockShared(&flow.lock);
+
+    if (flow.state != kFlowEstablished) {
+        ReleaseSRWLockShared(&flow.lock);
+        throw SocketError(SocketError::kStatusNotConnected);
+    } else if (flow.closing.exchange(true)) {
+        ReleaseSRWLockShared(&flow.lock);
+        throw SocketError(SocketError::kStatusNotConnected, "already closing");
+    }
+
+    this->postFlow(id);
+    ReleaseSRWLockShared(&flow.lock);
+}
+
+/**
+ * @brief Puts the flow on its worker's pending list (if it isn't already) and wakes the worker.
+*/
+void ConnectionManager::postFlow(FlowId id)
+{
+    auto& flow = this->flows[id];
+
+    if (flow.pending.exchange(true)) {
+        return;
+    }
+
+    auto w = this->workerForLane(flow.lane);
+
+    EnterCriticalSection(&w->pendingLock);
+    w->pending.push_back(id);
+    LeaveCriticalSection(&w->pendingLock);
+
+    SetEvent(w->wakeEvent);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Main loop of a worker: services pending flows, reads ACKs from its lanes and fires
+ * retransmission timers.
+*/
+void ConnectionManager::workerMain(Worker* w)
+{
+    std::vector<HANDLE> handles;
+    handles.push_back(this->quitEvent);
+    handles.push_back(w->wakeEvent);
+
+    for (auto lane : w->lanes) {
+        handles.push_back(this->lanes[lane].event);
+    }
+
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+
+    while (true) {
+        DWORD timeout = this->workerNextTimeout(w);
+        DWORD ret = WaitForMultipleObjects((DWORD) handles.size(), handles.data(), false, timeout);
+
+        if (ret == WAIT_OBJECT_0) {
+            break;
+        } else if (ret == (WAIT_OBJECT_0 + 1)) {
+            this->workerDrainPending(w);
+        } else if (ret >= (WAIT_OBJECT_0 + 2) && ret < (WAIT_OBJECT_0 + handles.size())) {
+            // service all lanes so one busy socket can't starve the others
+            for (auto lane : w->lanes) {
+                this->workerReadLane(w, lane);
+            }
+        } else if (ret != WAIT_TIMEOUT) {
+            std::cerr << "Manager worker wait failed: " << GetLastError() << std::endl;
+            break;
+        }
+
+        this->workerExpireTimers(w);
+    }
+}
+
+/**
+ * @brief Services all flows on the worker's pending list.
+*/
+void ConnectionManager::workerDrainPending(Worker* w)
+{
+    std::vector<FlowId> pending;
+
+    EnterCriticalSection(&w->pendingLock);
+    pending.swap(w->pending);
+    LeaveCriticalSection(&w->pendingLock);
+
+    for (auto id : pending) {
+        auto& flow = this->flows[id];
+        flow.pending = false;
+
+        // finished while it was on the list; its id can be handed out again now
+        if (flow.state == kFlowFree) {
+            this->flowRelease(id);
+            continue;
+        }
+
+        try {
+            this->flowService(w, id);
+        } catch (SenderSocket::SocketError& e) {
+            this->flowFinish(id, &e);
+        }
+    }
+}
+
+/**
+ * @brief Reads all pending datagrams from a lane and hands each to the flow it belongs to.
+*/
+void ConnectionManager::workerReadLane(Worker* w, size_t laneIdx)
+{
+    auto& lane = this->lanes[laneIdx];
+
+    char receive[SenderSocket::kMaxPacketSize];
+    auto rxHdr = reinterpret_cast<ReceiverPacketHeader*>(receive);
+
+    while (true) {
+        struct sockaddr_in from;
+        socklen_t fromLen = sizeof(from);
+
+        int err = recvfrom(lane.sock, receive, sizeof(receive), 0, (struct sockaddr*)&from, &fromLen);
+        if (err == SOCKET_ERROR) {
+            // ICMP unreachable from some previous send; not fatal for the other flows
+            if (WSAGetLastError() == WSAECONNRESET) {
+                continue;
+            }
+            break;
+        }
+        if (err < sizeof(ReceiverPacketHeader)) {
+            continue;
+        }
+
+        // find the flow
+        FlowId id = kInvalidFlow;
+
+        AcquireSRWLockShared(&lane.peersLock);
+        auto it = lane.peers.find(peerKey(from));
+        if (it != lane.peers.end()) {
+            id = it->second;
+        }
+        ReleaseSRWLockShared(&lane.peersLock);
+
+        if (id == kInvalidFlow) {
+            continue;
+        }
+
+        try {
+            this->flowHandleAck(w, id, rxHdr);
+        } catch (SenderSocket::SocketError& e) {
+            this->flowFinish(id, &e);
+        }
+    }
+}
+
+/**
+ * @brief Fires all retransmission timers that have expired.
+ *
+ * Flows keep at most one live heap entry: when a flow's deadline moves later, its entry is only
+ * re-queued once it reaches the top of the heap.
+*/
+void ConnectionManager::workerExpireTimers(Worker* w)
+{
+    auto now = std::chrono::steady_clock::now();
+
+    while (!w->timers.empty() && w->timers.top().first <= now) {
+        auto entry = w->timers.top();
+        w->timers.pop();
+
+        auto& flow = this->flows[entry.second];
+
+        // entry was superseded, or the flow went away
+        if (flow.state == kFlowFree || entry.first != flow.armedDeadline) {
+            continue;
+        }
+        flow.armedDeadline = std::chrono::steady_clock::time_point::max();
+
+        try {
+            if (flow.deadline <= now) {
+                this->flowTimeout(w, entry.second);
+            } else {
+                this->flowArmTimer(w, entry.second);
+            }
+        } catch (SenderSocket::SocketError& e) {
+            this->flowFinish(entry.second, &e);
+        }
+    }
+}
+
+/**
+ * @brief Determines how long the worker may sleep before the next timer fires.
+*/
+DWORD ConnectionManager::workerNextTimeout(Worker* w)
+{
+    if (w->timers.empty()) {
+        return INFINITE;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(w->timers.top().first - now).count();
+
+    return (ms > 0) ? (DWORD) ms : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Handles a flow that was posted to its worker: starts the handshake, transmits newly
+ * queued data, or starts closing.
+*/
+void ConnectionManager::flowService(Worker* w, FlowId id)
+{
+    auto& flow = this->flows[id];
+
+    switch (flow.state) {
+    case kFlowSynSent:
+        if (!flow.control().numTx) {
+            this->flowTxControl(flow);
+            this->flowArmTimer(w, id);
+        }
+        break;
+
+    case kFlowEstablished:
+        this->flowTransmit(w, id);
+
+        if (flow.closing && flow.senderBase == flow.currentSeq) {
+            this->flowBeginClose(w, id);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Transmits all queued packets that fit in the flow's window.
+*/
+void ConnectionManager::flowTransmit(Worker* w, FlowId id)
+{
+    auto& flow = this->flows[id];
+    const uint32_t queued = flow.currentSeq;
+
+    while (flow.nextToSend != queued && (flow.nextToSend - flow.senderBase) < flow.effectiveWindow) {
+        this->flowTxSlot(flow, flow.slots[flow.nextToSend % flow.window]);
+        flow.nextToSend++;
+    }
+
+    this->flowArmTimer(w, id);
+}
+
+/**
+ * @brief Sends a single slot of the flow out on its lane.
+*/
+void ConnectionManager::flowTxSlot(Flow& flow, Slot& slot, bool countAttempt)
+{
+    using SocketError = SenderSocket::SocketError;
+
+    int err = sendto(this->lanes[flow.lane].sock, slot.payload, slot.size, 0,
+        (struct sockaddr*)&flow.peer, sizeof(struct sockaddr_in));
+
+    // a full socket buffer is treated like a loss; the RTO recovers from it
+    if (err == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
+        throw SocketError(SocketError::kStatusSendFailed, WSAGetLastError());
+    }
+
+    if (countAttempt) {
+        slot.numTx++;
+    }
+    slot.txTime = std::chrono::steady_clock::now();
+
+    this->stats.totalBytesSent += slot.size;
+
+    if (slot.numTx > SenderSocket::kMaxRetransmissions) {
+        throw SocketError(SocketError::kStatusTimeout);
+    }
+}
+
+/**
+ * @brief (Re)transmits the flow's SYN or FIN.
+*/
+void ConnectionManager::flowTxControl(Flow& flow)
+{
+    using SocketError = SenderSocket::SocketError;
+
+    auto& control = flow.control();
+    const size_t attempts = (flow.state == kFlowSynSent) ? SenderSocket::kMaxRetransmissionsSYN : SenderSocket::kMaxRetransmissions;
+
+    if (control.numTx >= attempts) {
+        throw SocketError(SocketError::kStatusTimeout);
+    }
+
+    auto hdr = reinterpret_cast<SenderPacketHeader*>(control.payload);
+    hdr->seq = flow.currentSeq;
+
+    this->flowTxSlot(flow, control);
+    flow.deadline = control.txTime + std::chrono::microseconds((size_t) (flow.rto * 1000.0 * 1000.0));
+}
+
+/**
+ * @brief Builds the FIN for a flow whose data has all been acknowledged, and sends it.
+*/
+void ConnectionManager::flowBeginClose(Worker* w, FlowId id)
+{
+    auto& flow = this->flows[id];
+    auto& control = flow.control();
+
+    auto fin = reinterpret_cast<SenderPacketHeader*>(control.payload);
+    memset(fin, 0, sizeof(SenderPacketHeader));
+
+    fin->flags.magic = kFlagsMagic;
+    fin->flags.fin = 1;
+
+    control.size = sizeof(SenderPacketHeader);
+    control.numTx = 0;
+
+    flow.state = kFlowFinSent;
+    this->flowTxControl(flow);
+    this->flowArmTimer(w, id);
+}
+
+/**
+ * @brief Processes an ACK received for the given flow.
+ *
+ * This mirrors `SenderSocket::workerReadAck()`: handshake completion, fast retransmit after three
+ * duplicate ACKs, and RTT estimation from packets that were not retransmitted.
+*/
+void ConnectionManager::flowHandleAck(Worker* w, FlowId id, const ReceiverPacketHeader* rxHdr)
+{
+    using namespace std::chrono;
+
+    auto& flow = this->flows[id];
+    auto receivedAt = steady_clock::now();
+
+    // handshake responses
+    if (flow.state == kFlowSynSent && rxHdr->flags.syn) {
+        auto& control = flow.control();
+        double rtt = duration_cast<microseconds>(receivedAt - control.txTime).count() / 1e6;
+
+        flow.rto = (float) (rtt * 3.0);
+        flow.effectiveWindow = min(flow.window, rxHdr->receiveWindow);
+        flow.state = kFlowEstablished;
+
+        if (this->openCallback) {
+            this->openCallback(this, id, nullptr);
+        }
+
+        this->flowService(w, id);
+        return;
+    } else if (flow.state == kFlowFinSent && rxHdr->flags.fin) {
+        this->flowFinish(id, nullptr);
+        return;
+    } else if (flow.state != kFlowEstablished || !rxHdr->flags.ack) {
+        return;
+    }
+
+    const uint32_t ackSeq = rxHdr->ackSeq;
+
+    // duplicate acks; the receiver is still waiting for the packet at the sender base
+    if (flow.lastAckSeq != ackSeq) {
+        flow.lastAckSeq = ackSeq;
+        flow.lastAckCount = 1;
+    } else if (++flow.lastAckCount == 3 && ackSeq == flow.senderBase && ackSeq != flow.nextToSend) {
+        this->stats.fastReTx++;
+
+        this->flowTxSlot(flow, flow.slots[ackSeq % flow.window], true);
+        this->flowArmTimer(w, id);
+    }
+
+    // advance the sender base
+    if (ackSeq <= flow.senderBase || ackSeq > flow.nextToSend) {
+        return;
+    }
+
+    auto& packet = flow.slots[(ackSeq - 1) % flow.window];
+    auto& basePacket = flow.slots[flow.senderBase % flow.window];
+    const bool sampleValid = (packet.numTx == 1 && basePacket.numTx == 1);
+
+    flow.senderBase = ackSeq;
+    flow.effectiveWindow = min(flow.window, rxHdr->receiveWindow);
+
+    // update RTT estimates from packets that were only sent once
+    if (sampleValid) {
+        float sampleRtt = (float) max(duration_cast<microseconds>(receivedAt - packet.txTime).count() / 1e6, 0.01);
+
+        if (flow.estimatedRtt < 0) {
+            flow.estimatedRtt = sampleRtt;
+            flow.devRtt = sampleRtt / 2.f;
+        } else {
+            flow.estimatedRtt = (float) (((1.f - SenderSocket::kRttAlpha) * flow.estimatedRtt) + (SenderSocket::kRttAlpha * sampleRtt));
+            flow.devRtt = (float) (((1.f - SenderSocket::kRttBeta) * flow.devRtt) + (SenderSocket::kRttBeta * fabs(sampleRtt - flow.estimatedRtt)));
+        }
+
+        flow.rto = (float) min(flow.estimatedRtt + (4 * max(flow.devRtt, 0.010f)), 2.f);
+    }
+
+    // send whatever else fits now, and let the app refill the window
+    this->flowTransmit(w, id);
+
+    if (this->ackCallback) {
+        this->ackCallback(this, id, ackSeq);
+    }
+
+    if (flow.closing && flow.senderBase == flow.currentSeq) {
+        this->flowBeginClose(w, id);
+    }
+}
+
+/**
+ * @brief Handles expiry of the flow's retransmission timer.
+*/
+void ConnectionManager::flowTimeout(Worker* w, FlowId id)
+{
+    auto& flow = this->flows[id];
+
+    switch (flow.state) {
+    case kFlowSynSent:
+    case kFlowFinSent:
+        this->flowTxControl(flow);
+        break;
+
+    case kFlowEstablished:
+        if (flow.senderBase == flow.nextToSend) {
+            return;
+        }
+
+        this->stats.timeout++;
+        this->flowTxSlot(flow, flow.slots[flow.senderBase % flow.window]);
+        break;
+
+    default:
+        return;
+    }
+
+    this->flowArmTimer(w, id);
+}
+
+/**
+ * @brief Recomputes the flow's retransmission deadline, and makes sure the worker's timer heap
+ * will wake up for it.
+*/
+void ConnectionManager::flowArmTimer(Worker* w, FlowId id)
+{
+    auto& flow = this->flows[id];
+    const auto rto = std::chrono::microseconds((size_t) (flow.rto * 1000.0 * 1000.0));
+
+    if (flow.state == kFlowSynSent || flow.state == kFlowFinSent) {
+        flow.deadline = flow.control().txTime + rto;
+    } else if (flow.senderBase != flow.nextToSend) {
+        flow.deadline = flow.slots[flow.senderBase % flow.window].txTime + rto;
+    } else {
+        // nothing outstanding
+        return;
+    }
+
+    // only push a new entry if the existing one would fire too late
+    if (flow.deadline < flow.armedDeadline) {
+        flow.armedDeadline = flow.deadline;
+        w->timers.emplace(flow.deadline, id);
+    }
+}
+
+/**
+ * @brief Tears down a flow after it was closed or failed, invokes the close (or open, if the
+ * handshake never completed) callback, and returns it to the free list once it's no longer on its
+ * worker's pending list.
+*/
+void ConnectionManager::flowFinish(FlowId id, const SenderSocket::SocketError* error)
+{
+    auto& flow = this->flows[id];
+
+    if (flow.state == kFlowFree) {
+        return;
+    }
+
+    const bool wasOpening = (flow.state == kFlowSynSent);
+
+    // stop demuxing to it
+    auto& lane = this->lanes[flow.lane];
+
+    AcquireSRWLockExclusive(&lane.peersLock);
+    lane.peers.erase(peerKey(flow.peer));
+    ReleaseSRWLockExclusive(&lane.peersLock);
+
+    // wait for the app thread to be done with it; it can't post the flow after this
+    AcquireSRWLockExclusive(&flow.lock);
+    flow.state = kFlowFree;
+    ReleaseSRWLockExclusive(&flow.lock);
+
+    flow.armedDeadline = std::chrono::steady_clock::time_point::max();
+
+    // notify
+    if (wasOpening) {
+        if (this->openCallback) {
+            this->openCallback(this, id, error);
+        }
+    } else if (this->closeCallback) {
+        this->closeCallback(this, id, error);
+    }
+
+    // if it's still on the pending list (from a post before it finished), the id would be reused
+    // (maybe on another lane) while the old entry is outstanding; so it's released once the entry
+    // is drained instead
+    if (!flow.pending) {
+        this->flowRelease(id);
+    }
+}
+
+/**
+ * @brief Returns a finished flow to the free list. It must not be on its worker's pending list.
+*/
+void ConnectionManager::flowRelease(FlowId id)
+{
+    auto& flow = this->flows[id];
+
+    flow.slots.reset();
+    this->stats.activeFlows--;
+
+    EnterCriticalSection(&this->freeLock);
+    this->freeFlows.push_back(id);
+    LeaveCriticalSection(&this->freeLock);
+}
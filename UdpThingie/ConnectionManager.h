@@ -0,0 +1,269 @@
+#ifndef CONNECTIONMANAGER_H
+#define CONNECTIONMANAGER_H
+
+#include "SenderSocket.h"
+
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <chrono>
+#include <atomic>
+
+class ConnectionManager;
+
+namespace __fucker {
+    DWORD WINAPI ManagerWorkerEntry(LPVOID);
+}
+
+/**
+ * @brief Drives many sender flows over a few shared UDP sockets and a small pool of worker threads.
+ *
+ * Unlike `SenderSocket`, which has its own socket and two threads per connection, flows here are
+ * compact structs. Each worker owns a handful of sockets ("lanes") and every flow is pinned to one
+ * lane, so all of a flow's state is only ever touched by one worker. ACKs are demultiplexed by the
+ * lane they arrive on plus the peer address; two flows to the same receiver are placed on
+ * different lanes since the protocol has no connection identifier.
+ *
+ * All operations are non-blocking; progress is reported through callbacks, which are invoked on
+ * the worker threads.
+*/
+class ConnectionManager {
+    friend DWORD WINAPI __fucker::ManagerWorkerEntry(LPVOID);
+
+public:
+    /// Identifies a flow; only valid until its close (or failure) callback returns
+    using FlowId = uint32_t;
+    /// Invoked when a flow's handshake completes; error is `nullptr` on success
+    using CompletionCallback = std::function<void(ConnectionManager*, FlowId, const SenderSocket::SocketError*)>;
+    /// Invoked when a flow's sender base advances
+    using AckCallback = std::function<void(ConnectionManager*, FlowId, size_t)>;
+
+    /// Flow identifier that is never handed out
+    constexpr static const FlowId kInvalidFlow = 0xFFFFFFFF;
+
+public:
+    ConnectionManager(size_t maxFlows, size_t numWorkers = 2, size_t lanesPerWorker = 4);
+    virtual ~ConnectionManager() noexcept(false);
+
+    FlowId open(const std::string& host, uint16_t port, size_t window, float rtt, float speed, float loss[2]);
+    bool send(FlowId flow, const void* data, size_t length);
+    void close(FlowId flow);
+
+    /// Invoked when a flow is established (or failed to be)
+    void setOpenCallback(CompletionCallback callback)
+    {
+        this->openCallback = callback;
+    }
+    /// Invoked when a flow is closed (or failed); the flow is released afterwards
+    void setCloseCallback(CompletionCallback callback)
+    {
+        this->closeCallback = callback;
+    }
+    /// Invoked when a flow's packets are acknowledged; use this to refill its window
+    void setAckCallback(AckCallback callback)
+    {
+        this->ackCallback = callback;
+    }
+
+    /// Number of flows currently allocated
+    size_t getActiveFlows() const
+    {
+        return this->stats.activeFlows;
+    }
+    /// Total number of bytes sent (including headers and retransmissions)
+    size_t getBytesSent() const
+    {
+        return this->stats.totalBytesSent;
+    }
+
+private:
+    /// size of each worker thread's stack, in bytes
+    constexpr static const size_t kWorkerStackSize = (1024 * 256);
+    /// max number of lanes per worker (WaitForMultipleObjects limit, minus quit/wake events)
+    constexpr static const size_t kMaxLanesPerWorker = (MAXIMUM_WAIT_OBJECTS - 2);
+
+    /// State of a single flow
+    enum FlowState : uint8_t {
+        kFlowFree,
+        kFlowSynSent,
+        kFlowEstablished,
+        kFlowFinSent,
+    };
+
+    /**
+     * @brief Packet slot in a flow's send window
+    */
+    struct Slot {
+        /// timestamp of most recent transmission
+        std::chrono::steady_clock::time_point txTime;
+        /// number of times the packet has been transmitted
+        uint16_t numTx = 0;
+        /// size of the packet (including header)
+        uint16_t size = 0;
+        /// packet data
+        char payload[SenderSocket::kMaxPacketSize];
+    };
+
+    /**
+     * @brief Per-flow state; kept small since there may be thousands of these.
+     *
+     * Sequence numbers are written by exactly one side: `currentSeq` by the application thread
+     * calling `send()`, everything else by the flow's worker.
+     *
+     * `send()` and `close()` hold the flow's lock shared while they touch it; the worker takes it
+     * exclusively to tear the flow down. Once that's done, they see it isn't established anymore,
+     * so they can't write into its slots or post it after it's released.
+    */
+    struct Flow {
+        /// keeps the flow from being torn down while the app thread is using it
+        SRWLOCK lock = SRWLOCK_INIT;
+        /// peer address
+        struct sockaddr_in peer;
+        /// window slots (`window` entries), plus one trailing slot for the SYN/FIN
+        std::unique_ptr<Slot[]> slots;
+
+        /// when the retransmission timer expires
+        std::chrono::steady_clock::time_point deadline;
+        /// deadline of this flow's live timer heap entry; `time_point::max()` if none
+        std::chrono::steady_clock::time_point armedDeadline;
+
+        /// next sequence number to be assigned by `send()`
+        std::atomic<uint32_t> currentSeq = 0;
+        /// first unacknowledged sequence number
+        std::atomic<uint32_t> senderBase = 0;
+        /// next sequence number to transmit
+        uint32_t nextToSend = 0;
+        /// window size (in packets) we're allowed to use
+        std::atomic<uint32_t> effectiveWindow = 0;
+        /// configured window size
+        uint32_t window = 0;
+        /// last acknowledged sequence and how many times it was seen
+        uint32_t lastAckSeq = 0;
+        uint16_t lastAckCount = 0;
+
+        /// index of the lane this flow is on
+        uint16_t lane = 0;
+        /// connection state
+        std::atomic<FlowState> state = kFlowFree;
+        /// set once close was requested
+        std::atomic_bool closing = false;
+        /// set while the flow is on its worker's pending list
+        std::atomic_bool pending = false;
+
+        /// retransmission timeout, estimated RTT and deviation (seconds)
+        float rto = 1.f;
+        float estimatedRtt = -1.f;
+        float devRtt = -1.f;
+
+        /// returns the SYN/FIN slot
+        Slot& control()
+        {
+            return this->slots[this->window];
+        }
+    };
+
+    /**
+     * @brief A shared UDP socket, and the peers that have flows on it
+    */
+    struct Lane {
+        SOCKET sock = INVALID_SOCKET;
+        /// signalled when the socket is readable
+        HANDLE event = INVALID_HANDLE_VALUE;
+
+        /// protects the peer map
+        SRWLOCK peersLock = SRWLOCK_INIT;
+        /// flows on this lane, keyed by peer address/port
+        std::unordered_map<uint64_t, FlowId> peers;
+    };
+
+    /// Timer heap entry: (deadline, flow)
+    using TimerEntry = std::pair<std::chrono::steady_clock::time_point, FlowId>;
+
+    /**
+     * @brief Worker thread state
+    */
+    struct Worker {
+        ConnectionManager* mgr = nullptr;
+        size_t index = 0;
+        HANDLE thread = INVALID_HANDLE_VALUE;
+        /// signalled when flows were added to the pending list
+        HANDLE wakeEvent = INVALID_HANDLE_VALUE;
+
+        /// lanes (indices) serviced by this worker
+        std::vector<size_t> lanes;
+
+        /// protects the pending list
+        CRITICAL_SECTION pendingLock;
+        /// flows that have new data, or need their handshake started
+        std::vector<FlowId> pending;
+
+        /// retransmission timers, earliest first
+        std::priority_queue<TimerEntry, std::vector<TimerEntry>, std::greater<TimerEntry>> timers;
+    };
+
+private:
+    void workerMain(Worker* w);
+    void workerDrainPending(Worker* w);
+    void workerReadLane(Worker* w, size_t lane);
+    void workerExpireTimers(Worker* w);
+    DWORD workerNextTimeout(Worker* w);
+
+    void flowService(Worker* w, FlowId id);
+    void flowTransmit(Worker* w, FlowId id);
+    void flowTxSlot(Flow& flow, Slot& slot, bool countAttempt = true);
+    void flowTxControl(Flow& flow);
+    void flowBeginClose(Worker* w, FlowId id);
+    void flowHandleAck(Worker* w, FlowId id, const ReceiverPacketHeader* rxHdr);
+    void flowTimeout(Worker* w, FlowId id);
+    void flowArmTimer(Worker* w, FlowId id);
+    void flowFinish(FlowId id, const SenderSocket::SocketError* error);
+    void flowRelease(FlowId id);
+
+    void postFlow(FlowId id);
+    Worker* workerForLane(size_t lane)
+    {
+        return this->workers[lane % this->workers.size()].get();
+    }
+
+    static uint64_t peerKey(const struct sockaddr_in& addr)
+    {
+        return (((uint64_t) addr.sin_addr.s_addr) << 16) | addr.sin_port;
+    }
+
+private:
+    /// flow table; fixed size so it never moves while workers access it
+    std::unique_ptr<Flow[]> flows;
+    /// number of entries in the flow table
+    size_t maxFlows = 0;
+    /// protects the free list
+    CRITICAL_SECTION freeLock;
+    /// unused flow indices
+    std::vector<FlowId> freeFlows;
+
+    /// all lanes; lane `i` belongs to worker `i % workers.size()`
+    std::vector<Lane> lanes;
+    /// worker threads
+    std::vector<std::unique_ptr<Worker>> workers;
+    /// signalled when quit is desired
+    HANDLE quitEvent = INVALID_HANDLE_VALUE;
+
+    CompletionCallback openCallback;
+    CompletionCallback closeCallback;
+    AckCallback ackCallback;
+
+    /// aggregate counters
+    struct {
+        std::atomic_ulong activeFlows = 0;
+        std::atomic_ullong totalBytesSent = 0;
+        std::atomic_ulong timeout = 0;
+        std::atomic_ulong fastReTx = 0;
+    } stats;
+};
+
+#endif
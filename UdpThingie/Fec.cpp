@@ -0,0 +1,303 @@
+#include "pch.h"
+#include "Fec.h"
+
+#include <stdexcept>
+#include <cstring>
+
+#include <intrin.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+
+namespace {
+/**
+ * @brief Log/antilog tables for GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11D)
+*/
+struct GfTables {
+    uint8_t exp[512];
+    uint8_t log[256];
+
+    GfTables()
+    {
+        unsigned int x = 1;
+
+        for (size_t i = 0; i < 255; i++) {
+            this->exp[i] = (uint8_t) x;
+            this->log[x] = (uint8_t) i;
+
+            x <<= 1;
+            if (x & 0x100) {
+                x ^= 0x11D;
+            }
+        }
+
+        // duplicate so that exp[log a + log b] needs no modulo
+        for (size_t i = 255; i < 512; i++) {
+            this->exp[i] = this->exp[i - 255];
+        }
+        this->log[0] = 0;
+    }
+};
+
+const GfTables& Tables()
+{
+    static const GfTables tables;
+    return tables;
+}
+
+/// Whether the CPU supports SSSE3 (for the pshufb multiply)
+bool HaveSsse3()
+{
+    static const bool have = []() {
+        int info[4] = { 0 };
+        __cpuid(info, 1);
+        return (info[2] & (1 << 9)) != 0;
+    }();
+    return have;
+}
+}
+
+/**
+ * @brief Builds the coefficient matrix.
+ *
+ * @param dataCount Data symbols per block (n)
+ * @param parityCount Parity symbols per block (k); n + k may not exceed 255
+*/
+Fec::Fec(size_t dataCount, size_t parityCount) : n(dataCount), k(parityCount)
+{
+    if (!dataCount || !parityCount || (dataCount + parityCount) > kMaxSymbols) {
+        throw std::invalid_argument("invalid FEC block size");
+    }
+
+    /*
+     * Cauchy matrix C[j][i] = 1 / (x_j + y_i) with x_j = j and y_i = k + i; every square
+     * submatrix of it is invertible, which is what makes the code MDS. Scaling each column by a
+     * nonzero constant preserves that, so scale such that the first row is all ones.
+     */
+    this->matrix.resize(this->k * this->n);
+
+    for (size_t i = 0; i < this->n; i++) {
+        // 1 / C[0][i] = (0 + y_i)
+        const uint8_t norm = (uint8_t) (this->k + i);
+
+        for (size_t j = 0; j < this->k; j++) {
+            uint8_t c = inv((uint8_t) (j ^ (this->k + i)));
+            this->matrix[(j * this->n) + i] = mul(c, norm);
+        }
+    }
+}
+
+/**
+ * @brief Accumulates a data symbol into the block's parity symbols.
+ *
+ * Parity buffers must start out zeroed for each block. Data bytes past `len` are treated as zero,
+ * so symbols of different length may be mixed.
+ *
+ * @param parity Array of `k` parity buffers
+ * @param index Index of the data symbol in its block
+ * @param data Data to accumulate
+ * @param len Length of data
+ * @param offset Byte offset into the parity buffers at which `data` starts
+*/
+void Fec::encode(uint8_t* const* parity, size_t index, const void* data, size_t len, size_t offset) const
+{
+    auto src = reinterpret_cast<const uint8_t*>(data);
+
+    for (size_t j = 0; j < this->k; j++) {
+        mulAdd(parity[j] + offset, src, this->coefficient(j, index), len);
+    }
+}
+
+/**
+ * @brief Reconstructs erased data symbols of a block.
+ *
+ * @param data Array of `count` data buffers, each `symbolLen` bytes; missing ones are filled in
+ * @param dataPresent Which data symbols were received
+ * @param parity Array of `k` parity buffers; these are clobbered
+ * @param parityPresent Which parity symbols were received
+ * @param count Number of data symbols in this block (may be less than n for the last block)
+ * @param symbolLen Length of all symbols
+ * @return Whether the missing symbols could be recovered (false if too many were lost)
+*/
+bool Fec::reconstruct(uint8_t* const* data, const bool* dataPresent, uint8_t* const* parity,
+    const bool* parityPresent, size_t count, size_t symbolLen) const
+{
+    size_t missing[kMaxSymbols], rows[kMaxSymbols];
+    size_t numMissing = 0, numRows = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (!dataPresent[i]) {
+            missing[numMissing++] = i;
+        }
+    }
+    if (!numMissing) {
+        return true;
+    }
+
+    for (size_t j = 0; j < this->k && numRows < numMissing; j++) {
+        if (parityPresent[j]) {
+            rows[numRows++] = j;
+        }
+    }
+    if (numRows < numMissing) {
+        return false;
+    }
+
+    // reduce the used parity symbols to syndromes of only the missing data
+    for (size_t r = 0; r < numRows; r++) {
+        for (size_t i = 0; i < count; i++) {
+            if (dataPresent[i]) {
+                mulAdd(parity[rows[r]], data[i], this->coefficient(rows[r], i), symbolLen);
+            }
+        }
+    }
+
+    // invert the m x m submatrix (Gauss-Jordan)
+    const size_t m = numMissing;
+    std::vector<uint8_t> a(m * m), b(m * m, 0);
+
+    for (size_t r = 0; r < m; r++) {
+        for (size_t c = 0; c < m; c++) {
+            a[(r * m) + c] = this->coefficient(rows[r], missing[c]);
+        }
+        b[(r * m) + r] = 1;
+    }
+
+    for (size_t col = 0; col < m; col++) {
+        // find a pivot
+        size_t pivot = col;
+        while (pivot < m && !a[(pivot * m) + col]) {
+            pivot++;
+        }
+        if (pivot == m) {
+            return false;
+        }
+
+        if (pivot != col) {
+            for (size_t c = 0; c < m; c++) {
+                std::swap(a[(pivot * m) + c], a[(col * m) + c]);
+                std::swap(b[(pivot * m) + c], b[(col * m) + c]);
+            }
+        }
+
+        // normalize, then eliminate from all other rows
+        const uint8_t scale = inv(a[(col * m) + col]);
+        for (size_t c = 0; c < m; c++) {
+            a[(col * m) + c] = mul(a[(col * m) + c], scale);
+            b[(col * m) + c] = mul(b[(col * m) + c], scale);
+        }
+
+        for (size_t r = 0; r < m; r++) {
+            const uint8_t factor = a[(r * m) + col];
+            if (r == col || !factor) {
+                continue;
+            }
+
+            for (size_t c = 0; c < m; c++) {
+                a[(r * m) + c] ^= mul(factor, a[(col * m) + c]);
+                b[(r * m) + c] ^= mul(factor, b[(col * m) + c]);
+            }
+        }
+    }
+
+    // missing symbol = inverse * syndromes
+    for (size_t i = 0; i < m; i++) {
+        uint8_t* out = data[missing[i]];
+        memset(out, 0, symbolLen);
+
+        for (size_t r = 0; r < m; r++) {
+            mulAdd(out, parity[rows[r]], b[(i * m) + r], symbolLen);
+        }
+    }
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Multiplies two field elements.
+*/
+uint8_t Fec::mul(uint8_t a, uint8_t b)
+{
+    if (!a || !b) {
+        return 0;
+    }
+
+    auto& t = Tables();
+    return t.exp[t.log[a] + t.log[b]];
+}
+
+/**
+ * @brief Multiplicative inverse of a (nonzero) field element.
+*/
+uint8_t Fec::inv(uint8_t a)
+{
+    if (!a) {
+        throw std::domain_error("GF(256) inverse of zero");
+    }
+
+    auto& t = Tables();
+    return t.exp[255 - t.log[a]];
+}
+
+/**
+ * @brief Computes dst ^= c * src over a buffer.
+ *
+ * This is the hot loop of both encoding and decoding. Multiplying by 1 is a plain XOR (done 16
+ * bytes at a time with SSE2); anything else uses the split nibble table trick with pshufb when
+ * SSSE3 is available, falling back to the log tables otherwise.
+*/
+void Fec::mulAdd(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+{
+    size_t i = 0;
+
+    if (!c) {
+        return;
+    }
+
+    // XOR parity
+    if (c == 1) {
+        for (; i + 16 <= len; i += 16) {
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(s, d));
+        }
+        for (; i < len; i++) {
+            dst[i] ^= src[i];
+        }
+        return;
+    }
+
+    // c * x = c * (x & 0x0F) ^ c * (x & 0xF0); look up both halves with pshufb
+    if (HaveSsse3()) {
+        alignas(16) uint8_t lo[16], hi[16];
+        for (uint8_t x = 0; x < 16; x++) {
+            lo[x] = mul(c, x);
+            hi[x] = mul(c, (uint8_t) (x << 4));
+        }
+
+        const __m128i loTable = _mm_load_si128(reinterpret_cast<const __m128i*>(lo));
+        const __m128i hiTable = _mm_load_si128(reinterpret_cast<const __m128i*>(hi));
+        const __m128i mask = _mm_set1_epi8(0x0F);
+
+        for (; i + 16 <= len; i += 16) {
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+
+            __m128i l = _mm_shuffle_epi8(loTable, _mm_and_si128(s, mask));
+            __m128i h = _mm_shuffle_epi8(hiTable, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+
+            d = _mm_xor_si128(d, _mm_xor_si128(l, h));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), d);
+        }
+    }
+
+    // scalar tail (or everything, without SSSE3)
+    auto& t = Tables();
+    const unsigned int logC = t.log[c];
+
+    for (; i < len; i++) {
+        if (src[i]) {
+            dst[i] ^= t.exp[logC + t.log[src[i]]];
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Systematic Reed-Solomon erasure code over GF(2^8), used for forward error correction.
+ *
+ * A block of up to `n` data symbols is protected by `k` parity symbols, and any `k` erased
+ * symbols in a block can be reconstructed. The code matrix is a Cauchy matrix whose columns are
+ * scaled so that the first parity row is all ones; the first parity symbol is therefore the plain
+ * XOR of the block, and `k = 1` is simple XOR parity.
+ *
+ * Symbols are arbitrary byte strings of equal length; callers zero-pad shorter ones.
+*/
+class Fec {
+public:
+    /// Maximum number of data + parity symbols per block
+    constexpr static const size_t kMaxSymbols = 255;
+
+public:
+    Fec(size_t dataCount, size_t parityCount);
+
+    /// Number of data symbols per block
+    size_t getDataCount() const
+    {
+        return this->n;
+    }
+    /// Number of parity symbols per block
+    size_t getParityCount() const
+    {
+        return this->k;
+    }
+
+    /// Coefficient by which data symbol `data` is multiplied in parity symbol `parity`
+    uint8_t coefficient(size_t parity, size_t data) const
+    {
+        return this->matrix[(parity * this->n) + data];
+    }
+
+    void encode(uint8_t* const* parity, size_t index, const void* data, size_t len, size_t offset = 0) const;
+    bool reconstruct(uint8_t* const* data, const bool* dataPresent, uint8_t* const* parity,
+        const bool* parityPresent, size_t count, size_t symbolLen) const;
+
+public:
+    static uint8_t mul(uint8_t a, uint8_t b);
+    static uint8_t inv(uint8_t a);
+    static void mulAdd(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len);
+
+private:
+    /// data symbols per block
+    size_t n = 0;
+    /// parity symbols per block
+    size_t k = 0;
+    /// k x n coefficient matrix (row-major)
+    std::vector<uint8_t> matrix;
+};
+
+#endif
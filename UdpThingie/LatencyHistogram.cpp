@@ -0,0 +1,123 @@
+#include "pch.h"
+#include "LatencyHistogram.h"
+
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+
+/**
+ * @brief Rate of the time stamp counter, in ticks per second.
+ *
+ * Measured against the steady clock the first time it's needed; this takes ~20ms, so call it once
+ * up front rather than in the middle of a transfer.
+*/
+double Tsc::ticksPerSecond()
+{
+    static const double rate = []() {
+        using namespace std::chrono;
+
+        const auto start = steady_clock::now();
+        const uint64_t startTicks = __rdtsc();
+
+        Sleep(20);
+
+        const uint64_t endTicks = __rdtsc();
+        const auto end = steady_clock::now();
+
+        const double secs = duration_cast<nanoseconds>(end - start).count() / 1e9;
+        return ((double) (endTicks - startTicks)) / secs;
+    }();
+
+    return rate;
+}
+
+/**
+ * @brief Largest value that ends up in the given bucket.
+*/
+uint64_t LatencyHistogram::bucketMax(size_t bucket)
+{
+    if (bucket < kSubBuckets) {
+        return bucket;
+    }
+
+    const size_t shift = (bucket / kSubBuckets) - 1;
+    const uint64_t lowest = ((uint64_t) (kSubBuckets + (bucket % kSubBuckets))) << shift;
+
+    return lowest + ((1ULL << shift) - 1);
+}
+
+/**
+ * @brief Returns the value below which the given fraction of recorded values lie.
+ *
+ * @param p Fraction, between 0 and 1
+ * @return Upper bound of the bucket holding that value (capped at the largest recorded value), in
+ * ticks; 0 if nothing was recorded
+*/
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    const uint64_t total = this->getCount();
+    if (!total) {
+        return 0;
+    }
+
+    // rank of the value we're looking for (1-based)
+    uint64_t rank = (uint64_t) ceil(p * (double) total);
+    rank = min(max(rank, (uint64_t) 1), total);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kNumBuckets; i++) {
+        seen += this->buckets[i].load(std::memory_order_relaxed);
+
+        if (seen >= rank) {
+            return min(bucketMax(i), this->maximum.load(std::memory_order_relaxed));
+        }
+    }
+
+    // values were recorded while we were counting
+    return this->maximum.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Average of all recorded values, in ticks.
+*/
+double LatencyHistogram::mean() const
+{
+    const uint64_t total = this->getCount();
+    return total ? (((double) this->sum.load(std::memory_order_relaxed)) / (double) total) : 0.;
+}
+
+/**
+ * @brief Prints a one line summary (count and percentiles, in microseconds).
+*/
+void LatencyHistogram::print(std::ostream& out, const char* name) const
+{
+    // don't depend on (or leak) whatever formatting the stream was left with
+    std::ios format(nullptr);
+    format.copyfmt(out);
+
+    out << std::dec << std::setfill(' ');
+    out << std::setw(10) << std::left << name << std::right << " n " << std::setw(9) << this->getCount()
+        << std::fixed << std::setprecision(1)
+        << " mean " << std::setw(9) << Tsc::toMicros((uint64_t) this->mean())
+        << " p50 " << std::setw(9) << Tsc::toMicros(this->percentile(0.5))
+        << " p99 " << std::setw(9) << Tsc::toMicros(this->percentile(0.99))
+        << " p99.9 " << std::setw(9) << Tsc::toMicros(this->percentile(0.999))
+        << " max " << std::setw(9) << Tsc::toMicros(this->maximum.load(std::memory_order_relaxed))
+        << " us" << std::endl;
+
+    out.copyfmt(format);
+}
+
+/**
+ * @brief Clears all recorded values. Values recorded concurrently may or may not survive.
+*/
+void LatencyHistogram::reset()
+{
+    for (auto& bucket : this->buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+
+    this->count.store(0, std::memory_order_relaxed);
+    this->sum.store(0, std::memory_order_relaxed);
+    this->maximum.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,101 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <atomic>
+#include <ostream>
+
+#include <intrin.h>
+
+/**
+ * @brief Timestamps from the CPU's time stamp counter; cheap enough to take several per packet.
+ *
+ * Assumes an invariant TSC (constant rate, synchronized across cores), which any machine this
+ * will run on at high packet rates has.
+*/
+namespace Tsc {
+    /// Current TSC value
+    inline uint64_t now()
+    {
+        return __rdtsc();
+    }
+
+    double ticksPerSecond();
+
+    /// Converts a number of TSC ticks to microseconds
+    inline double toMicros(uint64_t ticks)
+    {
+        return ((double) ticks) * 1e6 / ticksPerSecond();
+    }
+}
+
+/**
+ * @brief Log-linear (HDR style) histogram of latencies, measured in TSC ticks.
+ *
+ * Values are bucketed by their most significant bit, and each power of two is split into 16
+ * linear sub-buckets, so any value is recorded with a relative error of at most ~6% across the
+ * full 64-bit range. Recording is a handful of instructions and an atomic increment, so it may be
+ * done from several threads at once without locking.
+*/
+class LatencyHistogram {
+public:
+    /// log2 of the number of sub-buckets per power of two
+    constexpr static const size_t kSubBucketBits = 4;
+    /// number of sub-buckets per power of two
+    constexpr static const size_t kSubBuckets = (1 << kSubBucketBits);
+    /// total number of buckets
+    constexpr static const size_t kNumBuckets = ((64 - kSubBucketBits + 1) * kSubBuckets);
+
+public:
+    LatencyHistogram() = default;
+    LatencyHistogram(const LatencyHistogram&) = delete;
+
+    /// Records a single value
+    void record(uint64_t ticks)
+    {
+        this->buckets[bucketFor(ticks)].fetch_add(1, std::memory_order_relaxed);
+        this->count.fetch_add(1, std::memory_order_relaxed);
+        this->sum.fetch_add(ticks, std::memory_order_relaxed);
+
+        uint64_t max = this->maximum.load(std::memory_order_relaxed);
+        while (ticks > max && !this->maximum.compare_exchange_weak(max, ticks, std::memory_order_relaxed)) {}
+    }
+
+    /// Number of values recorded
+    uint64_t getCount() const
+    {
+        return this->count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t percentile(double p) const;
+    double mean() const;
+
+    void print(std::ostream& out, const char* name) const;
+    void reset();
+
+private:
+    static size_t bucketFor(uint64_t value)
+    {
+        if (value < kSubBuckets) {
+            return (size_t) value;
+        }
+
+        unsigned long msb;
+        _BitScanReverse64(&msb, value);
+
+        const size_t shift = msb - kSubBucketBits;
+        return ((shift + 1) * kSubBuckets) + (size_t) ((value >> shift) & (kSubBuckets - 1));
+    }
+
+    static uint64_t bucketMax(size_t bucket);
+
+private:
+    /// number of values recorded in each bucket
+    std::atomic<uint64_t> buckets[kNumBuckets] = {};
+    /// total number of values, their sum and largest value
+    std::atomic<uint64_t> count = 0, sum = 0, maximum = 0;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef PACKETIO_H
+#define PACKETIO_H
+
+#include "pch.h"
+
+#include <cstddef>
+
+/**
+ * @brief Interface through which a socket puts datagrams on the wire and reads its acks.
+ *
+ * This lets the same protocol code run over different transmit paths. Implementations follow the
+ * WinSock conventions for errors: calls return `SOCKET_ERROR` and leave the reason to be fetched
+ * with `WSAGetLastError()`.
+ *
+ * Only one thread (the socket's worker) uses an instance at a time.
+*/
+class PacketIo {
+public:
+    virtual ~PacketIo() = default;
+
+    /**
+     * @brief Sends a datagram to the peer. Implementations may hold on to it until the next call
+     * to `flush()`. Data is copied, unless it lies in the arena passed to `registerArena()`; it is
+     * then read straight out of the arena, some time before the send completes.
+     *
+     * @return 0 on success, `SOCKET_ERROR` otherwise
+     */
+    virtual int send(const void* data, size_t length) = 0;
+    /**
+     * @brief Sends a datagram like `send()`, but always copies it, even if it's in the arena. Used
+     * for retransmissions: the peer may acknowledge an earlier copy of the packet (and its buffer
+     * be reused) while this one is still waiting to go out.
+     *
+     * @return 0 on success, `SOCKET_ERROR` otherwise
+     */
+    virtual int sendCopy(const void* data, size_t length)
+    {
+        return this->send(data, length);
+    }
+    /**
+     * @brief Sends any datagrams that were held back. Called before the worker goes to sleep.
+     *
+     * @return 0 on success, `SOCKET_ERROR` otherwise
+     */
+    virtual int flush()
+    {
+        return 0;
+    }
+
+    /**
+     * @brief Tells the backend where the caller's packet buffers live, so that it can send from
+     * them without copying. Optional; the default ignores it.
+     *
+     * The arena must stay valid as long as the backend, and packets in it shouldn't be modified
+     * until the peer acknowledged them. Packets that may still be in flight after that (i.e.
+     * retransmissions) must be sent with `sendCopy()`.
+     */
+    virtual void registerArena(void* base, size_t length)
+    {
+        (void) base;
+        (void) length;
+    }
+
+    /**
+     * @brief Reads a datagram from the peer.
+     *
+     * @return Length of the datagram, or `SOCKET_ERROR`
+     */
+    virtual int receive(void* buf, size_t length) = 0;
+
+    /// Event that is signalled when there are datagrams to receive
+    virtual HANDLE getReadEvent() const = 0;
+};
+
+#endif
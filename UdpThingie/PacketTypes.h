@@ -1,90 +1,238 @@
-// pragma once is the dumbest shit i have ever seen
-#ifndef PACKETTYPES_H
-#define PACKETTYPES_H
-
-#include "pch.h"
-
-// pack all structs (again in the most moronic michaelsoft way)
-#pragma pack(push, 1)
-
-/// Magic value to be shoved into the flags field
-constexpr static const DWORD /* ugh */ kFlagsMagic = 0x8311AA;
-
-/**
- * @brief A set of flags each packet header can have
-*/
-struct Flags {
-    /// must be 0
-    DWORD reserved : 5;
-    DWORD syn : 1;
-    DWORD ack : 1;
-    DWORD fin : 1;
-    /// must be set to the magic value
-    DWORD magic : 24;
-};
-/**
- * @brief Header for all transmitted packets
-*/
-struct SenderPacketHeader {
-    Flags flags;
-    /// Sequence number
-    DWORD seq;
-};
-/**
- * @brief Header for all received packets
-*/
-struct ReceiverPacketHeader {
-    Flags flags;
-    /// Receiver window size (in packets)
-    DWORD receiveWindow;
-    /// Next expected sequence
-    DWORD ackSeq;
-};
-
-/**
- * @brief Properties defining the link to be emulated by the server.
-*/
-struct LinkProperties {
-    /// round trip time (in seconds)
-    float RTT;
-    /// bottleneck bandwidth (in bps)
-    float speed;
-    /// probability of packet loss in each direction
-    float pLoss[2];
-    /// size of the router buffers, in packets
-    DWORD bufferSize;
-};
-/**
- * @brief Indices for the `pLoss` array in the link properties struct.
-*/
-enum PathLossDirection {
-    /// Path loss in the forward direction
-    kForwardDirection = 0,
-    /// Path loss in the reverse direction
-    kReturnDirection = 1,
-};
-
-/**
- * @brief Packet transmitted to set up a connection
-*/
-struct SenderSynPacket {
-    /// packet header
-    SenderPacketHeader header;
-    /// link properties to emulate
-    LinkProperties lp;
-};
-
-/**
- * @brief Packet containing payload data
-*/
-struct SenderDataPacket {
-    /// packet header
-    SenderPacketHeader header;
-    /// payload
-    char data[];
-};
-
-// this is stupid
-#pragma pack(pop)
-
+// pragma once is the dumbest shit i have ever seen
+#ifndef PACKETTYPES_H
+#define PACKETTYPES_H
+
+#include "pch.h"
+
+// pack all structs (again in the most moronic michaelsoft way)
+#pragma pack(push, 1)
+
+/// Magic value to be shoved into the flags field
+constexpr static const DWORD /* ugh */ kFlagsMagic = 0x8311AA;
+
+/**
+ * @brief A set of flags each packet header can have
+*/
+struct Flags {
+    /// set on FEC parity packets (only if negotiated)
+    DWORD parity : 1;
+    /// set on data packets carrying part of a compressed block (only if negotiated)
+    DWORD compressed : 1;
+    /// must be 0
+    DWORD reserved : 3;
+    DWORD syn : 1;
+    DWORD ack : 1;
+    DWORD fin : 1;
+    /// must be set to the magic value
+    DWORD magic : 24;
+};
+/**
+ * @brief Header for all transmitted packets
+*/
+struct SenderPacketHeader {
+    Flags flags;
+    /// Sequence number
+    DWORD seq;
+};
+/**
+ * @brief Header for all received packets
+*/
+struct ReceiverPacketHeader {
+    Flags flags;
+    /// Receiver window size (in packets)
+    DWORD receiveWindow;
+    /// Next expected sequence
+    DWORD ackSeq;
+};
+
+/**
+ * @brief Properties defining the link to be emulated by the server.
+*/
+struct LinkProperties {
+    /// round trip time (in seconds)
+    float RTT;
+    /// bottleneck bandwidth (in bps)
+    float speed;
+    /// probability of packet loss in each direction
+    float pLoss[2];
+    /// size of the router buffers, in packets
+    DWORD bufferSize;
+};
+/**
+ * @brief Indices for the `pLoss` array in the link properties struct.
+*/
+enum PathLossDirection {
+    /// Path loss in the forward direction
+    kForwardDirection = 0,
+    /// Path loss in the reverse direction
+    kReturnDirection = 1,
+};
+
+/**
+ * @brief Packet transmitted to set up a connection
+*/
+struct SenderSynPacket {
+    /// packet header
+    SenderPacketHeader header;
+    /// link properties to emulate
+    LinkProperties lp;
+};
+
+/// Magic value identifying the option block appended to a SYN (and echoed in the SYN-ACK)
+constexpr static const DWORD kSynOptionsMagic = 0x4F505431; // 'OPT1'
+
+/**
+ * @brief Optional protocol features, negotiated during the handshake.
+ *
+ * The sender appends a `SynOptions` block to its SYN requesting features; the receiver echoes one
+ * after its SYN-ACK header containing the subset it agrees to. A receiver that doesn't know about
+ * options replies with a bare header, which disables all of them.
+*/
+enum SynOptionFlags : DWORD {
+    /// Forward error correction parity packets
+    kSynOptionFec = (1 << 0),
+    /// Payload compression
+    kSynOptionCompression = (1 << 1),
+    /// Resuming an interrupted transfer
+    kSynOptionResume = (1 << 2),
+    /// Receiver acknowledges several packets at once, or after a delay
+    kSynOptionAckFrequency = (1 << 3),
+    /// Sender transmits data right behind the SYN, without waiting for the SYN-ACK
+    kSynOptionEarlyData = (1 << 4),
+};
+
+/**
+ * @brief Option block; unused fields must be zero
+*/
+struct SynOptions {
+    /// must be `kSynOptionsMagic`
+    DWORD magic;
+    /// requested (or accepted) features; see `SynOptionFlags`
+    DWORD flags;
+
+    /// FEC: number of data packets per block
+    WORD fecDataCount;
+    /// FEC: number of parity packets per block
+    WORD fecParityCount;
+
+    /// Compression: largest amount of (uncompressed) data per compressed block
+    DWORD compressionBlockSize;
+
+    /// Resume: identifies the transfer across connections
+    ULONGLONG transferId;
+    /**
+     * Resume: offset (in the data stream) up to which the sender has a checkpoint; the receiver
+     * replies with the offset to continue from, which may not be larger and must be a multiple of
+     * the range size. 0 starts the transfer over.
+     */
+    ULONGLONG resumeOffset;
+    /// Resume: CRC32 of the range ending at `resumeOffset`
+    DWORD resumeCrc;
+    /// Resume: size of each checkpoint range, in bytes
+    DWORD resumeRangeSize;
+
+    /**
+     * Ack frequency: most in-order packets the receiver may acknowledge together. Packets arriving
+     * out of order are still acknowledged right away.
+     */
+    WORD ackEvery;
+    /**
+     * Early data: number of data packets the sender may transmit before it gets the SYN-ACK. A
+     * receiver that declines this drops them; the sender then transmits them again.
+     */
+    WORD earlyData;
+    /// Ack frequency: longest time (in usec) the receiver may hold back an acknowledgement
+    DWORD ackDelay;
+};
+
+/**
+ * @brief SYN packet carrying an option block
+*/
+struct SenderSynOptionsPacket {
+    /// regular SYN
+    SenderSynPacket syn;
+    /// requested options
+    SynOptions options;
+};
+
+/**
+ * @brief SYN-ACK carrying the receiver's accepted options
+*/
+struct ReceiverSynAckPacket {
+    /// regular response header
+    ReceiverPacketHeader header;
+    /// accepted options
+    SynOptions options;
+};
+
+/**
+ * @brief Packet containing payload data
+*/
+struct SenderDataPacket {
+    /// packet header
+    SenderPacketHeader header;
+    /// payload
+    char data[];
+};
+
+/**
+ * @brief Header following the packet header in FEC parity packets.
+ *
+ * The packet header's sequence number is that of the first data packet in the block. The parity
+ * is computed over each data packet's payload length (16 bits, little endian) followed by its
+ * payload, zero-padded to `symbolLen`.
+*/
+struct FecParityHeader {
+    /// index of this parity packet within the block
+    BYTE index;
+    /// number of data packets in the block (the last block may be short)
+    BYTE dataCount;
+    /// length of the parity data that follows
+    WORD symbolLen;
+};
+
+/**
+ * @brief Parity packet
+*/
+struct SenderParityPacket {
+    /// packet header (with the parity flag set)
+    SenderPacketHeader header;
+    /// FEC block info
+    FecParityHeader fec;
+    /// parity data
+    char data[];
+};
+
+/**
+ * @brief Filters that may be applied to a block's data before it's compressed
+*/
+enum CompressionFilter : BYTE {
+    /// data is compressed as-is
+    kCompressionFilterNone = 0,
+    /// 32-bit words are replaced by their difference to the previous word
+    kCompressionFilterDelta32 = 1,
+};
+
+/**
+ * @brief Header at the start of each compressed block.
+ *
+ * A compressed block is split over as many data packets as needed, all of which have the
+ * compressed flag set; the first one begins with this header, followed by the compressed data
+ * (LZ4 block format). Blocks always start in a new packet. Data that didn't compress is sent in
+ * regular packets without the flag.
+*/
+struct CompressedBlockHeader {
+    /// length of the block's data once decompressed
+    DWORD rawLength;
+    /// length of the compressed data following the header
+    DWORD compressedLength;
+    /// filter to undo after decompressing; see `CompressionFilter`
+    BYTE filter;
+    /// must be 0
+    BYTE reserved[3];
+};
+
+// this is stupid
+#pragma pack(pop)
+
 #endif
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include "pch.h"
+#include "PageArena.h"
+
+#include <stdexcept>
+#include <string>
+
+/**
+ * @brief Allocates the arena.
+ *
+ * @param length Minimum size of the arena, in bytes
+ * @param lock Whether to lock the arena into memory if it can't use large pages
+*/
+PageArena::PageArena(size_t length, bool lock)
+{
+    if (!length) {
+        throw std::invalid_argument("arena length may not be zero");
+    }
+
+    if (!this->allocateLarge(length)) {
+        this->allocateRegular(length, lock);
+    }
+
+    this->prefault();
+}
+
+/**
+ * @brief Releases the arena's memory, and gives back the working set we took for it.
+*/
+PageArena::~PageArena()
+{
+    if (this->locked && !this->largePages) {
+        VirtualUnlock(this->base, this->length);
+    }
+
+    VirtualFree(this->base, 0, MEM_RELEASE);
+
+    if (this->workingSetGrowth) {
+        SIZE_T minWs, maxWs;
+        if (GetProcessWorkingSetSize(GetCurrentProcess(), &minWs, &maxWs)) {
+            SetProcessWorkingSetSize(GetCurrentProcess(), minWs - this->workingSetGrowth, maxWs - this->workingSetGrowth);
+        }
+    }
+}
+
+/**
+ * @brief Tries to allocate the arena from large pages.
+ *
+ * This requires the lock memory privilege, which is disabled (if the account holds it at all) by
+ * default; and it may fail if physical memory is too fragmented.
+ *
+ * @return Whether the arena was allocated
+*/
+bool PageArena::allocateLarge(size_t length)
+{
+    const size_t pageSize = GetLargePageMinimum();
+    if (!pageSize || !PageArena::enableLockPrivilege()) {
+        return false;
+    }
+
+    const size_t rounded = ((length + pageSize - 1) / pageSize) * pageSize;
+
+    this->base = (char*) VirtualAlloc(nullptr, rounded, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if (!this->base) {
+        return false;
+    }
+
+    this->length = rounded;
+    this->largePages = true;
+    this->locked = true;
+    return true;
+}
+
+/**
+ * @brief Allocates the arena from regular pages, and locks it if requested.
+ *
+ * Failing to lock the arena isn't fatal; it's just as likely to stay resident while it's in use.
+*/
+void PageArena::allocateRegular(size_t length, bool lock)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    const size_t pageSize = info.dwPageSize;
+    const size_t rounded = ((length + pageSize - 1) / pageSize) * pageSize;
+
+    this->base = (char*) VirtualAlloc(nullptr, rounded, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!this->base) {
+        throw std::runtime_error("VirtualAlloc(): " + std::to_string(GetLastError()));
+    }
+    this->length = rounded;
+
+    if (!lock) {
+        return;
+    }
+
+    // a process can only lock as much as its minimum working set, so make room for the arena
+    SIZE_T minWs, maxWs;
+    if (!GetProcessWorkingSetSize(GetCurrentProcess(), &minWs, &maxWs) ||
+        !SetProcessWorkingSetSize(GetCurrentProcess(), minWs + rounded, maxWs + rounded)) {
+        return;
+    }
+    this->workingSetGrowth = rounded;
+
+    this->locked = VirtualLock(this->base, rounded);
+}
+
+/**
+ * @brief Writes to every page of the arena, so they're all backed by physical memory.
+ *
+ * Locked pages are already resident, but touching them again is cheap.
+*/
+void PageArena::prefault()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    for (size_t off = 0; off < this->length; off += info.dwPageSize) {
+        this->base[off] = 0;
+    }
+}
+
+/**
+ * @brief Enables the lock memory privilege for the process, if the account holds it.
+*/
+bool PageArena::enableLockPrivilege()
+{
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+        return false;
+    }
+
+    TOKEN_PRIVILEGES privs;
+    privs.PrivilegeCount = 1;
+    privs.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+    if (!LookupPrivilegeValue(nullptr, SE_LOCK_MEMORY_NAME, &privs.Privileges[0].Luid)) {
+        CloseHandle(token);
+        return false;
+    }
+
+    // this "succeeds" even if the privilege isn't held; that shows up in the last error instead
+    BOOL ok = AdjustTokenPrivileges(token, false, &privs, 0, nullptr, nullptr);
+    const DWORD err = GetLastError();
+
+    CloseHandle(token);
+    return ok && (err == ERROR_SUCCESS);
+}
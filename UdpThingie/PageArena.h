@@ -0,0 +1,61 @@
+#ifndef PAGEARENA_H
+#define PAGEARENA_H
+
+#include "pch.h"
+
+/**
+ * @brief A single block of memory allocated straight from the VM system, fully faulted in up front.
+ *
+ * Large pages are used if the account holds the "Lock pages in memory" privilege and the system
+ * can find enough contiguous memory; those are never paged out, and need far fewer TLB entries.
+ * Otherwise regular pages are used, optionally locked into the working set. Either way, every
+ * page is touched before the constructor returns, so using the memory never takes a page fault.
+*/
+class PageArena {
+public:
+    PageArena(size_t length, bool lock);
+    ~PageArena();
+
+    PageArena(const PageArena&) = delete;
+    PageArena& operator=(const PageArena&) = delete;
+
+    /// Start of the arena
+    void* data() const
+    {
+        return this->base;
+    }
+    /// Usable size of the arena; may be larger than requested
+    size_t size() const
+    {
+        return this->length;
+    }
+
+    /// Whether the arena is backed by large pages
+    bool isLargePages() const
+    {
+        return this->largePages;
+    }
+    /// Whether the arena can't be paged out (always the case with large pages)
+    bool isLocked() const
+    {
+        return this->locked;
+    }
+
+private:
+    bool allocateLarge(size_t length);
+    void allocateRegular(size_t length, bool lock);
+    void prefault();
+
+    static bool enableLockPrivilege();
+
+private:
+    char* base = nullptr;
+    size_t length = 0;
+
+    bool largePages = false;
+    bool locked = false;
+    /// how much we grew the working set by to lock the arena
+    size_t workingSetGrowth = 0;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include "pch.h"
+#include "PayloadSource.h"
+
+/**
+ * @brief Reads the next piece of the stream.
+ *
+ * @param length Most bytes to read; on return, the number of bytes actually read (0 at the end
+ * of the stream)
+ * @return Start of the piece; valid until the next call
+*/
+void* PayloadSource::next(size_t& length)
+{
+    length = (size_t) min((uint64_t) length, this->length - this->offset);
+    if (!length) {
+        return nullptr;
+    }
+
+    void* data = this->produce(this->offset, length);
+
+    if (this->checksummed) {
+        this->crc = this->checksum.update(this->crc, data, length);
+    }
+    this->offset += length;
+
+    return data;
+}
+
+/**
+ * @brief Moves past the given number of bytes without reading them. If the source is checksummed,
+ * they still have to be produced to keep the CRC going, but only a bit at a time.
+*/
+void PayloadSource::skip(uint64_t length)
+{
+    length = min(length, this->length - this->offset);
+
+    if (!this->checksummed) {
+        this->offset += length;
+        return;
+    }
+
+    while (length) {
+        size_t chunk = (size_t) min(length, (uint64_t) kSkipChunk);
+        this->next(chunk);
+        length -= chunk;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Fills in the words covering the requested range. Pieces needn't start or end on a word
+ * boundary (FEC makes for odd payload sizes), so the words at either end may only partly be used.
+*/
+void* CounterSource::produce(uint64_t offset, size_t length)
+{
+    const uint64_t first = offset / sizeof(uint32_t);
+    const uint64_t last = (offset + length + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+    const size_t count = (size_t) (last - first);
+
+    if (this->words.size() < count) {
+        this->words.resize(count);
+    }
+
+    uint32_t* out = this->words.data();
+    for (size_t i = 0; i < count; i++) {
+        out[i] = (uint32_t) (first + i);
+    }
+
+    return reinterpret_cast<char*>(out) + (offset % sizeof(uint32_t));
+}
@@ -0,0 +1,102 @@
+#ifndef PAYLOADSOURCE_H
+#define PAYLOADSOURCE_H
+
+#include "Checksum.h"
+
+#include <cstdint>
+#include <cstddef>
+
+#include <vector>
+
+/**
+ * @brief Produces the data stream to send, one piece at a time.
+ *
+ * The stream is read front to back, and each piece only needs to stay valid until the next one is
+ * read; so a source can generate its data on the fly, and a transfer of any size needs only as
+ * much memory as a single piece. Sources that generate their data also keep the CRC32 of what was
+ * read so far, since there's nothing to compute it over up front.
+*/
+class PayloadSource {
+public:
+    virtual ~PayloadSource() = default;
+
+    void* next(size_t& length);
+    void skip(uint64_t length);
+
+    /// Total length of the stream, in bytes
+    uint64_t size() const
+    {
+        return this->length;
+    }
+    /// Number of bytes read (or skipped) so far
+    uint64_t tell() const
+    {
+        return this->offset;
+    }
+    /// Whether the source keeps a CRC32 of the stream
+    bool isChecksummed() const
+    {
+        return this->checksummed;
+    }
+    /// CRC32 of the stream up to `tell()`; only valid if `isChecksummed()`
+    uint32_t getChecksum() const
+    {
+        return this->crc;
+    }
+
+protected:
+    PayloadSource(uint64_t length, bool checksummed) : length(length), checksummed(checksummed) {};
+
+    /**
+     * @brief Returns `length` bytes of the stream, starting at `offset`. The data must stay valid
+     * until the next call.
+     */
+    virtual void* produce(uint64_t offset, size_t length) = 0;
+
+private:
+    /// Largest piece produced at once while skipping data that's checksummed
+    constexpr static const size_t kSkipChunk = (1024 * 64);
+
+    uint64_t length = 0;
+    uint64_t offset = 0;
+
+    bool checksummed = false;
+    uint32_t crc = 0;
+    Checksum checksum;
+};
+
+/**
+ * @brief Reads the stream out of a buffer in memory; it's not copied, and must stay around for as
+ * long as the source is used.
+*/
+class BufferSource : public PayloadSource {
+public:
+    BufferSource(void* buf, size_t length) : PayloadSource(length, false), buf(static_cast<char*>(buf)) {};
+
+protected:
+    void* produce(uint64_t offset, size_t length) override
+    {
+        return this->buf + offset;
+    }
+
+private:
+    char* buf = nullptr;
+};
+
+/**
+ * @brief Generates the test pattern: consecutive 32-bit words, each holding its index (the same as
+ * filling a `DWORD` array with `buf[i] = i`.)
+*/
+class CounterSource : public PayloadSource {
+public:
+    CounterSource(uint64_t count) : PayloadSource(count * sizeof(uint32_t), true) {};
+
+protected:
+    void* produce(uint64_t offset, size_t length) override;
+
+private:
+    /// words covering the piece last produced
+    std::vector<uint32_t> words;
+};
+
+#endif
@@ -0,0 +1,1091 @@
+#include "pch.h"
+#include "ReceiverSocket.h"
+#include "Fec.h"
+#include "Compressor.h"
+#include "PageArena.h"
+
+#include <cassert>
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+#include <intrin.h>
+
+using namespace __fucker;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Creates the events used to talk to the worker; the socket and worker are only set up
+ * once `listen()` is called.
+*/
+ReceiverSocket::ReceiverSocket()
+{
+    this->quitEvent = CreateEvent(nullptr, true, false, nullptr);
+    if (this->quitEvent == (HANDLE)ERROR_INVALID_HANDLE) {
+        throw std::runtime_error("CreateEvent(): " + std::to_string(GetLastError()));
+    }
+
+    this->closedEvent = CreateEvent(nullptr, true, false, nullptr);
+    if (this->closedEvent == (HANDLE)ERROR_INVALID_HANDLE) {
+        throw std::runtime_error("CreateEvent(): " + std::to_string(GetLastError()));
+    }
+
+    this->abortEvent = CreateEvent(nullptr, true, false, nullptr);
+    if (this->abortEvent == (HANDLE)ERROR_INVALID_HANDLE) {
+        throw std::runtime_error("CreateEvent(): " + std::to_string(GetLastError()));
+    }
+
+    this->readEvent = CreateEvent(nullptr, false, false, nullptr);
+    if (this->readEvent == (HANDLE)ERROR_INVALID_HANDLE) {
+        throw std::runtime_error("CreateEvent(): " + std::to_string(GetLastError()));
+    }
+}
+
+/**
+ * @brief Stops the worker, and closes the socket and output file. If the transfer didn't finish,
+ * whatever was written so far is left in the file.
+*/
+ReceiverSocket::~ReceiverSocket() noexcept(false)
+{
+    if (!SetEvent(this->quitEvent)) {
+        throw std::runtime_error("SetEvent(): " + std::to_string(GetLastError()));
+    }
+
+    if (this->workerThread != INVALID_HANDLE_VALUE) {
+        if (WaitForSingleObject(this->workerThread, 500) != WAIT_OBJECT_0) {
+            std::cerr << "Receiver worker failed to exit gracefully; killing it" << std::endl;
+            TerminateThread(this->workerThread, 0);
+        }
+        CloseHandle(this->workerThread);
+    }
+
+    // writes may still be in flight if the transfer was aborted
+    if (this->file != INVALID_HANDLE_VALUE) {
+        CancelIo(this->file);
+
+        for (auto& buf : this->writes) {
+            DWORD written;
+            if (buf.pending) {
+                GetOverlappedResult(this->file, &buf.overlapped, &written, true);
+            }
+            CloseHandle(buf.overlapped.hEvent);
+        }
+
+        CloseHandle(this->file);
+    }
+
+    if (this->sock != INVALID_SOCKET) {
+        closesocket(this->sock);
+    }
+
+    CloseHandle(this->readEvent);
+    CloseHandle(this->abortEvent);
+    CloseHandle(this->closedEvent);
+    CloseHandle(this->quitEvent);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Starts listening for a connection on the given port.
+ *
+ * The worker handles the connection from here on; use `waitForClose()` to wait for the transfer
+ * to complete.
+ *
+ * @param port Local port to listen on
+ * @param window Number of packets that may be buffered out of order
+*/
+void ReceiverSocket::listen(uint16_t port, size_t window)
+{
+    if (this->workerThread != INVALID_HANDLE_VALUE) {
+        throw SocketError(SocketError::kStatusConnected);
+    } else if (!window || window > MAXDWORD) {
+        throw std::invalid_argument("invalid window size");
+    }
+
+    // set up the reassembly ring
+    this->window = window;
+    this->advertised = (DWORD) window;
+
+    this->ringArena = std::make_unique<PageArena>(window * sizeof(Slot), false);
+    this->ring = static_cast<Slot*>(this->ringArena->data());
+
+    this->present.resize((window + 63) / 64, 0);
+
+    this->setUpOutput();
+    this->setUpSocket(port);
+
+    this->workerThread = CreateThread(nullptr, 0, ReceiverWorkerEntry, this, 0, nullptr);
+    assert(this->workerThread != INVALID_HANDLE_VALUE);
+}
+
+/**
+ * @brief Waits for the sender to close the connection, at which point all data has been written
+ * to the output. If the connection was aborted, the error that caused it is rethrown here.
+*/
+void ReceiverSocket::waitForClose()
+{
+    HANDLE events[] = {
+        this->closedEvent, this->abortEvent
+    };
+    DWORD waitRet = WaitForMultipleObjects(2, events, false, INFINITE);
+
+    switch (waitRet) {
+        // transfer completed
+        case WAIT_OBJECT_0:
+            return;
+        // connection got fucked
+        case (WAIT_OBJECT_0 + 1):
+            if (this->abortError) {
+                throw SocketError(*this->abortError);
+            }
+            throw SocketError(SocketError::kStatusRecvFailed, "Connection has broken");
+
+        default:
+            throw SocketError(SocketError::kStatusSystemError);
+    }
+}
+
+/**
+ * @brief Writes the data stream to the given file, replacing it; must be called before listening.
+*/
+void ReceiverSocket::setOutput(const std::string& path)
+{
+    if (this->workerThread != INVALID_HANDLE_VALUE) {
+        throw SocketError(SocketError::kStatusConnected);
+    }
+
+    this->outputPath = path;
+}
+
+/**
+ * @brief Passes the data stream to the given callback as it's received; must be called before
+ * listening. This may be combined with an output file.
+*/
+void ReceiverSocket::setDataCallback(DataCallback callback)
+{
+    if (this->workerThread != INVALID_HANDLE_VALUE) {
+        throw SocketError(SocketError::kStatusConnected);
+    }
+
+    this->dataCallback = callback;
+}
+
+/**
+ * @brief Limits how far acknowledgements may be coalesced; must be called before listening.
+ *
+ * The sender asks for how many packets it wants acknowledged together, and how long an ack may be
+ * held back; we agree to no more than this. Senders that don't ask get every packet acknowledged.
+ *
+ * @param every Most in-order packets acknowledged together; 1 acknowledges every packet
+ * @param delay Longest time (in usec) an acknowledgement may be held back waiting for more packets
+*/
+void ReceiverSocket::setAckPolicy(size_t every, DWORD delay)
+{
+    if (this->workerThread != INVALID_HANDLE_VALUE) {
+        throw SocketError(SocketError::kStatusConnected);
+    } else if (!every) {
+        throw std::invalid_argument("must acknowledge at least every packet");
+    }
+
+    this->maxAckEvery = every;
+    this->maxAckDelay = delay;
+}
+
+/**
+ * @brief Sets which of the options requested by the sender may be accepted (see
+ * `SynOptionFlags`); must be called before listening. Resuming is never accepted.
+*/
+void ReceiverSocket::setOptions(DWORD flags)
+{
+    if (this->workerThread != INVALID_HANDLE_VALUE) {
+        throw SocketError(SocketError::kStatusConnected);
+    }
+
+    this->acceptOptions = flags & kDefaultOptions;
+}
+
+/**
+ * @brief Creates the socket, bound to the given port on all interfaces.
+*/
+void ReceiverSocket::setUpSocket(uint16_t port)
+{
+    int err;
+
+    this->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (this->sock == INVALID_SOCKET) {
+        throw SocketError(SocketError::kStatusSystemError, WSAGetLastError());
+    }
+
+    struct sockaddr_in local = { 0 };
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = INADDR_ANY;
+    local.sin_port = htons(port);
+
+    err = bind(this->sock, (struct sockaddr*)&local, sizeof(local));
+    if (err == -1) {
+        throw SocketError(SocketError::kStatusSystemError, WSAGetLastError());
+    }
+
+    // a whole window may arrive while we're busy writing
+    const int kBufSz = (32 * 1000 * 1000);
+
+    if (setsockopt(this->sock, SOL_SOCKET, SO_RCVBUF, (const char*)&kBufSz, sizeof(int)) == SOCKET_ERROR) {
+        std::cerr << "SO_RCVBUF set failed: " << WSAGetLastError() << std::endl;
+    }
+
+    // readability is signalled through an event (this also makes the socket non-blocking)
+    err = WSAEventSelect(this->sock, this->readEvent, FD_READ);
+    if (err == SOCKET_ERROR) {
+        throw SocketError(SocketError::kStatusSystemError, WSAGetLastError());
+    }
+}
+
+/**
+ * @brief Opens the output file, if any, and allocates the write buffers.
+ *
+ * The file bypasses the cache, so that a transfer larger than memory doesn't evict everything
+ * else; which is also why writes need to be aligned.
+*/
+void ReceiverSocket::setUpOutput()
+{
+    if (this->outputPath.empty()) {
+        return;
+    }
+
+    this->file = CreateFileA(this->outputPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED, nullptr);
+    if (this->file == INVALID_HANDLE_VALUE) {
+        throw SocketError(SocketError::kStatusSystemError, "CreateFile(): " + std::to_string(GetLastError()));
+    }
+
+    // page aligned, which is at least sector aligned
+    this->writeArena = std::make_unique<PageArena>(kWriteBuffers * kWriteSize, false);
+
+    for (size_t i = 0; i < kWriteBuffers; i++) {
+        auto& buf = this->writes[i];
+
+        buf.data = static_cast<char*>(this->writeArena->data()) + (i * kWriteSize);
+
+        buf.overlapped.hEvent = CreateEvent(nullptr, true, false, nullptr);
+        if (buf.overlapped.hEvent == (HANDLE)ERROR_INVALID_HANDLE) {
+            throw std::runtime_error("CreateEvent(): " + std::to_string(GetLastError()));
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Trampoline to jump into the worker's main loop
+*/
+DWORD WINAPI __fucker::ReceiverWorkerEntry(LPVOID ctx)
+{
+    static_cast<ReceiverSocket*>(ctx)->workerMain();
+    return 0;
+}
+
+/**
+ * @brief Main loop of the worker: reads packets as they arrive, and sends delayed acks when due.
+*/
+void ReceiverSocket::workerMain()
+{
+    HANDLE handles[] = {
+        this->quitEvent, this->readEvent
+    };
+
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+
+    try {
+        while (true) {
+            const auto now = std::chrono::steady_clock::now();
+            DWORD timeout = INFINITE;
+
+            // wake up for the delayed ack, or to give up on the sender
+            if (this->state == kStateEstablished) {
+                auto deadline = this->lastHeard + std::chrono::milliseconds(kIdleTimeout);
+                if (this->ackArmed) {
+                    deadline = min(deadline, this->ackDeadline);
+                }
+
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+                timeout = (ms > 0) ? (DWORD) ms : 0;
+            }
+
+            DWORD err = WaitForMultipleObjects(2, handles, false, timeout);
+
+            switch (err) {
+            // want to quit
+            case WAIT_OBJECT_0:
+                goto beach;
+            // packets to read
+            case (WAIT_OBJECT_0 + 1):
+                this->workerReadPackets();
+                break;
+            // delayed ack or idle timeout
+            case WAIT_TIMEOUT:
+                break;
+
+            default:
+                throw SocketError(SocketError::kStatusSystemError);
+            }
+
+            if (this->state != kStateEstablished) {
+                continue;
+            }
+
+            if (this->ackArmed && std::chrono::steady_clock::now() >= this->ackDeadline) {
+                this->workerSendAck();
+            }
+            if ((std::chrono::steady_clock::now() - this->lastHeard) >= std::chrono::milliseconds(kIdleTimeout)) {
+                throw SocketError(SocketError::kStatusTimeout, "sender went away");
+            }
+        }
+    } catch (SocketError& e) {
+        std::cerr << "ReceiverWorker exception: " << e.what() << std::endl;
+        this->workerAbort(e);
+    } catch (const std::exception& e) {
+        std::cerr << "ReceiverWorker exception: " << e.what() << std::endl;
+        this->workerAbort(SocketError(SocketError::kStatusSystemError, e.what()));
+    }
+
+beach:;
+}
+
+/**
+ * @brief Reads all packets waiting on the socket.
+ *
+ * Acks for in-order packets are only sent once enough have been received; if a burst ends short
+ * of that, the ack is delayed, in case more packets are right behind it.
+*/
+void ReceiverSocket::workerReadPackets()
+{
+    char receive[kMaxPacketSize];
+
+    while (true) {
+        struct sockaddr_in from;
+        socklen_t fromLen = sizeof(from);
+
+        int err = recvfrom(this->sock, receive, sizeof(receive), 0, (struct sockaddr*)&from, &fromLen);
+        if (err == SOCKET_ERROR) {
+            const int error = WSAGetLastError();
+
+            // ICMP unreachable from an ack sent after the sender went away, or an oversized packet
+            if (error == WSAECONNRESET || error == WSAEMSGSIZE) {
+                continue;
+            } else if (error == WSAEWOULDBLOCK) {
+                break;
+            }
+            throw SocketError(SocketError::kStatusRecvFailed, error);
+        }
+
+        this->workerHandlePacket(receive, err, from);
+    }
+
+    if (this->pendingAcks && !this->ackArmed && this->state == kStateEstablished) {
+        if (!this->ackDelay) {
+            this->workerSendAck();
+        } else {
+            this->ackArmed = true;
+            this->ackDeadline = std::chrono::steady_clock::now() + std::chrono::microseconds(this->ackDelay);
+        }
+    }
+}
+
+/**
+ * @brief Figures out what kind of packet was received, and handles it.
+*/
+void ReceiverSocket::workerHandlePacket(const char* packet, size_t length, const struct sockaddr_in& from)
+{
+    if (length < sizeof(SenderPacketHeader)) {
+        return;
+    }
+
+    auto hdr = reinterpret_cast<const SenderPacketHeader*>(packet);
+    if (hdr->flags.magic != kFlagsMagic) {
+        return;
+    }
+
+    if (hdr->flags.syn) {
+        this->workerSyn(hdr, length, from);
+        return;
+    }
+
+    // data may overtake the SYN it was sent behind
+    if (this->state == kStateListening) {
+        if (!hdr->flags.fin && !hdr->flags.parity) {
+            this->workerEarlyData(packet, length, from);
+        }
+        return;
+    }
+
+    // everything else needs to come from whoever we're talking to
+    if (from.sin_addr.s_addr != this->peer.sin_addr.s_addr || from.sin_port != this->peer.sin_port) {
+        return;
+    }
+
+    this->lastHeard = std::chrono::steady_clock::now();
+
+    if (hdr->flags.fin) {
+        this->workerFin(hdr);
+    } else if (this->state != kStateEstablished) {
+        return;
+    } else if (hdr->flags.parity) {
+        this->workerParity(reinterpret_cast<const SenderParityPacket*>(packet), length);
+    } else {
+        this->workerData(hdr, packet + sizeof(SenderPacketHeader), length - sizeof(SenderPacketHeader));
+    }
+}
+
+/**
+ * @brief Handles a SYN: the first one establishes the connection, and retransmissions of it get
+ * the same SYN-ACK again.
+*/
+void ReceiverSocket::workerSyn(const SenderPacketHeader* hdr, size_t length, const struct sockaddr_in& from)
+{
+    if (this->state != kStateListening) {
+        const bool samePeer = (from.sin_addr.s_addr == this->peer.sin_addr.s_addr) &&
+            (from.sin_port == this->peer.sin_port);
+
+        if (samePeer && hdr->seq == this->synSeq && this->state == kStateEstablished) {
+            this->workerSend(&this->synAck, this->synAckLength);
+        }
+        return;
+    }
+
+    this->peer = from;
+    this->synSeq = hdr->seq;
+    this->expected = hdr->seq;
+    this->synTime = std::chrono::steady_clock::now();
+    this->lastHeard = this->synTime;
+
+    this->workerNegotiate(reinterpret_cast<const char*>(hdr), length);
+
+    // build the SYN-ACK; it's kept around in case it needs to be sent again
+    memset(&this->synAck, 0, sizeof(ReceiverSynAckPacket));
+
+    this->synAck.header.flags.magic = kFlagsMagic;
+    this->synAck.header.flags.syn = 1;
+    this->synAck.header.flags.ack = 1;
+    this->synAck.header.receiveWindow = this->advertised;
+    this->synAck.header.ackSeq = hdr->seq;
+
+    // only senders that asked for options get an option block back
+    this->synAckLength = sizeof(ReceiverPacketHeader);
+
+    if (length >= sizeof(SenderSynOptionsPacket)) {
+        this->synAck.options = this->options;
+        this->synAck.options.magic = kSynOptionsMagic;
+        this->synAckLength = sizeof(ReceiverSynAckPacket);
+    }
+
+    this->state = kStateEstablished;
+    this->workerSend(&this->synAck, this->synAckLength);
+
+    // now that we know where the stream starts, handle any early data that beat the SYN here
+    std::vector<EarlyPacket> held;
+    held.swap(this->early);
+
+    if (this->options.flags & kSynOptionEarlyData) {
+        for (const auto& packet : held) {
+            this->workerHandlePacket(packet.data.data(), packet.data.size(), packet.from);
+        }
+    }
+}
+
+/**
+ * @brief Holds on to a data packet received before the SYN. No more than a window's worth is kept;
+ * anything beyond that would be dropped anyways.
+*/
+void ReceiverSocket::workerEarlyData(const char* packet, size_t length, const struct sockaddr_in& from)
+{
+    if (!(this->acceptOptions & kSynOptionEarlyData) || this->early.size() >= this->window) {
+        return;
+    }
+
+    EarlyPacket held;
+    held.from = from;
+    held.data.assign(packet, packet + length);
+
+    this->early.push_back(std::move(held));
+}
+
+/**
+ * @brief Decides which of the options the sender asked for are accepted, and sets them up.
+*/
+void ReceiverSocket::workerNegotiate(const char* packet, size_t length)
+{
+    memset(&this->options, 0, sizeof(SynOptions));
+
+    if (length < sizeof(SenderSynOptionsPacket)) {
+        return;
+    }
+
+    const auto& requested = reinterpret_cast<const SenderSynOptionsPacket*>(packet)->options;
+    if (requested.magic != kSynOptionsMagic) {
+        return;
+    }
+
+    DWORD flags = requested.flags & this->acceptOptions;
+
+    // compression: we need to be able to hold a whole block
+    if (flags & kSynOptionCompression) {
+        const size_t blockSize = max((size_t) requested.compressionBlockSize, kMaxPayloadSize);
+
+        if (!requested.compressionBlockSize || blockSize > Compressor::kMaxBlockSize) {
+            flags &= ~kSynOptionCompression;
+        } else {
+            this->options.compressionBlockSize = requested.compressionBlockSize;
+
+            this->compressIn.resize(sizeof(CompressedBlockHeader) + Compressor::compressBound(blockSize));
+            this->compressOut.resize(blockSize);
+        }
+    }
+
+    // FEC: parity doesn't say whether the packets it rebuilds were compressed
+    if (flags & kSynOptionFec) {
+        const size_t n = requested.fecDataCount, k = requested.fecParityCount;
+
+        if ((flags & kSynOptionCompression) || !n || !k || (n + k) > Fec::kMaxSymbols || n >= this->window) {
+            flags &= ~kSynOptionFec;
+        } else {
+            this->fec = std::make_unique<Fec>(n, k);
+
+            this->options.fecDataCount = requested.fecDataCount;
+            this->options.fecParityCount = requested.fecParityCount;
+
+            // packets of a block that were already delivered are needed to rebuild the rest of
+            // it, so the sender mustn't get far enough ahead to overwrite them
+            this->advertised = (DWORD) (this->window - n);
+        }
+    }
+
+    // early data: the sender only sends it without any options that change the packetization
+    if ((flags & kSynOptionEarlyData) && requested.earlyData &&
+        !(requested.flags & (kSynOptionFec | kSynOptionCompression | kSynOptionResume))) {
+        this->options.earlyData = requested.earlyData;
+    } else {
+        flags &= ~kSynOptionEarlyData;
+    }
+
+    // ack frequency: hold back acks no longer than the sender can stand, but ack at least twice
+    // per window so it never has to wait for us
+    this->ackEvery = 1;
+    this->ackDelay = 0;
+
+    if (flags & kSynOptionAckFrequency) {
+        this->ackEvery = min(min((size_t) requested.ackEvery, this->maxAckEvery), max((size_t) this->advertised / 2, (size_t) 1));
+        this->ackDelay = min(requested.ackDelay, this->maxAckDelay);
+
+        if (this->ackEvery <= 1) {
+            this->ackEvery = 1;
+            this->ackDelay = 0;
+            flags &= ~kSynOptionAckFrequency;
+        } else {
+            this->options.ackEvery = (WORD) this->ackEvery;
+            this->options.ackDelay = this->ackDelay;
+        }
+    }
+
+    this->options.flags = flags;
+}
+
+/**
+ * @brief Handles a FIN. Since the sender only closes once everything was acknowledged, all data
+ * has arrived at this point; it's flushed to the output before the FIN-ACK goes out, which then
+ * carries the checksum of the stream.
+*/
+void ReceiverSocket::workerFin(const SenderPacketHeader* hdr)
+{
+    // missing something (can't happen with a well behaved sender)
+    if (hdr->seq != this->expected) {
+        this->workerSendAck();
+        return;
+    }
+
+    if (this->state == kStateEstablished) {
+        if (this->compressRemaining) {
+            throw SocketError(SocketError::kStatusRecvFailed, "stream ends in the middle of a compressed block");
+        }
+
+        this->writeFinish();
+
+        this->finTime = std::chrono::steady_clock::now();
+        this->ackArmed = false;
+        this->state = kStateClosed;
+
+        SetEvent(this->closedEvent);
+    }
+
+    ReceiverPacketHeader finAck = { 0 };
+    finAck.flags.magic = kFlagsMagic;
+    finAck.flags.fin = 1;
+    finAck.flags.ack = 1;
+    finAck.receiveWindow = this->crc;
+    finAck.ackSeq = hdr->seq + 1;
+
+    this->workerSend(&finAck, sizeof(finAck));
+}
+
+/**
+ * @brief Puts a data packet into the ring, and delivers whatever is in order now.
+*/
+void ReceiverSocket::workerData(const SenderPacketHeader* hdr, const char* data, size_t length)
+{
+    const DWORD seq = hdr->seq;
+    this->stats.packets++;
+
+    // the ack for this was lost, or it's just too far ahead: tell the sender where we are
+    if ((seq - this->expected) >= this->advertised) {
+        if (seq < this->expected) {
+            this->stats.duplicates++;
+        }
+        this->workerSendAck();
+        return;
+    }
+
+    const size_t index = seq % this->window;
+    const uint64_t bit = (1ULL << (index % 64));
+
+    if (this->present[index / 64] & bit) {
+        this->stats.duplicates++;
+        this->workerSendAck();
+        return;
+    }
+
+    auto& slot = this->ring[index];
+    slot.length = (WORD) length;
+    slot.compressed = hdr->flags.compressed;
+    memcpy(slot.data, data, length);
+
+    this->present[index / 64] |= bit;
+
+    if (seq != this->expected) {
+        this->stats.outOfOrder++;
+    }
+    if (this->fec) {
+        this->workerFecTry(seq);
+    }
+
+    // ack right away if something is missing (so the sender learns of it quickly) or a hole was
+    // just filled; otherwise, only once enough packets have come in
+    const size_t advanced = this->workerAdvance();
+    this->pendingAcks += advanced;
+
+    if (advanced != 1 || this->pendingAcks >= this->ackEvery) {
+        this->workerSendAck();
+    }
+}
+
+/**
+ * @brief Stores a parity packet for a block that's missing data, and rebuilds what's missing if
+ * possible.
+*/
+void ReceiverSocket::workerParity(const SenderParityPacket* packet, size_t length)
+{
+    if (!this->fec || length < sizeof(SenderParityPacket)) {
+        return;
+    }
+
+    const DWORD start = packet->header.seq;
+    const size_t count = packet->fec.dataCount, index = packet->fec.index;
+    const size_t symbolLen = packet->fec.symbolLen;
+
+    if (!count || count > this->fec->getDataCount() || index >= this->fec->getParityCount() ||
+        !symbolLen || symbolLen > (kMaxPayloadSize + 2) || (length - sizeof(SenderParityPacket)) < symbolLen) {
+        return;
+    }
+
+    // block was already delivered, or is nowhere near the window
+    if ((DWORD) (start + count - 1 - this->expected) >= this->advertised) {
+        return;
+    }
+
+    auto& block = this->fecBlocks[start];
+    if (block.parity.empty()) {
+        block.count = count;
+        block.symbolLen = symbolLen;
+        block.parity.resize(this->fec->getParityCount() * symbolLen);
+        block.present.resize(this->fec->getParityCount(), false);
+    } else if (block.count != count || block.symbolLen != symbolLen) {
+        return;
+    }
+
+    memcpy(block.parity.data() + (index * symbolLen), packet->data, symbolLen);
+    block.present[index] = true;
+
+    if (this->workerFecTry(start) && this->workerAdvance()) {
+        this->workerSendAck();
+    }
+}
+
+/**
+ * @brief Rebuilds the missing packets of the FEC block containing the given sequence number, if
+ * enough parity was received for it.
+ *
+ * @return Whether any packets were rebuilt
+*/
+bool ReceiverSocket::workerFecTry(DWORD seq)
+{
+    uint8_t* data[Fec::kMaxSymbols];
+    uint8_t* parity[Fec::kMaxSymbols];
+    bool dataPresent[Fec::kMaxSymbols], parityPresent[Fec::kMaxSymbols];
+
+    // find the block
+    auto it = this->fecBlocks.upper_bound(seq);
+    if (it == this->fecBlocks.begin()) {
+        return false;
+    }
+    --it;
+
+    const DWORD start = it->first;
+    auto& block = it->second;
+
+    if ((seq - start) >= block.count) {
+        return false;
+    }
+
+    // packets before the expected one were delivered, but are still in the ring
+    size_t missing = 0, available = 0;
+
+    for (size_t i = 0; i < block.count; i++) {
+        const DWORD s = start + (DWORD) i;
+        const size_t index = s % this->window;
+
+        dataPresent[i] = ((s - this->expected) >= this->advertised) ||
+            (this->present[index / 64] & (1ULL << (index % 64)));
+        missing += !dataPresent[i];
+    }
+    for (size_t j = 0; j < block.present.size(); j++) {
+        parityPresent[j] = block.present[j];
+        parity[j] = block.parity.data() + (j * block.symbolLen);
+        available += parityPresent[j];
+    }
+
+    if (!missing) {
+        this->fecBlocks.erase(it);
+        return false;
+    } else if (missing > available) {
+        return false;
+    }
+
+    // symbols are the 16-bit payload length followed by the payload
+    this->fecScratch.assign(block.count * block.symbolLen, 0);
+
+    for (size_t i = 0; i < block.count; i++) {
+        data[i] = this->fecScratch.data() + (i * block.symbolLen);
+
+        if (dataPresent[i]) {
+            const auto& slot = this->ring[(start + i) % this->window];
+            const size_t len = min((size_t) slot.length, block.symbolLen - 2);
+
+            data[i][0] = (uint8_t) (slot.length & 0xFF);
+            data[i][1] = (uint8_t) ((slot.length >> 8) & 0xFF);
+            memcpy(data[i] + 2, slot.data, len);
+        }
+    }
+
+    if (!this->fec->reconstruct(data, dataPresent, parity, parityPresent, block.count, block.symbolLen)) {
+        return false;
+    }
+
+    // put the rebuilt packets in the ring as if they had arrived
+    bool rebuilt = false;
+
+    for (size_t i = 0; i < block.count; i++) {
+        const size_t len = data[i][0] | (data[i][1] << 8);
+        if (dataPresent[i] || len > kMaxPayloadSize || (len + 2) > block.symbolLen) {
+            continue;
+        }
+
+        const size_t index = (start + i) % this->window;
+        auto& slot = this->ring[index];
+
+        slot.length = (WORD) len;
+        slot.compressed = 0;
+        memcpy(slot.data, data[i] + 2, len);
+
+        this->present[index / 64] |= (1ULL << (index % 64));
+        this->stats.recovered++;
+        rebuilt = true;
+    }
+
+    this->fecBlocks.erase(start);
+    return rebuilt;
+}
+
+/**
+ * @brief Delivers the run of packets at the head of the ring, and moves the head past them.
+ *
+ * The run is found a bitmap word at a time: the trailing ones of the word (shifted so that the
+ * head is bit 0) are all packets that can be delivered.
+ *
+ * @return Number of packets delivered
+*/
+size_t ReceiverSocket::workerAdvance()
+{
+    size_t total = 0;
+
+    while (true) {
+        const size_t index = this->expected % this->window;
+        const size_t shift = index % 64;
+
+        const uint64_t word = ~(this->present[index / 64] >> shift);
+
+        unsigned long firstMissing;
+        size_t run = _BitScanForward64(&firstMissing, word) ? firstMissing : 64;
+        run = min(run, min(64 - shift, this->window - index));
+
+        if (!run) {
+            break;
+        }
+
+        for (size_t i = 0; i < run; i++) {
+            this->workerDeliver(this->ring[index + i]);
+        }
+
+        const uint64_t mask = (run == 64) ? ~0ULL : (((1ULL << run) - 1) << shift);
+        this->present[index / 64] &= ~mask;
+
+        this->expected += (DWORD) run;
+        total += run;
+    }
+
+    // parity of blocks that are complete now is of no use anymore
+    while (!this->fecBlocks.empty()) {
+        auto it = this->fecBlocks.begin();
+        if ((DWORD) (it->first + it->second.count - 1 - this->expected) < this->advertised) {
+            break;
+        }
+        this->fecBlocks.erase(it);
+    }
+
+    return total;
+}
+
+/**
+ * @brief Hands the payload of an in-order packet to the output; parts of compressed blocks are
+ * collected until the block is complete.
+*/
+void ReceiverSocket::workerDeliver(const Slot& slot)
+{
+    if (!slot.compressed) {
+        if (this->compressRemaining) {
+            throw SocketError(SocketError::kStatusRecvFailed, "compressed block is cut short");
+        }
+
+        this->emit(slot.data, slot.length);
+        return;
+    } else if (!this->isCompressionEnabled()) {
+        throw SocketError(SocketError::kStatusRecvFailed, "compressed packet without compression");
+    }
+
+    const char* data = slot.data;
+    size_t length = slot.length;
+
+    // first packet of the block starts with its header
+    if (!this->compressRemaining) {
+        if (length < sizeof(CompressedBlockHeader)) {
+            throw SocketError(SocketError::kStatusRecvFailed, "compressed block header is cut short");
+        }
+
+        auto hdr = reinterpret_cast<const CompressedBlockHeader*>(data);
+        if (!hdr->compressedLength || hdr->rawLength > this->compressOut.size() ||
+            (sizeof(CompressedBlockHeader) + hdr->compressedLength) > this->compressIn.size()) {
+            throw SocketError(SocketError::kStatusRecvFailed, "invalid compressed block header");
+        }
+
+        this->compressInLen = 0;
+        this->compressRemaining = sizeof(CompressedBlockHeader) + hdr->compressedLength;
+    }
+
+    if (length > this->compressRemaining) {
+        throw SocketError(SocketError::kStatusRecvFailed, "compressed block overruns its length");
+    }
+
+    memcpy(this->compressIn.data() + this->compressInLen, data, length);
+    this->compressInLen += length;
+    this->compressRemaining -= length;
+
+    if (this->compressRemaining) {
+        return;
+    }
+
+    // whole block is here: decompress it
+    auto hdr = reinterpret_cast<const CompressedBlockHeader*>(this->compressIn.data());
+
+    const size_t raw = Compressor::decompress(this->compressIn.data() + sizeof(CompressedBlockHeader),
+        hdr->compressedLength, this->compressOut.data(), hdr->rawLength);
+    if (raw != hdr->rawLength) {
+        throw SocketError(SocketError::kStatusRecvFailed, "compressed block has the wrong length");
+    }
+
+    if (hdr->filter == kCompressionFilterDelta32) {
+        Compressor::deltaDecode32(this->compressOut.data(), raw);
+    } else if (hdr->filter != kCompressionFilterNone) {
+        throw SocketError(SocketError::kStatusRecvFailed, "unknown compression filter");
+    }
+
+    this->emit(this->compressOut.data(), raw);
+}
+
+/**
+ * @brief Acknowledges everything delivered so far.
+*/
+void ReceiverSocket::workerSendAck()
+{
+    ReceiverPacketHeader ack = { 0 };
+    ack.flags.magic = kFlagsMagic;
+    ack.flags.ack = 1;
+    ack.receiveWindow = this->advertised;
+    ack.ackSeq = this->expected;
+
+    this->workerSend(&ack, sizeof(ack));
+
+    this->pendingAcks = 0;
+    this->ackArmed = false;
+    this->stats.acks++;
+}
+
+/**
+ * @brief Sends a packet to the sender.
+*/
+void ReceiverSocket::workerSend(const void* data, size_t length)
+{
+    int err = sendto(this->sock, (const char*) data, (int) length, 0, (const struct sockaddr*)&this->peer, sizeof(this->peer));
+
+    // the socket buffer being full is as good as the packet getting lost
+    if (err == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
+        throw SocketError(SocketError::kStatusSendFailed, WSAGetLastError());
+    }
+}
+
+/**
+ * @brief Marks the connection as broken, and wakes up whoever is waiting on it.
+*/
+void ReceiverSocket::workerAbort(const SocketError& e)
+{
+    this->abortError = std::make_unique<SocketError>(e);
+    this->state = kStateFailed;
+
+    SetEvent(this->abortEvent);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Passes a piece of the data stream on to the output file and the callback.
+*/
+void ReceiverSocket::emit(const void* data, size_t length)
+{
+    this->crc = this->checksum.update(this->crc, data, length);
+    this->bytesReceived += length;
+
+    if (this->file != INVALID_HANDLE_VALUE) {
+        this->writeAppend(static_cast<const char*>(data), length);
+    }
+    if (this->dataCallback) {
+        this->dataCallback(this, data, length);
+    }
+}
+
+/**
+ * @brief Copies data into the current write buffer; full buffers are written out, and the next
+ * one is used as soon as its previous write completed.
+*/
+void ReceiverSocket::writeAppend(const char* data, size_t length)
+{
+    while (length) {
+        auto& buf = this->writes[this->writeCurrent];
+
+        const size_t chunk = min(length, kWriteSize - buf.used);
+        memcpy(buf.data + buf.used, data, chunk);
+
+        buf.used += chunk;
+        data += chunk;
+        length -= chunk;
+
+        if (buf.used == kWriteSize) {
+            this->writeSubmit(buf, kWriteSize);
+
+            this->writeCurrent = (this->writeCurrent + 1) % kWriteBuffers;
+            this->writeWait(this->writes[this->writeCurrent]);
+        }
+    }
+}
+
+/**
+ * @brief Starts writing a buffer to the end of the file.
+ *
+ * Disk space is reserved well ahead of the writes, so the file doesn't end up in lots of small
+ * fragments.
+*/
+void ReceiverSocket::writeSubmit(WriteBuffer& buf, size_t length)
+{
+    assert(!(length % kWriteAlignment));
+
+    if ((this->fileOffset + length) > this->fileAllocated) {
+        this->fileAllocated = this->fileOffset + length + kPreallocateSize;
+
+        FILE_ALLOCATION_INFO info;
+        info.AllocationSize.QuadPart = (LONGLONG) this->fileAllocated;
+
+        // this is only a hint; writes extend the file either way
+        SetFileInformationByHandle(this->file, FileAllocationInfo, &info, sizeof(info));
+    }
+
+    buf.overlapped.Offset = (DWORD) (this->fileOffset & 0xFFFFFFFF);
+    buf.overlapped.OffsetHigh = (DWORD) (this->fileOffset >> 32);
+
+    if (!WriteFile(this->file, buf.data, (DWORD) length, nullptr, &buf.overlapped) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        throw SocketError(SocketError::kStatusSystemError, "WriteFile(): " + std::to_string(GetLastError()));
+    }
+
+    buf.pending = true;
+    this->fileOffset += length;
+}
+
+/**
+ * @brief Waits for a buffer's write (if any) to complete, so it can be filled again.
+*/
+void ReceiverSocket::writeWait(WriteBuffer& buf)
+{
+    if (buf.pending) {
+        DWORD written;
+
+        if (!GetOverlappedResult(this->file, &buf.overlapped, &written, true)) {
+            throw SocketError(SocketError::kStatusSystemError, "WriteFile(): " + std::to_string(GetLastError()));
+        }
+        buf.pending = false;
+    }
+
+    buf.used = 0;
+}
+
+/**
+ * @brief Writes out the last partial buffer and waits for all writes to complete. The last write
+ * is padded to the alignment, so the file is truncated to its actual length afterwards.
+*/
+void ReceiverSocket::writeFinish()
+{
+    if (this->file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    auto& last = this->writes[this->writeCurrent];
+    if (last.used) {
+        const size_t padded = ((last.used + kWriteAlignment - 1) / kWriteAlignment) * kWriteAlignment;
+        memset(last.data + last.used, 0, padded - last.used);
+
+        this->writeSubmit(last, padded);
+    }
+
+    for (auto& buf : this->writes) {
+        this->writeWait(buf);
+    }
+
+    FILE_END_OF_FILE_INFO eof;
+    eof.EndOfFile.QuadPart = (LONGLONG) this->bytesReceived;
+
+    if (!SetFileInformationByHandle(this->file, FileEndOfFileInfo, &eof, sizeof(eof))) {
+        throw SocketError(SocketError::kStatusSystemError, "SetFileInformationByHandle(): " + std::to_string(GetLastError()));
+    }
+}
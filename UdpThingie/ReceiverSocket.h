@@ -0,0 +1,338 @@
+#ifndef RECEIVERSOCKET_H
+#define RECEIVERSOCKET_H
+
+#include "SenderSocket.h"
+#include "PacketTypes.h"
+#include "Checksum.h"
+
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <atomic>
+
+class Fec;
+class PageArena;
+
+namespace __fucker {
+    DWORD WINAPI ReceiverWorkerEntry(LPVOID);
+}
+
+/**
+ * @brief Receiving end of the protocol: accepts a single connection from a `SenderSocket` and
+ * reassembles its data stream.
+ *
+ * Packets are placed in a ring with one slot per packet of the window, and a bitmap of which
+ * slots are filled; whenever the packet at the head of the ring arrives, the run of filled slots
+ * following it is found a word of the bitmap at a time, and handed to the output in one go.
+ *
+ * Acknowledgements are cumulative. If the sender allows it, they're also coalesced: only every few
+ * in-order packets (or after a short delay) is one sent. Anything unusual (a packet arriving out of
+ * order, a duplicate, or a hole in the stream being filled) is acknowledged right away, so the
+ * sender finds out about losses as quickly as it otherwise would.
+ *
+ * The stream is written to a file with large, sector aligned writes that bypass the cache and
+ * are kept in flight while more data is received; or it's passed to a callback. On close, the
+ * CRC32 of the stream is sent back in the FIN-ACK's window field.
+ *
+ * FEC and compression are supported; resuming is not, so such transfers always start over. Since
+ * parity doesn't cover the compressed flag of a packet, FEC is declined if compression is used.
+ *
+ * Data may arrive before the SYN it follows (if the sender sends early data, and the SYN was lost
+ * or reordered); it's held on to until the SYN shows up.
+*/
+class ReceiverSocket {
+    friend DWORD WINAPI __fucker::ReceiverWorkerEntry(LPVOID);
+
+public:
+    using SocketError = SenderSocket::SocketError;
+
+    /// Largest packet the sender produces
+    constexpr static const size_t kMaxPacketSize = SenderSocket::kMaxPacketSize;
+    /// Largest payload of a data packet
+    constexpr static const size_t kMaxPayloadSize = kMaxPacketSize - sizeof(SenderPacketHeader);
+    /// Default limit on the number of in-order packets acknowledged together
+    constexpr static const size_t kDefaultAckEvery = 16;
+    /// Default limit on how long an acknowledgement is held back (in usec)
+    constexpr static const DWORD kDefaultAckDelay = (25 * 1000);
+    /// The connection is dropped if nothing was heard from the sender for this long (in msec)
+    constexpr static const DWORD kIdleTimeout = (30 * 1000);
+    /// Options accepted by default
+    constexpr static const DWORD kDefaultOptions = (kSynOptionFec | kSynOptionCompression | kSynOptionAckFrequency | kSynOptionEarlyData);
+
+    /// Amount of data written to the output file at once
+    constexpr static const size_t kWriteSize = (1024 * 1024);
+    /// Number of write buffers; all but the one being filled may be in flight
+    constexpr static const size_t kWriteBuffers = 4;
+    /// Writes to the output file are padded to a multiple of this (the largest common sector size)
+    constexpr static const size_t kWriteAlignment = 4096;
+    /// Disk space for the output file is reserved in chunks of this size
+    constexpr static const uint64_t kPreallocateSize = (1024ULL * 1024 * 256);
+
+    /**
+     * @brief Invoked on the worker thread with each piece of the data stream, in order.
+     */
+    using DataCallback = std::function<void(ReceiverSocket*, const void*, size_t)>;
+
+public:
+    ReceiverSocket();
+    virtual ~ReceiverSocket() noexcept(false);
+
+    void listen(uint16_t port, size_t window);
+    void waitForClose();
+
+    void setOutput(const std::string& path);
+    void setDataCallback(DataCallback callback);
+    void setAckPolicy(size_t every, DWORD delay);
+    void setOptions(DWORD flags);
+
+    /// Number of bytes of the data stream received so far
+    uint64_t getBytesReceived() const
+    {
+        return this->bytesReceived;
+    }
+    /// CRC32 of the data stream received so far
+    uint32_t getChecksum() const
+    {
+        return this->crc;
+    }
+    /// Whether FEC is in use for the connection
+    bool isFecEnabled() const
+    {
+        return this->fec != nullptr;
+    }
+    /// Whether compression is in use for the connection
+    bool isCompressionEnabled() const
+    {
+        return (this->options.flags & kSynOptionCompression) != 0;
+    }
+
+    /// time at which the SYN was received
+    std::chrono::steady_clock::time_point getSynTime() const
+    {
+        return this->synTime;
+    }
+    /// time at which the FIN was received
+    std::chrono::steady_clock::time_point getFinTime() const
+    {
+        return this->finTime;
+    }
+
+private:
+    /**
+     * @brief A packet in the reassembly ring
+     */
+    struct Slot {
+        /// length of the payload
+        WORD length;
+        /// whether the payload is part of a compressed block
+        BYTE compressed;
+        BYTE reserved;
+        /// payload
+        char data[kMaxPayloadSize];
+    };
+
+    /**
+     * @brief Parity received for an FEC block that is missing packets
+     */
+    struct FecBlock {
+        /// number of data packets in the block
+        size_t count = 0;
+        /// length of each symbol
+        size_t symbolLen = 0;
+        /// parity symbols, by index
+        std::vector<uint8_t> parity;
+        /// which parity symbols were received
+        std::vector<bool> present;
+    };
+
+    /**
+     * @brief Buffer for writing to the output file
+     */
+    struct WriteBuffer {
+        /// start of the buffer (in the write arena)
+        char* data = nullptr;
+        /// bytes filled in so far
+        size_t used = 0;
+        /// write in flight, if any
+        OVERLAPPED overlapped = { 0 };
+        bool pending = false;
+    };
+
+    /**
+     * @brief Data packet received before the SYN
+     */
+    struct EarlyPacket {
+        /// who sent it
+        struct sockaddr_in from;
+        /// the whole packet
+        std::vector<char> data;
+    };
+
+    /**
+     * @brief Connection state, as driven by the worker
+     */
+    enum State {
+        /// waiting for a SYN
+        kStateListening,
+        /// SYN received; data is being received
+        kStateEstablished,
+        /// FIN received; the FIN-ACK is sent again if needed
+        kStateClosed,
+        /// connection was aborted due to an error
+        kStateFailed,
+    };
+
+public:
+    /**
+     * @brief Counters for the connection
+     */
+    struct Stats {
+        /// data packets received
+        size_t packets = 0;
+        /// packets received that were already received before
+        size_t duplicates = 0;
+        /// packets received ahead of a missing one
+        size_t outOfOrder = 0;
+        /// packets rebuilt from parity
+        size_t recovered = 0;
+        /// acknowledgements sent
+        size_t acks = 0;
+    };
+
+    const Stats& getStats() const
+    {
+        return this->stats;
+    }
+
+private:
+    void setUpSocket(uint16_t port);
+    void setUpOutput();
+
+    void workerMain();
+    void workerReadPackets();
+    void workerHandlePacket(const char* packet, size_t length, const struct sockaddr_in& from);
+    void workerSyn(const SenderPacketHeader* hdr, size_t length, const struct sockaddr_in& from);
+    void workerNegotiate(const char* packet, size_t length);
+    void workerEarlyData(const char* packet, size_t length, const struct sockaddr_in& from);
+    void workerFin(const SenderPacketHeader* hdr);
+    void workerData(const SenderPacketHeader* hdr, const char* data, size_t length);
+    void workerParity(const SenderParityPacket* packet, size_t length);
+    bool workerFecTry(DWORD seq);
+    size_t workerAdvance();
+    void workerDeliver(const Slot& slot);
+    void workerSendAck();
+    void workerSend(const void* data, size_t length);
+    void workerAbort(const SocketError& e);
+
+    void emit(const void* data, size_t length);
+    void writeAppend(const char* data, size_t length);
+    void writeSubmit(WriteBuffer& buf, size_t length);
+    void writeWait(WriteBuffer& buf);
+    void writeFinish();
+
+private:
+    /// socket we listen on
+    SOCKET sock = INVALID_SOCKET;
+    /// signalled when the socket is readable
+    HANDLE readEvent = INVALID_HANDLE_VALUE;
+    /// signalled when the worker should quit
+    HANDLE quitEvent = INVALID_HANDLE_VALUE;
+    /// signalled once the FIN was received and all data was written out
+    HANDLE closedEvent = INVALID_HANDLE_VALUE;
+    /// signalled if the connection is aborted
+    HANDLE abortEvent = INVALID_HANDLE_VALUE;
+    /// the worker thread
+    HANDLE workerThread = INVALID_HANDLE_VALUE;
+
+    /// current state of the connection
+    std::atomic<State> state = kStateListening;
+    /// error that caused the connection to be aborted, if any
+    std::unique_ptr<SocketError> abortError;
+
+    /// sender of the connection (once a SYN was received)
+    struct sockaddr_in peer = { 0 };
+    /// sequence number of the SYN, and the SYN-ACK sent in response to it
+    DWORD synSeq = 0;
+    ReceiverSynAckPacket synAck = { 0 };
+    /// length of the SYN-ACK (it only includes options if the sender asked for any)
+    size_t synAckLength = 0;
+    /// when the SYN and FIN were received
+    std::chrono::steady_clock::time_point synTime, finTime;
+    /// when the last packet was received from the sender
+    std::chrono::steady_clock::time_point lastHeard;
+    /// data packets received before the SYN; handled once it arrives, if early data is accepted
+    std::vector<EarlyPacket> early;
+
+    /// options we're willing to accept, and what was agreed on
+    DWORD acceptOptions = kDefaultOptions;
+    SynOptions options = { 0 };
+
+    /// number of slots in the ring
+    size_t window = 0;
+    /// window advertised to the sender; smaller than the ring when FEC is on
+    DWORD advertised = 0;
+    /// memory backing the ring
+    std::unique_ptr<PageArena> ringArena;
+    /// reassembly ring; sequence number `n` goes in slot `n % window`
+    Slot* ring = nullptr;
+    /// bit set for every slot that holds a packet that hasn't been delivered yet
+    std::vector<uint64_t> present;
+    /// next sequence number to be delivered
+    DWORD expected = 0;
+
+    /// in-order packets that haven't been acknowledged yet
+    size_t pendingAcks = 0;
+    /// whether an acknowledgement is due at `ackDeadline`
+    bool ackArmed = false;
+    std::chrono::steady_clock::time_point ackDeadline;
+    /// number of packets acknowledged together, and longest delay (in usec), as agreed on
+    size_t ackEvery = 1;
+    DWORD ackDelay = 0;
+    /// most we're willing to agree to for either
+    size_t maxAckEvery = kDefaultAckEvery;
+    DWORD maxAckDelay = kDefaultAckDelay;
+
+    /// FEC decoder, if in use
+    std::unique_ptr<Fec> fec;
+    /// blocks with parity that may be needed to rebuild packets, by first sequence number
+    std::map<DWORD, FecBlock> fecBlocks;
+    /// symbols of the block being rebuilt
+    std::vector<uint8_t> fecScratch;
+
+    /// compressed block being collected
+    std::vector<char> compressIn;
+    /// bytes collected of the current block, and how many are still missing
+    size_t compressInLen = 0, compressRemaining = 0;
+    /// decompressed block
+    std::vector<char> compressOut;
+
+    /// where to write the stream, if anywhere
+    std::string outputPath;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    /// memory backing the write buffers
+    std::unique_ptr<PageArena> writeArena;
+    WriteBuffer writes[kWriteBuffers];
+    /// buffer currently being filled
+    size_t writeCurrent = 0;
+    /// file offset of the next write, and the amount of disk space reserved
+    uint64_t fileOffset = 0, fileAllocated = 0;
+
+    /// invoked with the data stream
+    DataCallback dataCallback;
+
+    /// CRC32 of the data stream so far
+    Checksum checksum;
+    std::atomic<uint32_t> crc = 0;
+    /// bytes of the data stream delivered so far
+    std::atomic<uint64_t> bytesReceived = 0;
+
+    Stats stats;
+};
+
+#endif
@@ -0,0 +1,397 @@
+#include "pch.h"
+#include "RioPacketIo.h"
+
+#include <cassert>
+
+namespace {
+/// request context of sends made straight out of the registered arena
+constexpr static const size_t kArenaContext = SIZE_MAX;
+/// number of send completions dequeued at once
+constexpr static const size_t kReapBatch = 64;
+}
+
+/**
+ * @brief Tears down the RIO queues and releases all registered buffers.
+*/
+RioPacketIo::~RioPacketIo()
+{
+    // closing the socket also frees its request queue
+    if (this->sock != INVALID_SOCKET) {
+        closesocket(this->sock);
+        this->sock = INVALID_SOCKET;
+    }
+
+    if (this->sendCq != RIO_INVALID_CQ) {
+        this->rio.RIOCloseCompletionQueue(this->sendCq);
+    }
+    if (this->recvCq != RIO_INVALID_CQ) {
+        this->rio.RIOCloseCompletionQueue(this->recvCq);
+    }
+
+    if (this->arenaId != RIO_INVALID_BUFFERID) {
+        this->rio.RIODeregisterBuffer(this->arenaId);
+    }
+    if (this->buffersId != RIO_INVALID_BUFFERID) {
+        this->rio.RIODeregisterBuffer(this->buffersId);
+    }
+    if (this->buffers) {
+        VirtualFree(this->buffers, 0, MEM_RELEASE);
+        this->buffers = nullptr;
+    }
+
+    if (this->readEvent != INVALID_HANDLE_VALUE) {
+        CloseHandle(this->readEvent);
+        this->readEvent = INVALID_HANDLE_VALUE;
+    }
+}
+
+/**
+ * @brief Creates the socket, connects it to the given address, and sets up the RIO queues.
+ *
+ * @return 0 on success, `SOCKET_ERROR` otherwise (including if RIO isn't available)
+*/
+int RioPacketIo::open(const struct sockaddr_storage* addr)
+{
+    int err;
+
+    // create the socket
+    SOCKET sock = WSASocket(AF_INET, SOCK_DGRAM, IPPROTO_UDP, nullptr, 0, WSA_FLAG_REGISTERED_IO);
+    if (sock == INVALID_SOCKET) {
+        return SOCKET_ERROR;
+    }
+    this->sock = sock;
+
+    // bind it to any local address
+    struct sockaddr_in local = { 0 };
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = INADDR_ANY;
+    local.sin_port = htons(0);
+
+    err = bind(sock, (struct sockaddr*)&local, sizeof(local));
+    if (err == -1) {
+        return SOCKET_ERROR;
+    }
+
+    // set default address to send to
+    err = connect(sock, (struct sockaddr*)addr, sizeof(struct sockaddr_in));
+    if (err != 0) {
+        return SOCKET_ERROR;
+    }
+
+    // receives land in our buffers directly, but the stack still queues datagrams while they're all busy
+    const int kRxBufSz = (32 * 1000 * 1000);
+
+    err = setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char*) &kRxBufSz, sizeof(int));
+    if (err == SOCKET_ERROR) {
+        return SOCKET_ERROR;
+    }
+
+    // get the RIO function table
+    GUID functionTableId = WSAID_MULTIPLE_RIO;
+    DWORD bytes = 0;
+
+    err = WSAIoctl(sock, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &functionTableId, sizeof(GUID),
+        &this->rio, sizeof(this->rio), &bytes, nullptr, nullptr);
+    if (err != 0) {
+        return SOCKET_ERROR;
+    }
+
+    // allocate and register the bounce/receive buffers (page aligned, as RIO likes it)
+    const size_t buffersLen = (kSendSlots + kRecvSlots) * kSlotSize;
+
+    this->buffers = (char*) VirtualAlloc(nullptr, buffersLen, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!this->buffers) {
+        WSASetLastError(WSAENOBUFS);
+        return SOCKET_ERROR;
+    }
+
+    this->buffersId = this->rio.RIORegisterBuffer(this->buffers, (DWORD) buffersLen);
+    if (this->buffersId == RIO_INVALID_BUFFERID) {
+        return SOCKET_ERROR;
+    }
+
+    for (size_t i = 0; i < kSendSlots; i++) {
+        this->freeSlots.push_back(kSendSlots - 1 - i);
+    }
+
+    // receive completions signal the read event; send completions are polled
+    this->readEvent = CreateEvent(nullptr, false, false, nullptr);
+    assert(this->readEvent != INVALID_HANDLE_VALUE);
+
+    RIO_NOTIFICATION_COMPLETION notify = {};
+    notify.Type = RIO_EVENT_COMPLETION;
+    notify.Event.EventHandle = this->readEvent;
+    notify.Event.NotifyReset = FALSE;
+
+    this->recvCq = this->rio.RIOCreateCompletionQueue((DWORD) kRecvSlots, &notify);
+    if (this->recvCq == RIO_INVALID_CQ) {
+        return SOCKET_ERROR;
+    }
+
+    this->sendCq = this->rio.RIOCreateCompletionQueue((DWORD) kMaxOutstandingSends, nullptr);
+    if (this->sendCq == RIO_INVALID_CQ) {
+        return SOCKET_ERROR;
+    }
+
+    this->rq = this->rio.RIOCreateRequestQueue(sock, (ULONG) kRecvSlots, 1, (ULONG) kMaxOutstandingSends, 1,
+        this->recvCq, this->sendCq, nullptr);
+    if (this->rq == RIO_INVALID_RQ) {
+        return SOCKET_ERROR;
+    }
+
+    // post all receives, and ask to be told when the first one completes
+    this->recvResults.resize(kRecvSlots);
+
+    for (size_t i = 0; i < kRecvSlots; i++) {
+        if (this->postReceive(i) == SOCKET_ERROR) {
+            return SOCKET_ERROR;
+        }
+    }
+
+    err = this->rio.RIONotify(this->recvCq);
+    if (err != ERROR_SUCCESS) {
+        WSASetLastError(err);
+        return SOCKET_ERROR;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Registers the caller's packet buffers, so they can be sent from without copying.
+ *
+ * If registration fails, sends keep going through the bounce buffers.
+*/
+void RioPacketIo::registerArena(void* base, size_t length)
+{
+    if (this->arenaId != RIO_INVALID_BUFFERID) {
+        this->rio.RIODeregisterBuffer(this->arenaId);
+        this->arenaId = RIO_INVALID_BUFFERID;
+        this->arena = nullptr;
+    }
+
+    if (!base || !length || length > MAXDWORD) {
+        return;
+    }
+
+    this->arenaId = this->rio.RIORegisterBuffer((char*) base, (DWORD) length);
+    if (this->arenaId != RIO_INVALID_BUFFERID) {
+        this->arena = (char*) base;
+        this->arenaLen = length;
+    }
+}
+
+/**
+ * @brief Queues a datagram to be sent; straight out of the arena, if it's in there.
+*/
+int RioPacketIo::send(const void* data, size_t length)
+{
+    return this->queueSend(data, length, true);
+}
+
+/**
+ * @brief Queues a datagram to be sent out of a bounce buffer, even if it's in the arena.
+*/
+int RioPacketIo::sendCopy(const void* data, size_t length)
+{
+    return this->queueSend(data, length, false);
+}
+
+/**
+ * @brief Queues a datagram to be sent.
+ *
+ * The send is deferred: it's only handed to the kernel when the batch is committed. If all request
+ * queue entries (or bounce buffers) are in use, this waits for earlier sends to complete.
+ *
+ * @param zeroCopy Whether the datagram may be sent straight out of the arena
+*/
+int RioPacketIo::queueSend(const void* data, size_t length, bool zeroCopy)
+{
+    const char* ptr = (const char*) data;
+    const bool inArena = zeroCopy && this->arena && ptr >= this->arena && (ptr + length) <= (this->arena + this->arenaLen);
+
+    if (length > kSlotSize && !inArena) {
+        WSASetLastError(WSAEMSGSIZE);
+        return SOCKET_ERROR;
+    }
+
+    // wait for room; anything deferred has to be committed first, or it'll never complete
+    while (this->outstanding == kMaxOutstandingSends || (!inArena && this->freeSlots.empty())) {
+        if (this->flush() == SOCKET_ERROR) {
+            return SOCKET_ERROR;
+        }
+
+        const int reaped = this->reapSends();
+        if (reaped == SOCKET_ERROR) {
+            return SOCKET_ERROR;
+        } else if (!reaped) {
+            Sleep(0);
+        }
+    }
+
+    // build the buffer descriptor: either in the arena, or a copy in a bounce buffer
+    RIO_BUF buf;
+    size_t context;
+
+    if (inArena) {
+        buf.BufferId = this->arenaId;
+        buf.Offset = (ULONG) (ptr - this->arena);
+        context = kArenaContext;
+    } else {
+        const size_t slot = this->freeSlots.back();
+        this->freeSlots.pop_back();
+
+        memcpy(this->slotData(slot), data, length);
+
+        buf.BufferId = this->buffersId;
+        buf.Offset = (ULONG) (slot * kSlotSize);
+        context = slot;
+    }
+    buf.Length = (ULONG) length;
+
+    if (!this->rio.RIOSend(this->rq, &buf, 1, RIO_MSG_DEFER, (PVOID) context)) {
+        if (!inArena) {
+            this->freeSlots.push_back(context);
+        }
+        return SOCKET_ERROR;
+    }
+
+    this->outstanding++;
+    this->deferred++;
+
+    // don't let the batch grow forever if the worker is busy
+    if (this->deferred >= kMaxDeferred) {
+        return this->flush();
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Commits all deferred sends to the kernel, in a single call.
+*/
+int RioPacketIo::flush()
+{
+    if (!this->deferred) {
+        return 0;
+    }
+
+    if (!this->rio.RIOSend(this->rq, nullptr, 0, RIO_MSG_COMMIT_ONLY, nullptr)) {
+        return SOCKET_ERROR;
+    }
+    this->deferred = 0;
+
+    return (this->reapSends() == SOCKET_ERROR) ? SOCKET_ERROR : 0;
+}
+
+/**
+ * @brief Dequeues completed sends, returning their bounce buffers to the pool.
+ *
+ * @return Number of sends that completed, or `SOCKET_ERROR` if one of them failed
+*/
+int RioPacketIo::reapSends()
+{
+    RIORESULT results[kReapBatch];
+    LONG status = 0;
+
+    const ULONG count = this->rio.RIODequeueCompletion(this->sendCq, results, (ULONG) kReapBatch);
+    if (count == RIO_CORRUPT_CQ) {
+        WSASetLastError(WSAEINVAL);
+        return SOCKET_ERROR;
+    }
+
+    for (ULONG i = 0; i < count; i++) {
+        const size_t context = (size_t) results[i].RequestContext;
+
+        if (context != kArenaContext) {
+            this->freeSlots.push_back(context);
+        }
+        if (results[i].Status) {
+            status = results[i].Status;
+        }
+    }
+
+    assert(this->outstanding >= count);
+    this->outstanding -= count;
+
+    if (status) {
+        WSASetLastError(status);
+        return SOCKET_ERROR;
+    }
+
+    return (int) count;
+}
+
+/**
+ * @brief Posts a receive into the given receive buffer.
+*/
+int RioPacketIo::postReceive(size_t slot)
+{
+    RIO_BUF buf;
+    buf.BufferId = this->buffersId;
+    buf.Offset = (ULONG) ((kSendSlots + slot) * kSlotSize);
+    buf.Length = (ULONG) kSlotSize;
+
+    return this->rio.RIOReceive(this->rq, &buf, 1, 0, (PVOID) slot) ? 0 : SOCKET_ERROR;
+}
+
+/**
+ * @brief Returns the next received datagram.
+ *
+ * Completions are dequeued in batches; while some are left over, the read event is kept signalled
+ * so the worker comes back for them. Once they've all been read, the completion queue is armed
+ * again to signal the event for the next one.
+*/
+int RioPacketIo::receive(void* buf, size_t length)
+{
+    int ret, err;
+
+    if (this->recvNext == this->recvCount) {
+        const ULONG count = this->rio.RIODequeueCompletion(this->recvCq, this->recvResults.data(),
+            (ULONG) this->recvResults.size());
+        if (count == RIO_CORRUPT_CQ) {
+            WSASetLastError(WSAEINVAL);
+            return SOCKET_ERROR;
+        }
+
+        this->recvCount = count;
+        this->recvNext = 0;
+    }
+
+    if (this->recvNext == this->recvCount) {
+        ret = SOCKET_ERROR;
+        WSASetLastError(WSAEWOULDBLOCK);
+        goto beach;
+    }
+
+    {
+        const RIORESULT& result = this->recvResults[this->recvNext++];
+        const size_t slot = (size_t) result.RequestContext;
+
+        if (result.Status) {
+            ret = SOCKET_ERROR;
+            WSASetLastError(result.Status);
+        } else {
+            ret = (int) min((size_t) result.BytesTransferred, length);
+            memcpy(buf, this->slotData(kSendSlots + slot), ret);
+        }
+
+        // the buffer is free again
+        if (this->postReceive(slot) == SOCKET_ERROR) {
+            return SOCKET_ERROR;
+        }
+    }
+
+beach:;
+    if (this->recvNext < this->recvCount) {
+        SetEvent(this->readEvent);
+    } else {
+        err = this->rio.RIONotify(this->recvCq);
+        if (err != ERROR_SUCCESS && err != WSAEALREADY) {
+            WSASetLastError(err);
+            return SOCKET_ERROR;
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,106 @@
+#ifndef RIOPACKETIO_H
+#define RIOPACKETIO_H
+
+#include "PacketIo.h"
+
+#include <MSWSock.h>
+
+#include <vector>
+
+/**
+ * @brief Sends datagrams through Registered I/O (RIO).
+ *
+ * All buffers that are sent from or received into are registered with the stack up front, so the
+ * kernel doesn't need to probe and lock them for every call. Sends are queued with `RIO_MSG_DEFER`
+ * and only handed to the kernel when the batch is committed (on `flush()`, or when enough have
+ * piled up), so a whole burst of packets costs a single system call. Receives are kept posted at
+ * all times, and their completion queue signals the read event.
+ *
+ * Data packets are sent straight out of the socket's send queue, if it was registered with
+ * `registerArena()`; everything else (including retransmissions, whose slot may be reused before
+ * the send completes) goes through a small pool of registered bounce buffers.
+*/
+class RioPacketIo : public PacketIo {
+public:
+    /// Size of each bounce/receive buffer; large enough for any datagram we send or receive
+    constexpr static const size_t kSlotSize = 2048;
+    /// Number of bounce buffers for sends
+    constexpr static const size_t kSendSlots = 64;
+    /// Number of receives kept posted
+    constexpr static const size_t kRecvSlots = 64;
+    /// Maximum number of sends that may be outstanding (i.e. queued or not yet completed)
+    constexpr static const size_t kMaxOutstandingSends = 1024;
+    /// Number of deferred sends after which they're committed, even if the worker hasn't flushed
+    constexpr static const size_t kMaxDeferred = 64;
+
+public:
+    RioPacketIo() = default;
+    virtual ~RioPacketIo();
+
+    int open(const struct sockaddr_storage* addr);
+
+    int send(const void* data, size_t length) override;
+    int sendCopy(const void* data, size_t length) override;
+    int flush() override;
+    int receive(void* buf, size_t length) override;
+
+    void registerArena(void* base, size_t length) override;
+
+    HANDLE getReadEvent() const override
+    {
+        return this->readEvent;
+    }
+
+private:
+    int queueSend(const void* data, size_t length, bool zeroCopy);
+    int reapSends();
+    int postReceive(size_t slot);
+
+    /// Address of the given bounce/receive buffer
+    char* slotData(size_t slot)
+    {
+        return this->buffers + (slot * kSlotSize);
+    }
+
+private:
+    /// the socket
+    SOCKET sock = INVALID_SOCKET;
+    /// signalled by the receive completion queue
+    HANDLE readEvent = INVALID_HANDLE_VALUE;
+
+    /// RIO function pointers
+    RIO_EXTENSION_FUNCTION_TABLE rio = { 0 };
+
+    /// send and receive completion queues
+    RIO_CQ sendCq = RIO_INVALID_CQ, recvCq = RIO_INVALID_CQ;
+    /// request queue for the socket
+    RIO_RQ rq = RIO_INVALID_RQ;
+
+    /// bounce buffers for sends, followed by receive buffers
+    char* buffers = nullptr;
+    /// registration of `buffers`
+    RIO_BUFFERID buffersId = RIO_INVALID_BUFFERID;
+
+    /// caller's packet buffers, if registered
+    char* arena = nullptr;
+    /// size of the arena
+    size_t arenaLen = 0;
+    /// registration of the arena
+    RIO_BUFFERID arenaId = RIO_INVALID_BUFFERID;
+
+    /// bounce buffers not in use
+    std::vector<size_t> freeSlots;
+    /// sends queued or in flight
+    size_t outstanding = 0;
+    /// sends queued with RIO_MSG_DEFER that haven't been committed yet
+    size_t deferred = 0;
+
+    /// receive completions dequeued but not yet read
+    std::vector<RIORESULT> recvResults;
+    /// number of valid entries in `recvResults`
+    size_t recvCount = 0;
+    /// index of the next completion in `recvResults` to hand out
+    size_t recvNext = 0;
+};
+
+#endif
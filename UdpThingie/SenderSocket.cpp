@@ -1,954 +1,2082 @@
-#include "pch.h"
-#include "SenderSocket.h"
-#include "PacketTypes.h"
-
-#include <cassert>
-#include <string>
-#include <sstream>
-#include <unordered_map>
-#include <chrono>
-#include <iostream>
-#include <iomanip>
-#include <algorithm>
-
-using namespace __fucker;
-
-///////////////////////////////////////////////////////////////////////////////////////////////////
-/**
- * @brief Constructs the sender socket.
- * 
- * All secondary threads (stats and worker) are created here, so that if thread creation fails, it
- * will fail early. That makes error handling simpler. These threads are started in a suspended
- * state such that only after the connection is opened will they be started.
- */
-SenderSocket::SenderSocket() noexcept(false)
-{
-    // create various events
-    this->quitEvent = CreateEvent(nullptr, true, false, L"StatsThreadQuit");
-    if (this->quitEvent == (HANDLE)ERROR_INVALID_HANDLE) {
-        std::string msg = "CreateEvent(): " + GetLastError();
-        throw std::runtime_error(msg);
-    }
-
-    this->abortEvent = CreateEvent(nullptr, true, false, L"ConnectionAbort");
-    if (this->abortEvent == (HANDLE)ERROR_INVALID_HANDLE) {
-        std::string msg = "CreateEvent(): " + GetLastError();
-        throw std::runtime_error(msg);
-    }
-
-    this->workerLoopEvent = CreateEvent(nullptr, false, false, nullptr);
-    if (this->workerLoopEvent == (HANDLE)ERROR_INVALID_HANDLE) {
-        std::string msg = "CreateEvent(): " + GetLastError();
-        throw std::runtime_error(msg);
-    }
-
-    // then, the secondary threads
-    this->setUpStatsThread();
-    this->setUpWorkerThread();
-
-    this->constructTime = std::chrono::steady_clock::now();
-}
-
-/**
- * Clean up any dangling resources.
- * 
- * This signals for threads to close gracefully. If they don't, we'll just kill them anyways.
- */
-SenderSocket::~SenderSocket() noexcept(false)
-{
-    // tell the stats/worker thread to go commit sudoku
-    if (!SetEvent(this->quitEvent)) {
-        std::string msg = "SetEvent(): " + GetLastError();
-        throw std::runtime_error(msg);
-    }
-
-    // wait for the stats thread and worker to actually die
-    if (WaitForSingleObject(this->statsThread, 500) != WAIT_OBJECT_0) {
-        std::cerr << "Stats thread failed to exit gracefully; killing it" << std::endl;
-        TerminateThread(this->statsThread, 0); // die bitch
-    }
-    CloseHandle(this->statsThread);
-    this->statsThread = INVALID_HANDLE_VALUE;
-
-    for (size_t i = 0; i < kNumWorkers; i++) {
-        // ignore threads that were never started
-        if (this->workerThread[i] == INVALID_HANDLE_VALUE) {
-            continue;
-        }
-
-        if (WaitForSingleObject(this->workerThread[i], 500) != WAIT_OBJECT_0) {
-            std::cerr << "Worker thread failed to exit gracefully; killing it" << std::endl;
-            TerminateThread(this->workerThread[i], 0);
-        }
-        CloseHandle(this->workerThread[i]);
-        this->workerThread[i] = INVALID_HANDLE_VALUE;
-    }
-
-    // clean up handles
-    CloseHandle(this->quitEvent);
-    CloseHandle(this->abortEvent);
-
-    CloseHandle(this->empty);
-    CloseHandle(this->full);
-    CloseHandle(this->workerLoopEvent);
-
-    this->quitEvent = INVALID_HANDLE_VALUE;
-    this->abortEvent = INVALID_HANDLE_VALUE;
-    this->workerLoopEvent = INVALID_HANDLE_VALUE;
-
-    // close socket if still open
-    if (this->sock != INVALID_SOCKET) {
-        closesocket(this->sock);
-        this->sock = INVALID_SOCKET;
-    }
-}
-
-///////////////////////////////////////////////////////////////////////////////////////////////////
-/**
- * @brief Attempts to open a connection to the remote host.
- */
-void SenderSocket::open(const std::string& host, uint16_t port, size_t window, float rtt, float speed, float loss[2])
-{
-    // sanity checking
-    if (this->isConnected) {
-        throw SocketError(SocketError::kStatusConnected);
-    }
-
-    // resolve address and establish the socket
-    struct sockaddr_storage storage;
-    memset(&storage, 0, sizeof(struct sockaddr_storage));
-
-    SenderSocket::resolve(host, &storage);
-
-    struct sockaddr_in* addr = (struct sockaddr_in*) &storage;
-    addr->sin_port = htons(port);
-
-    this->setUpSocket(&storage);
-    this->hostStr = host;
-
-    // set up the send queue
-    this->queue.reserve(window);
-    for (size_t i = 0; i < window; i++) {
-        this->queue.emplace_back();
-    }
-
-    this->full = CreateSemaphore(NULL, 0, (LONG) window, L"SendQueueFull");
-    this->empty = CreateSemaphore(NULL, 0, (LONG) window, L"SendQueueEmpty");
-
-    // build SYN packet
-    SenderSynPacket syn;
-    memset(&syn, 0, sizeof(SenderSynPacket));
-
-    syn.header.flags.magic = kFlagsMagic;
-    syn.header.flags.syn = 1;
-
-    syn.lp.bufferSize = (DWORD) (window + kMaxRetransmissions); // W+R
-    syn.lp.RTT = rtt;
-    syn.lp.speed = speed;
-    syn.lp.pLoss[0] = loss[0];
-    syn.lp.pLoss[1] = loss[1];
-
-    // prepare internal state, then send the SYN packet
-    this->window = window;
-    this->currentSeq = 0;
-    this->startTime = std::chrono::steady_clock::now();
-    this->rtoDelay = max(kRetransmissionTimeout, (2.0 * ((double) rtt)));
-
-    this->sendPacketRetransmit(&syn, sizeof(SenderSynPacket), kMaxRetransmissionsSYN, true, true, "SYN");
-
-    // if we get here, the connection was successful
-    this->synAckTime = std::chrono::steady_clock::now();
-    this->isConnected = true;
-
-    // set up stats and worker threads
-    for (size_t i = 0; i < kNumWorkers; i++) {
-        if (this->workerThread[i] == INVALID_HANDLE_VALUE) {
-            continue;
-        }
-        ResumeThread(this->workerThread[i]);
-    }
-
-    ResumeThread(this->statsThread);
-}
-
-/**
- * @brief Closes the connection. A FIN packet is sent before the socket is closed.
-*/
-void SenderSocket::close()
-{
-    if (!this->isConnected) {
-        throw SocketError(SocketError::kStatusNotConnected);
-    } else if (this->isClosing) {
-        throw SocketError(SocketError::kStatusNotConnected, "already waiting in close()");
-    }
-    this->isClosing = true;
-
-    // wait for the queue of pending packets to drain
-    while (this->senderBase != this->currentSeq) {
-        WaitForSingleObject(this->workerLoopEvent, max(100, (this->rtoDelay * 1000.f)));
-    }
-
-    // put the socket back into blocking mode
-    WSAEventSelect(this->sock, nullptr, 0);
-
-    u_long no = 0;
-    ioctlsocket(this->sock, FIONBIO, &no);
-
-    // build FIN packet
-    SenderPacketHeader fin;
-    memset(&fin, 0, sizeof(SenderPacketHeader));
-
-    fin.flags.magic = kFlagsMagic;
-    fin.flags.fin = 1;
-
-    // send it
-    this->sendPacketRetransmit(&fin, sizeof(SenderPacketHeader), kMaxRetransmissions, false, true, "FIN");
-
-    // actually close the socket
-    if (this->sock != INVALID_SOCKET) {
-        closesocket(this->sock);
-        this->sock = INVALID_SOCKET;
-    }
-
-    this->isConnected = false;
-
-    // notify threads to terminate
-    if (!SetEvent(this->quitEvent)) {
-        std::string msg = "SetEvent(): " + GetLastError();
-        throw std::runtime_error(msg);
-    }
-}
-
-/**
- * @brief Implements the raw transmit logic that will retransmit a packet a given number of times
- * before giving up.
- * 
- * @param data Packet to send (including header)
- * @param length Length of packet, in bytes
- * @param attempts Number of times to re-try transmitting the packet
- * @param updateRto If the round-trip delay should be updated
- * @param log If true, some detailed info is logged to the console
-*/
-void SenderSocket::sendPacketRetransmit(void* data, size_t length, size_t attempts, bool updateRto, bool log, const std::string& kind)
-{
-    int err;
-    double rto = 0;
-
-    // fixed timeout value (for retransmission)
-    struct timeval timeout = { 0 };
-    timeout.tv_sec = (int)this->rtoDelay;
-    timeout.tv_usec = (int)((this->rtoDelay - ((int64_t)this->rtoDelay)) * 1000 * 1000);
-
-    // receive buffer for ack (and where it came from)
-    static const size_t kReceiveSz = kMaxPacketSize;
-    char receive[kReceiveSz] = { 0 };
-    ReceiverPacketHeader* rxHdr = reinterpret_cast<ReceiverPacketHeader*>(receive);
-
-    struct sockaddr_storage respFrom;
-    socklen_t respFromLen = sizeof(struct sockaddr_storage);
-
-    // fill in outgoing sequence number
-    SenderPacketHeader* hdr = reinterpret_cast<SenderPacketHeader*>(data);
-    hdr->seq = this->currentSeq;
-
-    // retransmit the max amount allowed
-    for (size_t i = 0; i < attempts; i++) {
-        auto sentAt = std::chrono::steady_clock::now();
-
-        // send the packet
-        err = sendto(this->sock, (const char*)data, (int)length, 0, (struct sockaddr*)&this->host,
-            sizeof(struct sockaddr_in));
-        if (err == -1) {
-            throw SocketError(SocketError::kStatusSendFailed, WSAGetLastError());
-        }
-        this->stats.totalBytesSent += (unsigned long)length;
-
-        if (log && this->debug) {
-            auto nowTs = std::chrono::steady_clock::now();
-            double now = std::chrono::duration_cast<std::chrono::milliseconds>(nowTs - this->startTime).count() / 1000.f;
-
-            std::cout << "[" << std::fixed << std::setprecision(3) << std::setw(6) << now << "] --> "
-                      << kind << ' ' << hdr->seq << " (attempt " << (i + 1) << " of "
-                      << attempts << ", RTO " << this->rtoDelay << ")"
-                      << " to "
-                      << this->hostStr << std::endl;
-        }
-
-        // wait for activity on the socket
-        fd_set set;
-        FD_ZERO(&set);
-        FD_SET(this->sock, &set);
-
-        err = select(0, &set, nullptr, nullptr, &timeout);
-        if (err == -1) {
-            throw SocketError(SocketError::kStatusSystemError, WSAGetLastError());
-        }
-        // handle timeouts
-        if (err == 0) {
-            continue;
-        }
-
-        // receive a response
-        err = recvfrom(this->sock, receive, kReceiveSz, 0, (struct sockaddr*)&respFrom, &respFromLen);
-        if (err == -1) {
-            throw SocketError(SocketError::kStatusRecvFailed, WSAGetLastError());
-        }
-        assert(err >= sizeof(ReceiverPacketHeader));
-
-        // if SYN-ACK, update semaphore
-        if (rxHdr->flags.syn && rxHdr->flags.ack) {
-            this->lastReleased = min(this->window, rxHdr->receiveWindow);
-            ReleaseSemaphore(this->empty, (LONG) this->lastReleased, nullptr);
-        }
-
-        // calculate round-trip time for this packet
-        auto receivedAt = std::chrono::steady_clock::now();
-        rto = (std::chrono::duration_cast<std::chrono::milliseconds>(receivedAt - sentAt).count() / 1000.f);
-
-        goto success;
-    }
-
-    // if we get here, max number of retransmissions exhausted
-    throw SocketError(SocketError::kStatusTimeout);
-
-success:;
-    // print how long this song and dance took
-    auto nowTs = std::chrono::steady_clock::now();
-    double now = std::chrono::duration_cast<std::chrono::milliseconds>(nowTs - this->startTime).count() / 1000.f;
-
-    if (log) {
-        std::cout << "[" << std::fixed << std::setprecision(3) << std::setw(6) << now << "] <-- "
-                  << kind << ((rxHdr->flags.ack) ? "-ACK " : " ") << rxHdr->ackSeq << " window $"
-                  << std::hex << std::setw(8) << std::setfill('0') << rxHdr->receiveWindow << std::dec << std::setfill(' ');
-    }
-    if (updateRto) {
-        rto *= 3.f;
-
-        if (log) {
-            std::cout << "; setting initial RTO to " << rto;
-        }
-        this->rtoDelay = rto;
-    }
-    if (log) {
-        std::cout << std::endl;
-    }
-}
-
-///////////////////////////////////////////////////////////////////////////////////////////////////
-/**
- * Sends data from the given buffer.
- */
-void SenderSocket::send(void* data, size_t length)
-{
-    // validate we're connected and not attempting to close
-    if (!this->isConnected) {
-        throw SocketError(SocketError::kStatusNotConnected);
-    } else if (this->isClosing) {
-        throw SocketError(SocketError::kStatusNotConnected, "socket is closing");
-    }
-
-    // wait for quit, connection abort, or empty event
-    HANDLE events[] = {
-        this->quitEvent, this->abortEvent, this->empty
-    };
-    DWORD waitRet = WaitForMultipleObjects(3, events, false, INFINITE);
-
-    switch (waitRet) {
-        // need to quit
-        case WAIT_OBJECT_0:
-            throw SocketError(SocketError::kStatusNotConnected);
-        // connection got fucked
-        case (WAIT_OBJECT_0 + 1):
-            throw SocketError(SocketError::kStatusSendFailed, "Connection has broken");
-        // have space to send more packets
-        case (WAIT_OBJECT_0 + 2):
-            goto queueSpaceAvailable;
-
-        // system errors
-        default:
-            throw SocketError(SocketError::kStatusSystemError);
-    }
-
-    // we jump down here if queue space is available
-queueSpaceAvailable:;
-    // build the packet
-    char buf[kMaxPacketSize];
-    memset(&buf, 0, sizeof(SenderPacketHeader));
-
-    size_t usedPacketLen = (sizeof(SenderPacketHeader) + length);
-
-    auto packet = reinterpret_cast<SenderDataPacket*>(buf);
-    packet->header.flags.magic = kFlagsMagic;
-    packet->header.seq = this->currentSeq;
-
-    memcpy(packet->data, data, length);
-
-    // write it into the tx buffer
-    size_t slot = this->currentSeq % this->window;
-
-    this->queue[slot].txTime = std::chrono::steady_clock::now();
-    this->queue[slot].sequence = this->currentSeq;
-    this->queue[slot].type = pbuf::kTypeData;
-    this->queue[slot].numTx = 0;
-    this->queue[slot].payloadSz = usedPacketLen;
-
-    assert(usedPacketLen <= kMaxPacketSize);
-    memcpy(this->queue[slot].payload, packet, usedPacketLen);
-
-    // signal that there is a packet to send
-    this->currentSeq++;
-    ReleaseSemaphore(this->full, 1, nullptr);
-}
-
-///////////////////////////////////////////////////////////////////////////////////////////////////
-/**
- * @brief Sets up the UDP socket and connects it.
-*/
-void SenderSocket::setUpSocket(struct sockaddr_storage *addr)
-{
-    int err;
-
-    // create the socket
-    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock == -1) {
-        throw SocketError(SocketError::kStatusSystemError, WSAGetLastError());
-    }
-
-    // bind it to any local address
-    struct sockaddr_in local = { 0 };
-    local.sin_family = AF_INET;
-    local.sin_addr.s_addr = INADDR_ANY;
-    local.sin_port = htons(0);
-
-    err = bind(sock, (struct sockaddr*)&local, sizeof(local));
-    if (err == -1) {
-        throw SocketError(SocketError::kStatusSystemError, WSAGetLastError());
-    }
-
-    // set default address to send to
-    err = connect(sock, (struct sockaddr*)addr, sizeof(struct sockaddr_in));
-    if (err != 0) {
-        throw SocketError(SocketError::kStatusSystemError, WSAGetLastError());
-    }
-
-    // increase the receive/transmit buffer sizes
-    const int kRxBufSz = (20 * 1000 * 1000), kTxBufSz = (20 * 1000 * 1000);
-
-    err = setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char *) &kRxBufSz, sizeof(int));
-    if (err == SOCKET_ERROR) {
-        throw SocketError(SocketError::kStatusSystemError, WSAGetLastError());
-    }
-
-    err = setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (const char*) &kTxBufSz, sizeof(int));
-    if (err == SOCKET_ERROR) {
-        throw SocketError(SocketError::kStatusSystemError, WSAGetLastError());
-    }
-
-    // socket is good
-    this->sock = sock;
-    this->host = *addr;
-}
-
-/**
- * Attempts to resolve the given hostname.
- */
-void SenderSocket::resolve(const std::string& host, struct sockaddr_storage* outAddr)
-{
-    int err;
-
-    // common setup of the output address
-    sockaddr_in* addrV4 = reinterpret_cast<sockaddr_in*>(outAddr);
-    outAddr->ss_family = AF_INET;
-
-    // try to parse as IP string
-    IN_ADDR resolved = { 0 };
-    err = inet_pton(AF_INET, host.c_str(), &resolved);
-
-    if (err == 1) {
-        addrV4->sin_addr = resolved;
-        return;
-    } else if (err == -1) {
-        throw SocketError(SocketError::kStatusInvalidHost, WSAGetLastError());
-    }
-
-    // hints for lookup
-    struct addrinfo hints = { 0 };
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags |= AI_CANONNAME;
-
-    // otherwise, we need to perform a DNS lookup
-    struct addrinfo* result = nullptr;
-    struct addrinfo* ptr = nullptr;
-
-    err = getaddrinfo(host.c_str(), nullptr, &hints, &result);
-    if (err != 0) {
-        throw SocketError(SocketError ::kStatusInvalidHost, "getaddrinfo(): " + std::to_string(err));
-    }
-
-    // find the first address that's IPv4
-    for (ptr = result; ptr != nullptr; ptr = ptr->ai_next) {
-        char name[64] = { 0 };
-
-        if (ptr->ai_family == AF_INET) {
-            memcpy(outAddr, ptr->ai_addr, ptr->ai_addrlen);
-            goto beach;
-        }
-    }
-
-    // no suitable addresses
-    throw SocketError(SocketError::kStatusInvalidHost, "no addresses for host");
-
-    // cleanup
-beach:;
-    freeaddrinfo(result);
-}
-
-
-///////////////////////////////////////////////////////////////////////////////////////////////////
-/**
- * @brief Trampoline to jump into the class main method
- * @param ctx Context passed to thread creation
-*/
-DWORD WINAPI __fucker::WorkerThreadEntry(LPVOID _ctx)
-{
-    auto* ctx = static_cast<SenderSocket::WorkerCtx*>(_ctx);
-    
-    // enter main loop
-    ctx->sock->workerThreadMain(ctx);
-
-    // clean up
-    delete ctx;
-    return 0;
-}
-
-/**
- * @brief Creates the worker thread and its data structures
-*/
-void SenderSocket::setUpWorkerThread()
-{
-    using namespace __fucker;
-
-    // create suspended threads
-    for (size_t i = 0; i < kNumWorkers; i++) {
-        WorkerCtx* ctx = new WorkerCtx(this, i);
-
-        this->workerThread[i] = CreateThread(nullptr, kWorkerStackSize, WorkerThreadEntry, ctx, CREATE_SUSPENDED, nullptr);
-        assert(this->workerThread[i] != INVALID_HANDLE_VALUE);
-    }
-}
-
-
-/**
- * @brief Main loop of the worker thread; this pulls packets out of the send queue as they arrive
- * and goes to send them.
-*/
-void SenderSocket::workerThreadMain(WorkerCtx *ctx)
-{
-    int err;
-
-    // set sock buf sizes
-    int kernelBuffer = 32e6;
-    if (setsockopt(this->sock, SOL_SOCKET, SO_RCVBUF, (const char *) &kernelBuffer, sizeof(int)) == SOCKET_ERROR) {
-        std::cerr << "SO_RCVBUF set failed: " << WSAGetLastError() << std::endl;
-    }
-    
-    kernelBuffer = 32e6;
-    if (setsockopt(this->sock, SOL_SOCKET, SO_SNDBUF, (const char *) &kernelBuffer, sizeof(int)) == SOCKET_ERROR) {
-        std::cerr << "SO_SNDBUF set failed: " << WSAGetLastError() << std::endl;
-    }
-
-    // elevate our priority
-    // std::cout << "Worker thread " << ctx->i << " started" << std::endl;
-    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
-
-    // thread 0 handles socket reading, so set the socket up for async IO
-    if (ctx->i == 0) {
-        assert(this->sockEvent == INVALID_HANDLE_VALUE);
-        this->sockEvent = CreateEvent(nullptr, false, false, nullptr);
-        assert(this->sockEvent != INVALID_HANDLE_VALUE);
-
-        err = WSAEventSelect(this->sock, this->sockEvent, FD_READ);
-        if (err == SOCKET_ERROR) {
-            throw SocketError(SocketError::kStatusSystemError, WSAGetLastError());
-        }
-    }
-
-    // at what point in the future timeout expires
-    bool updateNextTimeout = true;
-    auto nextTimeout = std::chrono::steady_clock::now() + std::chrono::microseconds((size_t)(this->rtoDelay * 1000.0 * 1000.0));
-
-    /*
-     * Since we can have multiple worker threads, we need to coordinate which ones handle what;
-     * the transmitting can handle on multiple threads at once, however, only the first worker
-     * will read from the socket. This is accomplished by telling WaitForMultipleObjects() that
-     * we have two rather than three handles.
-     * 
-     * Likewise, all retransmissions are handled only by the first thread. All other threads
-     * simply pluck packets out of the work queue.
-     */
-    HANDLE handles[] = {
-        this->full, this->quitEvent,
-        this->sockEvent,
-    };
-
-    // while transfer is ongoing
-    try {
-        while (this->isConnected) {
-            // calculate timeout (all secondary workers have infinite waits)
-            DWORD timeout = INFINITE;
-
-            if (this->senderBase != this->currentSeq && ctx->i == 0) {
-                auto now = std::chrono::steady_clock::now();
-
-                double ms = std::chrono::duration_cast<std::chrono::milliseconds>(nextTimeout - now).count();
-
-                if (ms > 0) {
-                    timeout = (DWORD)ms;
-                } else {
-                    // if we get a negative or zero timeout, poll
-                    timeout = 0;
-                }
-            }
-
-            // wait for timeout, shit in the queue, or a packet
-            err = WaitForMultipleObjects((ctx->i == 0) ? 3 : 2, handles, false, timeout);
-
-            switch (err) {
-            // packet to transmit
-            case WAIT_OBJECT_0:
-                this->workerDrainQueue(updateNextTimeout);
-                break;
-            // data available to read
-            case (WAIT_OBJECT_0 + 2):
-                this->workerReadAck(updateNextTimeout);
-                break;
-            // want to quit
-            case (WAIT_OBJECT_0 + 1):
-                goto beach;
-
-            // timed out waiting for an ack; re-transmit the packet
-            case WAIT_TIMEOUT: {
-                updateNextTimeout = true;
-                this->stats.timeout++;
-
-                size_t slot = this->senderBase % this->window;
-                auto& packet = this->queue[slot];
-                this->workerTxPacket(packet);
-                break;
-            }
-
-            // system errors
-            default:
-                throw SocketError(SocketError::kStatusSystemError);
-            }
-
-            // recompute timeout
-            if (updateNextTimeout || true) {
-                // tx time of current packet + RTO
-                size_t slot = this->senderBase % this->window;
-                auto& packet = this->queue[slot];
-
-                nextTimeout = packet.txTime + std::chrono::microseconds((size_t) (this->rtoDelay * 1000.0 * 1000.0));
-            }
-            updateNextTimeout = false;
-
-            // signal we've gone once through the loop
-            SetEvent(this->workerLoopEvent);
-        }
-    } catch (const std::exception& e) {
-        std::cerr << "WorkerThread exception: " << e.what() << std::endl;
-        SetEvent(this->abortEvent);
-        return;
-    }
-
-beach:;
-}
-
-/**
- * @brief Reads the packet from the top of the queue and transmits it.
-*/
-void SenderSocket::workerDrainQueue(bool &updateTimeouts)
-{
-    // get the packet from the queue, then transmit it
-    size_t slot = this->nextToSend++ % this->window;
-    if (slot == 0) {
-        updateTimeouts = true;
-    }
-
-    this->workerTxPacket(this->queue[slot]);
-}
-
-/**
- * @brief Transmits the given packet.
-*/
-void SenderSocket::workerTxPacket(pbuf &packet, bool incrementTxAttempts, bool checkTxLimit)
-{
-    int err;
-
-    // transmit packet
-//    err = sendto(this->sock, (const char*)packet.payload, (int)packet.payloadSz, 0,
-//        (struct sockaddr*)&this->host, sizeof(struct sockaddr_in));
-    err = ::send(this->sock, (const char*)packet.payload, (int)packet.payloadSz, 0);
-
-    if (err == -1) {
-        throw SocketError(SocketError::kStatusSendFailed, WSAGetLastError());
-    }
-
-    if (incrementTxAttempts) {
-        packet.numTx++;
-    }
-    packet.txTime = std::chrono::steady_clock::now();
-
-    this->stats.totalBytesSent += (unsigned long)packet.payloadSz;
-
-    // if we've exceeded the number of retransmissions, signal error
-    if (packet.numTx > kMaxRetransmissions && checkTxLimit) {
-        throw std::runtime_error("Exceeded retx threshold for seq no" + std::to_string(packet.sequence));
-    }
-}
-
-/**
- * @brief Reads pending data from the socket.
-*/
-void SenderSocket::workerReadAck(bool &updateTimeouts)
-{
-    double sampleRtt = 0;
-    int err;
-
-    // read a packet from the socket
-    static const size_t kReceiveSz = kMaxPacketSize;
-    char receive[kReceiveSz] = { 0 };
-    ReceiverPacketHeader* rxHdr = reinterpret_cast<ReceiverPacketHeader*>(receive);
-
-    struct sockaddr_storage respFrom;
-    socklen_t respFromLen = sizeof(struct sockaddr_storage);
-
-    err = recvfrom(this->sock, receive, kReceiveSz, 0, (struct sockaddr*)&respFrom, &respFromLen);
-    if (err == -1) {
-        throw SocketError(SocketError::kStatusRecvFailed, WSAGetLastError());
-    }
-    assert(err >= sizeof(ReceiverPacketHeader));
-
-    // packet was an acknowledgement
-    if (rxHdr->flags.ack) {
-        // time the packet was received
-        auto receivedAt = std::chrono::steady_clock::now();
-
-        if (this->debug) {
-            std::cout << "\tTX: received ack for seq " << rxHdr->ackSeq << ", window "
-                      << rxHdr->receiveWindow << std::endl;
-        }
-
-        // check for receiving multiple acks for the same packet
-        if (this->lastAckSeq != rxHdr->ackSeq) {
-            // ack for a different sequence than previous
-            this->lastAckSeq = rxHdr->ackSeq;
-            this->lastAckCount = 1;
-        } else {
-            // if three acks received, retransmit this packet
-            if (++this->lastAckCount == 3) {
-                this->stats.fastReTx++;
-
-                size_t slot = (rxHdr->ackSeq - 1) % this->window;
-                auto& packet = this->queue[slot];
-                this->workerTxPacket(packet, true, false);
-
-                // reset ack state
-                updateTimeouts = true;
-            }
-        }
-
-        // move sender base if the ack is beyond what we've sent
-        if (rxHdr->ackSeq > this->senderBase) {
-            this->senderBase = rxHdr->ackSeq;
-            updateTimeouts = true;
-
-            // advance semaphore to allow more sending
-            size_t effectiveWin = min(this->window, rxHdr->receiveWindow);
-
-            /*if (this->stats.effectiveWindow != effectiveWin) {
-                std::cout << "Win: " << effectiveWin << " seq " << this->currentSeq << std::endl;
-            }*/
-
-            this->stats.effectiveWindow = effectiveWin;
-
-            size_t newReleased = this->senderBase + effectiveWin - this->lastReleased;
-            ReleaseSemaphore(this->empty, (LONG)newReleased, nullptr);
-            this->lastReleased += newReleased;
-
-            // update the "last ack received" time
-            this->dataAckTime = receivedAt;
-
-            // figure out when this packet was transmitted
-            size_t slot = (rxHdr->ackSeq - 1) % this->window;
-            auto& packet = this->queue[slot];
-            size_t baseSlot = this->senderBase % this->window;
-            auto& basePacket = this->queue[baseSlot];
-
-            if (packet.numTx > 1 || basePacket.numTx > 1) {
-                return;
-            }
-
-            auto sentAt = packet.txTime;
-            sampleRtt = max(std::chrono::duration_cast<std::chrono::milliseconds>(receivedAt - sentAt).count() / 1000.f, 0.01);
-
-            // update estimated RTT
-            if (this->estimatedRttLast <= 0) {
-                this->estimatedRttLast = sampleRtt;
-            } else {
-                this->estimatedRttLast = this->estimatedRtt;
-            }
-            this->estimatedRtt = ((1.f - kRttAlpha) * this->estimatedRttLast) + (kRttAlpha * sampleRtt);
-            //std::cout << "eRTT: " << this->estimatedRtt << "; last " << this->estimatedRttLast << ", sample " << sampleRtt << std::endl;
-
-            // update RTT deviation
-            if (this->devRttLast <= 0) {
-                this->devRttLast = 0;
-            } else {
-                this->devRttLast = this->devRtt;
-            }
-
-            this->devRtt = ((1 - kRttBeta) * this->devRttLast) + (kRttBeta * fabs(sampleRtt - this->estimatedRtt));
-            this->rtoDelay = min(this->estimatedRtt + (4 * max(this->devRtt, 0.010)), 2);
-        }
-    }
-}
-
-///////////////////////////////////////////////////////////////////////////////////////////////////
-/**
- * @brief Trampoline to jump into the class main method
- * @param ctx Context passed to thread creation
-*/
-DWORD WINAPI __fucker::StatsThreadEntry(LPVOID ctx)
-{
-    static_cast<SenderSocket*>(ctx)->statsThreadMain();
-    return 0;
-}
-
-/**
- * @brief Initializes the stats thread.
-*/
-void SenderSocket::setUpStatsThread()
-{
-    using namespace __fucker;
-
-    // set up thread
-    this->statsThread = CreateThread(nullptr, kStatsStackSize, StatsThreadEntry, this, CREATE_SUSPENDED, nullptr);
-    assert(this->statsThread != INVALID_HANDLE_VALUE);
-}
-
-/**
- * @brief Main loop for the stats thread
-*/
-void SenderSocket::statsThreadMain()
-{
-    // prepare stats structures
-    this->stats.lastPrint = std::chrono::steady_clock::now();
-    // this->statsThreadPrint(std::cout);
-
-    // wait on the quit event
-    while (WaitForSingleObject(this->quitEvent, 2000) == WAIT_TIMEOUT) {
-        this->statsThreadPrint(std::cout);
-    }
-
-    // clean up
-    std::cout << std::endl << std::flush;
-}
-
-/**
- * @brief Prints a single stats line to the given stream.
- * @param out Stream to receive stats text
-*/
-void SenderSocket::statsThreadPrint(std::ostream& out, bool newline)
-{
-    using namespace std::chrono;
-
-    auto now = steady_clock::now();
-
-    // seconds since the last stats computation
-    auto secsSinceLastStats = duration_cast<microseconds>(now - this->stats.lastPrint).count() / 1000.f / 1000.f;
-    this->stats.lastPrint = now;
-
-    // seconds since constructyboi
-    auto secs = duration_cast<seconds>(now - this->constructTime).count();
-
-    out << "[" << std::setw(2) << secs << "] ";
-
-    // sender base and mbytes acked
-    size_t bytesAcked = this->senderBase * kMaxPacketSize;
-    double mbAcked = ((double)bytesAcked) / 1000.f / 1000.f;
-    out << "B " << std::setw(7) << this->senderBase << " (" << std::setw(7) << std::setprecision(1) << mbAcked
-        << " MB) ";
-
-    // next sequence number
-    out << "N " << std::setw(7) << (this->currentSeq) << ' ';
-
-    // timeout/fast retransmit/effective window size
-    out << "T " << std::setw(5) << max(((long)this->stats.timeout) - 1, 0) << ' '
-        << "F " << std::setw(5) << max(((long)this->stats.fastReTx) - 1, 0) << ' '
-        << "W " << std::setw(7) << this->stats.effectiveWindow << ' ';
-
-    // goodput and RTT
-    // size_t acked = this->stats.payloadBytesAcked;
-    size_t bytesDiff = bytesAcked - this->stats.bytesConsumed;
-    this->stats.bytesConsumed = (unsigned long)bytesAcked;
-
-    double goodput = ((double)bytesDiff * 8) / 1000.f / 1000.f / secsSinceLastStats;
-
-    if (isnan(goodput)) {
-        goodput = 0;
-    }
-
-    out << "S " << std::setw(7) << std::setprecision(3) << goodput << " Mbps "
-        << " RTT " << std::setw(6) << std::fixed << std::setprecision(4) << this->estimatedRtt;
-
-    // lastly, newline if requested
-    if (newline) {
-        out << std::endl;
-    }
-}
-
-///////////////////////////////////////////////////////////////////////////////////////////////////
-/// Default descriptive texts for each of the error codes
-const std::unordered_map<SenderSocket::SocketError::Type, std::string> SenderSocket::SocketError::kDefaultMessages = {
-    {kStatusOk, "No error (yo wtf)"},
-    { kStatusConnected, "Socket already connected" },
-    { kStatusNotConnected, "Cannot perform IO on disconnected socket" },
-    { kStatusInvalidHost, "Destination host is invalid" },
-    { kStatusSendFailed, "send() failed" },
-    { kStatusRecvFailed, "recvfrom() failed" },
-    { kStatusTimeout, "Timeout after exhausting retransmissions" },
-};
-
-/**
- * @brief Creates a new error with no additional information beyond a type.
-*/
-SenderSocket::SocketError::SocketError(Type t)
-    : type(t)
-{
-    try {
-        this->message = kDefaultMessages.at(t);
-    } catch (std::out_of_range&) {
-        this->message = "unknown error";
-    }
-}
-
-/**
- * @brief Creates a new error with detailed error string.
-*/
-SenderSocket::SocketError::SocketError(Type t, const std::string &detail)
-    : type(t)
-{
-    std::stringstream str;
-
-    try {
-        str << kDefaultMessages.at(t);
-    } catch (std::out_of_range&) {
-        str << "unknown error";
-    }
-
-    str << ": " << detail;
-    
-    this->message = str.str();
+#include "pch.h"
+#include "SenderSocket.h"
+#include "PacketTypes.h"
+#include "Fec.h"
+#include "Compressor.h"
+#include "Checksum.h"
+#include "UdpPacketIo.h"
+#include "RioPacketIo.h"
+#include "TraceRing.h"
+#include "PageArena.h"
+
+#include <cassert>
+#include <string>
+#include <sstream>
+#include <unordered_map>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+using namespace __fucker;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Constructs the sender socket.
+ * 
+ * All secondary threads (stats and worker) are created here, so that if thread creation fails, it
+ * will fail early. That makes error handling simpler. These threads are started in a suspended
+ * state such that only after the connection is opened will they be started.
+ */
+SenderSocket::SenderSocket() noexcept(false)
+{
+    // create various events
+    this->quitEvent = CreateEvent(nullptr, true, false, nullptr);
+    if (this->quitEvent == (HANDLE)ERROR_INVALID_HANDLE) {
+        std::string msg = "CreateEvent(): " + GetLastError();
+        throw std::runtime_error(msg);
+    }
+
+    this->abortEvent = CreateEvent(nullptr, true, false, nullptr);
+    if (this->abortEvent == (HANDLE)ERROR_INVALID_HANDLE) {
+        std::string msg = "CreateEvent(): " + GetLastError();
+        throw std::runtime_error(msg);
+    }
+
+    this->workerLoopEvent = CreateEvent(nullptr, false, false, nullptr);
+    if (this->workerLoopEvent == (HANDLE)ERROR_INVALID_HANDLE) {
+        std::string msg = "CreateEvent(): " + GetLastError();
+        throw std::runtime_error(msg);
+    }
+
+    this->connectEvent = CreateEvent(nullptr, true, false, nullptr);
+    if (this->connectEvent == (HANDLE)ERROR_INVALID_HANDLE) {
+        std::string msg = "CreateEvent(): " + GetLastError();
+        throw std::runtime_error(msg);
+    }
+
+    this->closedEvent = CreateEvent(nullptr, true, false, nullptr);
+    if (this->closedEvent == (HANDLE)ERROR_INVALID_HANDLE) {
+        std::string msg = "CreateEvent(): " + GetLastError();
+        throw std::runtime_error(msg);
+    }
+
+    this->wakeEvent = CreateEvent(nullptr, false, false, nullptr);
+    if (this->wakeEvent == (HANDLE)ERROR_INVALID_HANDLE) {
+        std::string msg = "CreateEvent(): " + GetLastError();
+        throw std::runtime_error(msg);
+    }
+
+    // then, the secondary threads
+    this->setUpStatsThread();
+    this->setUpWorkerThread();
+
+    this->constructTime = this->clock->now();
+}
+
+/**
+ * Clean up any dangling resources.
+ * 
+ * This signals for threads to close gracefully. If they don't, we'll just kill them anyways.
+ */
+SenderSocket::~SenderSocket() noexcept(false)
+{
+    // tell the stats/worker thread to go commit sudoku
+    if (!SetEvent(this->quitEvent)) {
+        std::string msg = "SetEvent(): " + GetLastError();
+        throw std::runtime_error(msg);
+    }
+
+    // wait for the stats thread and worker to actually die; they won't get to run under a
+    // simulated clock unless we step aside
+    this->clock->leave();
+
+    if (WaitForSingleObject(this->statsThread, 500) != WAIT_OBJECT_0) {
+        std::cerr << "Stats thread failed to exit gracefully; killing it" << std::endl;
+        TerminateThread(this->statsThread, 0); // die bitch
+    }
+    CloseHandle(this->statsThread);
+    this->statsThread = INVALID_HANDLE_VALUE;
+
+    for (size_t i = 0; i < kNumWorkers; i++) {
+        // ignore threads that were never started
+        if (this->workerThread[i] == INVALID_HANDLE_VALUE) {
+            continue;
+        }
+
+        if (WaitForSingleObject(this->workerThread[i], 500) != WAIT_OBJECT_0) {
+            std::cerr << "Worker thread failed to exit gracefully; killing it" << std::endl;
+            TerminateThread(this->workerThread[i], 0);
+        }
+        CloseHandle(this->workerThread[i]);
+        this->workerThread[i] = INVALID_HANDLE_VALUE;
+    }
+
+    if (this->compressThread != INVALID_HANDLE_VALUE) {
+        if (WaitForSingleObject(this->compressThread, 500) != WAIT_OBJECT_0) {
+            std::cerr << "Compression thread failed to exit gracefully; killing it" << std::endl;
+            TerminateThread(this->compressThread, 0);
+        }
+        CloseHandle(this->compressThread);
+        this->compressThread = INVALID_HANDLE_VALUE;
+
+        CloseHandle(this->compressFree);
+        CloseHandle(this->compressReady);
+    }
+
+    this->clock->enter();
+
+    // clean up handles
+    CloseHandle(this->quitEvent);
+    CloseHandle(this->abortEvent);
+
+    CloseHandle(this->empty);
+    CloseHandle(this->full);
+    CloseHandle(this->workerLoopEvent);
+    CloseHandle(this->connectEvent);
+    CloseHandle(this->closedEvent);
+    CloseHandle(this->wakeEvent);
+
+    this->quitEvent = INVALID_HANDLE_VALUE;
+    this->abortEvent = INVALID_HANDLE_VALUE;
+    this->workerLoopEvent = INVALID_HANDLE_VALUE;
+    this->connectEvent = INVALID_HANDLE_VALUE;
+    this->closedEvent = INVALID_HANDLE_VALUE;
+    this->wakeEvent = INVALID_HANDLE_VALUE;
+
+    // close socket if still open
+    this->io.reset();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Attempts to open a connection to the remote host; this blocks until the connection has
+ * been established or the handshake failed.
+ */
+void SenderSocket::open(const std::string& host, uint16_t port, size_t window, float rtt, float speed, float loss[2])
+{
+    this->openAsync(host, port, window, rtt, speed, loss, nullptr);
+    this->waitForCompletion(this->connectEvent);
+}
+
+/**
+ * @brief Begins opening a connection to the remote host without waiting for the handshake.
+ * 
+ * Host resolution and socket setup happen synchronously, and errors there are thrown directly.
+ * The SYN is then (re)transmitted by the worker thread, which invokes the callback once the SYN-ACK
+ * arrives or retransmissions are exhausted.
+ * 
+ * @param callback Invoked on the worker thread when the handshake completes; may be empty
+ */
+void SenderSocket::openAsync(const std::string& host, uint16_t port, size_t window, float rtt, float speed, float loss[2], CompletionCallback callback)
+{
+    // sanity checking
+    if (this->state != kStateIdle) {
+        throw SocketError(SocketError::kStatusConnected);
+    }
+
+    // resolve address and establish the socket, unless we were handed a backend to use
+    if (!this->io) {
+        struct sockaddr_storage storage;
+        memset(&storage, 0, sizeof(struct sockaddr_storage));
+
+        SenderSocket::resolve(host, &storage);
+
+        struct sockaddr_in* addr = (struct sockaddr_in*) &storage;
+        addr->sin_port = htons(port);
+
+        this->setUpSocket(&storage);
+    }
+    this->hostStr = host;
+
+    // set up the send queue; all of its memory is faulted in now, rather than during the transfer
+    this->queueArena = std::make_unique<PageArena>(window * sizeof(pbuf), this->lockQueue);
+    this->queue = static_cast<pbuf*>(this->queueArena->data());
+
+    for (size_t i = 0; i < window; i++) {
+        new (&this->queue[i]) pbuf;
+    }
+
+    if (this->debug) {
+        std::cout << "\tSend queue: " << (this->queueArena->size() / 1024) << " KB in "
+                  << (this->queueArena->isLargePages() ? "large" : "regular") << " pages"
+                  << (this->queueArena->isLocked() ? ", locked" : "") << std::endl;
+    }
+
+    // let the backend send packets straight out of the queue; it doesn't move from here on
+    this->io->registerArena(this->queue, window * sizeof(pbuf));
+
+    this->full = CreateSemaphore(NULL, 0, (LONG) window, nullptr);
+    this->empty = CreateSemaphore(NULL, 0, (LONG) window, nullptr);
+
+    // build SYN packet
+    SenderSynPacket syn;
+    memset(&syn, 0, sizeof(SenderSynPacket));
+
+    syn.header.flags.magic = kFlagsMagic;
+    syn.header.flags.syn = 1;
+
+    syn.lp.bufferSize = (DWORD) (window + kMaxRetransmissions); // W+R
+    syn.lp.RTT = rtt;
+    syn.lp.speed = speed;
+    syn.lp.pLoss[0] = loss[0];
+    syn.lp.pLoss[1] = loss[1];
+
+    this->control.type = pbuf::kTypeSyn;
+    this->control.sequence = 0;
+    this->control.numTx = 0;
+    this->control.payloadSz = sizeof(SenderSynPacket);
+    memcpy(this->control.payload, &syn, sizeof(SenderSynPacket));
+
+    // early data can't be used with options that change how data is packetized
+    const bool early = this->earlyPackets &&
+        !(this->requestedOptions.flags & (kSynOptionFec | kSynOptionCompression | kSynOptionResume));
+
+    if (!early) {
+        this->requestedOptions.flags &= ~kSynOptionEarlyData;
+    }
+
+    // append the option block if any optional features were requested
+    if (this->requestedOptions.flags) {
+        auto synOpts = reinterpret_cast<SenderSynOptionsPacket*>(this->control.payload);
+
+        synOpts->options = this->requestedOptions;
+        synOpts->options.magic = kSynOptionsMagic;
+
+        if (early) {
+            synOpts->options.earlyData = (WORD) min(this->earlyPackets, window);
+        }
+
+        // the receiver must ack at least twice per window, or we'd stall waiting for it
+        if (synOpts->options.flags & kSynOptionAckFrequency) {
+            synOpts->options.ackEvery = (WORD) min((size_t) synOpts->options.ackEvery, max(window / 2, (size_t) 1));
+        }
+        this->control.payloadSz = sizeof(SenderSynOptionsPacket);
+    }
+
+    // prepare internal state; the worker sends the SYN as soon as it starts
+    this->window = window;
+    this->currentSeq = 0;
+    this->startTime = this->clock->now();
+    this->rtoDelay = max(kInitialSynTimeout, (2.0 * ((double) rtt)));
+
+    this->openCallback = callback;
+    this->state = kStateSynSent;
+
+    // hand out queue slots for the early data; the worker sends it as soon as the SYN is out
+    if (early) {
+        this->isEarlyOpen = true;
+        this->workerUpdateWindow((DWORD) this->earlyPackets);
+    }
+
+    // set up stats and worker threads
+    for (size_t i = 0; i < kNumWorkers; i++) {
+        if (this->workerThread[i] == INVALID_HANDLE_VALUE) {
+            continue;
+        }
+        this->clock->attach();
+        ResumeThread(this->workerThread[i]);
+    }
+
+    this->clock->attach();
+    ResumeThread(this->statsThread);
+}
+
+/**
+ * @brief Closes the connection. A FIN packet is sent before the socket is closed; this blocks
+ * until all queued data has been acknowledged and the FIN-ACK was received.
+*/
+void SenderSocket::close()
+{
+    this->closeAsync(nullptr);
+    this->waitForCompletion(this->closedEvent);
+}
+
+/**
+ * @brief Begins closing the connection without waiting for it.
+ * 
+ * No more data may be sent after this is called. Once all outstanding packets have been
+ * acknowledged, the worker sends the FIN and invokes the callback once it has been acknowledged.
+ * 
+ * @param callback Invoked on the worker thread when the connection is closed; may be empty
+*/
+void SenderSocket::closeAsync(CompletionCallback callback)
+{
+    if (!this->isConnected && !this->isEarlyOpen) {
+        throw SocketError(SocketError::kStatusNotConnected);
+    } else if (this->isClosing) {
+        throw SocketError(SocketError::kStatusNotConnected, "already waiting in close()");
+    }
+
+    this->closeCallback = callback;
+
+    // whatever is in the partially filled block still needs to go out
+    if (this->compressHaveBlock) {
+        this->compressSubmit();
+    }
+
+    this->isClosing = true;
+
+    // kick the worker so it notices if the queue is already drained
+    SetEvent(this->wakeEvent);
+}
+
+/**
+ * @brief Waits for the given completion event (set by the worker) or the connection to abort.
+ * 
+ * If the connection was aborted, the error that caused it is rethrown here.
+*/
+void SenderSocket::waitForCompletion(HANDLE event)
+{
+    HANDLE events[] = {
+        event, this->abortEvent
+    };
+    DWORD waitRet = this->clock->wait(2, events, INFINITE);
+
+    switch (waitRet) {
+        // operation completed
+        case WAIT_OBJECT_0:
+            return;
+        // connection got fucked
+        case (WAIT_OBJECT_0 + 1):
+            if (this->abortError) {
+                throw SocketError(*this->abortError);
+            }
+            throw SocketError(SocketError::kStatusSendFailed, "Connection has broken");
+
+        // system errors
+        default:
+            throw SocketError(SocketError::kStatusSystemError);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * Sends data from the given buffer. This blocks until there is space in the send window.
+ */
+void SenderSocket::send(void* data, size_t length)
+{
+    // validate we're connected (or may send early data) and not attempting to close
+    if (!this->isConnected && !this->isEarlyOpen) {
+        throw SocketError(SocketError::kStatusNotConnected);
+    } else if (this->isClosing) {
+        throw SocketError(SocketError::kStatusNotConnected, "socket is closing");
+    } else if (length > this->getMaxPayloadSize()) {
+        throw SocketError(SocketError::kStatusSendFailed, "payload too large");
+    }
+
+    // with compression, data goes through the compression stage rather than straight to the queue
+    if (this->compressor) {
+        this->compressAppend(data, length, true);
+        return;
+    }
+
+    // wait for quit, connection abort, or empty event
+    HANDLE events[] = {
+        this->quitEvent, this->abortEvent, this->empty
+    };
+    const uint64_t waitStart = this->latency ? Tsc::now() : 0;
+    DWORD waitRet = this->clock->wait(3, events, INFINITE);
+
+    switch (waitRet) {
+        // need to quit
+        case WAIT_OBJECT_0:
+            throw SocketError(SocketError::kStatusNotConnected);
+        // connection got fucked
+        case (WAIT_OBJECT_0 + 1):
+            throw SocketError(SocketError::kStatusSendFailed, "Connection has broken");
+        // have space to send more packets
+        case (WAIT_OBJECT_0 + 2):
+            if (this->latency) {
+                this->traceStage(kLatencySendWait, this->currentSeq, waitStart, Tsc::now());
+            }
+
+            this->trackStream(data, length);
+            this->enqueuePacket(data, length, this->streamQueued);
+            break;
+
+        // system errors
+        default:
+            throw SocketError(SocketError::kStatusSystemError);
+    }
+}
+
+/**
+ * @brief Queues data for transmission if there is space in the send window, without blocking.
+ * 
+ * Use the ack callback to find out when space frees up again.
+ * 
+ * @return Whether the data was queued; false if the window is currently full.
+ */
+bool SenderSocket::trySend(void* data, size_t length)
+{
+    // validate we're connected (or may send early data) and not attempting to close
+    if (!this->isConnected && !this->isEarlyOpen) {
+        throw SocketError(SocketError::kStatusNotConnected);
+    } else if (this->isClosing) {
+        throw SocketError(SocketError::kStatusNotConnected, "socket is closing");
+    } else if (length > this->getMaxPayloadSize()) {
+        throw SocketError(SocketError::kStatusSendFailed, "payload too large");
+    }
+
+    if (this->compressor) {
+        return this->compressAppend(data, length, false);
+    }
+
+    // poll for queue space
+    HANDLE events[] = {
+        this->quitEvent, this->abortEvent, this->empty
+    };
+    DWORD waitRet = this->clock->wait(3, events, 0);
+
+    switch (waitRet) {
+        case WAIT_OBJECT_0:
+            throw SocketError(SocketError::kStatusNotConnected);
+        case (WAIT_OBJECT_0 + 1):
+            throw SocketError(SocketError::kStatusSendFailed, "Connection has broken");
+        case (WAIT_OBJECT_0 + 2):
+            this->trackStream(data, length);
+            this->enqueuePacket(data, length, this->streamQueued);
+            return true;
+        // window is full
+        case WAIT_TIMEOUT:
+            return false;
+
+        default:
+            throw SocketError(SocketError::kStatusSystemError);
+    }
+}
+
+/**
+ * @brief Requests forward error correction for the connection; must be called before opening.
+ * 
+ * For every block of `dataCount` data packets, `parityCount` parity packets are sent, letting the
+ * receiver rebuild up to that many lost packets per block without waiting for a retransmission.
+ * FEC is only used if the receiver agrees to it during the handshake.
+ * 
+ * @param dataCount Data packets per block; 0 disables FEC
+ * @param parityCount Parity packets per block
+ */
+void SenderSocket::setFec(size_t dataCount, size_t parityCount)
+{
+    if (this->state != kStateIdle) {
+        throw SocketError(SocketError::kStatusConnected);
+    }
+
+    if (!dataCount) {
+        this->requestedOptions.flags &= ~kSynOptionFec;
+        return;
+    }
+
+    // validate the parameters early
+    Fec test(dataCount, parityCount);
+
+    this->requestedOptions.flags |= kSynOptionFec;
+    this->requestedOptions.fecDataCount = (WORD) dataCount;
+    this->requestedOptions.fecParityCount = (WORD) parityCount;
+}
+
+/**
+ * @brief Requests payload compression for the connection; must be called before opening.
+ * 
+ * Sent data is collected into blocks of up to `blockSize` bytes, which are compressed on a
+ * separate thread and then split into packets. Blocks that don't compress are sent as-is.
+ * Compression is only used if the receiver agrees to it during the handshake; it may also pick a
+ * smaller block size.
+ * 
+ * @param blockSize Amount of data per compressed block; 0 disables compression
+ */
+void SenderSocket::setCompression(size_t blockSize)
+{
+    if (this->state != kStateIdle) {
+        throw SocketError(SocketError::kStatusConnected);
+    }
+
+    if (!blockSize) {
+        this->requestedOptions.flags &= ~kSynOptionCompression;
+        return;
+    } else if (blockSize > Compressor::kMaxBlockSize) {
+        throw std::invalid_argument("invalid compression block size");
+    }
+
+    this->requestedOptions.flags |= kSynOptionCompression;
+    this->requestedOptions.compressionBlockSize = (DWORD) blockSize;
+}
+
+/**
+ * @brief Makes the transfer resumable; must be called before opening.
+ * 
+ * For a new transfer, pass a checkpoint with a unique transfer id and no progress. To resume an
+ * interrupted one, pass the checkpoint it left behind; after the connection is open,
+ * `getResumeOffset()` tells how much of the data stream to skip. As data is acknowledged, the
+ * current state can be retrieved with `getCheckpoint()` and saved.
+ * 
+ * Resuming is only possible if the receiver agrees to it during the handshake.
+ */
+void SenderSocket::setResume(const Checkpoint& checkpoint)
+{
+    if (this->state != kStateIdle) {
+        throw SocketError(SocketError::kStatusConnected);
+    } else if (!checkpoint.rangeSize || (checkpoint.offset % checkpoint.rangeSize) ||
+        (checkpoint.offset / checkpoint.rangeSize) != checkpoint.ranges.size()) {
+        throw std::invalid_argument("invalid checkpoint");
+    }
+
+    this->resume = checkpoint;
+
+    this->requestedOptions.flags |= kSynOptionResume;
+    this->requestedOptions.transferId = checkpoint.transferId;
+    this->requestedOptions.resumeOffset = checkpoint.offset;
+    this->requestedOptions.resumeCrc = checkpoint.ranges.empty() ? 0 : checkpoint.ranges.back();
+    this->requestedOptions.resumeRangeSize = checkpoint.rangeSize;
+}
+
+/**
+ * @brief Lets the receiver acknowledge several packets at once; must be called before opening.
+ * 
+ * Rather than acking every packet, the receiver acks every `every` in-order packets, or once
+ * `delay` has passed since the first unacknowledged one. This cuts down on return traffic for
+ * large windows. Losses are still reported right away, since out of order packets are always
+ * acknowledged immediately. The receiver may pick smaller values, or decline entirely.
+ * 
+ * @param every Most packets acknowledged together; 1 (or 0) acknowledges every packet
+ * @param delay Longest time (in usec) an acknowledgement may be held back
+ */
+void SenderSocket::setAckFrequency(size_t every, DWORD delay)
+{
+    if (this->state != kStateIdle) {
+        throw SocketError(SocketError::kStatusConnected);
+    } else if (every > 0xFFFF || delay > (kMaxAckDelay * 1000)) {
+        throw std::invalid_argument("invalid ack frequency");
+    }
+
+    if (every <= 1) {
+        this->requestedOptions.flags &= ~kSynOptionAckFrequency;
+        return;
+    }
+
+    this->requestedOptions.flags |= kSynOptionAckFrequency;
+    this->requestedOptions.ackEvery = (WORD) every;
+    this->requestedOptions.ackDelay = delay;
+}
+
+/**
+ * @brief Allows data to be sent before the handshake completes; must be called before opening.
+ * 
+ * Up to `packets` data packets are sent right behind the SYN, rather than an RTT later once the
+ * SYN-ACK comes back, so that small transfers complete in about one round trip. To make use of
+ * this, open the connection with `openAsync()` and start sending right away.
+ * 
+ * If the receiver doesn't accept early data, it drops those packets, and they're sent again once
+ * the SYN-ACK arrives. Since FEC, compression and resuming all change how the data stream is split
+ * into packets depending on what the receiver agrees to, no early data is sent with any of them.
+ * 
+ * @param packets Number of packets to send ahead of the SYN-ACK; 0 disables early data
+ */
+void SenderSocket::setEarlyData(size_t packets)
+{
+    if (this->state != kStateIdle) {
+        throw SocketError(SocketError::kStatusConnected);
+    } else if (packets > 0xFFFF) {
+        throw std::invalid_argument("too many early packets");
+    }
+
+    this->earlyPackets = packets;
+
+    if (!packets) {
+        this->requestedOptions.flags &= ~kSynOptionEarlyData;
+        return;
+    }
+
+    this->requestedOptions.flags |= kSynOptionEarlyData;
+    this->requestedOptions.earlyData = (WORD) packets;
+}
+
+/**
+ * @brief Selects how packets are put on the wire; must be called before opening.
+ * 
+ * Backends that aren't supported by the OS fall back to a plain socket.
+ */
+void SenderSocket::setIoBackend(IoBackend backend)
+{
+    if (this->state != kStateIdle) {
+        throw SocketError(SocketError::kStatusConnected);
+    }
+
+    this->ioBackend = backend;
+}
+
+/**
+ * @brief Replaces the clock the socket uses for all timing and waiting (e.g. with a `SimClock`);
+ * must be called before opening.
+ * 
+ * The socket attaches its own threads to the clock. Any other threads calling into the socket
+ * (i.e. the app) have to be attached and entered by the caller, for as long as they're using it
+ * (including when destroying it.)
+ */
+void SenderSocket::setClock(std::shared_ptr<Clock> clock)
+{
+    if (this->state != kStateIdle) {
+        throw SocketError(SocketError::kStatusConnected);
+    }
+
+    this->clock = clock;
+    this->constructTime = this->clock->now();
+}
+
+/**
+ * @brief Locks the send queue into memory, so it can't be paged out during the transfer; must be
+ * called before opening.
+ * 
+ * The queue is put in large pages if possible, which are always locked; this only matters if that
+ * fails. If the queue can't be locked either, it is just allocated normally.
+ */
+void SenderSocket::setLockWindow(bool lock)
+{
+    if (this->state != kStateIdle) {
+        throw SocketError(SocketError::kStatusConnected);
+    }
+
+    this->lockQueue = lock;
+}
+
+/**
+ * @brief Uses the given backend instead of a socket (e.g. a `SimLink`); must be called before
+ * opening. The host passed to `open()` is then only used for display.
+ */
+void SenderSocket::setPacketIo(std::unique_ptr<PacketIo> io)
+{
+    if (this->state != kStateIdle) {
+        throw SocketError(SocketError::kStatusConnected);
+    }
+
+    this->io = std::move(io);
+    this->ioBackend = kIoExternal;
+}
+
+/**
+ * @brief Turns on latency tracking; must be called before opening.
+ * 
+ * Each stage a data packet goes through is timed and recorded into a histogram (see `getLatency()`).
+ * If `traceEvents` is nonzero, the most recent that many of these timings are also kept as
+ * individual events, which can be written out with `dumpTrace()` after the transfer.
+ */
+void SenderSocket::setTracing(size_t traceEvents)
+{
+    if (this->state != kStateIdle) {
+        throw SocketError(SocketError::kStatusConnected);
+    }
+
+    // calibrate the TSC now, rather than on the first print
+    Tsc::ticksPerSecond();
+
+    this->latency = std::make_unique<LatencyHistogram[]>(kNumLatencyStages);
+
+    if (traceEvents) {
+        this->trace = std::make_unique<TraceRing>(traceEvents);
+    }
+}
+
+/**
+ * @brief Writes the recorded trace events to the given file, in Chrome trace format. Call this
+ * only once the connection is closed.
+ */
+void SenderSocket::dumpTrace(const std::string& path) const
+{
+    if (!this->trace) {
+        throw std::logic_error("tracing not enabled");
+    }
+
+    this->trace->dump(path);
+}
+
+/**
+ * @brief Records the latency of a stage, and the trace event for it if enabled.
+ */
+void SenderSocket::traceStage(LatencyStage stage, uint64_t seq, uint64_t start, uint64_t end)
+{
+    this->latency[stage].record((end > start) ? (end - start) : 0);
+
+    if (this->trace) {
+        this->trace->record(kLatencyStageNames[stage], seq, start, end);
+    }
+}
+
+/**
+ * @brief Returns a checkpoint covering all data that has been acknowledged so far.
+ * 
+ * Only whole ranges are included, so up to a range's worth of data is sent again on resume.
+ */
+Checkpoint SenderSocket::getCheckpoint()
+{
+    Checkpoint checkpoint(this->resume.transferId, this->resume.rangeSize);
+
+    if (!this->checksum) {
+        return checkpoint;
+    }
+
+    AcquireSRWLockShared(&this->resumeLock);
+
+    const size_t numRanges = min((size_t) (this->streamAcked / this->resume.rangeSize), this->resume.ranges.size());
+    checkpoint.offset = ((uint64_t) numRanges) * this->resume.rangeSize;
+    checkpoint.ranges.assign(this->resume.ranges.begin(), this->resume.ranges.begin() + numRanges);
+
+    ReleaseSRWLockShared(&this->resumeLock);
+
+    return checkpoint;
+}
+
+/**
+ * @brief Accounts for data the app handed to us: advances the data stream offset, and, for
+ * resumable transfers, updates the range CRCs.
+ */
+void SenderSocket::trackStream(const void* data, size_t length)
+{
+    this->streamQueued += length;
+
+    if (!this->checksum) {
+        return;
+    }
+
+    auto ptr = reinterpret_cast<const char*>(data);
+
+    while (length) {
+        const size_t take = min(length, this->resume.rangeSize - this->rangeFill);
+
+        this->rangeCrc = this->checksum->update(this->rangeCrc, ptr, take);
+        this->rangeFill += take;
+        ptr += take;
+        length -= take;
+
+        // range is complete
+        if (this->rangeFill == this->resume.rangeSize) {
+            AcquireSRWLockExclusive(&this->resumeLock);
+            this->resume.ranges.push_back(this->rangeCrc);
+            ReleaseSRWLockExclusive(&this->resumeLock);
+
+            this->rangeCrc = 0;
+            this->rangeFill = 0;
+        }
+    }
+}
+
+/**
+ * @brief Writes a data packet into the send window and signals the worker to send it. The caller
+ * must have acquired a slot from the `empty` semaphore.
+ * 
+ * @param streamEnd Data stream offset up to which data is complete once this packet is received
+ * @param compressed Whether the packet is part of a compressed block
+ */
+void SenderSocket::enqueuePacket(const void* data, size_t length, uint64_t streamEnd, bool compressed)
+{
+    // build the packet
+    char buf[kMaxPacketSize];
+    memset(&buf, 0, sizeof(SenderPacketHeader));
+
+    size_t usedPacketLen = (sizeof(SenderPacketHeader) + length);
+
+    auto packet = reinterpret_cast<SenderDataPacket*>(buf);
+    packet->header.flags.magic = kFlagsMagic;
+    packet->header.flags.compressed = compressed ? 1 : 0;
+    packet->header.seq = this->currentSeq;
+
+    memcpy(packet->data, data, length);
+
+    // write it into the tx buffer
+    size_t slot = this->currentSeq % this->window;
+
+    this->queue[slot].txTime = this->clock->now();
+    this->queue[slot].sequence = this->currentSeq;
+    this->queue[slot].type = pbuf::kTypeData;
+    this->queue[slot].numTx = 0;
+    this->queue[slot].sent = false;
+    this->queue[slot].streamEnd = streamEnd;
+    this->queue[slot].payloadSz = usedPacketLen;
+    this->queue[slot].queuedTsc = this->latency ? Tsc::now() : 0;
+    this->queue[slot].firstTxTsc = 0;
+
+    assert(usedPacketLen <= kMaxPacketSize);
+    memcpy(this->queue[slot].payload, packet, usedPacketLen);
+
+    // signal that there is a packet to send
+    this->currentSeq++;
+    ReleaseSemaphore(this->full, 1, nullptr);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Sets up the backend used to talk to the receiver, and connects it.
+*/
+void SenderSocket::setUpSocket(struct sockaddr_storage *addr)
+{
+    if (this->ioBackend == kIoRegisteredIo) {
+        auto rio = std::make_unique<RioPacketIo>();
+
+        if (rio->open(addr) != SOCKET_ERROR) {
+            this->io = std::move(rio);
+            this->host = *addr;
+            return;
+        }
+
+        // RIO is unavailable (pre-Windows 8) or the provider doesn't support it
+        this->ioBackend = kIoSocket;
+    }
+
+    auto udp = std::make_unique<UdpPacketIo>(this->ioBackend == kIoSegmentationOffload);
+
+    if (udp->open(addr) == SOCKET_ERROR) {
+        throw SocketError(SocketError::kStatusSystemError, WSAGetLastError());
+    }
+
+    if (this->ioBackend == kIoSegmentationOffload && !udp->isOffloadEnabled()) {
+        this->ioBackend = kIoSocket;
+    }
+
+    // socket is good
+    this->io = std::move(udp);
+    this->host = *addr;
+}
+
+/**
+ * Attempts to resolve the given hostname.
+ */
+void SenderSocket::resolve(const std::string& host, struct sockaddr_storage* outAddr)
+{
+    int err;
+
+    // common setup of the output address
+    sockaddr_in* addrV4 = reinterpret_cast<sockaddr_in*>(outAddr);
+    outAddr->ss_family = AF_INET;
+
+    // try to parse as IP string
+    IN_ADDR resolved = { 0 };
+    err = inet_pton(AF_INET, host.c_str(), &resolved);
+
+    if (err == 1) {
+        addrV4->sin_addr = resolved;
+        return;
+    } else if (err == -1) {
+        throw SocketError(SocketError::kStatusInvalidHost, WSAGetLastError());
+    }
+
+    // hints for lookup
+    struct addrinfo hints = { 0 };
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags |= AI_CANONNAME;
+
+    // otherwise, we need to perform a DNS lookup
+    struct addrinfo* result = nullptr;
+    struct addrinfo* ptr = nullptr;
+
+    err = getaddrinfo(host.c_str(), nullptr, &hints, &result);
+    if (err != 0) {
+        throw SocketError(SocketError ::kStatusInvalidHost, "getaddrinfo(): " + std::to_string(err));
+    }
+
+    // find the first address that's IPv4
+    for (ptr = result; ptr != nullptr; ptr = ptr->ai_next) {
+        char name[64] = { 0 };
+
+        if (ptr->ai_family == AF_INET) {
+            memcpy(outAddr, ptr->ai_addr, ptr->ai_addrlen);
+            goto beach;
+        }
+    }
+
+    // no suitable addresses
+    throw SocketError(SocketError::kStatusInvalidHost, "no addresses for host");
+
+    // cleanup
+beach:;
+    freeaddrinfo(result);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Trampoline to jump into the class main method
+ * @param ctx Context passed to thread creation
+*/
+DWORD WINAPI __fucker::WorkerThreadEntry(LPVOID _ctx)
+{
+    auto* ctx = static_cast<SenderSocket::WorkerCtx*>(_ctx);
+    
+    // enter main loop
+    ctx->sock->clock->enter();
+    ctx->sock->workerThreadMain(ctx);
+    ctx->sock->clock->detach();
+
+    // clean up
+    delete ctx;
+    return 0;
+}
+
+/**
+ * @brief Creates the worker thread and its data structures
+*/
+void SenderSocket::setUpWorkerThread()
+{
+    using namespace __fucker;
+
+    // create suspended threads
+    for (size_t i = 0; i < kNumWorkers; i++) {
+        WorkerCtx* ctx = new WorkerCtx(this, i);
+
+        this->workerThread[i] = CreateThread(nullptr, kWorkerStackSize, WorkerThreadEntry, ctx, CREATE_SUSPENDED, nullptr);
+        assert(this->workerThread[i] != INVALID_HANDLE_VALUE);
+    }
+}
+
+
+/**
+ * @brief Main loop of the worker thread; this pulls packets out of the send queue as they arrive
+ * and goes to send them.
+*/
+void SenderSocket::workerThreadMain(WorkerCtx *ctx)
+{
+    int err;
+
+    // elevate our priority
+    // std::cout << "Worker thread " << ctx->i << " started" << std::endl;
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+
+    // the first worker kicks off the handshake
+    if (ctx->i == 0) {
+        try {
+            this->workerTxControl();
+        } catch (const SocketError& e) {
+            this->workerAbort(e);
+            return;
+        }
+    }
+
+    // at what point in the future timeout expires
+    bool updateNextTimeout = true;
+    auto nextTimeout = this->clock->now() + std::chrono::microseconds((size_t)(this->rtoDelay * 1000.0 * 1000.0));
+
+    /*
+     * Since we can have multiple worker threads, we need to coordinate which ones handle what;
+     * the transmitting can handle on multiple threads at once, however, only the first worker
+     * will read from the socket. This is accomplished by telling WaitForMultipleObjects() that
+     * we have two rather than four handles.
+     * 
+     * Likewise, all retransmissions (and the SYN/FIN handshakes) are handled only by the first
+     * thread. All other threads simply pluck packets out of the work queue.
+     */
+    HANDLE handles[] = {
+        this->full, this->quitEvent,
+        this->io->getReadEvent(), this->wakeEvent,
+    };
+
+    // while the connection is alive
+    try {
+        while (this->state != kStateClosed) {
+            // calculate timeout (all secondary workers have infinite waits)
+            DWORD timeout = INFINITE;
+            const bool handshaking = (this->state == kStateSynSent || this->state == kStateFinSent);
+            const bool probing = this->workerWindowClosed();
+
+            if ((handshaking || this->senderBase != this->nextToSend || probing) && ctx->i == 0) {
+                auto now = this->clock->now();
+                auto deadline = probing ? this->nextProbe : nextTimeout;
+
+                double ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+
+                if (ms > 0) {
+                    timeout = (DWORD)ms;
+                } else {
+                    // if we get a negative or zero timeout, poll
+                    timeout = 0;
+                }
+            }
+
+            // push out anything the backend held back before going to sleep
+            if (ctx->i == 0 && this->io->flush() == SOCKET_ERROR) {
+                throw SocketError(SocketError::kStatusSendFailed, WSAGetLastError());
+            }
+
+            // wait for timeout, shit in the queue, or a packet
+            err = this->clock->wait((ctx->i == 0) ? 4 : 2, handles, timeout);
+
+            switch (err) {
+            // packet to transmit
+            case WAIT_OBJECT_0:
+                this->workerDrainQueue(updateNextTimeout);
+                break;
+            // data available to read
+            case (WAIT_OBJECT_0 + 2):
+                this->workerReadAck(updateNextTimeout);
+                break;
+            // want to quit
+            case (WAIT_OBJECT_0 + 1):
+                goto beach;
+            // woken up to re-check state
+            case (WAIT_OBJECT_0 + 3):
+                break;
+
+            // timed out waiting for an ack; re-transmit the packet
+            case WAIT_TIMEOUT: {
+                updateNextTimeout = true;
+
+                if (handshaking) {
+                    this->workerTxControl();
+                } else if (probing) {
+                    this->workerProbeWindow();
+                } else {
+                    this->stats.timeout++;
+
+                    size_t slot = this->senderBase % this->window;
+                    auto& packet = this->queue[slot];
+                    this->workerTxPacket(packet);
+                }
+                break;
+            }
+
+            // system errors
+            default:
+                throw SocketError(SocketError::kStatusSystemError);
+            }
+
+            // close was requested and everything has been sent once: protect the last partial block
+            if (ctx->i == 0 && this->fec && this->isClosing && !this->compressPending &&
+                this->nextToSend == this->currentSeq) {
+                this->workerFecFlush();
+            }
+
+            // once close was requested and all data is acknowledged, send the FIN
+            if (ctx->i == 0 && this->isClosing && this->state == kStateEstablished &&
+                !this->compressPending && this->senderBase == this->currentSeq) {
+                this->workerBeginClose();
+            }
+
+            // recompute timeout
+            if (updateNextTimeout || true) {
+                // tx time of current packet + RTO
+                auto& packet = this->workerTimeoutPacket();
+                nextTimeout = packet.txTime + std::chrono::microseconds((size_t) (this->rtoDelay * 1000.0 * 1000.0));
+            }
+            updateNextTimeout = false;
+
+            // signal we've gone once through the loop
+            SetEvent(this->workerLoopEvent);
+        }
+    } catch (SocketError& e) {
+        std::cerr << "WorkerThread exception: " << e.what() << std::endl;
+        this->workerAbort(e);
+        return;
+    } catch (const std::exception& e) {
+        std::cerr << "WorkerThread exception: " << e.what() << std::endl;
+        this->workerAbort(SocketError(SocketError::kStatusSystemError, e.what()));
+        return;
+    }
+
+beach:;
+}
+
+/**
+ * @brief Returns the packet whose retransmission timer is currently running: the SYN/FIN during
+ * a handshake, or the packet at the sender base otherwise.
+*/
+SenderSocket::pbuf& SenderSocket::workerTimeoutPacket()
+{
+    if (this->state == kStateSynSent || this->state == kStateFinSent) {
+        return this->control;
+    }
+
+    size_t slot = this->senderBase % this->window;
+    return this->queue[slot];
+}
+
+/**
+ * @brief (Re)transmits the pending control (SYN or FIN) packet.
+ * 
+ * This takes the place of the old blocking retransmit loop: each call is one attempt, and the
+ * worker's RTO timer drives the retries.
+*/
+void SenderSocket::workerTxControl()
+{
+    auto& packet = this->control;
+    const size_t attempts = (packet.type == pbuf::kTypeSyn) ? kMaxRetransmissionsSYN : kMaxRetransmissions;
+    const char* kind = (packet.type == pbuf::kTypeSyn) ? "SYN" : "FIN";
+
+    // if we get here, max number of retransmissions exhausted
+    if (packet.numTx >= attempts) {
+        throw SocketError(SocketError::kStatusTimeout);
+    }
+
+    // back off exponentially on SYN retransmissions, so the first one can go out early
+    if (packet.type == pbuf::kTypeSyn && packet.numTx) {
+        this->rtoDelay = min(this->rtoDelay * 2.0, max(kMaxSynTimeout, this->rtoDelay));
+    }
+
+    // fill in outgoing sequence number; it doesn't move on for early data sent behind the SYN
+    auto hdr = reinterpret_cast<SenderPacketHeader*>(packet.payload);
+    hdr->seq = (DWORD) packet.sequence;
+
+    this->workerTxPacket(packet, true, false);
+
+    if (this->debug) {
+        auto nowTs = this->clock->now();
+        double now = std::chrono::duration_cast<std::chrono::milliseconds>(nowTs - this->startTime).count() / 1000.f;
+
+        std::cout << "[" << std::fixed << std::setprecision(3) << std::setw(6) << now << "] --> "
+                  << kind << ' ' << hdr->seq << " (attempt " << packet.numTx << " of "
+                  << attempts << ", RTO " << this->rtoDelay << ")"
+                  << " to "
+                  << this->hostStr << std::endl;
+    }
+}
+
+/**
+ * @brief Builds the FIN packet and starts transmitting it.
+*/
+void SenderSocket::workerBeginClose()
+{
+    SenderPacketHeader fin;
+    memset(&fin, 0, sizeof(SenderPacketHeader));
+
+    fin.flags.magic = kFlagsMagic;
+    fin.flags.fin = 1;
+
+    this->control.type = pbuf::kTypeFin;
+    this->control.sequence = this->currentSeq;
+    this->control.numTx = 0;
+    this->control.payloadSz = sizeof(SenderPacketHeader);
+    memcpy(this->control.payload, &fin, sizeof(SenderPacketHeader));
+
+    this->state = kStateFinSent;
+    this->workerTxControl();
+}
+
+/**
+ * @brief Handles the response to a SYN or FIN: this completes the corresponding handshake and
+ * notifies whoever is waiting on it.
+*/
+void SenderSocket::workerControlAck(const ReceiverPacketHeader* rxHdr, size_t length)
+{
+    const bool isSyn = (this->state == kStateSynSent);
+    const char* kind = isSyn ? "SYN" : "FIN";
+
+    // calculate round-trip time for the most recent transmission
+    auto receivedAt = this->clock->now();
+    double rto = (std::chrono::duration_cast<std::chrono::microseconds>(receivedAt - this->control.txTime).count() / (1000.0 * 1000.0));
+
+    // print how long this song and dance took
+    double now = std::chrono::duration_cast<std::chrono::milliseconds>(receivedAt - this->startTime).count() / 1000.f;
+
+    std::cout << "[" << std::fixed << std::setprecision(3) << std::setw(6) << now << "] <-- "
+              << kind << ((rxHdr->flags.ack) ? "-ACK " : " ") << rxHdr->ackSeq << " window $"
+              << std::hex << std::setw(8) << std::setfill('0') << rxHdr->receiveWindow << std::dec << std::setfill(' ');
+
+    if (isSyn) {
+        // a retransmitted SYN makes the sample ambiguous; keep the backed off timeout then
+        if (this->control.numTx == 1) {
+            this->rtoDelay = max(rto * 3.0, kMinRetransmissionTimeout);
+        }
+        std::cout << "; setting initial RTO to " << this->rtoDelay << std::endl;
+
+        this->workerNegotiate(rxHdr, length);
+
+        // early data the receiver didn't take is sent again, now that we know its window
+        if (this->isEarlyOpen && !this->isEarlyDataEnabled()) {
+            this->nextToSend = this->senderBase;
+        }
+
+        // allow the sender to fill the window
+        this->workerUpdateWindow(rxHdr->receiveWindow);
+
+        // if we get here, the connection was successful
+        this->synAckTime = receivedAt;
+        this->isConnected = true;
+        this->state = kStateEstablished;
+
+        SetEvent(this->connectEvent);
+
+        if (this->openCallback) {
+            this->openCallback(this, nullptr);
+        }
+    } else {
+        std::cout << std::endl;
+
+        // actually close the socket
+        this->io.reset();
+
+        this->isConnected = false;
+        this->state = kStateClosed;
+
+        // notify threads to terminate
+        SetEvent(this->quitEvent);
+        SetEvent(this->closedEvent);
+
+        if (this->closeCallback) {
+            this->closeCallback(this, nullptr);
+        }
+    }
+}
+
+/**
+ * @brief Figures out which of the requested options the receiver agreed to, based on the option
+ * block (if any) following its SYN-ACK header, and enables them.
+*/
+void SenderSocket::workerNegotiate(const ReceiverPacketHeader* rxHdr, size_t length)
+{
+    memset(&this->options, 0, sizeof(SynOptions));
+
+    if (length >= sizeof(ReceiverSynAckPacket)) {
+        auto synAck = reinterpret_cast<const ReceiverSynAckPacket*>(rxHdr);
+
+        if (synAck->options.magic == kSynOptionsMagic) {
+            this->options = synAck->options;
+            this->options.flags &= this->requestedOptions.flags;
+        }
+    }
+
+    // forward error correction; the receiver may pick smaller blocks
+    if (this->options.flags & kSynOptionFec) {
+        this->fec = std::make_unique<Fec>(this->options.fecDataCount, this->options.fecParityCount);
+
+        this->fecParity.resize(this->options.fecParityCount);
+        for (auto& parity : this->fecParity) {
+            memset(parity.payload, 0, kMaxPacketSize);
+        }
+
+        if (this->debug) {
+            std::cout << "\tFEC: " << this->options.fecParityCount << " parity per "
+                      << this->options.fecDataCount << " data packets" << std::endl;
+        }
+    }
+
+    // compression; needs to know the final payload size, so set it up after FEC
+    if (this->options.flags & kSynOptionCompression) {
+        this->setUpCompressThread();
+    }
+
+    // ack frequency; delayed acks make RTT samples look longer than they are
+    this->peerAckDelay = 0;
+
+    if (this->options.flags & kSynOptionAckFrequency) {
+        this->peerAckDelay = this->options.ackDelay / (1000.0 * 1000.0);
+
+        if (this->debug) {
+            std::cout << "\tAcks: every " << this->options.ackEvery << " packets or "
+                      << this->options.ackDelay << " usec" << std::endl;
+        }
+    }
+
+    this->workerNegotiateResume();
+}
+
+/**
+ * @brief Figures out where to resume the transfer.
+ * 
+ * The receiver replies with the offset it wants to continue from, along with the CRC of the range
+ * ending there. We only believe it if that matches our checkpoint; otherwise (or if the receiver
+ * doesn't support resuming at all) the transfer starts over from the beginning.
+*/
+void SenderSocket::workerNegotiateResume()
+{
+    uint64_t offset = 0;
+
+    if (this->options.flags & kSynOptionResume) {
+        const uint64_t rangeSize = this->resume.rangeSize;
+        offset = this->options.resumeOffset;
+
+        bool valid = (this->options.transferId == this->resume.transferId &&
+            this->options.resumeRangeSize == rangeSize && !(offset % rangeSize) &&
+            offset <= this->resume.offset);
+
+        if (valid && offset) {
+            valid = (this->options.resumeCrc == this->resume.ranges[(offset / rangeSize) - 1]);
+        }
+
+        if (!valid) {
+            std::cerr << "Receiver's resume point (" << offset << ") doesn't match checkpoint; "
+                      << "starting over" << std::endl;
+            offset = 0;
+        }
+
+        this->checksum = std::make_unique<Checksum>();
+    }
+
+    // drop any ranges past the resume point; they'll be sent (and checksummed) again
+    this->resume.offset = offset;
+    this->resume.ranges.resize(offset / this->resume.rangeSize);
+
+    this->resumeOffset = offset;
+    this->streamQueued = offset;
+    this->streamAcked = offset;
+
+    if (this->debug && this->checksum) {
+        std::cout << "\tResume: continuing transfer " << std::hex << this->resume.transferId
+                  << std::dec << " at byte " << offset << std::endl;
+    }
+}
+
+/**
+ * @brief Adds a freshly transmitted data packet to the current FEC block; once the block is
+ * complete, its parity packets are sent.
+*/
+void SenderSocket::workerFecAccumulate(pbuf& packet)
+{
+    uint8_t* parity[Fec::kMaxSymbols];
+
+    if (!this->fecBlockCount) {
+        this->fecBlockStart = (DWORD) packet.sequence;
+    }
+
+    for (size_t j = 0; j < this->fecParity.size(); j++) {
+        parity[j] = reinterpret_cast<uint8_t*>(this->fecParity[j].payload) + sizeof(SenderParityPacket);
+    }
+
+    // symbol is the 16-bit payload length followed by the payload
+    const size_t dataLen = packet.payloadSz - sizeof(SenderPacketHeader);
+    const uint8_t lenBytes[2] = {
+        (uint8_t) (dataLen & 0xFF), (uint8_t) ((dataLen >> 8) & 0xFF)
+    };
+
+    this->fec->encode(parity, this->fecBlockCount, lenBytes, sizeof(lenBytes));
+    this->fec->encode(parity, this->fecBlockCount, packet.payload + sizeof(SenderPacketHeader), dataLen, sizeof(lenBytes));
+
+    this->fecSymbolLen = max(this->fecSymbolLen, dataLen + sizeof(lenBytes));
+
+    if (++this->fecBlockCount == this->fec->getDataCount()) {
+        this->workerFecFlush();
+    }
+}
+
+/**
+ * @brief Sends the parity packets for the current (possibly partial) FEC block, then resets the
+ * accumulators for the next one. Parity packets are never retransmitted.
+*/
+void SenderSocket::workerFecFlush()
+{
+    if (!this->fecBlockCount) {
+        return;
+    }
+
+    for (size_t j = 0; j < this->fecParity.size(); j++) {
+        auto& pb = this->fecParity[j];
+        auto packet = reinterpret_cast<SenderParityPacket*>(pb.payload);
+
+        memset(&packet->header, 0, sizeof(SenderPacketHeader));
+        packet->header.flags.magic = kFlagsMagic;
+        packet->header.flags.parity = 1;
+        packet->header.seq = this->fecBlockStart;
+
+        packet->fec.index = (BYTE) j;
+        packet->fec.dataCount = (BYTE) this->fecBlockCount;
+        packet->fec.symbolLen = (WORD) this->fecSymbolLen;
+
+        pb.payloadSz = sizeof(SenderParityPacket) + this->fecSymbolLen;
+        assert(pb.payloadSz <= kMaxPacketSize);
+
+        this->workerTxPacket(pb, false, false);
+
+        // clear the accumulator for the next block
+        memset(packet->data, 0, this->fecSymbolLen);
+    }
+
+    this->fecBlockCount = 0;
+    this->fecSymbolLen = 0;
+}
+
+/**
+ * @brief Marks the connection as broken. Anyone blocked on it is woken up, and the callback for
+ * any pending open or close is invoked with the error.
+*/
+void SenderSocket::workerAbort(const SocketError& e)
+{
+    const State prev = this->state;
+
+    this->abortError = std::make_unique<SocketError>(e);
+    this->state = kStateFailed;
+    this->isConnected = false;
+
+    SetEvent(this->abortEvent);
+
+    if (prev == kStateSynSent && this->openCallback) {
+        this->openCallback(this, this->abortError.get());
+    } else if (this->isClosing && this->closeCallback) {
+        this->closeCallback(this, this->abortError.get());
+    }
+}
+
+/**
+ * @brief Transmits queued packets, as far as the receiver's window allows.
+ *
+ * Packets beyond the send limit stay in the queue until an ack opens the window again; this may
+ * be called for those later on, so a wakeup that finds nothing sendable is fine.
+*/
+void SenderSocket::workerDrainQueue(bool &updateTimeouts)
+{
+    while (this->nextToSend < this->currentSeq && this->nextToSend < this->sendLimit) {
+        // get the packet from the queue, then transmit it
+        size_t slot = this->nextToSend++ % this->window;
+        if (slot == 0) {
+            updateTimeouts = true;
+        }
+
+        this->workerTxPacket(this->queue[slot]);
+
+        if (this->fec) {
+            this->workerFecAccumulate(this->queue[slot]);
+        }
+    }
+}
+
+/**
+ * @brief Transmits the given packet.
+*/
+void SenderSocket::workerTxPacket(pbuf &packet, bool incrementTxAttempts, bool checkTxLimit)
+{
+    int err;
+    const uint64_t txStart = this->latency ? Tsc::now() : 0;
+
+    // transmit packet
+//    err = sendto(this->sock, (const char*)packet.payload, (int)packet.payloadSz, 0,
+//        (struct sockaddr*)&this->host, sizeof(struct sockaddr_in));
+    // a retransmission may still be queued when an earlier copy is acked, and the slot reused
+    if (packet.sent) {
+        err = this->io->sendCopy(packet.payload, packet.payloadSz);
+    } else {
+        err = this->io->send(packet.payload, packet.payloadSz);
+    }
+
+    if (err == -1) {
+        throw SocketError(SocketError::kStatusSendFailed, WSAGetLastError());
+    }
+    packet.sent = true;
+
+    if (this->latency) {
+        this->traceStage(kLatencyTx, packet.sequence, txStart, Tsc::now());
+
+        if (packet.type == pbuf::kTypeData) {
+            if (!packet.firstTxTsc) {
+                packet.firstTxTsc = txStart;
+                this->traceStage(kLatencyQueued, packet.sequence, packet.queuedTsc, txStart);
+            } else if (incrementTxAttempts) {
+                this->traceStage(kLatencyRetx, packet.sequence, packet.firstTxTsc, txStart);
+            }
+        }
+    }
+
+    if (incrementTxAttempts) {
+        packet.numTx++;
+    }
+    packet.txTime = this->clock->now();
+
+    this->stats.totalBytesSent += (unsigned long)packet.payloadSz;
+
+    // if we've exceeded the number of retransmissions, signal error
+    if (packet.numTx > kMaxRetransmissions && checkTxLimit) {
+        throw SocketError(SocketError::kStatusTimeout, "Exceeded retx threshold for seq no " + std::to_string(packet.sequence));
+    }
+}
+
+/**
+ * @brief Reads pending data from the socket.
+*/
+void SenderSocket::workerReadAck(bool &updateTimeouts)
+{
+    double sampleRtt = 0;
+    int err;
+
+    // read a packet from the socket
+    static const size_t kReceiveSz = kMaxPacketSize;
+    char receive[kReceiveSz] = { 0 };
+    ReceiverPacketHeader* rxHdr = reinterpret_cast<ReceiverPacketHeader*>(receive);
+
+    err = this->io->receive(receive, kReceiveSz);
+    if (err == -1) {
+        throw SocketError(SocketError::kStatusRecvFailed, WSAGetLastError());
+    }
+    assert(err >= sizeof(ReceiverPacketHeader));
+
+    // responses to the SYN/FIN complete the handshake
+    if (this->state == kStateSynSent && rxHdr->flags.syn) {
+        this->workerControlAck(rxHdr, err);
+        this->workerDrainQueue(updateTimeouts);
+        updateTimeouts = true;
+        return;
+    } else if (this->state == kStateFinSent && rxHdr->flags.fin) {
+        this->workerControlAck(rxHdr, err);
+        return;
+    }
+
+    // packet was an acknowledgement
+    if (rxHdr->flags.ack && this->state == kStateEstablished) {
+        // time the packet was received
+        auto receivedAt = this->clock->now();
+
+        if (this->debug) {
+            std::cout << "\tTX: received ack for seq " << rxHdr->ackSeq << ", window "
+                      << rxHdr->receiveWindow << std::endl;
+        }
+
+        // any ack means the receiver is still around
+        this->probesUnanswered = 0;
+
+        /*
+         * Check for receiving multiple acks for the same packet. An ack that only changes the
+         * window is a window update, not a sign of loss, so it doesn't count as a duplicate.
+         */
+        if (this->lastAckSeq != rxHdr->ackSeq) {
+            // ack for a different sequence than previous
+            this->lastAckSeq = rxHdr->ackSeq;
+            this->lastAckCount = 1;
+        } else if (rxHdr->receiveWindow == this->peerWindow) {
+            /*
+             * If three acks received, retransmit the packet the receiver is waiting for. This
+             * still works with coalesced acks: the receiver never holds back acks for packets
+             * that arrive out of order, so each duplicate is still one packet past the hole.
+             */
+            if (++this->lastAckCount == 3 && rxHdr->ackSeq < this->nextToSend) {
+                this->stats.fastReTx++;
+
+                size_t slot = rxHdr->ackSeq % this->window;
+                auto& packet = this->queue[slot];
+                this->workerTxPacket(packet, true, false);
+
+                // reset ack state
+                updateTimeouts = true;
+            }
+        }
+
+        const bool advanced = (rxHdr->ackSeq > this->senderBase);
+        uint64_t streamEnd = 0;
+
+        // move sender base if the ack is beyond what we've sent
+        if (advanced) {
+            if (this->latency) {
+                this->workerTraceAcked(rxHdr->ackSeq);
+            }
+
+            // read before the slot is handed back to the app, which may fill it right away
+            streamEnd = this->queue[(rxHdr->ackSeq - 1) % this->window].streamEnd;
+
+            this->senderBase = rxHdr->ackSeq;
+            updateTimeouts = true;
+
+            // a zero window probe may have been accepted
+            if (this->nextToSend < this->senderBase) {
+                this->nextToSend = this->senderBase;
+            }
+        }
+
+        // every ack carries a window; apply it, then send whatever it allows
+        this->workerUpdateWindow(rxHdr->receiveWindow);
+        this->workerDrainQueue(updateTimeouts);
+
+        if (advanced) {
+            this->streamAcked = streamEnd;
+
+            // update the "last ack received" time
+            this->dataAckTime = receivedAt;
+
+            if (this->ackCallback) {
+                this->ackCallback(this, this->senderBase);
+            }
+
+            // figure out when this packet was transmitted
+            size_t slot = (rxHdr->ackSeq - 1) % this->window;
+            auto& packet = this->queue[slot];
+            size_t baseSlot = this->senderBase % this->window;
+            auto& basePacket = this->queue[baseSlot];
+
+            if (packet.numTx > 1 || basePacket.numTx > 1) {
+                return;
+            }
+
+            auto sentAt = packet.txTime;
+            sampleRtt = max(std::chrono::duration_cast<std::chrono::milliseconds>(receivedAt - sentAt).count() / 1000.f, 0.01);
+
+            // update estimated RTT
+            if (this->estimatedRttLast <= 0) {
+                this->estimatedRttLast = sampleRtt;
+            } else {
+                this->estimatedRttLast = this->estimatedRtt;
+            }
+            this->estimatedRtt = ((1.f - kRttAlpha) * this->estimatedRttLast) + (kRttAlpha * sampleRtt);
+            //std::cout << "eRTT: " << this->estimatedRtt << "; last " << this->estimatedRttLast << ", sample " << sampleRtt << std::endl;
+
+            // update RTT deviation
+            if (this->devRttLast <= 0) {
+                this->devRttLast = 0;
+            } else {
+                this->devRttLast = this->devRtt;
+            }
+
+            this->devRtt = ((1 - kRttBeta) * this->devRttLast) + (kRttBeta * fabs(sampleRtt - this->estimatedRtt));
+            this->rtoDelay = min(this->estimatedRtt + (4 * max(this->devRtt, 0.010)) + this->peerAckDelay, 2);
+        }
+    }
+}
+
+/**
+ * @brief Records the ack latency of all packets between the sender base and the given sequence
+ * number, which were just acknowledged. Retransmitted packets are skipped, since there's no telling
+ * which transmission the ack is for.
+*/
+void SenderSocket::workerTraceAcked(size_t ackSeq)
+{
+    const uint64_t now = Tsc::now();
+
+    for (size_t seq = this->senderBase; seq < ackSeq; seq++) {
+        const auto& packet = this->queue[seq % this->window];
+
+        if (packet.numTx == 1 && packet.firstTxTsc) {
+            this->traceStage(kLatencyAck, seq, packet.firstTxTsc, now);
+        }
+    }
+}
+
+/**
+ * @brief Applies a receive window advertised by the receiver.
+ *
+ * The window is treated as credit: the receiver allows us to have packets up to sender base +
+ * window on the wire. The app is handed queue slots (via the `empty` semaphore) up to that point
+ * as well, but credit already handed out can't be taken back; if the window shrinks, we just stop
+ * releasing slots and transmitting until the sender base catches up again. Packets the app queued
+ * in the meantime wait in the queue.
+*/
+void SenderSocket::workerUpdateWindow(DWORD receiveWindow)
+{
+    const size_t effectiveWin = min(this->window, (size_t) receiveWindow);
+
+    /*if (this->stats.effectiveWindow != effectiveWin) {
+        std::cout << "Win: " << effectiveWin << " seq " << this->currentSeq << std::endl;
+    }*/
+
+    this->peerWindow = receiveWindow;
+    this->stats.effectiveWindow = (unsigned long) effectiveWin;
+    this->sendLimit = this->senderBase + effectiveWin;
+
+    // hand out queue slots for any window space not yet released
+    if (this->sendLimit > this->lastReleased) {
+        size_t newReleased = this->sendLimit - this->lastReleased;
+        ReleaseSemaphore(this->empty, (LONG) newReleased, nullptr);
+        this->lastReleased = this->sendLimit;
+    }
+
+    // (re)arm the persist timer while the window is closed; reset its backoff once it reopens
+    if (this->workerWindowClosed()) {
+        this->nextProbe = this->clock->now() + std::chrono::microseconds((size_t) (this->probeInterval * 1000.0 * 1000.0));
+    } else if (this->sendLimit > this->nextToSend) {
+        this->probeInterval = this->rtoDelay;
+    }
+}
+
+/**
+ * @brief Whether we're stuck behind a closed receive window: there's queued data, but nothing in
+ * flight that would get us an ack (and with it, a window update).
+*/
+bool SenderSocket::workerWindowClosed() const
+{
+    return (this->state == kStateEstablished && this->senderBase == this->nextToSend &&
+        this->nextToSend < this->currentSeq && this->nextToSend >= this->sendLimit);
+}
+
+/**
+ * @brief Sends a zero window probe: the next queued packet, sent outside of the window.
+ *
+ * If the receiver has room for it after all, the ack moves the sender base past it; otherwise it's
+ * dropped, but the ack still tells us the current window. Probes back off exponentially, and don't
+ * count as transmissions of the packet; only a receiver that doesn't answer any of them is given
+ * up on.
+*/
+void SenderSocket::workerProbeWindow()
+{
+    if (++this->probesUnanswered > kMaxRetransmissions) {
+        throw SocketError(SocketError::kStatusTimeout, "Receiver window stayed closed");
+    }
+
+    size_t slot = this->nextToSend % this->window;
+    this->workerTxPacket(this->queue[slot], false, false);
+
+    if (this->debug) {
+        std::cout << "\tTX: zero window probe with seq " << this->nextToSend << ", next in "
+                  << this->probeInterval << std::endl;
+    }
+
+    this->probeInterval = min(this->probeInterval * 2.0, kMaxProbeInterval);
+    this->nextProbe = this->clock->now() + std::chrono::microseconds((size_t) (this->probeInterval * 1000.0 * 1000.0));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Trampoline to jump into the class main method
+ * @param ctx Context passed to thread creation
+*/
+DWORD WINAPI __fucker::CompressThreadEntry(LPVOID ctx)
+{
+    auto sock = static_cast<SenderSocket*>(ctx);
+
+    sock->clock->enter();
+    sock->compressThreadMain();
+    sock->clock->detach();
+    return 0;
+}
+
+/**
+ * @brief Sets up the compression stage once it has been negotiated: allocates the block buffers
+ * and starts the compression thread.
+*/
+void SenderSocket::setUpCompressThread()
+{
+    using namespace __fucker;
+
+    // every send must fit into a block
+    const size_t maxPayload = this->getMaxPayloadSize();
+    const size_t blockSize = min(max((size_t) this->options.compressionBlockSize, maxPayload), Compressor::kMaxBlockSize);
+
+    this->compressor = std::make_unique<Compressor>();
+
+    this->compressBlocks.resize(kCompressBuffers);
+    for (auto& block : this->compressBlocks) {
+        block.data.resize(blockSize);
+    }
+
+    this->compressFiltered.resize(blockSize);
+    for (auto& out : this->compressOut) {
+        out.resize(sizeof(CompressedBlockHeader) + Compressor::compressBound(blockSize));
+    }
+
+    this->compressFree = CreateSemaphore(NULL, (LONG) kCompressBuffers, (LONG) kCompressBuffers, nullptr);
+    this->compressReady = CreateSemaphore(NULL, 0, (LONG) kCompressBuffers, nullptr);
+
+    this->clock->attach();
+    this->compressThread = CreateThread(nullptr, kCompressStackSize, CompressThreadEntry, this, 0, nullptr);
+    assert(this->compressThread != INVALID_HANDLE_VALUE);
+
+    if (this->debug) {
+        std::cout << "\tCompression: " << blockSize << " byte blocks" << std::endl;
+    }
+}
+
+/**
+ * @brief Main loop of the compression thread: compresses blocks as the app fills them, and queues
+ * the resulting packets.
+ * 
+ * This is the only thread queueing packets while compression is on, so it's what gets throttled
+ * by the send window; the app in turn blocks once all block buffers are in use.
+*/
+void SenderSocket::compressThreadMain()
+{
+    HANDLE events[] = {
+        this->quitEvent, this->abortEvent, this->compressReady
+    };
+
+    while (this->clock->wait(3, events, INFINITE) == (WAIT_OBJECT_0 + 2)) {
+        auto& block = this->compressBlocks[this->compressNext];
+        this->compressNext = (this->compressNext + 1) % kCompressBuffers;
+
+        // bail if the connection went away while waiting for window space
+        if (!this->compressBlock(block)) {
+            return;
+        }
+
+        ReleaseSemaphore(this->compressFree, 1, nullptr);
+
+        // let the worker know in case it's waiting for us to finish before closing
+        this->compressPending--;
+        SetEvent(this->wakeEvent);
+    }
+}
+
+/**
+ * @brief Appends data to the block being filled, handing it to the compression thread once full.
+ * 
+ * @param wait Whether to block if all block buffers are in use
+ * @return Whether the data was accepted; only false if not waiting.
+*/
+bool SenderSocket::compressAppend(const void* data, size_t length, bool wait)
+{
+    // get a buffer to fill if we don't have one
+    if (!this->compressHaveBlock) {
+        HANDLE events[] = {
+            this->quitEvent, this->abortEvent, this->compressFree
+        };
+        DWORD waitRet = this->clock->wait(3, events, wait ? INFINITE : 0);
+
+        switch (waitRet) {
+            case WAIT_OBJECT_0:
+                throw SocketError(SocketError::kStatusNotConnected);
+            case (WAIT_OBJECT_0 + 1):
+                throw SocketError(SocketError::kStatusSendFailed, "Connection has broken");
+            case (WAIT_OBJECT_0 + 2):
+                break;
+            // all buffers are busy
+            case WAIT_TIMEOUT:
+                return false;
+
+            default:
+                throw SocketError(SocketError::kStatusSystemError);
+        }
+
+        this->compressHaveBlock = true;
+        this->compressBlocks[this->compressFill].length = 0;
+    }
+
+    auto& block = this->compressBlocks[this->compressFill];
+
+    memcpy(block.data.data() + block.length, data, length);
+    block.length += length;
+
+    this->trackStream(data, length);
+
+    // hand it off once the next send might not fit anymore
+    if ((block.length + this->getMaxPayloadSize()) > block.data.size()) {
+        this->compressSubmit();
+    }
+
+    return true;
+}
+
+/**
+ * @brief Hands the block being filled to the compression thread.
+*/
+void SenderSocket::compressSubmit()
+{
+    this->compressBlocks[this->compressFill].streamEnd = this->streamQueued;
+
+    this->compressHaveBlock = false;
+    this->compressFill = (this->compressFill + 1) % kCompressBuffers;
+
+    this->compressPending++;
+    ReleaseSemaphore(this->compressReady, 1, nullptr);
+}
+
+/**
+ * @brief Compresses a block and queues the packets containing it.
+ * 
+ * Integer arrays have no repeated byte sequences until they've been run through the delta filter,
+ * so if the block doesn't compress well as-is, the filtered version is tried as well and the
+ * smaller one is sent. If neither is smaller than the block, it's sent uncompressed.
+ * 
+ * @return Whether all packets were queued; false if the connection went away in the meantime.
+*/
+bool SenderSocket::compressBlock(CompressBlock& block)
+{
+    const size_t cap = this->compressOut[0].size() - sizeof(CompressedBlockHeader);
+    size_t len[2] = { 0, 0 };
+
+    len[0] = this->compressor->compress(block.data.data(), block.length,
+        this->compressOut[0].data() + sizeof(CompressedBlockHeader), cap);
+
+    if (!len[0] || (len[0] * 2) > block.length) {
+        Compressor::deltaEncode32(block.data.data(), this->compressFiltered.data(), block.length);
+
+        len[1] = this->compressor->compress(this->compressFiltered.data(), block.length,
+            this->compressOut[1].data() + sizeof(CompressedBlockHeader), cap);
+    }
+
+    // pick the smaller one
+    size_t which = 0;
+    if (len[1] && (!len[0] || len[1] < len[0])) {
+        which = 1;
+    }
+
+    this->stats.compressRawBytes += block.length;
+    const uint64_t streamStart = block.streamEnd - block.length;
+
+    // didn't compress at all
+    if (!len[which]) {
+        this->stats.compressOutBytes += block.length;
+        return this->compressEmit(block.data.data(), block.length, false, streamStart, block.streamEnd);
+    }
+
+    auto hdr = reinterpret_cast<CompressedBlockHeader*>(this->compressOut[which].data());
+    memset(hdr, 0, sizeof(CompressedBlockHeader));
+
+    hdr->rawLength = (DWORD) block.length;
+    hdr->compressedLength = (DWORD) len[which];
+    hdr->filter = which ? kCompressionFilterDelta32 : kCompressionFilterNone;
+
+    const size_t total = sizeof(CompressedBlockHeader) + len[which];
+    this->stats.compressOutBytes += total;
+
+    return this->compressEmit(this->compressOut[which].data(), total, true, streamStart, block.streamEnd);
+}
+
+/**
+ * @brief Splits data into packets and queues them, waiting for window space as needed.
+ * 
+ * @param streamStart Data stream offset of the start of the block
+ * @param streamEnd Data stream offset of the end of the block
+ * @return Whether all packets were queued; false if the connection went away in the meantime.
+*/
+bool SenderSocket::compressEmit(const char* data, size_t length, bool compressed, uint64_t streamStart, uint64_t streamEnd)
+{
+    const size_t maxPayload = this->getMaxPayloadSize();
+
+    HANDLE events[] = {
+        this->quitEvent, this->abortEvent, this->empty
+    };
+
+    for (size_t off = 0; off < length; off += maxPayload) {
+        if (this->clock->wait(3, events, INFINITE) != (WAIT_OBJECT_0 + 2)) {
+            return false;
+        }
+
+        const size_t chunk = min(length - off, maxPayload);
+
+        // a compressed block can only be decoded once all of it has arrived
+        uint64_t end = streamStart + off + chunk;
+        if (compressed) {
+            end = ((off + chunk) == length) ? streamEnd : streamStart;
+        }
+
+        this->enqueuePacket(data + off, chunk, end, compressed);
+    }
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Trampoline to jump into the class main method
+ * @param ctx Context passed to thread creation
+*/
+DWORD WINAPI __fucker::StatsThreadEntry(LPVOID ctx)
+{
+    auto sock = static_cast<SenderSocket*>(ctx);
+
+    sock->clock->enter();
+    sock->statsThreadMain();
+    sock->clock->detach();
+    return 0;
+}
+
+/**
+ * @brief Initializes the stats thread.
+*/
+void SenderSocket::setUpStatsThread()
+{
+    using namespace __fucker;
+
+    // set up thread
+    this->statsThread = CreateThread(nullptr, kStatsStackSize, StatsThreadEntry, this, CREATE_SUSPENDED, nullptr);
+    assert(this->statsThread != INVALID_HANDLE_VALUE);
+}
+
+/**
+ * @brief Main loop for the stats thread
+*/
+void SenderSocket::statsThreadMain()
+{
+    // prepare stats structures
+    this->stats.lastPrint = this->clock->now();
+    // this->statsThreadPrint(std::cout);
+
+    // wait on the quit event; in simulated time, so that simulations print the same stats every run
+    while (this->clock->wait(1, &this->quitEvent, 2000) == WAIT_TIMEOUT) {
+        this->statsThreadPrint(std::cout);
+    }
+
+    // clean up
+    std::cout << std::endl << std::flush;
+}
+
+/**
+ * @brief Prints a single stats line to the given stream.
+ * @param out Stream to receive stats text
+*/
+void SenderSocket::statsThreadPrint(std::ostream& out, bool newline)
+{
+    using namespace std::chrono;
+
+    auto now = this->clock->now();
+
+    // seconds since the last stats computation
+    auto secsSinceLastStats = duration_cast<microseconds>(now - this->stats.lastPrint).count() / 1000.f / 1000.f;
+    this->stats.lastPrint = now;
+
+    // seconds since constructyboi
+    auto secs = duration_cast<seconds>(now - this->constructTime).count();
+
+    out << "[" << std::setw(2) << secs << "] ";
+
+    // sender base and mbytes acked
+    size_t bytesAcked = this->senderBase * kMaxPacketSize;
+    double mbAcked = ((double)bytesAcked) / 1000.f / 1000.f;
+    out << "B " << std::setw(7) << this->senderBase << " (" << std::setw(7) << std::setprecision(1) << mbAcked
+        << " MB) ";
+
+    // next sequence number
+    out << "N " << std::setw(7) << (this->currentSeq) << ' ';
+
+    // timeout/fast retransmit/effective window size
+    out << "T " << std::setw(5) << max(((long)this->stats.timeout) - 1, 0) << ' '
+        << "F " << std::setw(5) << max(((long)this->stats.fastReTx) - 1, 0) << ' '
+        << "W " << std::setw(7) << this->stats.effectiveWindow << ' ';
+
+    // goodput and RTT
+    // size_t acked = this->stats.payloadBytesAcked;
+    size_t bytesDiff = bytesAcked - this->stats.bytesConsumed;
+    this->stats.bytesConsumed = (unsigned long)bytesAcked;
+
+    // two prints at the same (simulated) time have nothing to go by
+    double goodput = 0;
+
+    if (secsSinceLastStats > 0) {
+        goodput = ((double)bytesDiff * 8) / 1000.f / 1000.f / secsSinceLastStats;
+    }
+
+    out << "S " << std::setw(7) << std::setprecision(3) << goodput << " Mbps "
+        << " RTT " << std::setw(6) << std::fixed << std::setprecision(4) << this->estimatedRtt;
+
+    // lastly, newline if requested
+    if (newline) {
+        out << std::endl;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/// Names of the latency stages
+const char* const SenderSocket::kLatencyStageNames[kNumLatencyStages] = {
+    "send wait", "queued", "tx", "ack", "retx",
+};
+
+/// Default descriptive texts for each of the error codes
+const std::unordered_map<SenderSocket::SocketError::Type, std::string> SenderSocket::SocketError::kDefaultMessages = {
+    {kStatusOk, "No error (yo wtf)"},
+    { kStatusConnected, "Socket already connected" },
+    { kStatusNotConnected, "Cannot perform IO on disconnected socket" },
+    { kStatusInvalidHost, "Destination host is invalid" },
+    { kStatusSendFailed, "send() failed" },
+    { kStatusRecvFailed, "recvfrom() failed" },
+    { kStatusTimeout, "Timeout after exhausting retransmissions" },
+};
+
+/**
+ * @brief Creates a new error with no additional information beyond a type.
+*/
+SenderSocket::SocketError::SocketError(Type t)
+    : type(t)
+{
+    try {
+        this->message = kDefaultMessages.at(t);
+    } catch (std::out_of_range&) {
+        this->message = "unknown error";
+    }
+}
+
+/**
+ * @brief Creates a new error with detailed error string.
+*/
+SenderSocket::SocketError::SocketError(Type t, const std::string &detail)
+    : type(t)
+{
+    std::stringstream str;
+
+    try {
+        str << kDefaultMessages.at(t);
+    } catch (std::out_of_range&) {
+        str << "unknown error";
+    }
+
+    str << ": " << detail;
+    
+    this->message = str.str();
 }
\ No newline at end of file
@@ -1,311 +1,646 @@
-#ifndef SENDERSOCKET_H
-#define SENDERSOCKET_H
-
-#include <cstdint>
-#include <cstddef>
-
-#include <stdexcept>
-#include <string>
-#include <unordered_map>
-#include <chrono>
-#include <atomic>
-#include <ostream>
-
-namespace __fucker {
-    DWORD WINAPI StatsThreadEntry(LPVOID);
-    DWORD WINAPI WorkerThreadEntry(LPVOID);
-}
-
-/**
- * @brief Implements the fancy schmanzy stuff on top of UDP to go very very fast
-*/
-class SenderSocket {
-    friend DWORD WINAPI __fucker::StatsThreadEntry(LPVOID);
-    friend DWORD WINAPI __fucker::WorkerThreadEntry(LPVOID);
-
-
-public:
-	/// Port number in use
-    constexpr static const uint16_t kPortNumber = 22345;
-	/// Maximum packet size
-    constexpr static const size_t kMaxPacketSize = (1500 - 28);
-    // constexpr static const size_t kMaxPacketSize = (9000 - 28);
-    /// Max number of retransmissions (for connection establishment SYN packets)
-    constexpr static const size_t kMaxRetransmissionsSYN = 50;
-    /// Max number of retransmissions (for all other types of packets)
-    constexpr static const size_t kMaxRetransmissions = 50;
-    /// Default retransmission timeout (in seconds)
-    constexpr static const double kRetransmissionTimeout = 1.0;
-    /// Weight of estimated RTT (alpha)
-    constexpr static const double kRttAlpha = 0.125;
-    /// Estimated difference between SampleRTT/EstimatedRTT (beta)
-    constexpr static const double kRttBeta = 0.25;
-
-public:
-    /**
-     * @brief Errors produced as a result of socket IO calls. These are propagated out from the
-     * appropriate functions as exceptions of this type.
-    */
-    class SocketError : public std::exception {
-        friend class SenderSocket;
-
-    public:
-        /**
-         * @brief Various error types caused by the class.
-         * 
-         * Note that all system errors (send/recv failed) carry additional info.
-         */
-        enum Type {
-            /// No error
-            kStatusOk = 0,
-            /// Attempt to connect on an already connected socket
-            kStatusConnected = 1,
-            /// Attempt to send/receive on a disconnected socket
-            kStatusNotConnected = 2,
-            /// Invalid target hostname or IP address
-            kStatusInvalidHost = 3,
-            /// Internal error sending data
-            kStatusSendFailed = 4,
-            /// Timeout on retransmissions
-            kStatusTimeout = 5,
-            /// Internal error receiving data
-            kStatusRecvFailed = 6,
-            /// Some undefined system error took place
-            kStatusSystemError = 7,
-        };
-
-        /// Gets the type of exception
-        const Type getType() const
-        {
-            return this->type;
-        }
-
-        /// Descriptive message
-        virtual const char* what() noexcept
-        {
-            return this->message.c_str();
-        }
-
-    private:
-        SocketError(Type);
-        SocketError(Type t, size_t code)
-            : SocketError(t, std::to_string(code)) {};
-        SocketError(Type, const std::string&);
-
-    private:
-        std::string message;
-        Type type;
-
-    private:
-        static const std::unordered_map<Type, std::string> kDefaultMessages;
-    };
-
-public:
-    /// Returns the time at which connection establishment began
-    std::chrono::steady_clock::time_point getStartTime() const
-    {
-        return this->startTime;
-    }
-
-    /// Returns the time at which the SYN-ACK to establish the connection was received
-    std::chrono::steady_clock::time_point getSynAckTime() const
-    {
-        return this->synAckTime;
-    }
-
-    /// Returns the time at which the most recent ACK for a data packet was received
-    std::chrono::steady_clock::time_point getDataAckTime() const
-    {
-        return this->dataAckTime;
-    }
-
-    /// Returns the currently estimated RTT
-    double getEstimatedRtt() const
-    {
-        return this->estimatedRtt;
-    }
-
-    /// Total number of acknowledged bytes
-    size_t getBytesSent() const
-    {
-        return this->stats.totalBytesSent;
-    }
-    /// Total number of acknowledged payload bytes
-    size_t getAckedPayloadBytes() const
-    {
-        return this->stats.payloadBytesAcked;
-    }
-
-private:
-    /// size of the stats thread stack, in bytes
-    constexpr static const size_t kStatsStackSize = (1024 * 128);
-    /// size of the worker thread stack, in bytes
-    constexpr static const size_t kWorkerStackSize = (1024 * 256);
-
-private:
-    /**
-     * @brief Tx queue entry; holds a packet awaiting transmission
-    */
-    struct pbuf {
-        /// Sequence number of the packet to be transmitted
-        size_t sequence = 0;
-        /// Type of packet
-        enum {
-            kTypeUnknown,
-            kTypeData,
-            kTypeFin,
-            kTypeSyn
-        } type = kTypeUnknown;
-
-        /// timestamp of transmission time
-        std::chrono::steady_clock::time_point txTime;
-        /// number of times the packet has been transmitted
-        size_t numTx = 0;
-
-        /// Size of the payload data
-        size_t payloadSz = 0;
-        /// Actual payload data for the packet
-        char payload[kMaxPacketSize];
-    };
-
-    // worker thread context
-    struct WorkerCtx {
-        WorkerCtx() = delete;
-        WorkerCtx(SenderSocket* s, size_t _i) : sock(s) , i(_i) { }
-
-        SenderSocket* sock = nullptr;
-        size_t i = 0;
-    };
-
-private:
-    /// Socket used for communicating
-    SOCKET sock = INVALID_SOCKET;
-    /// Event signalled when there is data to read from the socket
-    HANDLE sockEvent = INVALID_HANDLE_VALUE;
-
-    /// Destination host
-    struct sockaddr_storage host = { 0 };
-    /// String version of destination host
-    std::string hostStr = "";
-    /// Window size
-    size_t window = 0;
-
-    /// when set, close has been called at least once. no more data should be accepted
-    bool isClosing = false;
-    /// if set, we've established a connection before
-    bool isConnected = false;
-    /// time at which the connection was begun to be established
-    std::chrono::steady_clock::time_point startTime;
-    /// time at which the SYN-ACK was received
-    std::chrono::steady_clock::time_point synAckTime;
-    /// time the constructor was called
-    std::chrono::steady_clock::time_point constructTime;
-    /// when the most recent ACK for a data payload packet was received
-    std::chrono::steady_clock::time_point dataAckTime;
-
-    /// current retransmission delay
-    double rtoDelay = kRetransmissionTimeout;
-    /// current sequence number. incremented on every transmission
-    DWORD currentSeq = 0;
-
-    /// RTT deviation
-    double devRtt = 0;
-    /// RTT deviation (previous value)
-    double devRttLast = -1;
-    /// Estimated RTT
-    double estimatedRtt = 0;
-    /// Estimated RTT (previous value)
-    double estimatedRttLast = -1;
-
-    /// When set, debug logging is on.
-    bool debug = false;
-
-    /// handle to the stats thread
-    HANDLE statsThread = INVALID_HANDLE_VALUE;
-    /// signalled when quit is desired
-    HANDLE quitEvent = INVALID_HANDLE_VALUE;
-
-    /// number of worker threads
-    constexpr static const size_t kNumWorkers = 1;
-    /// handle to the worker threads
-    HANDLE workerThread[kNumWorkers] = { INVALID_HANDLE_VALUE };
-    /// event signalled by the worker to indicate the connection has become fucked
-    HANDLE abortEvent = INVALID_HANDLE_VALUE;
-    /// the worker thread signals this every time it passes through its main loop
-    HANDLE workerLoopEvent = INVALID_HANDLE_VALUE;
-
-    /// sequence number of the last acknowledged packet
-    DWORD lastAckSeq = 0;
-    /// number of times an ack was received for the same packet
-    size_t lastAckCount = 0;
-
-    /// semaphore indicating queue has empty spots
-    HANDLE empty = INVALID_HANDLE_VALUE;
-    /// semaphore indicating queue is full
-    HANDLE full = INVALID_HANDLE_VALUE;
-
-    /// packets waiting to be transmitted
-    std::vector<pbuf> queue;
-    /// Sender base value
-    size_t senderBase = 0;
-    /// Index of packet to send next
-    size_t nextToSend = 0;
-    /// Last released packet
-    size_t lastReleased = 0;
-
-    /// Current stats to print for the stats thread
-    struct {
-        /// Number of ACKed packets
-        std::atomic_ulong packetsAcked = 0;
-        /// Next sequence number
-        std::atomic_ulong nextSeq = 0;
-        /// Number of timeouts
-        std::atomic_ulong timeout = 0;
-        /// Number of fast retransmitted
-        std::atomic_ulong fastReTx = 0;
-        /// effective window size
-        std::atomic_ulong effectiveWindow = 1;
-
-        /// number of bytes sent (including headers)
-        std::atomic_ulong totalBytesSent = 0;
-        /// number of payload bytes acked (total)
-        std::atomic_ulong payloadBytesAcked = 0;
-        /// last number of bytes acked
-        std::atomic_ulong bytesConsumed = 0;
-
-        /// last time stats were printed
-        std::chrono::steady_clock::time_point lastPrint;
-    } stats;
-
-public:
-    SenderSocket();
-    virtual ~SenderSocket() noexcept(false);
-
-    void open(const std::string& host, uint16_t port, size_t window, float rtt, float speed, float loss[2]);
-    void close();
-
-    void send(void* data, size_t length);
-
-private:
-    void setUpSocket(struct sockaddr_storage* addr);
-    void sendPacketRetransmit(void* data, size_t length, size_t numRetrans = kMaxRetransmissions, bool updateRto = false, bool log = false, const std::string& kind = "");
-
-private:
-    static void resolve(const std::string &host, struct sockaddr_storage* outAddr);
-
-private:
-    void setUpStatsThread();
-    void statsThreadMain();
-    void statsThreadPrint(std::ostream &out, bool newline = true);
-
-private:
-    void setUpWorkerThread();
-    void workerThreadMain(WorkerCtx *);
-
-    void workerDrainQueue(bool &);
-    void workerTxPacket(pbuf&, bool = true, bool = true);
-
-    void workerReadAck(bool &);
-};
-
+#ifndef SENDERSOCKET_H
+#define SENDERSOCKET_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <chrono>
+#include <atomic>
+#include <ostream>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "PacketTypes.h"
+#include "Checkpoint.h"
+#include "LatencyHistogram.h"
+#include "Clock.h"
+
+class Fec;
+class Compressor;
+class Checksum;
+class PacketIo;
+class TraceRing;
+class PageArena;
+
+namespace __fucker {
+    DWORD WINAPI StatsThreadEntry(LPVOID);
+    DWORD WINAPI WorkerThreadEntry(LPVOID);
+    DWORD WINAPI CompressThreadEntry(LPVOID);
+}
+
+/**
+ * @brief Implements the fancy schmanzy stuff on top of UDP to go very very fast
+*/
+class SenderSocket {
+    friend DWORD WINAPI __fucker::StatsThreadEntry(LPVOID);
+    friend DWORD WINAPI __fucker::WorkerThreadEntry(LPVOID);
+    friend DWORD WINAPI __fucker::CompressThreadEntry(LPVOID);
+    friend class ConnectionManager;
+
+
+public:
+	/// Port number in use
+    constexpr static const uint16_t kPortNumber = 22345;
+	/// Maximum packet size
+    constexpr static const size_t kMaxPacketSize = (1500 - 28);
+    // constexpr static const size_t kMaxPacketSize = (9000 - 28);
+    /// Max number of retransmissions (for connection establishment SYN packets)
+    constexpr static const size_t kMaxRetransmissionsSYN = 50;
+    /// Max number of retransmissions (for all other types of packets)
+    constexpr static const size_t kMaxRetransmissions = 50;
+    /// Default retransmission timeout (in seconds)
+    constexpr static const double kRetransmissionTimeout = 1.0;
+    /// Shortest timeout for the first SYN (in seconds); it doubles with every retransmission
+    constexpr static const double kInitialSynTimeout = 0.25;
+    /// Longest timeout between SYN retransmissions (in seconds)
+    constexpr static const double kMaxSynTimeout = 2.0;
+    /// Shortest retransmission timeout derived from the handshake (in seconds)
+    constexpr static const double kMinRetransmissionTimeout = 0.04;
+    /// Longest interval between zero window probes (in seconds)
+    constexpr static const double kMaxProbeInterval = 5.0;
+    /// Weight of estimated RTT (alpha)
+    constexpr static const double kRttAlpha = 0.125;
+    /// Estimated difference between SampleRTT/EstimatedRTT (beta)
+    constexpr static const double kRttBeta = 0.25;
+    /// Per-packet overhead of FEC: the parity header plus the symbol length prefix
+    constexpr static const size_t kFecOverhead = (sizeof(FecParityHeader) + sizeof(uint16_t));
+    /// Default amount of data compressed as one block
+    constexpr static const size_t kDefaultCompressionBlockSize = (1024 * 64);
+    /// Longest time the receiver may be allowed to hold back an ack (in msec)
+    constexpr static const DWORD kMaxAckDelay = 200;
+    /// Default number of packets acknowledged together, if ack coalescing is requested
+    constexpr static const size_t kDefaultAckEvery = 8;
+    /// Default longest time an ack may be held back, if ack coalescing is requested (in usec)
+    constexpr static const DWORD kDefaultAckDelay = (10 * 1000);
+
+public:
+    /**
+     * @brief Errors produced as a result of socket IO calls. These are propagated out from the
+     * appropriate functions as exceptions of this type.
+    */
+    class SocketError : public std::exception {
+        friend class SenderSocket;
+        friend class ReceiverSocket;
+        friend class ConnectionManager;
+
+    public:
+        /**
+         * @brief Various error types caused by the class.
+         * 
+         * Note that all system errors (send/recv failed) carry additional info.
+         */
+        enum Type {
+            /// No error
+            kStatusOk = 0,
+            /// Attempt to connect on an already connected socket
+            kStatusConnected = 1,
+            /// Attempt to send/receive on a disconnected socket
+            kStatusNotConnected = 2,
+            /// Invalid target hostname or IP address
+            kStatusInvalidHost = 3,
+            /// Internal error sending data
+            kStatusSendFailed = 4,
+            /// Timeout on retransmissions
+            kStatusTimeout = 5,
+            /// Internal error receiving data
+            kStatusRecvFailed = 6,
+            /// Some undefined system error took place
+            kStatusSystemError = 7,
+        };
+
+        /// Gets the type of exception
+        const Type getType() const
+        {
+            return this->type;
+        }
+
+        /// Descriptive message
+        virtual const char* what() noexcept
+        {
+            return this->message.c_str();
+        }
+
+    private:
+        SocketError(Type);
+        SocketError(Type t, size_t code)
+            : SocketError(t, std::to_string(code)) {};
+        SocketError(Type, const std::string&);
+
+    private:
+        std::string message;
+        Type type;
+
+    private:
+        static const std::unordered_map<Type, std::string> kDefaultMessages;
+    };
+
+    /**
+     * @brief Invoked when an asynchronous open or close operation completes.
+     *
+     * The error argument is `nullptr` if the operation succeeded. Callbacks run on the worker
+     * thread, so they should return quickly and must not call the blocking `open()`/`close()`.
+     */
+    using CompletionCallback = std::function<void(SenderSocket*, const SocketError*)>;
+    /**
+     * @brief Invoked on the worker thread whenever the sender base advances; the argument is the
+     * new sender base (all packets with lower sequence numbers have been acknowledged.)
+     */
+    using AckCallback = std::function<void(SenderSocket*, size_t)>;
+
+    /**
+     * @brief Ways of getting packets onto the wire
+     */
+    enum IoBackend {
+        /// regular UDP socket, one send call per datagram
+        kIoSocket,
+        /// UDP socket, with runs of datagrams coalesced through segmentation offload
+        kIoSegmentationOffload,
+        /// Registered I/O: send queue registered with the stack, sends committed in batches
+        kIoRegisteredIo,
+        /// backend supplied by the app with `setPacketIo()`
+        kIoExternal,
+    };
+
+    /**
+     * @brief Stages of a data packet's life whose latency can be tracked
+     */
+    enum LatencyStage {
+        /// app blocked in `send()`, waiting for a free queue slot
+        kLatencySendWait,
+        /// packet waited in the queue until the worker first transmitted it
+        kLatencyQueued,
+        /// handing a packet to the IO backend
+        kLatencyTx,
+        /// first transmission until the packet was acknowledged (only packets sent once)
+        kLatencyAck,
+        /// first transmission until each retransmission
+        kLatencyRetx,
+
+        kNumLatencyStages
+    };
+    /// Names of the latency stages, as used in traces
+    static const char* const kLatencyStageNames[kNumLatencyStages];
+
+public:
+    /// Returns the time at which connection establishment began
+    std::chrono::steady_clock::time_point getStartTime() const
+    {
+        return this->startTime;
+    }
+
+    /// Returns the time at which the SYN-ACK to establish the connection was received
+    std::chrono::steady_clock::time_point getSynAckTime() const
+    {
+        return this->synAckTime;
+    }
+
+    /// Returns the time at which the most recent ACK for a data packet was received
+    std::chrono::steady_clock::time_point getDataAckTime() const
+    {
+        return this->dataAckTime;
+    }
+
+    /// Returns the currently estimated RTT
+    double getEstimatedRtt() const
+    {
+        return this->estimatedRtt;
+    }
+
+    /// Total number of acknowledged bytes
+    size_t getBytesSent() const
+    {
+        return this->stats.totalBytesSent;
+    }
+    /// Total number of acknowledged payload bytes
+    size_t getAckedPayloadBytes() const
+    {
+        return this->stats.payloadBytesAcked;
+    }
+
+    /// Whether the connection has been established (and not yet closed)
+    bool isOpen() const
+    {
+        return this->state == kStateEstablished;
+    }
+
+    /// Installs the callback invoked as packets are acknowledged; set before opening.
+    void setAckCallback(AckCallback callback)
+    {
+        this->ackCallback = callback;
+    }
+
+    /// Whether forward error correction was negotiated with the receiver
+    bool isFecEnabled() const
+    {
+        return this->fec != nullptr;
+    }
+
+    /// Whether payload compression was negotiated with the receiver
+    bool isCompressionEnabled() const
+    {
+        return this->compressor != nullptr;
+    }
+    /// Ratio of data passed to send to what was actually put into packets
+    double getCompressionRatio() const
+    {
+        const double out = (double) this->stats.compressOutBytes;
+        return (out > 0) ? (((double) this->stats.compressRawBytes) / out) : 1.;
+    }
+
+    /// Whether the receiver accepted data sent ahead of the SYN-ACK
+    bool isEarlyDataEnabled() const
+    {
+        return (this->options.flags & kSynOptionEarlyData) != 0;
+    }
+
+    /// Whether the transfer is resumable (i.e. the receiver agreed to it)
+    bool isResumeEnabled() const
+    {
+        return this->checksum != nullptr;
+    }
+    /// Offset into the data stream at which the app should continue sending after a resume
+    uint64_t getResumeOffset() const
+    {
+        return this->resumeOffset;
+    }
+
+    /// Backend in use; may differ from the requested one if it isn't supported
+    IoBackend getIoBackend() const
+    {
+        return this->ioBackend;
+    }
+
+    /// Histogram of the given stage's latencies; `nullptr` if tracing isn't enabled
+    const LatencyHistogram* getLatency(LatencyStage stage) const
+    {
+        return this->latency ? &this->latency[stage] : nullptr;
+    }
+
+    /// Maximum number of bytes that may be passed to a single send call
+    size_t getMaxPayloadSize() const
+    {
+        return kMaxPacketSize - sizeof(SenderPacketHeader) - (this->fec ? kFecOverhead : 0);
+    }
+
+private:
+    /// size of the stats thread stack, in bytes
+    constexpr static const size_t kStatsStackSize = (1024 * 128);
+    /// size of the worker thread stack, in bytes
+    constexpr static const size_t kWorkerStackSize = (1024 * 256);
+    /// size of the compression thread stack, in bytes
+    constexpr static const size_t kCompressStackSize = (1024 * 128);
+    /// number of blocks that can be queued for compression
+    constexpr static const size_t kCompressBuffers = 4;
+
+private:
+    /**
+     * @brief Tx queue entry; holds a packet awaiting transmission
+    */
+    struct pbuf {
+        /// Sequence number of the packet to be transmitted
+        size_t sequence = 0;
+        /// Type of packet
+        enum {
+            kTypeUnknown,
+            kTypeData,
+            kTypeFin,
+            kTypeSyn
+        } type = kTypeUnknown;
+
+        /// timestamp of transmission time
+        std::chrono::steady_clock::time_point txTime;
+        /// number of times the packet has been transmitted
+        size_t numTx = 0;
+        /// set once the packet was handed to the backend (including as a probe); any further
+        /// copies may still be queued when an earlier one is acked, so they're never zero-copy
+        bool sent = false;
+        /// offset in the app's data stream up to which data is complete once this packet arrives
+        uint64_t streamEnd = 0;
+        /// TSC timestamps of when the packet was queued and first transmitted (only when tracing)
+        uint64_t queuedTsc = 0, firstTxTsc = 0;
+
+        /// Size of the payload data
+        size_t payloadSz = 0;
+        /// Actual payload data for the packet
+        char payload[kMaxPacketSize];
+    };
+
+    /**
+     * @brief Connection state, as driven by the worker thread
+     */
+    enum State {
+        /// not yet opened
+        kStateIdle,
+        /// SYN sent, waiting for SYN-ACK
+        kStateSynSent,
+        /// connection established; data may be sent
+        kStateEstablished,
+        /// FIN sent, waiting for FIN-ACK
+        kStateFinSent,
+        /// connection was closed gracefully
+        kStateClosed,
+        /// connection was aborted due to an error
+        kStateFailed,
+    };
+
+    // worker thread context
+    struct WorkerCtx {
+        WorkerCtx() = delete;
+        WorkerCtx(SenderSocket* s, size_t _i) : sock(s) , i(_i) { }
+
+        SenderSocket* sock = nullptr;
+        size_t i = 0;
+    };
+
+private:
+    /// time source for all timeouts and waits
+    std::shared_ptr<Clock> clock = std::make_shared<RealClock>();
+
+    /// Backend used for communicating
+    std::unique_ptr<PacketIo> io;
+    /// Type of backend to set up on open
+    IoBackend ioBackend = kIoSocket;
+
+    /// Destination host
+    struct sockaddr_storage host = { 0 };
+    /// String version of destination host
+    std::string hostStr = "";
+    /// Window size
+    size_t window = 0;
+
+    /// when set, close has been called at least once. no more data should be accepted
+    std::atomic_bool isClosing = false;
+    /// if set, we've established a connection before
+    std::atomic_bool isConnected = false;
+    /// if set, data may be sent while the handshake is still in progress
+    std::atomic_bool isEarlyOpen = false;
+    /// number of packets that may be sent ahead of the SYN-ACK
+    size_t earlyPackets = 0;
+    /// current state of the connection
+    std::atomic<State> state = kStateIdle;
+    /// time at which the connection was begun to be established
+    std::chrono::steady_clock::time_point startTime;
+    /// time at which the SYN-ACK was received
+    std::chrono::steady_clock::time_point synAckTime;
+    /// time the constructor was called
+    std::chrono::steady_clock::time_point constructTime;
+    /// when the most recent ACK for a data payload packet was received
+    std::chrono::steady_clock::time_point dataAckTime;
+
+    /// current retransmission delay
+    double rtoDelay = kRetransmissionTimeout;
+    /// longest time the receiver may hold back an ack (in seconds); padded onto the RTO
+    double peerAckDelay = 0;
+    /// current sequence number. incremented on every transmission
+    std::atomic<DWORD> currentSeq = 0;
+
+    /// RTT deviation
+    double devRtt = 0;
+    /// RTT deviation (previous value)
+    double devRttLast = -1;
+    /// Estimated RTT
+    double estimatedRtt = 0;
+    /// Estimated RTT (previous value)
+    double estimatedRttLast = -1;
+
+    /// When set, debug logging is on.
+    bool debug = false;
+
+    /// handle to the stats thread
+    HANDLE statsThread = INVALID_HANDLE_VALUE;
+    /// signalled when quit is desired
+    HANDLE quitEvent = INVALID_HANDLE_VALUE;
+
+    /// number of worker threads
+    constexpr static const size_t kNumWorkers = 1;
+    /// handle to the worker threads
+    HANDLE workerThread[kNumWorkers] = { INVALID_HANDLE_VALUE };
+    /// event signalled by the worker to indicate the connection has become fucked
+    HANDLE abortEvent = INVALID_HANDLE_VALUE;
+    /// the worker thread signals this every time it passes through its main loop
+    HANDLE workerLoopEvent = INVALID_HANDLE_VALUE;
+    /// signalled by the worker once the SYN-ACK has been received
+    HANDLE connectEvent = INVALID_HANDLE_VALUE;
+    /// signalled by the worker once the FIN-ACK has been received
+    HANDLE closedEvent = INVALID_HANDLE_VALUE;
+    /// signalled to wake the worker (e.g. when close is requested on an idle connection)
+    HANDLE wakeEvent = INVALID_HANDLE_VALUE;
+
+    /// invoked when the connection has been established (or failed to be)
+    CompletionCallback openCallback;
+    /// invoked when the connection has been closed (or failed to be)
+    CompletionCallback closeCallback;
+    /// invoked whenever the sender base advances
+    AckCallback ackCallback;
+    /// error that caused the connection to be aborted, if any
+    std::unique_ptr<SocketError> abortError;
+
+    /// SYN/FIN packet currently being (re)transmitted by the worker
+    pbuf control;
+
+    /// options requested in the SYN
+    SynOptions requestedOptions = { 0 };
+    /// options the receiver agreed to
+    SynOptions options = { 0 };
+
+    /// FEC encoder; only set once FEC was negotiated
+    std::unique_ptr<Fec> fec;
+    /// parity packets being accumulated for the current FEC block
+    std::vector<pbuf> fecParity;
+    /// number of data packets accumulated into the current block
+    size_t fecBlockCount = 0;
+    /// sequence number of the first packet in the current block
+    DWORD fecBlockStart = 0;
+    /// longest symbol (length prefix + payload) in the current block
+    size_t fecSymbolLen = 0;
+
+    /**
+     * @brief Block of data waiting to be compressed
+     */
+    struct CompressBlock {
+        /// buffer (block size bytes)
+        std::vector<char> data;
+        /// number of bytes in the buffer
+        size_t length = 0;
+        /// data stream offset of the end of the block
+        uint64_t streamEnd = 0;
+    };
+
+    /// compressor; only set once compression was negotiated
+    std::unique_ptr<Compressor> compressor;
+    /// thread running the compression stage
+    HANDLE compressThread = INVALID_HANDLE_VALUE;
+    /// block buffers, used round robin by the app (filling) and the compression thread
+    std::vector<CompressBlock> compressBlocks;
+    /// block the app is filling, and the next block to compress
+    size_t compressFill = 0, compressNext = 0;
+    /// set when the app holds the block at `compressFill`
+    bool compressHaveBlock = false;
+    /// semaphores counting free block buffers, and blocks waiting to be compressed
+    HANDLE compressFree = INVALID_HANDLE_VALUE, compressReady = INVALID_HANDLE_VALUE;
+    /// number of blocks handed to the compression thread that haven't been fully queued yet
+    std::atomic<size_t> compressPending = 0;
+    /// delta filtered copy of a block, and compressed output (header + data) of both variants
+    std::vector<char> compressFiltered, compressOut[2];
+
+    /// checkpoint of the transfer; `ranges` holds the CRCs of all ranges sent so far
+    Checkpoint resume;
+    /// protects the checkpoint's ranges
+    SRWLOCK resumeLock = SRWLOCK_INIT;
+    /// computes range CRCs; only set if resuming was negotiated
+    std::unique_ptr<Checksum> checksum;
+    /// data stream offset at which the app continues after a resume
+    uint64_t resumeOffset = 0;
+    /// data stream offset up to which the app has handed us data
+    uint64_t streamQueued = 0;
+    /// data stream offset up to which all data has been acknowledged
+    std::atomic<uint64_t> streamAcked = 0;
+    /// CRC of the partial range at the end of the stream, and how many bytes it covers
+    uint32_t rangeCrc = 0;
+    size_t rangeFill = 0;
+
+    /// sequence number of the last acknowledged packet
+    DWORD lastAckSeq = 0;
+    /// number of times an ack was received for the same packet
+    size_t lastAckCount = 0;
+
+    /// semaphore indicating queue has empty spots
+    HANDLE empty = INVALID_HANDLE_VALUE;
+    /// semaphore indicating queue is full
+    HANDLE full = INVALID_HANDLE_VALUE;
+
+    /// packets waiting to be transmitted; one per slot of the window, living in `queueArena`
+    pbuf* queue = nullptr;
+    /// memory backing the send queue
+    std::unique_ptr<PageArena> queueArena;
+    /// whether to lock the send queue into memory, if it doesn't end up in large pages anyways
+    bool lockQueue = false;
+    /// Sender base value
+    size_t senderBase = 0;
+    /// Index of packet to send next
+    size_t nextToSend = 0;
+    /// Last released packet
+    size_t lastReleased = 0;
+    /// Packets with a sequence number below this may be put on the wire (sender base + window)
+    size_t sendLimit = 0;
+    /// most recently advertised receive window
+    DWORD peerWindow = 0;
+
+    /// when the next zero window probe is due
+    std::chrono::steady_clock::time_point nextProbe;
+    /// current interval between zero window probes (seconds)
+    double probeInterval = kRetransmissionTimeout;
+    /// number of probes sent since the last ack was received
+    size_t probesUnanswered = 0;
+
+    /// latency histograms, one per stage; only allocated when tracing
+    std::unique_ptr<LatencyHistogram[]> latency;
+    /// recent per-packet events, if requested
+    std::unique_ptr<TraceRing> trace;
+
+    /// Current stats to print for the stats thread
+    struct {
+        /// Number of ACKed packets
+        std::atomic_ulong packetsAcked = 0;
+        /// Next sequence number
+        std::atomic_ulong nextSeq = 0;
+        /// Number of timeouts
+        std::atomic_ulong timeout = 0;
+        /// Number of fast retransmitted
+        std::atomic_ulong fastReTx = 0;
+        /// effective window size
+        std::atomic_ulong effectiveWindow = 1;
+
+        /// number of bytes sent (including headers)
+        std::atomic_ulong totalBytesSent = 0;
+        /// number of payload bytes acked (total)
+        std::atomic_ulong payloadBytesAcked = 0;
+        /// last number of bytes acked
+        std::atomic_ulong bytesConsumed = 0;
+
+        /// number of bytes passed through the compression stage
+        std::atomic_ullong compressRawBytes = 0;
+        /// number of bytes the compression stage put into packets
+        std::atomic_ullong compressOutBytes = 0;
+
+        /// last time stats were printed
+        std::chrono::steady_clock::time_point lastPrint;
+    } stats;
+
+public:
+    SenderSocket();
+    virtual ~SenderSocket() noexcept(false);
+
+    void open(const std::string& host, uint16_t port, size_t window, float rtt, float speed, float loss[2]);
+    void openAsync(const std::string& host, uint16_t port, size_t window, float rtt, float speed, float loss[2], CompletionCallback callback);
+    void close();
+    void closeAsync(CompletionCallback callback);
+
+    void send(void* data, size_t length);
+    bool trySend(void* data, size_t length);
+
+    void setFec(size_t dataCount, size_t parityCount);
+    void setCompression(size_t blockSize);
+    void setResume(const Checkpoint& checkpoint);
+    void setAckFrequency(size_t every, DWORD delay);
+    void setEarlyData(size_t packets);
+    void setIoBackend(IoBackend backend);
+    void setPacketIo(std::unique_ptr<PacketIo> io);
+    void setClock(std::shared_ptr<Clock> clock);
+    void setLockWindow(bool lock);
+    void setTracing(size_t traceEvents);
+    void dumpTrace(const std::string& path) const;
+    Checkpoint getCheckpoint();
+
+private:
+    void setUpSocket(struct sockaddr_storage* addr);
+    void enqueuePacket(const void* data, size_t length, uint64_t streamEnd, bool compressed = false);
+    void trackStream(const void* data, size_t length);
+    void waitForCompletion(HANDLE event);
+    void traceStage(LatencyStage stage, uint64_t seq, uint64_t start, uint64_t end);
+
+private:
+    static void resolve(const std::string &host, struct sockaddr_storage* outAddr);
+
+private:
+    void setUpStatsThread();
+    void statsThreadMain();
+    void statsThreadPrint(std::ostream &out, bool newline = true);
+
+private:
+    void setUpCompressThread();
+    void compressThreadMain();
+    bool compressAppend(const void* data, size_t length, bool wait);
+    void compressSubmit();
+    bool compressBlock(CompressBlock&);
+    bool compressEmit(const char* data, size_t length, bool compressed, uint64_t streamStart, uint64_t streamEnd);
+
+private:
+    void setUpWorkerThread();
+    void workerThreadMain(WorkerCtx *);
+
+    void workerDrainQueue(bool &);
+    void workerTxPacket(pbuf&, bool = true, bool = true);
+    void workerTxControl();
+    void workerBeginClose();
+    pbuf& workerTimeoutPacket();
+
+    void workerReadAck(bool &);
+    void workerTraceAcked(size_t);
+    void workerUpdateWindow(DWORD);
+    bool workerWindowClosed() const;
+    void workerProbeWindow();
+    void workerControlAck(const ReceiverPacketHeader*, size_t);
+    void workerNegotiate(const ReceiverPacketHeader*, size_t);
+    void workerNegotiateResume();
+
+    void workerFecAccumulate(pbuf&);
+    void workerFecFlush();
+    void workerAbort(const SocketError&);
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,225 @@
+#include "pch.h"
+#include "SimClock.h"
+
+/**
+ * @brief Creates the clock. Simulated time starts an hour past the steady clock's epoch, so that
+ * default constructed time points are always in the past.
+*/
+SimClock::SimClock()
+{
+    this->start = time_point(std::chrono::hours(1));
+    this->current = this->start;
+}
+
+/**
+ * @brief Current simulated time
+*/
+Clock::time_point SimClock::now()
+{
+    AcquireSRWLockShared(&this->lock);
+    const time_point time = this->current;
+    ReleaseSRWLockShared(&this->lock);
+
+    return time;
+}
+
+/**
+ * @brief Waits for one of the handles to be signalled, or for the given amount of simulated time.
+ *
+ * Handles are only polled, never waited on for real: they can only be signalled by attached
+ * threads or timers, and those never run while we're deciding who runs next.
+*/
+DWORD SimClock::wait(DWORD count, const HANDLE* handles, DWORD timeout)
+{
+    // already signalled (or just polling): keep running
+    DWORD ret = WaitForMultipleObjects(count, handles, false, 0);
+    if (ret != WAIT_TIMEOUT || !timeout) {
+        return ret;
+    }
+
+    AcquireSRWLockExclusive(&this->lock);
+
+    Waiter waiter;
+    waiter.count = count;
+    waiter.handles = handles;
+    waiter.forever = (timeout == INFINITE);
+    waiter.deadline = this->current + std::chrono::milliseconds(waiter.forever ? 0 : timeout);
+
+    this->waiters.push_back(&waiter);
+
+    // let someone else run
+    this->running = false;
+    this->dispatch();
+
+    while (!waiter.granted) {
+        SleepConditionVariableSRW(&this->changed, &this->lock, INFINITE, 0);
+    }
+
+    ReleaseSRWLockExclusive(&this->lock);
+    return waiter.result;
+}
+
+/**
+ * @brief Registers a thread that waits on the clock; it's not running until it calls `enter()`.
+*/
+void SimClock::attach()
+{
+    AcquireSRWLockExclusive(&this->lock);
+    this->attached++;
+    this->outside++;
+    ReleaseSRWLockExclusive(&this->lock);
+}
+
+/**
+ * @brief Unregisters the calling thread, and lets the next one run.
+*/
+void SimClock::detach()
+{
+    AcquireSRWLockExclusive(&this->lock);
+    this->attached--;
+    this->running = false;
+    this->dispatch();
+    ReleaseSRWLockExclusive(&this->lock);
+}
+
+/**
+ * @brief Waits for the calling thread's turn to run.
+ *
+ * Threads that are waiting get to run first; as long as any thread is outside the clock, time
+ * doesn't move forward, so it'll eventually get its turn.
+*/
+void SimClock::enter()
+{
+    AcquireSRWLockExclusive(&this->lock);
+
+    while (this->running) {
+        SleepConditionVariableSRW(&this->changed, &this->lock, INFINITE, 0);
+    }
+
+    this->running = true;
+    this->outside--;
+
+    ReleaseSRWLockExclusive(&this->lock);
+}
+
+/**
+ * @brief Lets other threads run while the calling thread blocks on something else.
+*/
+void SimClock::leave()
+{
+    AcquireSRWLockExclusive(&this->lock);
+    this->outside++;
+    this->running = false;
+    this->dispatch();
+    ReleaseSRWLockExclusive(&this->lock);
+}
+
+/**
+ * @brief Schedules a callback to be invoked once simulated time reaches the given point.
+ *
+ * Callbacks run on whichever thread advances the clock, without the clock locked; they may
+ * schedule further timers and signal handles, but must not wait.
+*/
+void SimClock::schedule(time_point at, std::function<void()> callback)
+{
+    AcquireSRWLockExclusive(&this->lock);
+    this->timers.push({ at, this->nextOrder++, std::move(callback) });
+    ReleaseSRWLockExclusive(&this->lock);
+}
+
+/**
+ * @brief Picks the thread that runs next, now that nobody is. Called with the lock held.
+ *
+ * That's the first waiter whose handles are signalled (or whose wait timed out); if there is none,
+ * and every attached thread is waiting, time moves forward until there is.
+*/
+void SimClock::dispatch()
+{
+    while (true) {
+        for (size_t i = 0; i < this->waiters.size(); i++) {
+            auto waiter = this->waiters[i];
+
+            const DWORD ret = WaitForMultipleObjects(waiter->count, waiter->handles, false, 0);
+            if (ret != WAIT_TIMEOUT) {
+                this->grant(i, ret);
+                return;
+            } else if (!waiter->forever && this->current >= waiter->deadline) {
+                this->grant(i, WAIT_TIMEOUT);
+                return;
+            }
+        }
+
+        // someone's about to enter; it'll take it from here
+        if (this->outside || this->waiters.empty()) {
+            WakeAllConditionVariable(&this->changed);
+            return;
+        }
+
+        // everyone is waiting: move on to the next thing that happens
+        if (!this->advance()) {
+            this->grant(0, WAIT_FAILED);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Lets a waiting thread run. Called with the lock held.
+*/
+void SimClock::grant(size_t index, DWORD result)
+{
+    auto waiter = this->waiters[index];
+    this->waiters.erase(this->waiters.begin() + index);
+
+    waiter->result = result;
+    waiter->granted = true;
+    this->running = true;
+
+    WakeAllConditionVariable(&this->changed);
+}
+
+/**
+ * @brief Moves time forward to the next timer or deadline, and fires all timers that are due.
+ * Called with the lock held.
+ *
+ * @return Whether there was anything to move forward to
+*/
+bool SimClock::advance()
+{
+    bool found = false;
+    time_point next;
+
+    if (!this->timers.empty()) {
+        next = this->timers.top().at;
+        found = true;
+    }
+    for (auto waiter : this->waiters) {
+        if (!waiter->forever && (!found || waiter->deadline < next)) {
+            next = waiter->deadline;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        return false;
+    }
+
+    if (next > this->current) {
+        this->current = next;
+    }
+
+    // fire due timers; they may schedule more, which needs the lock. nobody enters meanwhile
+    this->running = true;
+
+    while (!this->timers.empty() && this->timers.top().at <= this->current) {
+        auto callback = this->timers.top().callback;
+        this->timers.pop();
+
+        ReleaseSRWLockExclusive(&this->lock);
+        callback();
+        AcquireSRWLockExclusive(&this->lock);
+    }
+
+    this->running = false;
+    return true;
+}
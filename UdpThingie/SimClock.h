@@ -0,0 +1,109 @@
+#ifndef SIMCLOCK_H
+#define SIMCLOCK_H
+
+#include "Clock.h"
+
+#include <cstdint>
+
+#include <deque>
+#include <functional>
+#include <queue>
+#include <vector>
+
+/**
+ * @brief Simulated clock: attached threads take turns running, and time only moves forward once
+ * all of them are blocked waiting on the clock; it then jumps straight to the next thing that's
+ * going to happen.
+ *
+ * That's either one of the waiting threads timing out, or a timer scheduled with `schedule()`
+ * (which is how a simulated network delivers packets.) Running code takes no simulated time at
+ * all, so a transfer that would take minutes over a real link finishes as quickly as the CPU can
+ * push the packets through.
+ *
+ * Only one attached thread runs at a time: when it blocks, the first thread (in the order they
+ * started waiting) whose handles are signalled gets to run next. Since that only depends on what
+ * the threads did, and not on how the OS scheduled them, a run can be repeated exactly.
+ *
+ * Every thread that waits on the clock must be attached to it, and call `enter()` before doing
+ * anything else. If all threads are waiting without a timeout and there is nothing left to
+ * deliver, nothing can ever happen again; waits then fail with `WAIT_FAILED`.
+*/
+class SimClock : public Clock {
+public:
+    SimClock();
+
+    time_point now() override;
+    DWORD wait(DWORD count, const HANDLE* handles, DWORD timeout) override;
+
+    void attach() override;
+    void detach() override;
+    void enter() override;
+    void leave() override;
+
+    void schedule(time_point at, std::function<void()> callback);
+
+    /// Time elapsed since the clock was created
+    std::chrono::nanoseconds elapsed()
+    {
+        return this->now() - this->start;
+    }
+
+private:
+    /**
+     * @brief A thread blocked in `wait()`
+     */
+    struct Waiter {
+        DWORD count;
+        const HANDLE* handles;
+
+        /// when the wait times out, unless it's forever
+        time_point deadline;
+        bool forever;
+
+        /// set once the thread may run again, along with what the wait returns
+        bool granted = false;
+        DWORD result = WAIT_FAILED;
+    };
+
+    /**
+     * @brief Callback to be invoked at a particular time
+     */
+    struct Timer {
+        time_point at;
+        /// timers due at the same time fire in the order they were scheduled
+        uint64_t order;
+        std::function<void()> callback;
+
+        bool operator>(const Timer& other) const
+        {
+            return (this->at != other.at) ? (this->at > other.at) : (this->order > other.order);
+        }
+    };
+
+    void dispatch();
+    void grant(size_t index, DWORD result);
+    bool advance();
+
+private:
+    /// protects all of the state below
+    SRWLOCK lock = SRWLOCK_INIT;
+    /// broadcast whenever a thread may run
+    CONDITION_VARIABLE changed = CONDITION_VARIABLE_INIT;
+
+    /// simulated time at creation, and currently
+    time_point start, current;
+
+    /// set while an attached thread is running (or timers are being fired)
+    bool running = false;
+    /// number of attached threads, and how many of them are neither running nor waiting
+    size_t attached = 0, outside = 0;
+    /// blocked threads, in the order they started waiting
+    std::deque<Waiter*> waiters;
+
+    /// pending timers
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    /// order of the next timer to be scheduled
+    uint64_t nextOrder = 0;
+};
+
+#endif
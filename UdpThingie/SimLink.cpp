@@ -0,0 +1,213 @@
+#include "pch.h"
+#include "SimLink.h"
+
+#include <stdexcept>
+#include <string>
+
+namespace {
+/**
+ * @brief Converts seconds to a clock duration
+*/
+Clock::time_point::duration Seconds(double secs)
+{
+    return std::chrono::duration_cast<Clock::time_point::duration>(std::chrono::duration<double>(secs));
+}
+
+/**
+ * @brief splitmix64 finalizer; turns related inputs into unrelated outputs
+*/
+uint64_t Mix(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+}
+
+/**
+ * @brief Sets up the link.
+ *
+ * @param clock Clock the socket using the link runs on
+ * @param link Delay, loss and bottleneck to simulate
+ * @param receiveWindow Window the receiver advertises, in packets
+ * @param seed Seeds the packet loss
+*/
+SimLink::SimLink(std::shared_ptr<SimClock> clock, const LinkProperties& link, DWORD receiveWindow, uint64_t seed)
+    : clock(clock), link(link), seed(seed)
+{
+    this->state = std::make_shared<State>();
+    this->state->window = receiveWindow;
+
+    this->state->readEvent = CreateEvent(nullptr, false, false, nullptr);
+    if (this->state->readEvent == (HANDLE)ERROR_INVALID_HANDLE) {
+        throw std::runtime_error("CreateEvent(): " + std::to_string(GetLastError()));
+    }
+}
+
+/**
+ * @brief Puts a packet on the link.
+ *
+ * The packet is first queued for the bottleneck (or dropped if its buffer is full), then possibly
+ * lost, and otherwise arrives at the receiver half an RTT after it was serialized. Whether the
+ * ack it causes is lost is decided here as well, so all randomness is tied to the packet.
+*/
+int SimLink::send(const void* data, size_t length)
+{
+    if (length < sizeof(SenderPacketHeader)) {
+        WSASetLastError(WSAEINVAL);
+        return SOCKET_ERROR;
+    }
+
+    auto hdr = reinterpret_cast<const SenderPacketHeader*>(data);
+    const auto now = this->clock->now();
+
+    // identify the packet: parity and control packets reuse data sequence numbers
+    const uint64_t key = (((uint64_t) hdr->seq) << 2) | (hdr->flags.parity ? 1 : 0) |
+        ((hdr->flags.syn || hdr->flags.fin) ? 2 : 0);
+
+    // queue it for the bottleneck
+    const auto serialization = Seconds((length * 8.) / this->link.speed);
+    Clock::time_point departure;
+    uint32_t attempt;
+
+    AcquireSRWLockExclusive(&this->state->lock);
+
+    attempt = this->state->sends[key]++;
+
+    const auto backlog = (this->state->linkFree > now) ? (this->state->linkFree - now) : Clock::time_point::duration(0);
+    const bool bufferFull = serialization.count() && (backlog / serialization) >= this->link.bufferSize;
+
+    if (!bufferFull) {
+        this->state->linkFree = max(now, this->state->linkFree) + serialization;
+        departure = this->state->linkFree;
+    }
+
+    ReleaseSRWLockExclusive(&this->state->lock);
+
+    // as far as the sender's concerned, it's gone either way
+    if (bufferFull || this->lose(kForwardDirection, key, attempt)) {
+        return 0;
+    }
+
+    const auto oneWay = Seconds(this->link.RTT / 2.);
+    const auto arrival = departure + oneWay;
+    const bool dropAck = this->lose(kReturnDirection, key, attempt);
+
+    std::vector<char> packet((const char*) data, ((const char*) data) + length);
+
+    auto state = this->state;
+    auto clock = this->clock.get();
+
+    this->clock->schedule(arrival, [state, clock, packet, arrival, oneWay, dropAck]() {
+        SimLink::deliver(state, clock, packet, arrival + oneWay, dropAck);
+    });
+
+    return 0;
+}
+
+/**
+ * @brief Receiver side: processes a packet that arrived, and sends back the response.
+*/
+void SimLink::deliver(const std::shared_ptr<State>& state, SimClock* clock,
+    const std::vector<char>& packet, Clock::time_point ackAt, bool dropAck)
+{
+    auto hdr = reinterpret_cast<const SenderPacketHeader*>(packet.data());
+
+    ReceiverPacketHeader resp = { 0 };
+    resp.flags.magic = kFlagsMagic;
+    resp.flags.ack = 1;
+    resp.receiveWindow = state->window;
+
+    // parity packets would only be used to repair the stream; nothing to acknowledge
+    if (hdr->flags.parity) {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&state->lock);
+
+    if (hdr->flags.syn) {
+        resp.flags.syn = 1;
+        resp.ackSeq = hdr->seq;
+        state->expected = hdr->seq;
+    } else if (hdr->flags.fin) {
+        resp.flags.fin = 1;
+        resp.ackSeq = hdr->seq + 1;
+    } else {
+        if (hdr->seq == state->expected) {
+            state->expected++;
+
+            // fill in whatever arrived early
+            while (state->buffered.erase(state->expected)) {
+                state->expected++;
+            }
+        } else if (hdr->seq > state->expected && hdr->seq < (state->expected + state->window)) {
+            state->buffered.insert(hdr->seq);
+        }
+
+        resp.ackSeq = state->expected;
+    }
+
+    ReleaseSRWLockExclusive(&state->lock);
+
+    if (dropAck) {
+        return;
+    }
+
+    // the response arrives at the sender after another half RTT
+    clock->schedule(ackAt, [state, resp]() {
+        const char* bytes = reinterpret_cast<const char*>(&resp);
+
+        AcquireSRWLockExclusive(&state->lock);
+        state->inbox.emplace_back(bytes, bytes + sizeof(resp));
+        ReleaseSRWLockExclusive(&state->lock);
+
+        SetEvent(state->readEvent);
+    });
+}
+
+/**
+ * @brief Returns the next packet that arrived at the sender.
+*/
+int SimLink::receive(void* buf, size_t length)
+{
+    AcquireSRWLockExclusive(&this->state->lock);
+
+    if (this->state->inbox.empty()) {
+        ReleaseSRWLockExclusive(&this->state->lock);
+
+        WSASetLastError(WSAEWOULDBLOCK);
+        return SOCKET_ERROR;
+    }
+
+    std::vector<char> packet = std::move(this->state->inbox.front());
+    this->state->inbox.pop_front();
+
+    const bool more = !this->state->inbox.empty();
+
+    ReleaseSRWLockExclusive(&this->state->lock);
+
+    // the event is auto reset, so it needs to be set again for the remaining packets
+    if (more) {
+        SetEvent(this->state->readEvent);
+    }
+
+    const size_t copy = min(packet.size(), length);
+    memcpy(buf, packet.data(), copy);
+
+    return (int) copy;
+}
+
+/**
+ * @brief Decides whether a packet is lost.
+ *
+ * @param key Identifies the packet
+ * @param attempt Number of times the packet was sent before
+*/
+bool SimLink::lose(PathLossDirection direction, uint64_t key, uint32_t attempt) const
+{
+    const uint64_t hash = Mix(this->seed ^ Mix(key ^ (((uint64_t) attempt) << 40) ^ (((uint64_t) direction) << 62)));
+    const double sample = (double) (hash >> 11) / (double) (1ULL << 53);
+
+    return sample < this->link.pLoss[direction];
+}
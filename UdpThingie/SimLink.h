@@ -0,0 +1,88 @@
+#ifndef SIMLINK_H
+#define SIMLINK_H
+
+#include "PacketIo.h"
+#include "PacketTypes.h"
+#include "SimClock.h"
+
+#include <cstdint>
+
+#include <deque>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief In-memory network link with a minimal receiver at the other end, for running a socket
+ * against a `SimClock`.
+ *
+ * The forward path has a bottleneck of the given speed with a drop-tail router buffer in front of
+ * it; both directions add half the RTT of delay and drop packets with the given probabilities.
+ * The receiver completes the handshakes (declining all options) and acknowledges data packets
+ * cumulatively, buffering those that arrive out of order. Parity packets are ignored.
+ *
+ * Whether a packet is lost depends only on the seed, its sequence number, and how many times that
+ * sequence number was sent before; so a run can be reproduced exactly with the same seed.
+*/
+class SimLink : public PacketIo {
+public:
+    SimLink(std::shared_ptr<SimClock> clock, const LinkProperties& link, DWORD receiveWindow, uint64_t seed);
+    virtual ~SimLink() = default;
+
+    int send(const void* data, size_t length) override;
+    int receive(void* buf, size_t length) override;
+
+    HANDLE getReadEvent() const override
+    {
+        return this->state->readEvent;
+    }
+
+private:
+    /**
+     * @brief Everything timers touch; shared with them, so the link may go away while packets are
+     * still in flight.
+     */
+    struct State {
+        ~State()
+        {
+            CloseHandle(this->readEvent);
+        }
+
+        /// protects all of the below
+        SRWLOCK lock = SRWLOCK_INIT;
+        /// signalled while there are packets to receive
+        HANDLE readEvent = INVALID_HANDLE_VALUE;
+
+        /// packets that arrived at the sender
+        std::deque<std::vector<char>> inbox;
+
+        /// receiver: next expected sequence number
+        DWORD expected = 0;
+        /// receiver: packets received out of order
+        std::set<DWORD> buffered;
+        /// window the receiver advertises
+        DWORD window = 0;
+
+        /// number of times each packet was sent (for the loss decision)
+        std::unordered_map<uint64_t, uint32_t> sends;
+
+        /// time at which the bottleneck finishes sending everything queued so far
+        Clock::time_point linkFree;
+    };
+
+    static void deliver(const std::shared_ptr<State>& state, SimClock* clock,
+        const std::vector<char>& packet, Clock::time_point ackAt, bool dropAck);
+    bool lose(PathLossDirection direction, uint64_t key, uint32_t attempt) const;
+
+private:
+    std::shared_ptr<SimClock> clock;
+    std::shared_ptr<State> state;
+
+    /// link being simulated
+    LinkProperties link;
+    /// seeds the loss decisions
+    uint64_t seed = 0;
+};
+
+#endif
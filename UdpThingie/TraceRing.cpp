@@ -0,0 +1,66 @@
+#include "pch.h"
+#include "TraceRing.h"
+#include "LatencyHistogram.h"
+
+#include <stdexcept>
+#include <fstream>
+#include <iomanip>
+
+/**
+ * @brief Allocates the ring.
+ *
+ * @param capacity Number of events to keep; rounded up to a power of two
+*/
+TraceRing::TraceRing(size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    this->events.resize(size);
+    this->mask = size - 1;
+}
+
+/**
+ * @brief Writes all events in the ring to the given file, in the Chrome trace event format.
+ *
+ * Timestamps are in microseconds, relative to the oldest event in the file.
+*/
+void TraceRing::dump(const std::string& path) const
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("failed to open trace file '" + path + "'");
+    }
+
+    // the ring may have wrapped around; if so, only the last `size` events are still in it
+    const uint64_t total = this->head.load(std::memory_order_relaxed);
+    const uint64_t first = (total > this->events.size()) ? (total - this->events.size()) : 0;
+
+    uint64_t base = UINT64_MAX;
+    for (uint64_t i = first; i < total; i++) {
+        base = min(base, this->events[i & this->mask].start);
+    }
+
+    const double ticksPerMicro = Tsc::ticksPerSecond() / 1e6;
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" << std::endl;
+    out << std::fixed << std::setprecision(3);
+
+    for (uint64_t i = first; i < total; i++) {
+        const Event& event = this->events[i & this->mask];
+
+        out << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+            << ",\"ts\":" << ((double) (event.start - base) / ticksPerMicro)
+            << ",\"dur\":" << ((double) event.duration / ticksPerMicro)
+            << ",\"args\":{\"seq\":" << event.seq << "}}"
+            << (((i + 1) < total) ? "," : "") << std::endl;
+    }
+
+    out << "]}" << std::endl;
+
+    if (!out) {
+        throw std::runtime_error("failed to write trace file '" + path + "'");
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef TRACERING_H
+#define TRACERING_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Fixed size ring of timed events, which can be written out as a Chrome trace (JSON) file
+ * for viewing in `chrome://tracing` or Perfetto.
+ *
+ * Recording claims a slot with a single atomic increment, so any thread can record without
+ * locking; once the ring is full, the oldest events are overwritten. The ring should only be
+ * dumped once nothing is recording anymore.
+*/
+class TraceRing {
+public:
+    /**
+     * @brief A single event: something that took place on a thread over a span of time
+     */
+    struct Event {
+        /// what happened; must be a string literal
+        const char* name = nullptr;
+        /// TSC timestamp of the start, and duration in ticks
+        uint64_t start = 0, duration = 0;
+        /// packet sequence number this applies to
+        uint64_t seq = 0;
+        /// thread on which it was recorded
+        uint32_t thread = 0;
+    };
+
+public:
+    TraceRing(size_t capacity);
+
+    /// Records an event spanning the given range of TSC timestamps
+    void record(const char* name, uint64_t seq, uint64_t start, uint64_t end)
+    {
+        const uint64_t index = this->head.fetch_add(1, std::memory_order_relaxed);
+        Event& event = this->events[index & this->mask];
+
+        event.name = name;
+        event.start = start;
+        event.duration = (end > start) ? (end - start) : 0;
+        event.seq = seq;
+        event.thread = GetCurrentThreadId();
+    }
+
+    void dump(const std::string& path) const;
+
+private:
+    /// event storage; size is a power of two
+    std::vector<Event> events;
+    /// mask to turn an event number into an index
+    uint64_t mask = 0;
+    /// number of events recorded so far
+    std::atomic<uint64_t> head = 0;
+};
+
+#endif
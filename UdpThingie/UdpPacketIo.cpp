@@ -0,0 +1,194 @@
+#include "pch.h"
+#include "UdpPacketIo.h"
+
+#include <cassert>
+#include <iostream>
+
+/**
+ * @brief Sets up the backend; the socket is created by `open()`.
+ *
+ * @param segmentationOffload Whether to coalesce datagrams (if the OS supports it)
+*/
+UdpPacketIo::UdpPacketIo(bool segmentationOffload) : offload(segmentationOffload)
+{
+    if (this->offload) {
+        this->batch.resize(kMaxBatchSize);
+    }
+}
+
+/**
+ * @brief Closes the socket.
+*/
+UdpPacketIo::~UdpPacketIo()
+{
+    if (this->sock != INVALID_SOCKET) {
+        closesocket(this->sock);
+        this->sock = INVALID_SOCKET;
+    }
+    if (this->readEvent != INVALID_HANDLE_VALUE) {
+        CloseHandle(this->readEvent);
+        this->readEvent = INVALID_HANDLE_VALUE;
+    }
+}
+
+/**
+ * @brief Creates the UDP socket and connects it to the given address.
+ *
+ * @return 0 on success, `SOCKET_ERROR` otherwise
+*/
+int UdpPacketIo::open(const struct sockaddr_storage* addr)
+{
+    int err;
+
+    // create the socket
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock == -1) {
+        return SOCKET_ERROR;
+    }
+    this->sock = sock;
+
+    // bind it to any local address
+    struct sockaddr_in local = { 0 };
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = INADDR_ANY;
+    local.sin_port = htons(0);
+
+    err = bind(sock, (struct sockaddr*)&local, sizeof(local));
+    if (err == -1) {
+        return SOCKET_ERROR;
+    }
+
+    // set default address to send to
+    err = connect(sock, (struct sockaddr*)addr, sizeof(struct sockaddr_in));
+    if (err != 0) {
+        return SOCKET_ERROR;
+    }
+
+    // increase the receive/transmit buffer sizes
+    const int kRxBufSz = (32 * 1000 * 1000), kTxBufSz = (32 * 1000 * 1000);
+
+    err = setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char *) &kRxBufSz, sizeof(int));
+    if (err == SOCKET_ERROR) {
+        return SOCKET_ERROR;
+    }
+
+    err = setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (const char*) &kTxBufSz, sizeof(int));
+    if (err == SOCKET_ERROR) {
+        return SOCKET_ERROR;
+    }
+
+    // see if segmentation offload is supported (Windows 10 2004 and later)
+    if (this->offload) {
+        DWORD segSize = 0;
+        int segSizeLen = sizeof(segSize);
+
+        if (getsockopt(sock, IPPROTO_UDP, UDP_SEND_MSG_SIZE, (char*) &segSize, &segSizeLen) == SOCKET_ERROR) {
+            std::cerr << "UDP segmentation offload unavailable (" << WSAGetLastError()
+                      << "); sending datagrams individually" << std::endl;
+            this->offload = false;
+        }
+    }
+
+    // reads are driven by the worker waiting on this event
+    this->readEvent = CreateEvent(nullptr, false, false, nullptr);
+    assert(this->readEvent != INVALID_HANDLE_VALUE);
+
+    return WSAEventSelect(sock, this->readEvent, FD_READ);
+}
+
+/**
+ * @brief Sends a datagram, or adds it to the batch.
+ *
+ * Datagrams can only be coalesced if all but the last one are the same size; data packets are
+ * almost always full size, so a batch is generally a run of data packets, ended by the next
+ * control or short packet.
+*/
+int UdpPacketIo::send(const void* data, size_t length)
+{
+    if (!this->offload) {
+        return (::send(this->sock, (const char*) data, (int) length, 0) == SOCKET_ERROR) ? SOCKET_ERROR : 0;
+    }
+
+    // send the current batch if this datagram can't be appended to it
+    if (this->batchLen && (this->batchClosed || length > this->segmentSize ||
+        (this->batchLen + length) > kMaxBatchSize)) {
+        if (this->sendBatch() == SOCKET_ERROR) {
+            return SOCKET_ERROR;
+        }
+    }
+
+    if (!this->batchLen) {
+        this->segmentSize = length;
+    }
+
+    memcpy(this->batch.data() + this->batchLen, data, length);
+    this->batchLen += length;
+
+    if (length < this->segmentSize) {
+        this->batchClosed = true;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Sends the pending batch, if any.
+*/
+int UdpPacketIo::flush()
+{
+    if (!this->batchLen) {
+        return 0;
+    }
+    return this->sendBatch();
+}
+
+/**
+ * @brief Hands the batch to the stack to be segmented into datagrams.
+*/
+int UdpPacketIo::sendBatch()
+{
+    int err;
+
+    // a single datagram doesn't need any of the segmentation stuff
+    if (this->batchLen <= this->segmentSize) {
+        err = ::send(this->sock, this->batch.data(), (int) this->batchLen, 0);
+    } else {
+        char control[WSA_CMSG_SPACE(sizeof(DWORD))] = { 0 };
+
+        WSABUF buf;
+        buf.buf = this->batch.data();
+        buf.len = (ULONG) this->batchLen;
+
+        WSAMSG msg = { 0 };
+        msg.lpBuffers = &buf;
+        msg.dwBufferCount = 1;
+        msg.Control.buf = control;
+        msg.Control.len = sizeof(control);
+
+        // the size each datagram is cut to
+        WSACMSGHDR* cmsg = WSA_CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = IPPROTO_UDP;
+        cmsg->cmsg_type = UDP_SEND_MSG_SIZE;
+        cmsg->cmsg_len = WSA_CMSG_LEN(sizeof(DWORD));
+        *reinterpret_cast<DWORD*>(WSA_CMSG_DATA(cmsg)) = (DWORD) this->segmentSize;
+
+        DWORD sent = 0;
+        err = WSASendMsg(this->sock, &msg, 0, &sent, nullptr, nullptr);
+    }
+
+    this->batchLen = 0;
+    this->batchClosed = false;
+
+    return (err == SOCKET_ERROR) ? SOCKET_ERROR : 0;
+}
+
+/**
+ * @brief Reads a datagram from the socket.
+*/
+int UdpPacketIo::receive(void* buf, size_t length)
+{
+    struct sockaddr_storage respFrom;
+    socklen_t respFromLen = sizeof(struct sockaddr_storage);
+
+    return recvfrom(this->sock, (char*) buf, (int) length, 0, (struct sockaddr*)&respFrom, &respFromLen);
+}
@@ -0,0 +1,64 @@
+#ifndef UDPPACKETIO_H
+#define UDPPACKETIO_H
+
+#include "PacketIo.h"
+
+#include <vector>
+
+/**
+ * @brief Sends datagrams through a regular connected UDP socket.
+ *
+ * With segmentation offload enabled, consecutive datagrams of the same size are coalesced into
+ * one large buffer that is handed to the stack with a single `WSASendMsg()` call (`UDP_SEND_MSG_SIZE`).
+ * The stack (or the NIC, if it supports USO) then splits it back up into datagrams, so a whole
+ * burst of packets costs one trip through the kernel instead of one each. If the OS doesn't
+ * support it, every datagram is sent on its own.
+*/
+class UdpPacketIo : public PacketIo {
+public:
+    /// Largest amount of data coalesced into one send
+    constexpr static const size_t kMaxBatchSize = (1024 * 63);
+
+public:
+    UdpPacketIo(bool segmentationOffload);
+    virtual ~UdpPacketIo();
+
+    int open(const struct sockaddr_storage* addr);
+
+    int send(const void* data, size_t length) override;
+    int flush() override;
+    int receive(void* buf, size_t length) override;
+
+    HANDLE getReadEvent() const override
+    {
+        return this->readEvent;
+    }
+
+    /// Whether datagrams are actually being coalesced
+    bool isOffloadEnabled() const
+    {
+        return this->offload;
+    }
+
+private:
+    int sendBatch();
+
+private:
+    /// the socket
+    SOCKET sock = INVALID_SOCKET;
+    /// signalled when the socket is readable
+    HANDLE readEvent = INVALID_HANDLE_VALUE;
+
+    /// whether to coalesce datagrams
+    bool offload = false;
+    /// datagrams waiting to be sent
+    std::vector<char> batch;
+    /// bytes in the batch
+    size_t batchLen = 0;
+    /// size of each datagram in the batch (except for the last one, which may be shorter)
+    size_t segmentSize = 0;
+    /// set once a short datagram was added; nothing more may be added to the batch after it
+    bool batchClosed = false;
+};
+
+#endif
@@ -1,173 +1,612 @@
-#include "pch.h"
-#include "SenderSocket.h"
-#include "PacketTypes.h"
-#include "Checksum.h"
-
-#include <string>
-#include <iostream>
-#include <iomanip>
-#include <algorithm>
-#include <chrono>
-
-#ifdef _WIN32
-// what the hell are they smoking at microsoft to come up with this bullshit
-#pragma comment(lib, "ws2_32.lib")
-
-/**
- * Performs general initialization of stuff like WinSock
- */
-static void WinbowlsInit()
-{
-    int err;
-    WSAData wsDetails;
-
-    // winsock
-    err = WSAStartup(MAKEWORD(2, 2), &wsDetails);
-
-    if (err != 0) {
-        std::cerr << "WSAStartup() failed: " << err << std::endl;
-        exit(-1);
-    }
-}
-#endif
-
-/**
- * @brief Program entry point
- * @return 
-*/
-int main(int argc, const char **argv)
-{
-    size_t power, senderWindow, bufSize, bufSizeBytes;
-    float rtt, loss[2], speed;
-    Checksum cs;
-
-    // platform init
-#ifdef _WIN32
-    WinbowlsInit();
-#endif
-
-	// read the command line args in
-	if (argc != 8) {
-    printUsage:;
-        std::cerr << "usage: " << argv[0] << " [server address] [log2 buffer size] [window size] "
-                    << std::endl
-                    << "[RTT] [forward loss] [reverse loss] [bottleneck link speed]"
-                    << std::endl;
-        return -1;
-	}
-
-    // get server address, and the buffer/window sizes
-    std::string serverAddr(argv[1]);
-
-    power = std::atoi(argv[2]);
-    if (power <= 0 || power > 36) {
-        std::cerr << "invalid buffer size" << std::endl;
-        goto printUsage;
-    }
-    bufSize = (size_t) std::pow(2, power);
-    bufSizeBytes = bufSize * sizeof(DWORD);
-
-    senderWindow = std::atoi(argv[3]);
-    if (senderWindow <= 0) {
-        std::cerr << "invalid sender window size" << std::endl;
-        goto printUsage;
-    }
-
-    // floating point values (aka everything else)
-    rtt = std::stof(argv[4]);
-    if (rtt <= 0 || rtt >= 30) {
-        std::cerr << "invalid RTT" << std::endl;
-        goto printUsage;
-    }
-
-    loss[kForwardDirection] = std::stof(argv[5]);
-    if (loss[kForwardDirection] < 0 || loss[kForwardDirection] >= 1) {
-        std::cerr << "invalid forward loss" << std::endl;
-        goto printUsage;
-    }
-
-    loss[kReturnDirection] = std::stof(argv[6]);
-    if (loss[kReturnDirection] < 0 || loss[kReturnDirection] >= 1) {
-        std::cerr << "invalid return loss" << std::endl;
-        goto printUsage;
-    }
-
-    speed = 1e6f * std::stof(argv[7]);
-    if (speed <= 0 || speed > 10000 * 10e6) {
-        std::cerr << "invalid bottleneck bandwidth" << std::endl;
-        goto printUsage;
-    }
-
-    // print the info
-    std::cout << "Main:\tsender W = " << senderWindow << ", RTT " << rtt << " sec, loss "
-              << loss[0] << " / " << loss[1] << ", link " << (speed / 1e6) << " Mbps" << std::endl;
-
-    // allocate the buffer
-    std::cout << "Main:\tinitializing DWORD array with 2^" << power << " elements...";
-    auto bufFillStart = std::chrono::steady_clock::now();
-
-    DWORD* buf = new DWORD[bufSize];
-    for (size_t i = 0; i < bufSize; i++) {
-        buf[i] = (DWORD) i;
-    }
-
-    auto bufFillEnd = std::chrono::steady_clock::now();
-    std::cout << " done in "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(bufFillEnd - bufFillStart).count()
-              << " ms" << std::endl;
-
-    std::cout << "Main:\tcalculating expected CRC32... ";
-    uint32_t check = cs.crc32(buf, bufSizeBytes);
-    bufFillStart = std::chrono::steady_clock::now();
-
-    std::cout << "$" << std::setw(8) << std::hex << check << "; done in " << std::dec
-              << std::chrono::duration_cast<std::chrono::milliseconds>(bufFillStart - bufFillEnd).count()
-              << " ms" << std::endl;
-
-    // everything appears to be in order here
-    SenderSocket sock;
-    try {
-        // connect socket
-        auto connectStart = std::chrono::steady_clock::now();
-        sock.open(serverAddr, SenderSocket::kPortNumber, senderWindow, rtt, speed, loss);
-        auto connectEnd = std::chrono::steady_clock::now();
-
-        std::cout << "Main:\tConnected to " << serverAddr << " in "
-                  << std::chrono::duration_cast<std::chrono::milliseconds>(connectEnd - connectStart).count() / 1000.f
-                  << " sec. Packet size is " << SenderSocket::kMaxPacketSize << " bytes" << std::endl;
-
-        // repeatedly send
-        auto sendStartTime = std::chrono::steady_clock::now();
-
-        size_t off = 0;
-        while (off < bufSizeBytes) {
-            size_t numBytes = min(bufSizeBytes - off, SenderSocket::kMaxPacketSize - sizeof(SenderPacketHeader));
-            sock.send(((uint8_t *) buf) + off, numBytes);
-            off += numBytes;
-        }
-        auto sendEnd = std::chrono::steady_clock::now();
-
-        // done
-        sock.close();
-        auto now = std::chrono::steady_clock::now();
-
-        double transferLenSec = std::chrono::duration_cast<std::chrono::milliseconds>(sock.getDataAckTime() - sendStartTime).count() / 1000.f;
-        double rateSecs = std::chrono::duration_cast<std::chrono::milliseconds>(now - sock.getSynAckTime()).count() / 1000.f;
-
-        double rate = (((double)sock.getBytesSent() * 8) / rateSecs) / 1000.f;
-        std::cout << "Main:\tTransfer finished in " << transferLenSec << " sec" 
-                  << ", " << rate << " Kbps, checksum $" << std::hex << std::setw(8) 
-                  << std::setfill('0') << check <<  std::endl;
-
-        double idealRate = ((double) SenderSocket::kMaxPacketSize * 8 * senderWindow) / sock.getEstimatedRtt();
-        std::cout << "Main:\testRtt " << sock.getEstimatedRtt() << ", ideal rate "
-                  << idealRate / 1000.f << " Kbps" << std::endl;
-    } catch(SenderSocket::SocketError &e) {
-        std::cerr << "Socket error " << e.getType() << ": " << e.what() << std::endl;
-        return -1;
-    }
-
-    // clean up
-    delete[] buf;
-    return 0;
+#include "pch.h"
+#include "SenderSocket.h"
+#include "ConnectionManager.h"
+#include "ReceiverSocket.h"
+#include "PacketTypes.h"
+#include "Checksum.h"
+#include "Checkpoint.h"
+#include "PayloadSource.h"
+#include "SimClock.h"
+#include "SimLink.h"
+
+#include <cstdio>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <atomic>
+
+#ifdef _WIN32
+// what the hell are they smoking at microsoft to come up with this bullshit
+#pragma comment(lib, "ws2_32.lib")
+
+/**
+ * Performs general initialization of stuff like WinSock
+ */
+static void WinbowlsInit()
+{
+    int err;
+    WSAData wsDetails;
+
+    // winsock
+    err = WSAStartup(MAKEWORD(2, 2), &wsDetails);
+
+    if (err != 0) {
+        std::cerr << "WSAStartup() failed: " << err << std::endl;
+        exit(-1);
+    }
+}
+#endif
+
+/**
+ * @brief Writes the transfer checkpoint to disk; failures only produce a warning since the
+ * transfer itself can carry on without it.
+ */
+static void SaveCheckpoint(const std::string& path, const Checkpoint& checkpoint)
+{
+    try {
+        checkpoint.save(path);
+    } catch (const std::exception& e) {
+        std::cerr << "Main:\tfailed to save checkpoint: " << e.what() << std::endl;
+    }
+}
+
+/// Number of events kept for the trace file
+constexpr static const size_t kTraceEvents = (1024 * 1024);
+
+/**
+ * @brief Receives a transfer rather than sending one; invoked as
+ * `--receive [port] [window size] [output file]`, the file being optional.
+ */
+static int ReceiveMain(int argc, const char** argv)
+{
+    if (argc < 4) {
+        std::cerr << "usage: " << argv[0] << " --receive [port] [window size] [output file]" << std::endl;
+        return -1;
+    }
+
+    const int port = std::atoi(argv[2]);
+    const int window = std::atoi(argv[3]);
+
+    if (port <= 0 || port > 65535 || window <= 0) {
+        std::cerr << "invalid port or window size" << std::endl;
+        return -1;
+    }
+
+    ReceiverSocket sock;
+
+    try {
+        if (argc >= 5) {
+            sock.setOutput(argv[4]);
+        }
+        sock.listen((uint16_t) port, (size_t) window);
+
+        std::cout << "Main:\tlistening on port " << port << ", window " << window << std::endl;
+
+        sock.waitForClose();
+    } catch (SenderSocket::SocketError& e) {
+        std::cerr << "Socket error " << e.getType() << ": " << e.what() << std::endl;
+        return -1;
+    }
+
+    const double secs = std::chrono::duration_cast<std::chrono::milliseconds>(sock.getFinTime() - sock.getSynTime()).count() / 1000.;
+    const double rate = secs ? (((double) sock.getBytesReceived() * 8) / secs) / 1000. : 0;
+    const auto& stats = sock.getStats();
+
+    std::cout << "Main:\treceived " << sock.getBytesReceived() << " bytes in " << secs << " sec, "
+              << rate << " Kbps, checksum $" << std::hex << std::setw(8) << std::setfill('0')
+              << sock.getChecksum() << std::dec << std::setfill(' ') << std::endl;
+    std::cout << "Main:\t" << stats.packets << " packets (" << stats.duplicates << " duplicate, "
+              << stats.outOfOrder << " out of order, " << stats.recovered << " recovered), "
+              << stats.acks << " acks" << std::endl;
+
+    return 0;
+}
+
+/**
+ * @brief Sends the buffer to the server over several flows at once, multiplexed by a connection
+ * manager, rather than over a single socket. Each flow sends all of it.
+ */
+static int FlowsMain(const std::string& serverAddr, size_t numFlows, size_t window, float rtt, float speed,
+    float loss[2], const char* buf, size_t bufLen)
+{
+    using FlowId = ConnectionManager::FlowId;
+    using SocketError = SenderSocket::SocketError;
+
+    // every lane carries at most one flow to the server
+    constexpr static const size_t kWorkers = 2;
+    const size_t lanesPerWorker = (numFlows + kWorkers - 1) / kWorkers;
+
+    // how far along each flow is (indexed by flow id, which are below the number of flows)
+    struct FlowProgress {
+        std::atomic_bool open = false;
+        std::atomic_bool failed = false;
+        size_t offset = 0;
+        bool closing = false;
+    };
+
+    auto progress = std::make_unique<FlowProgress[]>(numFlows);
+    std::atomic<size_t> remaining = numFlows;
+
+    HANDLE wake = CreateEvent(nullptr, false, false, nullptr);
+    auto finished = [&](FlowId id, const SocketError* error) {
+        if (error) {
+            std::cerr << "Main:\tflow " << id << " failed: " << error->what() << std::endl;
+            progress[id].failed = true;
+        }
+
+        remaining--;
+        SetEvent(wake);
+    };
+
+    try {
+        ConnectionManager mgr(numFlows, kWorkers, lanesPerWorker);
+
+        mgr.setOpenCallback([&](ConnectionManager*, FlowId id, const SocketError* error) {
+            if (error) {
+                finished(id, error);
+            } else {
+                progress[id].open = true;
+                SetEvent(wake);
+            }
+        });
+        mgr.setCloseCallback([&](ConnectionManager*, FlowId id, const SocketError* error) {
+            finished(id, error);
+        });
+        mgr.setAckCallback([&](ConnectionManager*, FlowId, size_t) {
+            SetEvent(wake);
+        });
+
+        const auto start = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < numFlows; i++) {
+            mgr.open(serverAddr, SenderSocket::kPortNumber, window, rtt, speed, loss);
+        }
+
+        // fill each flow's window as acks come in; close it once all data is queued
+        const size_t maxPayload = SenderSocket::kMaxPacketSize - sizeof(SenderPacketHeader);
+
+        while (remaining) {
+            for (FlowId id = 0; id < numFlows; id++) {
+                auto& flow = progress[id];
+                if (!flow.open || flow.closing) {
+                    continue;
+                }
+
+                try {
+                    while (flow.offset < bufLen) {
+                        const size_t numBytes = min(maxPayload, bufLen - flow.offset);
+                        if (!mgr.send(id, buf + flow.offset, numBytes)) {
+                            break;
+                        }
+                        flow.offset += numBytes;
+                    }
+
+                    if (flow.offset == bufLen) {
+                        flow.closing = true;
+                        mgr.close(id);
+                    }
+                } catch (SocketError&) {
+                    // flow failed in the meantime; its close callback reports it
+                    flow.closing = true;
+                }
+            }
+
+            WaitForSingleObject(wake, 100);
+        }
+
+        const double secs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() / 1000.;
+        size_t failed = 0;
+
+        for (size_t i = 0; i < numFlows; i++) {
+            failed += progress[i].failed ? 1 : 0;
+        }
+
+        std::cout << "Main:\t" << numFlows << " flows (" << failed << " failed) finished in " << secs << " sec, "
+                  << ((mgr.getBytesSent() * 8) / secs) / 1000. << " Kbps total" << std::endl;
+
+        CloseHandle(wake);
+        return failed ? -1 : 0;
+    } catch (std::exception& e) {
+        std::cerr << "Main:\t" << e.what() << std::endl;
+
+        CloseHandle(wake);
+        return -1;
+    }
+}
+
+/**
+ * @brief Program entry point
+ * @return 
+*/
+int main(int argc, const char **argv)
+{
+    size_t power, senderWindow, bufSize, bufSizeBytes;
+    float rtt, loss[2], speed;
+    size_t fecData = 0, fecParity = 0;
+    size_t ackEvery = 0, earlyPackets = 0, numFlows = 0;
+    unsigned long ackDelay = SenderSocket::kDefaultAckDelay;
+    bool compress = false, lockWindow = false, stream = false;
+    SenderSocket::IoBackend backend = SenderSocket::kIoSocket;
+    std::string resumePath, tracePath;
+    bool simulate = false;
+    uint64_t simSeed = 0;
+    Checkpoint checkpoint;
+    Checksum cs;
+
+    // platform init
+#ifdef _WIN32
+    WinbowlsInit();
+#endif
+
+    if (argc >= 2 && std::string(argv[1]) == "--receive") {
+        return ReceiveMain(argc, argv);
+    }
+
+	// read the command line args in
+	if (argc < 8) {
+    printUsage:;
+        std::cerr << "usage: " << argv[0] << " [server address] [log2 buffer size] [window size] "
+                    << std::endl
+                    << "[RTT] [forward loss] [reverse loss] [bottleneck link speed] [options]"
+                    << std::endl
+                    << "   or: " << argv[0] << " --receive [port] [window size] [output file]"
+                    << std::endl
+                    << "options:" << std::endl
+                    << "\t--fec N:K\tsend K parity packets per N data packets" << std::endl
+                    << "\t--ack [N[:T]]\tlet the receiver ack every N packets (default "
+                    << SenderSocket::kDefaultAckEvery << "), or after T usec" << std::endl
+                    << "\t--early N\tsend N packets right behind the SYN" << std::endl
+                    << "\t--compress\tcompress the payload" << std::endl
+                    << "\t--stream\tgenerate the buffer while sending, rather than up front" << std::endl
+                    << "\t--resume FILE\tcheckpoint progress to FILE, and resume from it" << std::endl
+                    << "\t--uso\t\tcoalesce packets using UDP segmentation offload" << std::endl
+                    << "\t--rio\t\tsend packets using Registered I/O" << std::endl
+                    << "\t--lock\t\tlock the send window into memory" << std::endl
+                    << "\t--trace FILE\tprint per-packet latencies, and write a trace to FILE" << std::endl
+                    << "\t--simulate SEED\trun against a simulated link rather than the server" << std::endl
+                    << "\t--flows N\tsend the buffer over N flows at once, sharing a few threads" << std::endl;
+        return -1;
+	}
+
+    // get server address, and the buffer/window sizes
+    std::string serverAddr(argv[1]);
+
+    power = std::atoi(argv[2]);
+    if (power <= 0 || power > 36) {
+        std::cerr << "invalid buffer size" << std::endl;
+        goto printUsage;
+    }
+    bufSize = (size_t) std::pow(2, power);
+    bufSizeBytes = bufSize * sizeof(DWORD);
+
+    senderWindow = std::atoi(argv[3]);
+    if (senderWindow <= 0) {
+        std::cerr << "invalid sender window size" << std::endl;
+        goto printUsage;
+    }
+
+    // floating point values (aka everything else)
+    rtt = std::stof(argv[4]);
+    if (rtt <= 0 || rtt >= 30) {
+        std::cerr << "invalid RTT" << std::endl;
+        goto printUsage;
+    }
+
+    loss[kForwardDirection] = std::stof(argv[5]);
+    if (loss[kForwardDirection] < 0 || loss[kForwardDirection] >= 1) {
+        std::cerr << "invalid forward loss" << std::endl;
+        goto printUsage;
+    }
+
+    loss[kReturnDirection] = std::stof(argv[6]);
+    if (loss[kReturnDirection] < 0 || loss[kReturnDirection] >= 1) {
+        std::cerr << "invalid return loss" << std::endl;
+        goto printUsage;
+    }
+
+    speed = 1e6f * std::stof(argv[7]);
+    if (speed <= 0 || speed > 10000 * 10e6) {
+        std::cerr << "invalid bottleneck bandwidth" << std::endl;
+        goto printUsage;
+    }
+
+    // optional arguments
+    for (int i = 8; i < argc; i++) {
+        const std::string arg(argv[i]);
+
+        if (arg == "--fec" && (i + 1) < argc) {
+            if (sscanf(argv[++i], "%zu:%zu", &fecData, &fecParity) != 2 || !fecData || !fecParity) {
+                std::cerr << "invalid FEC parameters" << std::endl;
+                goto printUsage;
+            }
+        } else if (arg == "--ack") {
+            ackEvery = SenderSocket::kDefaultAckEvery;
+
+            // both the count and the delay are optional
+            if ((i + 1) < argc && argv[i + 1][0] != '-') {
+                const int n = sscanf(argv[++i], "%zu:%lu", &ackEvery, &ackDelay);
+                if (n < 1 || ackEvery < 2 || ackDelay > (SenderSocket::kMaxAckDelay * 1000)) {
+                    std::cerr << "invalid ack frequency" << std::endl;
+                    goto printUsage;
+                }
+            }
+        } else if (arg == "--early" && (i + 1) < argc) {
+            if (sscanf(argv[++i], "%zu", &earlyPackets) != 1 || !earlyPackets) {
+                std::cerr << "invalid number of early packets" << std::endl;
+                goto printUsage;
+            }
+        } else if (arg == "--compress") {
+            compress = true;
+        } else if (arg == "--stream") {
+            stream = true;
+        } else if (arg == "--resume" && (i + 1) < argc) {
+            resumePath = argv[++i];
+        } else if (arg == "--uso") {
+            backend = SenderSocket::kIoSegmentationOffload;
+        } else if (arg == "--rio") {
+            backend = SenderSocket::kIoRegisteredIo;
+        } else if (arg == "--lock") {
+            lockWindow = true;
+        } else if (arg == "--trace" && (i + 1) < argc) {
+            tracePath = argv[++i];
+        } else if (arg == "--simulate" && (i + 1) < argc) {
+            simulate = true;
+            simSeed = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--flows" && (i + 1) < argc) {
+            if (sscanf(argv[++i], "%zu", &numFlows) != 1 || !numFlows) {
+                std::cerr << "invalid flow count" << std::endl;
+                goto printUsage;
+            }
+        } else {
+            std::cerr << "unknown option '" << arg << "'" << std::endl;
+            goto printUsage;
+        }
+    }
+
+    // print the info
+    std::cout << "Main:\tsender W = " << senderWindow << ", RTT " << rtt << " sec, loss "
+              << loss[0] << " / " << loss[1] << ", link " << (speed / 1e6) << " Mbps" << std::endl;
+
+    // generate the data as it's sent, so the buffer size isn't limited by memory
+    DWORD* buf = nullptr;
+    uint32_t check = 0;
+    std::unique_ptr<PayloadSource> source;
+
+    if (stream) {
+        std::cout << "Main:\tstreaming DWORD array with 2^" << power << " elements; CRC32 is "
+                  << "calculated while sending" << std::endl;
+
+        source = std::make_unique<CounterSource>(bufSize);
+    } else {
+        // allocate the buffer
+        std::cout << "Main:\tinitializing DWORD array with 2^" << power << " elements...";
+        auto bufFillStart = std::chrono::steady_clock::now();
+
+        buf = new DWORD[bufSize];
+        for (size_t i = 0; i < bufSize; i++) {
+            buf[i] = (DWORD) i;
+        }
+
+        auto bufFillEnd = std::chrono::steady_clock::now();
+        std::cout << " done in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(bufFillEnd - bufFillStart).count()
+                  << " ms" << std::endl;
+
+        std::cout << "Main:\tcalculating expected CRC32... ";
+        check = cs.crc32(buf, bufSizeBytes);
+        bufFillStart = std::chrono::steady_clock::now();
+
+        std::cout << "$" << std::setw(8) << std::hex << check << "; done in " << std::dec
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(bufFillStart - bufFillEnd).count()
+                  << " ms" << std::endl;
+
+        source = std::make_unique<BufferSource>(buf, bufSizeBytes);
+    }
+
+    // the connection manager only does plain transfers, out of memory
+    if (numFlows) {
+        if (stream || simulate || !resumePath.empty()) {
+            std::cerr << "--flows can't be combined with --stream, --simulate or --resume" << std::endl;
+            return -1;
+        }
+
+        int ret = FlowsMain(serverAddr, numFlows, senderWindow, rtt, speed, loss, reinterpret_cast<const char*>(buf), bufSizeBytes);
+        delete[] buf;
+        return ret;
+    }
+
+    // pick up where an interrupted transfer left off, or start a new one
+    if (!resumePath.empty()) {
+        try {
+            if (Checkpoint::load(resumePath, checkpoint)) {
+                std::cout << "Main:\tloaded checkpoint at " << checkpoint.offset << " bytes" << std::endl;
+            } else {
+                std::random_device rd;
+                checkpoint = Checkpoint((((uint64_t) rd()) << 32) | rd());
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Main:\t" << e.what() << std::endl;
+            return -1;
+        }
+    }
+
+    // everything appears to be in order here
+    SenderSocket sock;
+    std::shared_ptr<Clock> clock = std::make_shared<RealClock>();
+
+    // in simulation, the link properties describe the simulated link rather than being sent along
+    if (simulate) {
+        auto simClock = std::make_shared<SimClock>();
+
+        LinkProperties lp;
+        lp.RTT = rtt;
+        lp.speed = speed;
+        lp.pLoss[kForwardDirection] = loss[kForwardDirection];
+        lp.pLoss[kReturnDirection] = loss[kReturnDirection];
+        lp.bufferSize = (DWORD) (senderWindow + SenderSocket::kMaxRetransmissions);
+
+        sock.setClock(simClock);
+        sock.setPacketIo(std::make_unique<SimLink>(simClock, lp, (DWORD) senderWindow, simSeed));
+
+        // we call into the socket, so time may only pass while we're waiting on it
+        simClock->attach();
+        simClock->enter();
+        clock = simClock;
+
+        std::cout << "Main:\tsimulating link with seed " << simSeed << std::endl;
+    }
+
+    try {
+        // connect socket
+        auto connectStart = clock->now();
+        if (fecData) {
+            sock.setFec(fecData, fecParity);
+        }
+        if (ackEvery) {
+            sock.setAckFrequency(ackEvery, (DWORD) ackDelay);
+        }
+        if (earlyPackets) {
+            sock.setEarlyData(earlyPackets);
+        }
+        if (compress) {
+            sock.setCompression(SenderSocket::kDefaultCompressionBlockSize);
+        }
+        if (!resumePath.empty()) {
+            sock.setResume(checkpoint);
+        }
+        if (!simulate) {
+            sock.setIoBackend(backend);
+        }
+        if (lockWindow) {
+            sock.setLockWindow(true);
+        }
+        if (!tracePath.empty()) {
+            sock.setTracing(kTraceEvents);
+        }
+
+        // with early data, start sending right away; the handshake completes in the background
+        if (earlyPackets && !fecData && !compress && resumePath.empty()) {
+            sock.openAsync(serverAddr, SenderSocket::kPortNumber, senderWindow, rtt, speed, loss, nullptr);
+
+            std::cout << "Main:\tSYN sent to " << serverAddr << "; sending up to " << earlyPackets
+                      << " packets ahead of the handshake" << std::endl;
+        } else {
+            sock.open(serverAddr, SenderSocket::kPortNumber, senderWindow, rtt, speed, loss);
+            auto connectEnd = clock->now();
+
+            std::cout << "Main:\tConnected to " << serverAddr << " in "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(connectEnd - connectStart).count() / 1000.f
+                      << " sec. Packet size is " << SenderSocket::kMaxPacketSize << " bytes" << std::endl;
+        }
+
+        if (fecData) {
+            std::cout << "Main:\tFEC " << (sock.isFecEnabled() ? "enabled" : "declined by receiver") << std::endl;
+        }
+        if (compress) {
+            std::cout << "Main:\tcompression " << (sock.isCompressionEnabled() ? "enabled" : "declined by receiver") << std::endl;
+        }
+        if (!simulate && backend != sock.getIoBackend()) {
+            std::cout << "Main:\trequested IO backend unavailable; using plain socket" << std::endl;
+        }
+
+        // skip whatever the receiver already has
+        if (!resumePath.empty()) {
+            if (!sock.isResumeEnabled()) {
+                std::cout << "Main:\tresume declined by receiver" << std::endl;
+            } else if (sock.getResumeOffset()) {
+                source->skip(sock.getResumeOffset());
+                std::cout << "Main:\tresuming at " << source->tell() << " bytes" << std::endl;
+            }
+        }
+
+        // repeatedly send
+        auto sendStartTime = clock->now();
+        auto lastCheckpoint = sendStartTime;
+
+        const size_t maxPayload = sock.getMaxPayloadSize();
+
+        for (size_t i = 0; source->tell() < source->size(); i++) {
+            size_t numBytes = maxPayload;
+            void* data = source->next(numBytes);
+            sock.send(data, numBytes);
+
+            // periodically save progress
+            if (sock.isResumeEnabled() && !(i % 1024)) {
+                auto now = clock->now();
+
+                if ((now - lastCheckpoint) >= std::chrono::seconds(5)) {
+                    SaveCheckpoint(resumePath, sock.getCheckpoint());
+                    lastCheckpoint = now;
+                }
+            }
+        }
+        auto sendEnd = clock->now();
+
+        // done
+        sock.close();
+
+        if (source->isChecksummed()) {
+            check = source->getChecksum();
+        }
+
+        // transfer is complete; nothing left to resume
+        if (!resumePath.empty()) {
+            std::remove(resumePath.c_str());
+        }
+        auto now = clock->now();
+
+        double transferLenSec = std::chrono::duration_cast<std::chrono::milliseconds>(sock.getDataAckTime() - sendStartTime).count() / 1000.f;
+        double rateSecs = std::chrono::duration_cast<std::chrono::milliseconds>(now - sock.getSynAckTime()).count() / 1000.f;
+
+        double rate = (((double)sock.getBytesSent() * 8) / rateSecs) / 1000.f;
+        std::cout << "Main:\tTransfer finished in " << transferLenSec << " sec" 
+                  << ", " << rate << " Kbps, checksum $" << std::hex << std::setw(8) 
+                  << std::setfill('0') << check << std::dec << std::setfill(' ') << std::endl;
+
+        double idealRate = ((double) SenderSocket::kMaxPacketSize * 8 * senderWindow) / sock.getEstimatedRtt();
+        std::cout << "Main:\testRtt " << sock.getEstimatedRtt() << ", ideal rate "
+                  << idealRate / 1000.f << " Kbps" << std::endl;
+
+        if (earlyPackets) {
+            std::cout << "Main:\tearly data " << (sock.isEarlyDataEnabled() ? "accepted" : "declined by receiver") << std::endl;
+        }
+        if (sock.isCompressionEnabled()) {
+            std::cout << "Main:\tcompression ratio " << std::setprecision(2) << sock.getCompressionRatio() << std::endl;
+        }
+
+        if (!tracePath.empty()) {
+            std::cout << "Main:\tlatencies:" << std::endl;
+            for (size_t j = 0; j < SenderSocket::kNumLatencyStages; j++) {
+                auto stage = static_cast<SenderSocket::LatencyStage>(j);
+
+                std::cout << "\t";
+                sock.getLatency(stage)->print(std::cout, SenderSocket::kLatencyStageNames[stage]);
+            }
+
+            try {
+                sock.dumpTrace(tracePath);
+            } catch (const std::exception& e) {
+                std::cerr << "Main:\tfailed to write trace: " << e.what() << std::endl;
+            }
+        }
+    } catch(SenderSocket::SocketError &e) {
+        std::cerr << "Socket error " << e.getType() << ": " << e.what() << std::endl;
+
+        if (sock.isResumeEnabled()) {
+            Checkpoint last = sock.getCheckpoint();
+            SaveCheckpoint(resumePath, last);
+
+            std::cerr << "Main:\tsaved checkpoint at " << last.offset << " bytes; run again with the "
+                      << "same arguments to resume" << std::endl;
+        }
+        return -1;
+    }
+
+    // clean up
+    delete[] buf;
+    return 0;
 }
\ No newline at end of file